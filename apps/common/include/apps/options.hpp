@@ -0,0 +1,36 @@
+#ifndef APPS_OPTIONS_HPP
+#define APPS_OPTIONS_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+
+namespace apps {
+
+// "4096", "64K", "4M", "2G"; false on anything else, or on a size that does not fit
+inline
+bool parse_size(const char *s, uint64_t& value) noexcept
+{
+  char *end = nullptr;
+  unsigned long long v = std::strtoull(s, &end, 10);
+  if (end == s || *s == '-')
+    return false;
+
+  unsigned int shift = 0;
+  switch (*end) {
+  case 'K': case 'k': shift = 10; ++ end; break;
+  case 'M': case 'm': shift = 20; ++ end; break;
+  case 'G': case 'g': shift = 30; ++ end; break;
+  default: break;
+  }
+
+  if (*end != '\0' || v > (std::numeric_limits<uint64_t>::max() >> shift))
+    return false;
+
+  value = static_cast<uint64_t>(v) << shift;
+  return true;
+}
+
+} // namespace apps
+
+#endif // APPS_OPTIONS_HPP
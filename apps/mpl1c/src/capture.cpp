@@ -0,0 +1,418 @@
+#include "commands.hpp"
+#include "common.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace mpl1c {
+
+namespace {
+
+// O_DIRECT wants buffer address, file offset and size aligned to the logical block size
+constexpr size_t disk_alignment = 4096;
+
+struct capture_options
+{
+  std::string uri = default_uri;
+  std::string path;
+  uint64_t block_size = 4 << 20;
+  uint64_t buffers = 3;
+  uint64_t seconds = 0;   // 0: until Ctrl+C
+  uint64_t bytes = 0;     // 0: unlimited
+  bool direct = true;
+};
+
+struct disk_buffer
+{
+  unsigned char *data;
+  size_t size;  // bytes to write
+};
+
+/**
+ * Writes filled buffers from its own thread, so the USB side only waits for the file system when
+ * every buffer is queued (overrun).
+ */
+class disk_writer
+{
+private:
+  int fd_ = -1;
+  std::vector<disk_buffer> buffers_;
+  std::deque<disk_buffer *> free_;
+  std::deque<disk_buffer *> queue_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  int error_ = 0;
+  uint64_t written_ = 0;
+
+  static int write_all(int fd, const unsigned char *data, size_t size) noexcept
+  {
+    while (size != 0) {
+      ssize_t n = ::write(fd, data, size);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        return errno;
+      }
+      data += n;
+      size -= static_cast<size_t>(n);
+    }
+    return 0;
+  }
+
+  void thread_fn() noexcept
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      cv_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+      if (queue_.empty())
+        break;
+
+      disk_buffer *b = queue_.front();
+      queue_.pop_front();
+      bool failed = (error_ != 0);
+      lock.unlock();
+
+      int err = failed ? 0 : write_all(fd_, b->data, b->size);
+
+      lock.lock();
+      if (err != 0 && error_ == 0)
+        error_ = err;
+      else if (err == 0 && !failed)
+        written_ += b->size;
+      free_.push_back(b);
+    }
+  }
+
+public:
+  ~disk_writer()
+  {
+    for (auto& b : buffers_)
+      std::free(b.data);
+    if (fd_ >= 0)
+      ::close(fd_);
+  }
+
+  bool open(const capture_options& options, size_t block_size)
+  {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    fd_ = ::open(options.path.c_str(), flags | (options.direct ? O_DIRECT : 0), 0644);
+    if (fd_ < 0 && options.direct && errno == EINVAL) {
+      std::fprintf(stderr, "mpl1c: O_DIRECT not supported by %s, using page cache\n", options.path.c_str());
+      fd_ = ::open(options.path.c_str(), flags, 0644);
+    }
+
+    if (fd_ < 0) {
+      std::fprintf(stderr, "mpl1c: open %s: %s\n", options.path.c_str(), std::strerror(errno));
+      return false;
+    }
+
+    buffers_.resize(options.buffers);
+    for (auto& b : buffers_) {
+      void *p = nullptr;
+      if (::posix_memalign(&p, disk_alignment, block_size) != 0) {
+        std::fprintf(stderr, "mpl1c: out of memory\n");
+        return false;
+      }
+      b.data = static_cast<unsigned char *>(p);
+      b.size = 0;
+      free_.push_back(&b);
+    }
+
+    thread_ = std::thread(&disk_writer::thread_fn, this);
+    return true;
+  }
+
+  // never blocks: nullptr means every buffer is still queued for the disk
+  disk_buffer *acquire() noexcept
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty())
+      return nullptr;
+
+    disk_buffer *b = free_.front();
+    free_.pop_front();
+    return b;
+  }
+
+  void submit(disk_buffer *b, size_t size)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    b->size = size;
+    queue_.push_back(b);
+    cv_.notify_one();
+  }
+
+  // Drains the queue, then writes the last (unaligned) piece through the page cache.
+  int finish(const unsigned char *tail, size_t size)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    if (thread_.joinable())
+      thread_.join();
+
+    if (error_ == 0 && size != 0) {
+      int flags = ::fcntl(fd_, F_GETFL);
+      if (flags >= 0 && (flags & O_DIRECT) != 0)
+        ::fcntl(fd_, F_SETFL, flags & ~O_DIRECT);
+
+      error_ = write_all(fd_, tail, size);
+      if (error_ == 0)
+        written_ += size;
+    }
+
+    return error_;
+  }
+
+  uint64_t written() noexcept
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return written_;
+  }
+
+  int error() noexcept
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+  }
+};
+
+void capture_usage()
+{
+  std::fprintf(stderr,
+    "usage: mpl1c capture [options] FILE\n"
+    "  --uri URI        link to read (default %s); on USB links LEASE_TRANSFERS=n sets how\n"
+    "                   many IN transfers stay queued\n"
+    "  --seconds N      stop after N seconds (default: Ctrl+C)\n"
+    "  --bytes SIZE     stop after SIZE bytes\n"
+    "  --block SIZE     disk buffer size (default 4M)\n"
+    "  --buffers N      number of disk buffers (default 3)\n"
+    "  --no-direct      write through the page cache instead of O_DIRECT\n",
+    default_uri);
+}
+
+bool parse_capture_options(int argc, char *argv[], capture_options& options)
+{
+  for (int i = 1; i < argc; ++ i) {
+    std::string arg = argv[i];
+    bool has_value = (i + 1 < argc);
+
+    if (arg == "--uri" && has_value) {
+      options.uri = argv[++ i];
+    } else if (arg == "--seconds" && has_value) {
+      if (!parse_size(argv[++ i], options.seconds))
+        return false;
+    } else if (arg == "--bytes" && has_value) {
+      if (!parse_size(argv[++ i], options.bytes))
+        return false;
+    } else if (arg == "--block" && has_value) {
+      if (!parse_size(argv[++ i], options.block_size))
+        return false;
+    } else if (arg == "--buffers" && has_value) {
+      if (!parse_size(argv[++ i], options.buffers) || options.buffers < 2)
+        return false;
+    } else if (arg == "--no-direct") {
+      options.direct = false;
+    } else if (!arg.empty() && arg[0] != '-' && options.path.empty()) {
+      options.path = arg;
+    } else {
+      return false;
+    }
+  }
+
+  return !options.path.empty();
+}
+
+} // namespace
+
+int capture_main(int argc, char *argv[])
+{
+  capture_options options;
+  if (!parse_capture_options(argc, argv, options)) {
+    capture_usage();
+    return 2;
+  }
+
+  auto link = open_link(options.uri);
+  if (!link)
+    return 1;
+
+  pilink::pilink::info_s info{};
+  size_t packet_size = 512;
+  if (!link->get_link_info(info) && info.in.packet_size != 0)
+    packet_size = info.in.packet_size;
+
+  // whole disk blocks and whole packets
+  size_t unit = std::max(packet_size, disk_alignment);
+  size_t block_size = static_cast<size_t>((options.block_size + unit - 1) / unit * unit);
+  block_size = std::max(block_size, 2 * unit);
+
+  disk_writer writer;
+  if (!writer.open(options, block_size))
+    return 1;
+
+  install_stop_handler();
+
+  disk_buffer *current = writer.acquire();
+  size_t used = 0;
+
+  uint64_t received = 0;
+  uint64_t dropped = 0;
+  uint64_t overruns = 0;
+  uint64_t overwritten = 0;
+  std::error_code ec;
+
+  // hands over the aligned part, the unaligned tail starts the next buffer
+  auto hand_over = [&] {
+    size_t aligned = used / disk_alignment * disk_alignment;
+    disk_buffer *next = writer.acquire();
+    if (next == nullptr) {
+      // disk is behind: keep the USB side running and drop this block
+      ++ overruns;
+      dropped += aligned;
+      ::memmove(current->data, current->data + aligned, used - aligned);
+    } else {
+      ::memcpy(next->data, current->data + aligned, used - aligned);
+      writer.submit(current, aligned);
+      current = next;
+    }
+    used -= aligned;
+  };
+
+  // Leases keep the IN transfers queued on the link (LEASE_TRANSFERS on USB links) while one is
+  // copied into the disk buffer; it goes back to the link only after the copy. Links that lend
+  // nothing are read into the disk buffer with read_some.
+  bool leases = true;
+
+  auto start = clock::now();
+  double cpu_start = cpu_seconds();
+  auto last_report = start;
+  uint64_t last_received = 0;
+  uint64_t last_written = 0;
+
+  while (!stop_requested.load()) {
+    if (options.bytes != 0 && received >= options.bytes)
+      break;
+    if (options.seconds != 0 && seconds_since(start) >= static_cast<double>(options.seconds))
+      break;
+    if (writer.error() != 0)
+      break;
+
+    if (leases) {
+      pilink::pilink::lease_s lease{};
+      ec = link->read_lease(lease, 1000);
+      if (ec == std::errc::operation_not_supported && received == 0) {
+        leases = false;
+        ec = {};
+        continue;
+      }
+
+      for (size_t copied = 0; copied < lease.size;) {
+        size_t n = std::min(lease.size - copied, block_size - used);
+        ::memcpy(current->data + used, lease.data + copied, n);
+        used += n;
+        copied += n;
+        if (used == block_size)
+          hand_over();
+      }
+      received += lease.size;
+
+      // the producer reused it while it was copied (shared memory): what was copied is void
+      if (lease.data != nullptr && link->release(lease) == pilink::error::lease_overwritten)
+        ++ overwritten;
+    } else {
+      size_t space = (block_size - used) / packet_size * packet_size;
+      if (space == 0) {
+        hand_over();
+        continue;
+      }
+
+      size_t transferred = 0;
+      ec = link->read_some(current->data + used, space, transferred, 1000);
+      used += transferred;
+      received += transferred;
+    }
+
+    if (ec == std::errc::timed_out || ec == std::errc::argument_out_of_domain)
+      ec = {};
+    if (ec)
+      break;
+
+    if (seconds_since(last_report) >= 1.0) {
+      double dt = seconds_since(last_report);
+      uint64_t written = writer.written();
+      std::fprintf(stderr, "%8.1f s  in %8.1f MB/s  disk %8.1f MB/s  written %10.1f MB  dropped %llu B (%llu overruns)\n",
+        seconds_since(start),
+        mbytes(received - last_received) / dt,
+        mbytes(written - last_written) / dt,
+        mbytes(written),
+        static_cast<unsigned long long>(dropped),
+        static_cast<unsigned long long>(overruns));
+      last_report = clock::now();
+      last_received = received;
+      last_written = written;
+    }
+  }
+
+  int err = writer.finish(current->data, used);
+  double elapsed = seconds_since(start);
+  double cpu = cpu_seconds() - cpu_start;
+
+  if (ec)
+    std::fprintf(stderr, "mpl1c: read: %s\n", ec.message().c_str());
+  if (err != 0)
+    std::fprintf(stderr, "mpl1c: write %s: %s\n", options.path.c_str(), std::strerror(err));
+
+  std::fprintf(stderr, "captured %.1f MB in %.1f s, %.1f MB/s sustained, written %.1f MB, dropped %llu B (%llu overruns)\n",
+    mbytes(received), elapsed, elapsed > 0.0 ? mbytes(received) / elapsed : 0.0,
+    mbytes(writer.written()),
+    static_cast<unsigned long long>(dropped),
+    static_cast<unsigned long long>(overruns));
+  if (overwritten != 0)
+    std::fprintf(stderr, "%llu leases overwritten by the producer while copied, their data is not reliable\n",
+      static_cast<unsigned long long>(overwritten));
+  print_cpu_usage(cpu, received);
+
+  pilink::pilink::stats_s stats{};
+  if (!link->get_link_stats(stats)) {
+    if (stats.iso_packets != 0)
+      std::fprintf(stderr, "isochronous: %llu packets, %llu lost (error status), %llu queue underruns\n",
+        static_cast<unsigned long long>(stats.iso_packets),
+        static_cast<unsigned long long>(stats.iso_packet_errors),
+        static_cast<unsigned long long>(stats.iso_underruns));
+
+    if (stats.pipe_recoveries != 0)
+      std::fprintf(stderr, "recovery: %llu stalls cleared, %llu B requested again\n",
+        static_cast<unsigned long long>(stats.pipe_recoveries),
+        static_cast<unsigned long long>(stats.recovery_bytes));
+
+    if (stats.outages != 0)
+      std::fprintf(stderr, "device away %llu times, %llu ms in all, %llu B of writes dropped\n",
+        static_cast<unsigned long long>(stats.outages),
+        static_cast<unsigned long long>(stats.outage_ms),
+        static_cast<unsigned long long>(stats.outage_dropped_bytes));
+
+    if (stats.lost_segments != 0)
+      std::fprintf(stderr, "striped: %llu segments never arrived and were skipped\n",
+        static_cast<unsigned long long>(stats.lost_segments));
+  }
+
+  (void)link->disconnect();
+
+  return (ec || err != 0) ? 1 : 0;
+}
+
+} // namespace mpl1c
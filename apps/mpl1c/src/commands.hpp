@@ -0,0 +1,16 @@
+#ifndef MPL1C_COMMANDS_HPP
+#define MPL1C_COMMANDS_HPP
+
+namespace mpl1c {
+
+// argv[0] is the command name
+#ifdef __linux__
+int capture_main(int argc, char *argv[]);
+int replay_main(int argc, char *argv[]);
+int latency_main(int argc, char *argv[]);
+#endif
+int soak_main(int argc, char *argv[]);
+
+} // namespace mpl1c
+
+#endif // MPL1C_COMMANDS_HPP
@@ -0,0 +1,98 @@
+#ifndef MPL1C_COMMON_HPP
+#define MPL1C_COMMON_HPP
+
+#include <pilink/pilink.hpp>
+#include <apps/options.hpp>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <ctime>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace mpl1c {
+
+using clock = std::chrono::steady_clock;
+
+constexpr const char *default_uri = "LIBUSB://";
+
+inline
+double seconds_since(clock::time_point start) noexcept
+{
+  return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+inline
+double mbytes(uint64_t bytes) noexcept
+{
+  return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+// user + system time of the whole process, transport threads included (on Windows what clock()
+// gives, wall time since start)
+inline
+double cpu_seconds() noexcept
+{
+#ifdef _WIN32
+  return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#else
+  rusage usage{};
+  if (::getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0.0;
+
+  auto seconds = [](const timeval& tv) {
+    return static_cast<double>(tv.tv_sec) + static_cast<double>(tv.tv_usec) / 1e6;
+  };
+  return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+#endif
+}
+
+// the figure to compare backends by
+inline
+void print_cpu_usage(double cpu, uint64_t bytes) noexcept
+{
+  double gbytes = static_cast<double>(bytes) / (1024.0 * 1024.0 * 1024.0);
+  std::fprintf(stderr, "cpu %.2f s, %.3f cpu s/GB\n", cpu, gbytes > 0.0 ? cpu / gbytes : 0.0);
+}
+
+using apps::parse_size;
+
+inline
+std::unique_ptr<pilink::pilink> open_link(const std::string& uri)
+{
+  auto link = pilink::make_pilink(uri.c_str());
+  if (!link) {
+    std::fprintf(stderr, "mpl1c: out of memory\n");
+    return nullptr;
+  }
+
+  std::error_code ec = link->connect(uri.c_str());
+  if (ec) {
+    std::fprintf(stderr, "mpl1c: connect %s: %s\n", uri.c_str(), ec.message().c_str());
+    return nullptr;
+  }
+
+  return link;
+}
+
+// Ctrl+C ends long running commands
+inline std::atomic<bool> stop_requested{false};
+
+inline
+void install_stop_handler() noexcept
+{
+  auto handler = [](int) { stop_requested.store(true); };
+  std::signal(SIGINT, handler);
+  std::signal(SIGTERM, handler);
+}
+
+} // namespace mpl1c
+
+#endif // MPL1C_COMMON_HPP
@@ -0,0 +1,97 @@
+#ifndef MPL1C_HISTOGRAM_HPP
+#define MPL1C_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace mpl1c {
+
+/**
+ * Log-linear histogram in the HDR style: every power of two range is split in 64 linear buckets,
+ * so any recorded value is known to within 1/64 (about 1.6%) over the full 64 bit range, in a
+ * fixed ~30 KiB table with O(1) record.
+ */
+class histogram
+{
+private:
+  static constexpr unsigned sub_bits = 7;
+  static constexpr uint64_t sub_count = uint64_t{1} << sub_bits;
+  static constexpr uint64_t half = sub_count / 2;
+
+  std::vector<uint64_t> counts_;
+  uint64_t count_ = 0;
+  uint64_t min_ = std::numeric_limits<uint64_t>::max();
+  uint64_t max_ = 0;
+  double sum_ = 0.0;
+
+  static unsigned msb(uint64_t v) noexcept
+  {
+    return 63u - static_cast<unsigned>(__builtin_clzll(v));
+  }
+
+  static size_t index_of(uint64_t v) noexcept
+  {
+    if (v < sub_count)
+      return static_cast<size_t>(v);
+
+    unsigned e = msb(v) - (sub_bits - 1);
+    return static_cast<size_t>(e * half + (v >> e));
+  }
+
+  // highest value that lands in bucket i
+  static uint64_t highest_of(size_t i) noexcept
+  {
+    if (i < sub_count)
+      return i;
+
+    uint64_t e = i / half - 1;
+    uint64_t mantissa = i - e * half;
+    return ((mantissa + 1) << e) - 1;
+  }
+
+public:
+  histogram()
+    : counts_((64 - sub_bits + 2) * half, 0)
+  {
+  }
+
+  void record(uint64_t v) noexcept
+  {
+    ++ counts_[index_of(v)];
+    ++ count_;
+    min_ = std::min(min_, v);
+    max_ = std::max(max_, v);
+    sum_ += static_cast<double>(v);
+  }
+
+  uint64_t count() const noexcept { return count_; }
+  uint64_t min() const noexcept { return count_ ? min_ : 0; }
+  uint64_t max() const noexcept { return max_; }
+  double mean() const noexcept { return count_ ? sum_ / static_cast<double>(count_) : 0.0; }
+
+  // value at or below which percent of the samples are
+  uint64_t percentile(double percent) const noexcept
+  {
+    if (count_ == 0)
+      return 0;
+
+    auto target = static_cast<uint64_t>(std::ceil(percent / 100.0 * static_cast<double>(count_)));
+    target = std::clamp<uint64_t>(target, 1, count_);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++ i) {
+      seen += counts_[i];
+      if (seen >= target)
+        return std::min(highest_of(i), max_);
+    }
+
+    return max_;
+  }
+};
+
+} // namespace mpl1c
+
+#endif // MPL1C_HISTOGRAM_HPP
@@ -0,0 +1,341 @@
+#include "commands.hpp"
+#include "common.hpp"
+#include "histogram.hpp"
+
+#include <pilink/framing.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace mpl1c {
+
+namespace {
+
+/*
+ * The device echoes the OUT stream back on IN. Every probe is a framed message (see framing.hpp):
+ *   u32 kind, u32 sequence, u64 send time (steady clock, ns), padding up to --size
+ * Background messages have their own kind and are dropped by the receiver. A probe not echoed
+ * within --timeout is lost: it leaves the window and a late echo is ignored.
+ */
+constexpr uint32_t kind_probe = 0x50524F42;       // "PROB"
+constexpr uint32_t kind_background = 0x424B4744;  // "BKGD"
+constexpr size_t probe_header_size = 16;
+
+struct latency_options
+{
+  std::string uri = default_uri;
+  std::vector<uint64_t> sizes{ 64 };
+  uint64_t count = 10000;
+  uint64_t warmup = 100;
+  uint64_t concurrency = 1;
+  uint64_t background = 0;    // bytes per background message, 0: no background traffic
+  uint64_t timeout_ms = 1000; // probe is lost past it
+  int cpu = -1;               // pin the receiving thread, -1: not pinned
+};
+
+uint64_t now_ns() noexcept
+{
+  return static_cast<uint64_t>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count());
+}
+
+void put_u32(unsigned char *p, uint32_t v) noexcept { ::memcpy(p, &v, sizeof(v)); }
+void put_u64(unsigned char *p, uint64_t v) noexcept { ::memcpy(p, &v, sizeof(v)); }
+uint32_t get_u32(const unsigned char *p) noexcept { uint32_t v; ::memcpy(&v, p, sizeof(v)); return v; }
+uint64_t get_u64(const unsigned char *p) noexcept { uint64_t v; ::memcpy(&v, p, sizeof(v)); return v; }
+
+// shared between the sending (calling) thread and the receiving thread
+struct probe_state
+{
+  std::mutex mutex;
+  std::condition_variable cv;
+  histogram *samples = nullptr;
+  uint64_t warmup = 0;
+  uint64_t since = 0;       // echoes of probes sent before this run started are stale
+  std::map<uint32_t, uint64_t> in_flight;   // sequence -> deadline (ns), deadlines ascend
+  uint64_t received = 0;
+  uint64_t lost = 0;
+  bool stop = false;
+  std::error_code error;
+};
+
+void receiver_fn(pilink::pilink& link, probe_state& state) noexcept
+{
+  pilink::frame_reader reader(link, 1 << 20);
+
+  for (;;) {
+    std::error_code ec = reader.read(100);
+
+    pilink::message_view message;
+    while (reader.next(message)) {
+      uint64_t arrived = now_ns();
+      if (message.size < probe_header_size || get_u32(message.data) != kind_probe)
+        continue;
+
+      uint32_t sequence = get_u32(message.data + 4);
+      uint64_t sent = get_u64(message.data + 8);
+
+      std::lock_guard<std::mutex> lock(state.mutex);
+      auto it = state.in_flight.find(sequence);
+      if (sent < state.since || it == state.in_flight.end())
+        continue;   // stale, or already counted lost
+      state.in_flight.erase(it);
+      if (state.samples != nullptr && sequence >= state.warmup)
+        state.samples->record(arrived - sent);
+      ++ state.received;
+      state.cv.notify_all();
+    }
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.stop)
+      break;
+
+    if (ec && ec != std::errc::timed_out) {
+      state.error = ec;
+      state.cv.notify_all();
+      break;
+    }
+  }
+}
+
+// under state.mutex
+void expire_probes(probe_state& state, uint64_t now) noexcept
+{
+  while (!state.in_flight.empty() && state.in_flight.begin()->second <= now) {
+    state.in_flight.erase(state.in_flight.begin());
+    ++ state.lost;
+  }
+}
+
+// until the first deadline, at most 100 ms so a stop request is seen
+std::chrono::nanoseconds next_wait(const probe_state& state, uint64_t now) noexcept
+{
+  constexpr uint64_t most = 100'000'000;
+  uint64_t wait = most;
+  if (!state.in_flight.empty())
+    wait = std::min(most, state.in_flight.begin()->second - now);
+  return std::chrono::nanoseconds(wait);
+}
+
+std::error_code run_probes(pilink::pilink& link, const latency_options& options, size_t size, probe_state& state, histogram& samples, uint64_t& lost)
+{
+  pilink::frame_writer writer(link, std::max<size_t>(size, options.background) + pilink::frame_writer::header_size);
+  std::vector<unsigned char> probe(size, 0);
+  std::vector<unsigned char> background(std::max<size_t>(options.background, probe_header_size), 0);
+  put_u32(background.data(), kind_background);
+
+  const uint64_t total = options.warmup + options.count;
+
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.samples = &samples;
+    state.warmup = options.warmup;
+    state.since = now_ns();
+    state.in_flight.clear();
+    state.received = 0;
+    state.lost = 0;
+  }
+
+  const uint64_t timeout_ns = options.timeout_ms * 1'000'000;
+
+  std::error_code ec;
+  for (uint64_t sequence = 0; sequence < total && !ec && !stop_requested.load(); ++ sequence) {
+    std::unique_lock<std::mutex> lock(state.mutex);
+    for (;;) {
+      uint64_t now = now_ns();
+      expire_probes(state, now);
+      if (state.in_flight.size() < options.concurrency || state.error || stop_requested.load())
+        break;
+
+      if (options.background == 0) {
+        state.cv.wait_for(lock, next_wait(state, now));
+        continue;
+      }
+
+      // window is full: keep the link busy with background traffic meanwhile
+      lock.unlock();
+      ec = writer.write(background.data(), background.size(), 1000);
+      if (!ec)
+        ec = writer.flush(1000);
+      lock.lock();
+      if (ec)
+        break;
+    }
+
+    if (state.error)
+      ec = state.error;
+    if (ec || stop_requested.load())
+      break;
+
+    uint64_t sent = now_ns();
+    state.in_flight.emplace(static_cast<uint32_t>(sequence), sent + timeout_ns);
+    lock.unlock();
+
+    put_u32(probe.data(), kind_probe);
+    put_u32(probe.data() + 4, static_cast<uint32_t>(sequence));
+    put_u64(probe.data() + 8, sent);
+
+    ec = writer.write(probe.data(), probe.size(), 1000);
+    if (!ec)
+      ec = writer.flush(1000);
+  }
+
+  // collect the echoes still in flight, each until its deadline
+  std::unique_lock<std::mutex> lock(state.mutex);
+  for (;;) {
+    uint64_t now = now_ns();
+    expire_probes(state, now);
+    if (state.in_flight.empty() || state.error || stop_requested.load())
+      break;
+
+    state.cv.wait_for(lock, next_wait(state, now));
+  }
+  if (!ec && state.error)
+    ec = state.error;
+  lost = state.lost;
+  state.in_flight.clear();
+  state.samples = nullptr;
+
+  return ec;
+}
+
+void print_samples(size_t size, const latency_options& options, const histogram& h, uint64_t lost)
+{
+  auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+
+  std::printf("size %zu B, %llu samples, %llu lost, concurrency %llu, background %s\n",
+    size, static_cast<unsigned long long>(h.count()), static_cast<unsigned long long>(lost),
+    static_cast<unsigned long long>(options.concurrency),
+    options.background ? "on" : "off");
+  std::printf("  min %9.1f us  p50 %9.1f us  p99 %9.1f us  p99.9 %9.1f us  max %9.1f us  mean %9.1f us\n",
+    us(h.min()), us(h.percentile(50.0)), us(h.percentile(99.0)), us(h.percentile(99.9)),
+    us(h.max()), h.mean() / 1000.0);
+}
+
+void latency_usage()
+{
+  std::fprintf(stderr,
+    "usage: mpl1c latency [options]\n"
+    "  --uri URI          echo link (default %s)\n"
+    "  --size SIZE[,..]   probe sizes, one run each (default 64, min %zu, max %zu)\n"
+    "  --count N          probes per size (default 10000)\n"
+    "  --warmup N         probes not recorded (default 100)\n"
+    "  --concurrency N    probes in flight (default 1)\n"
+    "  --background SIZE  background messages of SIZE bytes while probing\n"
+    "  --timeout MS       a probe not echoed by then is lost (default 1000)\n"
+    "  --cpu N            pin the receiving thread to CPU N (pairs with LATENCY=LOW)\n",
+    default_uri, probe_header_size, pilink::max_message_size);
+}
+
+bool parse_latency_options(int argc, char *argv[], latency_options& options)
+{
+  for (int i = 1; i < argc; ++ i) {
+    std::string arg = argv[i];
+    bool has_value = (i + 1 < argc);
+
+    if (arg == "--uri" && has_value) {
+      options.uri = argv[++ i];
+    } else if (arg == "--size" && has_value) {
+      options.sizes.clear();
+      std::string list = argv[++ i];
+      size_t begin = 0;
+      while (begin <= list.size()) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos)
+          end = list.size();
+        uint64_t size = 0;
+        if (!parse_size(list.substr(begin, end - begin).c_str(), size) || size < probe_header_size || size > pilink::max_message_size)
+          return false;
+        options.sizes.push_back(size);
+        begin = end + 1;
+      }
+    } else if (arg == "--count" && has_value) {
+      if (!parse_size(argv[++ i], options.count) || options.count == 0)
+        return false;
+    } else if (arg == "--warmup" && has_value) {
+      if (!parse_size(argv[++ i], options.warmup))
+        return false;
+    } else if (arg == "--concurrency" && has_value) {
+      if (!parse_size(argv[++ i], options.concurrency) || options.concurrency == 0)
+        return false;
+    } else if (arg == "--background" && has_value) {
+      if (!parse_size(argv[++ i], options.background) || options.background > pilink::max_message_size)
+        return false;
+    } else if (arg == "--timeout" && has_value) {
+      if (!parse_size(argv[++ i], options.timeout_ms) || options.timeout_ms == 0 || options.timeout_ms > 3'600'000)
+        return false;
+    } else if (arg == "--cpu" && has_value) {
+      uint64_t cpu = 0;
+      if (!parse_size(argv[++ i], cpu) || cpu >= CPU_SETSIZE)
+        return false;
+      options.cpu = static_cast<int>(cpu);
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+} // namespace
+
+int latency_main(int argc, char *argv[])
+{
+  latency_options options;
+  if (!parse_latency_options(argc, argv, options)) {
+    latency_usage();
+    return 2;
+  }
+
+  auto link = open_link(options.uri);
+  if (!link)
+    return 1;
+
+  install_stop_handler();
+
+  probe_state state;
+  std::thread receiver(&receiver_fn, std::ref(*link), std::ref(state));
+
+  if (options.cpu >= 0) {
+    // with LATENCY=LOW the receiver spins on completions; keep it on one core
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(static_cast<size_t>(options.cpu), &set);
+    int err = ::pthread_setaffinity_np(receiver.native_handle(), sizeof(set), &set);
+    if (err != 0)
+      std::fprintf(stderr, "mpl1c: cannot pin to CPU %d: %s\n", options.cpu, std::strerror(err));
+  }
+
+  std::error_code ec;
+  for (uint64_t size : options.sizes) {
+    histogram samples;
+    uint64_t lost = 0;
+    ec = run_probes(*link, options, static_cast<size_t>(size), state, samples, lost);
+    print_samples(static_cast<size_t>(size), options, samples, lost);
+    if (ec || stop_requested.load())
+      break;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.stop = true;
+  }
+  receiver.join();
+
+  if (ec)
+    std::fprintf(stderr, "mpl1c: %s\n", ec.message().c_str());
+
+  (void)link->disconnect();
+
+  return ec ? 1 : 0;
+}
+
+} // namespace mpl1c
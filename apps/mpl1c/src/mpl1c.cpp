@@ -1,14 +1,53 @@
 #include <pilink/pilink.hpp>
+#include <cstdio>
+#include <cstring>
+
+#include "commands.hpp"
+
+namespace {
+
+struct command
+{
+  const char *name;
+  int (*main)(int argc, char *argv[]);
+  const char *help;
+};
+
+const command commands[] = {
+#ifdef __linux__
+  { "capture", &mpl1c::capture_main, "record the IN stream to a file" },
+  { "replay",  &mpl1c::replay_main,  "stream a file to the OUT pipe" },
+  { "latency", &mpl1c::latency_main, "round-trip latency through an echoing device" },
+#endif
+  { "soak",    &mpl1c::soak_main,    "PRBS pattern through the link, verified bit-exactly" },
+};
+
+void usage()
+{
+  std::fprintf(stderr, "usage: mpl1c [COMMAND [options]]\n");
+  std::fprintf(stderr, "without a command the device is connected and disconnected\n\n");
+  for (const auto& c : commands)
+    std::fprintf(stderr, "  %-10s %s\n", c.name, c.help);
+}
+
+} // namespace
 
 int main(int argc, char *argv[])
 {
-  (void)argc;
-  (void)argv;
+  if (argc >= 2) {
+    for (const auto& c : commands) {
+      if (std::strcmp(argv[1], c.name) == 0)
+        return c.main(argc - 1, argv + 1);
+    }
+
+    usage();
+    return 2;
+  }
 
   std::error_code ec;
 
-  auto link = pilink::make_pilink("LIBUSB");
-  ec = link->connect("test");
+  auto link = pilink::make_pilink("LIBUSB://");
+  ec = link->connect("LIBUSB://");
 
 
   ec = link->disconnect();
@@ -0,0 +1,338 @@
+#include "prbs.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MPL1C_PRBS_AVX2
+#include <immintrin.h>
+#endif
+
+namespace mpl1c {
+namespace prbs {
+
+namespace {
+
+uint64_t splitmix64(uint64_t& x) noexcept
+{
+  uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+inline
+uint64_t xorshift64(uint64_t& x) noexcept
+{
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return x;
+}
+
+void put_u32(unsigned char *p, uint32_t v) noexcept { ::memcpy(p, &v, sizeof(v)); }
+void put_u64(unsigned char *p, uint64_t v) noexcept { ::memcpy(p, &v, sizeof(v)); }
+uint32_t get_u32(const unsigned char *p) noexcept { uint32_t v; ::memcpy(&v, p, sizeof(v)); return v; }
+uint64_t get_u64(const unsigned char *p) noexcept { uint64_t v; ::memcpy(&v, p, sizeof(v)); return v; }
+
+void fill_sw(lanes& state, unsigned char *data, size_t steps) noexcept
+{
+  uint64_t a = state.s[0], b = state.s[1], c = state.s[2], d = state.s[3];
+
+  for (; steps != 0; -- steps, data += step_size) {
+    uint64_t w[4] = { xorshift64(a), xorshift64(b), xorshift64(c), xorshift64(d) };
+    ::memcpy(data, w, step_size);
+  }
+
+  state.s[0] = a; state.s[1] = b; state.s[2] = c; state.s[3] = d;
+}
+
+uint64_t check_sw(lanes& state, const unsigned char *data, size_t steps) noexcept
+{
+  uint64_t a = state.s[0], b = state.s[1], c = state.s[2], d = state.s[3];
+  uint64_t errors = 0;
+
+  for (; steps != 0; -- steps, data += step_size) {
+    errors += static_cast<uint64_t>(__builtin_popcountll(xorshift64(a) ^ get_u64(data)));
+    errors += static_cast<uint64_t>(__builtin_popcountll(xorshift64(b) ^ get_u64(data + 8)));
+    errors += static_cast<uint64_t>(__builtin_popcountll(xorshift64(c) ^ get_u64(data + 16)));
+    errors += static_cast<uint64_t>(__builtin_popcountll(xorshift64(d) ^ get_u64(data + 24)));
+  }
+
+  state.s[0] = a; state.s[1] = b; state.s[2] = c; state.s[3] = d;
+  return errors;
+}
+
+#ifdef MPL1C_PRBS_AVX2
+
+// the four lanes live in one ymm register, one step is three shift/xor pairs
+
+__attribute__((target("avx2")))
+void fill_avx2(lanes& state, unsigned char *data, size_t steps) noexcept
+{
+  __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state.s));
+
+  for (; steps != 0; -- steps, data += step_size) {
+    x = _mm256_xor_si256(x, _mm256_slli_epi64(x, 13));
+    x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 7));
+    x = _mm256_xor_si256(x, _mm256_slli_epi64(x, 17));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(data), x);
+  }
+
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(state.s), x);
+}
+
+// Compares with OR-accumulated differences only; bits are counted (scalar) for a mismatching run.
+__attribute__((target("avx2")))
+uint64_t check_avx2(lanes& state, const unsigned char *data, size_t steps) noexcept
+{
+  lanes start = state;
+  __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state.s));
+  __m256i diff = _mm256_setzero_si256();
+
+  const unsigned char *p = data;
+  for (size_t n = steps; n != 0; -- n, p += step_size) {
+    x = _mm256_xor_si256(x, _mm256_slli_epi64(x, 13));
+    x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 7));
+    x = _mm256_xor_si256(x, _mm256_slli_epi64(x, 17));
+    diff = _mm256_or_si256(diff, _mm256_xor_si256(x, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))));
+  }
+
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(state.s), x);
+  if (_mm256_testz_si256(diff, diff))
+    return 0;
+
+  state = start;
+  return check_sw(state, data, steps);
+}
+
+#endif // MPL1C_PRBS_AVX2
+
+struct kernels
+{
+  void (*fill)(lanes&, unsigned char *, size_t) noexcept;
+  uint64_t (*check)(lanes&, const unsigned char *, size_t) noexcept;
+};
+
+kernels select_kernels() noexcept
+{
+#ifdef MPL1C_PRBS_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return { &fill_avx2, &check_avx2 };
+#endif
+  return { &fill_sw, &check_sw };
+}
+
+const kernels& get_kernels() noexcept
+{
+  static const kernels k = select_kernels();
+  return k;
+}
+
+} // namespace
+
+lanes seed_lanes(uint64_t seed, uint64_t offset) noexcept
+{
+  lanes state;
+  uint64_t x = seed ^ (offset * 0xD1B54A32D192ED03ull);
+  for (auto& s : state.s) {
+    do {
+      s = splitmix64(x);
+    } while (s == 0);   // the all zero state is a fixed point
+  }
+  return state;
+}
+
+void fill(lanes& state, unsigned char *data, size_t steps) noexcept
+{
+  get_kernels().fill(state, data, steps);
+}
+
+uint64_t check(lanes& state, const unsigned char *data, size_t steps) noexcept
+{
+  return get_kernels().check(state, data, steps);
+}
+
+generator::generator(uint64_t seed, size_t block_size) noexcept
+  : seed_(seed)
+  , block_size_(std::max(block_size / step_size * step_size, min_block_size))
+{
+}
+
+void generator::fill(unsigned char *data, size_t size) noexcept
+{
+  while (size != 0) {
+    size_t in_block = static_cast<size_t>(offset_ % block_size_);
+    size_t n;
+
+    if (in_block < header_size) {
+      if (in_block == 0) {
+        put_u32(header_, magic);
+        put_u32(header_ + 4, static_cast<uint32_t>(block_size_));
+        put_u64(header_ + 8, offset_);
+        put_u64(header_ + 16, ~offset_);
+        put_u64(header_ + 24, seed_);
+        state_ = seed_lanes(seed_, offset_);
+      }
+      n = std::min(header_size - in_block, size);
+      ::memcpy(data, header_ + in_block, n);
+    } else {
+      size_t in_step = (in_block - header_size) % step_size;
+      if (in_step != 0 || size < step_size) {
+        // piece boundary inside a step
+        if (in_step == 0)
+          prbs::fill(state_, carry_, 1);
+        n = std::min(step_size - in_step, size);
+        ::memcpy(data, carry_ + in_step, n);
+      } else {
+        n = std::min(block_size_ - in_block, size) / step_size * step_size;
+        prbs::fill(state_, data, n / step_size);
+      }
+    }
+
+    data += n;
+    size -= n;
+    offset_ += n;
+  }
+}
+
+void verifier::feed(const unsigned char *data, size_t size) noexcept
+{
+  stats_.received += size;
+
+  while (size != 0) {
+    size_t n = 0;
+    switch (state_) {
+    case state_t::search:  n = search(data, size); break;
+    case state_t::header:  n = header(data, size); break;
+    case state_t::payload: n = payload(data, size); break;
+    }
+
+    data += n;
+    size -= n;
+    offset_ += n;
+  }
+}
+
+// A magic split across two pieces is missed; the next header is at most a block away.
+size_t verifier::search(const unsigned char *data, size_t size) noexcept
+{
+  const unsigned char first = static_cast<unsigned char>(magic & 0xFF);
+  const unsigned char *p = data;
+  const unsigned char *end = data + size;
+
+  while (p < end) {
+    p = static_cast<const unsigned char *>(::memchr(p, first, static_cast<size_t>(end - p)));
+    if (p == nullptr)
+      break;
+
+    if (static_cast<size_t>(end - p) >= sizeof(magic) && get_u32(p) == magic) {
+      state_ = state_t::header;
+      header_used_ = 0;
+      expected_ = false;
+      return static_cast<size_t>(p - data);
+    }
+    ++ p;
+  }
+
+  return size;
+}
+
+size_t verifier::header(const unsigned char *data, size_t size) noexcept
+{
+  size_t n = std::min(header_size - header_used_, size);
+  ::memcpy(header_ + header_used_, data, n);
+  header_used_ += n;
+  if (header_used_ < header_size)
+    return n;
+
+  uint64_t offset = get_u64(header_ + 8);
+  size_t block_size = get_u32(header_ + 4);
+  bool valid = get_u32(header_) == magic
+    && (offset ^ get_u64(header_ + 16)) == ~uint64_t{0}
+    && block_size >= min_block_size
+    && block_size % step_size == 0;
+
+  if (!valid) {
+    if (expected_)
+      ++ stats_.sync_losses;
+    state_ = state_t::search;
+    return n;
+  }
+
+  // offset_ + n - header_size: where this header starts by our own count
+  uint64_t here = offset_ + n - header_size;
+  if (locked_ && offset != here) {
+    ++ stats_.resyncs;
+    if (offset > here)
+      stats_.lost += offset - here;
+  }
+
+  locked_ = true;
+  block_size_ = block_size;
+  lanes_ = seed_lanes(get_u64(header_ + 24), offset);
+  offset_ = offset + header_size - n;
+  in_block_ = header_size;
+  carry_used_ = 0;
+  state_ = state_t::payload;
+  return n;
+}
+
+size_t verifier::payload(const unsigned char *data, size_t size) noexcept
+{
+  size_t remain = block_size_ - in_block_;
+  size_t n;
+
+  if (carry_used_ != 0 || size < step_size) {
+    n = std::min(step_size - carry_used_, size);
+    ::memcpy(carry_ + carry_used_, data, n);
+    carry_used_ += n;
+    if (carry_used_ == step_size) {
+      carry_used_ = 0;
+      judge(check(lanes_, carry_, 1), step_size);
+    }
+  } else {
+    n = std::min({ size, remain, piece_size }) / step_size * step_size;
+
+    lanes start = lanes_;
+    uint64_t errors = check(lanes_, data, n / step_size);
+    if (errors == 0) {
+      stats_.verified += n;
+    } else {
+      // narrow it down so the bytes after a gap are not counted as bit errors
+      lanes_ = start;
+      size_t done = 0;
+      while (done < n && state_ == state_t::payload) {
+        judge(check(lanes_, data + done, 1), step_size);
+        done += step_size;
+      }
+      n = done;
+    }
+  }
+
+  in_block_ += n;
+  if (state_ == state_t::payload && in_block_ == block_size_) {
+    state_ = state_t::header;
+    header_used_ = 0;
+    expected_ = true;
+  }
+
+  return n;
+}
+
+void verifier::judge(uint64_t errors, size_t size) noexcept
+{
+  // random data differs in half the bits; real bit errors come one or two at a time
+  if (errors > size / 4) {
+    ++ stats_.sync_losses;
+    state_ = state_t::search;
+    return;
+  }
+
+  stats_.bit_errors += errors;
+  stats_.verified += size;
+}
+
+} // namespace prbs
+} // namespace mpl1c
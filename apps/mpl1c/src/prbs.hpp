@@ -0,0 +1,112 @@
+#ifndef MPL1C_PRBS_HPP
+#define MPL1C_PRBS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mpl1c {
+namespace prbs {
+
+/*
+ * The test stream is cut in blocks of block_size bytes (a multiple of step_size). Every block
+ * starts with a header
+ *   u32 magic, u32 block size, u64 stream offset, u64 ~stream offset, u64 seed
+ * followed by pseudo random payload: four interleaved xorshift64 LFSR lanes seeded from the
+ * seed and the block offset, one 64 bit word per lane and step. Blocks are self describing, so
+ * a receiver can join or resynchronise at any block boundary and tell from the offsets how many
+ * bytes went missing.
+ */
+constexpr uint32_t magic = 0x53425250;  // "PRBS"
+constexpr size_t header_size = 32;
+constexpr size_t step_size = 32;
+constexpr size_t min_block_size = header_size + step_size;
+
+struct lanes
+{
+  uint64_t s[4];
+};
+
+lanes seed_lanes(uint64_t seed, uint64_t offset) noexcept;
+
+// steps * step_size bytes of pattern, advances the lanes
+void fill(lanes& state, unsigned char *data, size_t steps) noexcept;
+
+// compares steps * step_size bytes against the pattern, advances the lanes, returns the bit errors
+uint64_t check(lanes& state, const unsigned char *data, size_t steps) noexcept;
+
+/**
+ * @brief Produces the test stream in pieces of any size.
+ */
+class generator
+{
+private:
+  uint64_t seed_;
+  size_t block_size_;
+  uint64_t offset_ = 0;
+  lanes state_{};
+  unsigned char header_[header_size];
+  unsigned char carry_[step_size];
+
+public:
+  generator(uint64_t seed, size_t block_size) noexcept;
+
+  void fill(unsigned char *data, size_t size) noexcept;
+
+  uint64_t offset() const noexcept { return offset_; }
+};
+
+/**
+ * @brief Checks the test stream in pieces of any size.
+ *
+ * Starts out of sync and locks onto the first block header. A payload step that disagrees in
+ * more than 8 of its 256 bits is taken as lost synchronisation (bytes missing inside a block)
+ * rather than as bit errors; the verifier then searches for the next header.
+ */
+class verifier
+{
+public:
+  struct stats
+  {
+    uint64_t received = 0;      // bytes fed
+    uint64_t verified = 0;      // payload bytes compared while in sync
+    uint64_t bit_errors = 0;
+    uint64_t lost = 0;          // bytes missing according to the block offsets
+    uint64_t resyncs = 0;       // headers at an unexpected offset
+    uint64_t sync_losses = 0;
+  };
+
+private:
+  enum class state_t { search, header, payload };
+
+  // largest payload piece judged at once
+  static constexpr size_t piece_size = 1024;
+
+  state_t state_ = state_t::search;
+  bool locked_ = false;         // seen a valid header at least once
+  bool expected_ = false;       // current header is at a block boundary of the locked stream
+  size_t block_size_ = 0;
+  uint64_t offset_ = 0;         // stream offset of the next byte as counted here
+  size_t in_block_ = 0;
+  size_t header_used_ = 0;
+  size_t carry_used_ = 0;
+  lanes lanes_{};
+  unsigned char header_[header_size];
+  unsigned char carry_[step_size];
+  stats stats_;
+
+  size_t search(const unsigned char *data, size_t size) noexcept;
+  size_t header(const unsigned char *data, size_t size) noexcept;
+  size_t payload(const unsigned char *data, size_t size) noexcept;
+  void judge(uint64_t errors, size_t size) noexcept;
+
+public:
+  void feed(const unsigned char *data, size_t size) noexcept;
+
+  bool in_sync() const noexcept { return state_ != state_t::search; }
+  const stats& get_stats() const noexcept { return stats_; }
+};
+
+} // namespace prbs
+} // namespace mpl1c
+
+#endif // MPL1C_PRBS_HPP
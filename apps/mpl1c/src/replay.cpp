@@ -0,0 +1,231 @@
+#include "commands.hpp"
+#include "common.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mpl1c {
+
+namespace {
+
+struct replay_options
+{
+  std::string uri = default_uri;
+  std::string path;
+  uint64_t window = 4 << 20;  // bytes submitted per write_some
+  uint64_t rate = 0;          // bytes per second, 0: as fast as the link takes it
+  uint64_t loops = 1;         // 0: forever
+};
+
+/**
+ * Read-only mapping of the source file. The kernel reads ahead on its own (MADV_SEQUENTIAL),
+ * the next window is requested explicitly (MADV_WILLNEED) and consumed ranges are dropped from
+ * the page cache, so tens of GB stream through a bounded amount of memory.
+ */
+class mapped_file
+{
+private:
+  int fd_ = -1;
+  unsigned char *data_ = nullptr;
+  size_t size_ = 0;
+
+public:
+  ~mapped_file()
+  {
+    if (data_ != nullptr)
+      ::munmap(data_, size_);
+    if (fd_ >= 0)
+      ::close(fd_);
+  }
+
+  bool open(const std::string& path)
+  {
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+      std::fprintf(stderr, "mpl1c: open %s: %s\n", path.c_str(), std::strerror(errno));
+      return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd_, &st) != 0 || st.st_size <= 0) {
+      std::fprintf(stderr, "mpl1c: %s: empty or unreadable\n", path.c_str());
+      return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+
+    void *p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+      std::fprintf(stderr, "mpl1c: mmap %s: %s\n", path.c_str(), std::strerror(errno));
+      return false;
+    }
+    data_ = static_cast<unsigned char *>(p);
+
+    ::madvise(data_, size_, MADV_SEQUENTIAL);
+    ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return true;
+  }
+
+  const unsigned char *data() const noexcept { return data_; }
+  size_t size() const noexcept { return size_; }
+
+  void will_need(size_t offset, size_t length) noexcept
+  {
+    length = std::min(length, size_ - std::min(offset, size_));
+    if (length == 0)
+      return;
+
+    // madvise wants a page aligned start
+    size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t aligned = offset / page * page;
+    ::madvise(data_ + aligned, length + (offset - aligned), MADV_WILLNEED);
+  }
+
+  void done_with(size_t offset, size_t length) noexcept
+  {
+    ::posix_fadvise(fd_, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_DONTNEED);
+  }
+};
+
+void replay_usage()
+{
+  std::fprintf(stderr,
+    "usage: mpl1c replay [options] FILE\n"
+    "  --uri URI        link to write (default %s)\n"
+    "  --rate SIZE      pace to SIZE bytes per second (default: unpaced)\n"
+    "  --loop N         play the file N times, 0 forever (default 1)\n"
+    "  --window SIZE    bytes per transfer submission (default 4M)\n",
+    default_uri);
+}
+
+bool parse_replay_options(int argc, char *argv[], replay_options& options)
+{
+  for (int i = 1; i < argc; ++ i) {
+    std::string arg = argv[i];
+    bool has_value = (i + 1 < argc);
+
+    if (arg == "--uri" && has_value) {
+      options.uri = argv[++ i];
+    } else if (arg == "--rate" && has_value) {
+      if (!parse_size(argv[++ i], options.rate))
+        return false;
+    } else if (arg == "--loop" && has_value) {
+      if (!parse_size(argv[++ i], options.loops))
+        return false;
+    } else if (arg == "--window" && has_value) {
+      if (!parse_size(argv[++ i], options.window) || options.window == 0)
+        return false;
+    } else if (!arg.empty() && arg[0] != '-' && options.path.empty()) {
+      options.path = arg;
+    } else {
+      return false;
+    }
+  }
+
+  return !options.path.empty();
+}
+
+} // namespace
+
+int replay_main(int argc, char *argv[])
+{
+  replay_options options;
+  if (!parse_replay_options(argc, argv, options)) {
+    replay_usage();
+    return 2;
+  }
+
+  mapped_file file;
+  if (!file.open(options.path))
+    return 1;
+
+  auto link = open_link(options.uri);
+  if (!link)
+    return 1;
+
+  pilink::pilink::info_s info{};
+  size_t packet_size = 512;
+  if (!link->get_link_info(info) && info.out.packet_size != 0)
+    packet_size = info.out.packet_size;
+
+  // with pacing, submit about 10 ms worth at a time so the rate stays smooth
+  size_t window = static_cast<size_t>(options.window);
+  if (options.rate != 0)
+    window = std::min(window, static_cast<size_t>(std::max<uint64_t>(options.rate / 100, packet_size)));
+  window = std::max(window / packet_size * packet_size, packet_size);
+
+  install_stop_handler();
+
+  std::error_code ec;
+  uint64_t sent = 0;
+  uint64_t loop = 0;
+
+  auto start = clock::now();
+  double cpu_start = cpu_seconds();
+  auto last_report = start;
+  uint64_t last_sent = 0;
+
+  while (!ec && !stop_requested.load() && (options.loops == 0 || loop < options.loops)) {
+    size_t offset = 0;
+    file.will_need(0, window);
+
+    while (offset < file.size() && !stop_requested.load()) {
+      size_t length = std::min(window, file.size() - offset);
+      file.will_need(offset + length, window);
+
+      if (options.rate != 0) {
+        auto due = start + std::chrono::duration_cast<clock::duration>(
+          std::chrono::duration<double>(static_cast<double>(sent) / static_cast<double>(options.rate)));
+        std::this_thread::sleep_until(due);
+      }
+
+      // straight from the mapping, no intermediate buffer
+      size_t transferred = 0;
+      ec = link->write_some(file.data() + offset, length, transferred, 1000);
+      file.done_with(offset, transferred);
+      offset += transferred;
+      sent += transferred;
+
+      if (ec == std::errc::timed_out)
+        ec = {};
+      if (ec)
+        break;
+
+      if (seconds_since(last_report) >= 1.0) {
+        double dt = seconds_since(last_report);
+        std::fprintf(stderr, "%8.1f s  out %8.1f MB/s  sent %10.1f MB  loop %llu\n",
+          seconds_since(start), mbytes(sent - last_sent) / dt, mbytes(sent),
+          static_cast<unsigned long long>(loop + 1));
+        last_report = clock::now();
+        last_sent = sent;
+      }
+    }
+
+    // only a pass that got to the end of the file counts
+    if (offset == file.size())
+      ++ loop;
+    else
+      break;
+  }
+
+  double elapsed = seconds_since(start);
+  double cpu = cpu_seconds() - cpu_start;
+  if (ec)
+    std::fprintf(stderr, "mpl1c: write: %s\n", ec.message().c_str());
+
+  std::fprintf(stderr, "replayed %.1f MB in %.1f s (%llu loops), %.1f MB/s\n",
+    mbytes(sent), elapsed, static_cast<unsigned long long>(loop),
+    elapsed > 0.0 ? mbytes(sent) / elapsed : 0.0);
+  print_cpu_usage(cpu, sent);
+
+  (void)link->disconnect();
+
+  return ec ? 1 : 0;
+}
+
+} // namespace mpl1c
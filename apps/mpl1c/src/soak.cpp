@@ -0,0 +1,237 @@
+#include "commands.hpp"
+#include "common.hpp"
+#include "prbs.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace mpl1c {
+
+namespace {
+
+struct soak_options
+{
+  std::string uri = default_uri;
+  bool send = true;
+  bool receive = true;
+  uint64_t seed = 1;
+  uint64_t block_size = 64 << 10;   // PRBS block, the resync granularity
+  uint64_t chunk = 1 << 20;         // bytes per write_some/read_some
+  uint64_t seconds = 0;             // 0: until Ctrl+C
+  uint64_t bytes = 0;               // 0: unlimited
+};
+
+struct sender_state
+{
+  std::atomic<uint64_t> sent{0};
+  std::atomic<bool> done{false};
+  std::error_code error;
+};
+
+bool limit_reached(const soak_options& options, clock::time_point start, uint64_t bytes) noexcept
+{
+  if (stop_requested.load())
+    return true;
+  if (options.bytes != 0 && bytes >= options.bytes)
+    return true;
+  return options.seconds != 0 && seconds_since(start) >= static_cast<double>(options.seconds);
+}
+
+// the pattern is generated straight into the transfer buffer
+void sender_fn(pilink::pilink& link, const soak_options& options, clock::time_point start, sender_state& state) noexcept
+{
+  prbs::generator generator(options.seed, static_cast<size_t>(options.block_size));
+  std::vector<unsigned char> buffer(static_cast<size_t>(options.chunk));
+  uint64_t sent = 0;
+
+  while (!limit_reached(options, start, sent)) {
+    size_t size = buffer.size();
+    if (options.bytes != 0)
+      size = static_cast<size_t>(std::min<uint64_t>(size, options.bytes - sent));
+    generator.fill(buffer.data(), size);
+
+    size_t offset = 0;
+    while (offset < size && !stop_requested.load()) {
+      size_t transferred = 0;
+      std::error_code ec = link.write_some(buffer.data() + offset, size - offset, transferred, 1000);
+      offset += transferred;
+      sent += transferred;
+      state.sent.store(sent);
+
+      if (ec && ec != std::errc::timed_out) {
+        state.error = ec;
+        state.done.store(true);
+        return;
+      }
+    }
+  }
+
+  state.done.store(true);
+}
+
+void print_report(const char *prefix, double elapsed, double dt, uint64_t out, uint64_t in, const prbs::verifier::stats& s)
+{
+  std::fprintf(stderr, "%s%8.1f s  out %8.1f MB/s  in %8.1f MB/s  verified %10.1f MB  bit errors %llu  lost %llu B  resyncs %llu  sync losses %llu\n",
+    prefix, elapsed,
+    dt > 0.0 ? mbytes(out) / dt : 0.0,
+    dt > 0.0 ? mbytes(in) / dt : 0.0,
+    mbytes(s.verified),
+    static_cast<unsigned long long>(s.bit_errors),
+    static_cast<unsigned long long>(s.lost),
+    static_cast<unsigned long long>(s.resyncs),
+    static_cast<unsigned long long>(s.sync_losses));
+}
+
+void soak_usage()
+{
+  std::fprintf(stderr,
+    "usage: mpl1c soak [options]\n"
+    "  --uri URI        link under test (default %s)\n"
+    "  --tx | --rx      only generate or only verify (default both, device loops OUT to IN)\n"
+    "  --seconds N      stop after N seconds (default: Ctrl+C)\n"
+    "  --bytes SIZE     stop after SIZE bytes\n"
+    "  --seed N         pattern seed (default 1, the verifier takes it from the stream)\n"
+    "  --block SIZE     pattern block size, the resync granularity (default 64K)\n"
+    "  --chunk SIZE     bytes per transfer call (default 1M)\n",
+    default_uri);
+}
+
+bool parse_soak_options(int argc, char *argv[], soak_options& options)
+{
+  for (int i = 1; i < argc; ++ i) {
+    std::string arg = argv[i];
+    bool has_value = (i + 1 < argc);
+
+    if (arg == "--uri" && has_value) {
+      options.uri = argv[++ i];
+    } else if (arg == "--tx") {
+      options.receive = false;
+    } else if (arg == "--rx") {
+      options.send = false;
+    } else if (arg == "--seconds" && has_value) {
+      if (!parse_size(argv[++ i], options.seconds))
+        return false;
+    } else if (arg == "--bytes" && has_value) {
+      if (!parse_size(argv[++ i], options.bytes))
+        return false;
+    } else if (arg == "--seed" && has_value) {
+      if (!parse_size(argv[++ i], options.seed))
+        return false;
+    } else if (arg == "--block" && has_value) {
+      if (!parse_size(argv[++ i], options.block_size) || options.block_size < prbs::min_block_size
+          || options.block_size > UINT32_MAX)
+        return false;
+    } else if (arg == "--chunk" && has_value) {
+      if (!parse_size(argv[++ i], options.chunk) || options.chunk == 0)
+        return false;
+    } else {
+      return false;
+    }
+  }
+
+  return options.send || options.receive;
+}
+
+} // namespace
+
+int soak_main(int argc, char *argv[])
+{
+  soak_options options;
+  if (!parse_soak_options(argc, argv, options)) {
+    soak_usage();
+    return 2;
+  }
+
+  auto link = open_link(options.uri);
+  if (!link)
+    return 1;
+
+  install_stop_handler();
+
+  auto start = clock::now();
+  double cpu_start = cpu_seconds();
+  sender_state sender;
+  std::thread sender_thread;
+  if (options.send)
+    sender_thread = std::thread(&sender_fn, std::ref(*link), std::cref(options), start, std::ref(sender));
+  else
+    sender.done.store(true);
+
+  prbs::verifier verifier;
+  std::vector<unsigned char> buffer(static_cast<size_t>(options.chunk));
+  uint64_t received = 0;
+  std::error_code ec;
+
+  auto last_report = start;
+  uint64_t last_sent = 0;
+  uint64_t last_received = 0;
+
+  for (;;) {
+    if (options.receive) {
+      // with both directions, drain what the sender put out before stopping
+      bool sender_done = sender.done.load();
+      if (options.send ? (sender_done && received >= sender.sent.load()) : limit_reached(options, start, received))
+        break;
+
+      size_t transferred = 0;
+      ec = link->read_some(buffer.data(), buffer.size(), transferred, 1000);
+      verifier.feed(buffer.data(), transferred);
+      received += transferred;
+
+      if (ec == std::errc::timed_out && sender_done && options.send)
+        break;    // the rest is not coming back
+      if (ec == std::errc::timed_out || ec == std::errc::argument_out_of_domain)
+        ec = {};
+      if (ec)
+        break;
+    } else {
+      if (sender.done.load())
+        break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    if (seconds_since(last_report) >= 1.0) {
+      uint64_t sent = sender.sent.load();
+      print_report("", seconds_since(start), seconds_since(last_report),
+        sent - last_sent, received - last_received, verifier.get_stats());
+      last_report = clock::now();
+      last_sent = sent;
+      last_received = received;
+    }
+  }
+
+  if (sender_thread.joinable()) {
+    stop_requested.store(true);
+    sender_thread.join();
+  }
+
+  double elapsed = seconds_since(start);
+  double cpu = cpu_seconds() - cpu_start;
+  uint64_t sent = sender.sent.load();
+  const auto& stats = verifier.get_stats();
+
+  if (ec)
+    std::fprintf(stderr, "mpl1c: read: %s\n", ec.message().c_str());
+  if (sender.error)
+    std::fprintf(stderr, "mpl1c: write: %s\n", sender.error.message().c_str());
+
+  print_report("total ", elapsed, elapsed, sent, received, stats);
+  print_cpu_usage(cpu, (sent + received));
+
+  bool failed = ec || sender.error;
+  if (options.receive) {
+    // bytes that never came back count as lost too
+    uint64_t missing = (options.send && sent > received + stats.lost) ? sent - received - stats.lost : 0;
+    if (missing != 0)
+      std::fprintf(stderr, "mpl1c: %llu B sent but not received\n", static_cast<unsigned long long>(missing));
+    failed = failed || stats.bit_errors != 0 || stats.lost != 0 || stats.sync_losses != 0 || missing != 0
+      || (received != 0 && stats.verified == 0);
+  }
+
+  (void)link->disconnect();
+
+  return failed ? 1 : 0;
+}
+
+} // namespace mpl1c
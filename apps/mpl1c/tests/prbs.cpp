@@ -0,0 +1,122 @@
+#include "prbs.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/*
+ * The PRBS test stream: generated in pieces of any size it is the same as in one go, and the
+ * verifier, fed in pieces of any size, counts a gap and flipped bits exactly.
+ */
+
+namespace {
+
+using namespace mpl1c;
+
+constexpr uint64_t seed = 0x1234567890abcdefull;
+constexpr size_t block_size = 4096;
+constexpr size_t blocks = 64;
+
+int failures = 0;
+
+void check(bool ok, const char *what)
+{
+  if (!ok) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    ++ failures;
+  }
+}
+
+std::vector<unsigned char> stream(size_t size)
+{
+  std::vector<unsigned char> data(size);
+  prbs::generator generator(seed, block_size);
+  generator.fill(data.data(), data.size());
+  return data;
+}
+
+void feed_in_pieces(prbs::verifier& verifier, const std::vector<unsigned char>& data, std::mt19937& random)
+{
+  for (size_t offset = 0; offset < data.size();) {
+    size_t piece = std::min<size_t>(data.size() - offset, random() % 3000 + 1);
+    verifier.feed(data.data() + offset, piece);
+    offset += piece;
+  }
+}
+
+void pieces() noexcept
+{
+  std::mt19937 random(1);
+  auto whole = stream(blocks * block_size);
+
+  std::vector<unsigned char> chunked(whole.size());
+  prbs::generator generator(seed, block_size);
+  for (size_t offset = 0; offset < chunked.size();) {
+    // odd sizes that cut headers and steps, and some long runs
+    size_t piece = random() % 4 == 0 ? random() % 20000 + 1 : random() % 50 + 1;
+    piece = std::min(piece, chunked.size() - offset);
+    generator.fill(chunked.data() + offset, piece);
+    offset += piece;
+  }
+
+  check(chunked == whole, "chunked generation matches a single pass");
+  check(generator.offset() == whole.size(), "generator offset");
+}
+
+void clean() noexcept
+{
+  std::mt19937 random(2);
+  auto data = stream(blocks * block_size);
+
+  prbs::verifier verifier;
+  feed_in_pieces(verifier, data, random);
+
+  const auto& stats = verifier.get_stats();
+  check(verifier.in_sync(), "in sync");
+  check(stats.received == data.size(), "received");
+  check(stats.verified == blocks * (block_size - prbs::header_size), "all payload verified");
+  check(stats.bit_errors == 0 && stats.lost == 0 && stats.resyncs == 0 && stats.sync_losses == 0, "no errors");
+}
+
+void gap_and_flips() noexcept
+{
+  std::mt19937 random(3);
+  auto data = stream(blocks * block_size);
+
+  // ten bits in the payload of later blocks, one per block
+  const size_t flips = 10;
+  for (size_t i = 0; i < flips; ++ i) {
+    size_t block = 20 + i * 3;
+    size_t at = block * block_size + prbs::header_size + random() % (block_size - prbs::header_size);
+    data[at] ^= static_cast<unsigned char>(1u << (random() % 8));
+  }
+
+  // 1000 bytes missing from the middle of block 5
+  const size_t gap = 1000;
+  size_t gap_at = 5 * block_size + 1500;
+  data.erase(data.begin() + static_cast<std::ptrdiff_t>(gap_at), data.begin() + static_cast<std::ptrdiff_t>(gap_at + gap));
+
+  prbs::verifier verifier;
+  feed_in_pieces(verifier, data, random);
+
+  const auto& stats = verifier.get_stats();
+  check(verifier.in_sync(), "in sync after the gap");
+  check(stats.lost == gap, "gap counted exactly");
+  check(stats.bit_errors == flips, "flipped bits counted exactly");
+  check(stats.sync_losses == 1 && stats.resyncs == 1, "one sync loss, one resync");
+}
+
+} // namespace
+
+int main()
+{
+  pieces();
+  clean();
+  gap_and_flips();
+
+  if (failures == 0)
+    std::printf("prbs: ok\n");
+
+  return failures == 0 ? 0 : 1;
+}
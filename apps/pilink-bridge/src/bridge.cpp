@@ -0,0 +1,161 @@
+#include <pilink/pilink.hpp>
+#include <apps/options.hpp>
+#include <pilink/tcp.hpp>
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Bridge: owns links and serves them to other hosts, where they are opened as
+ * TCP://<host>:<port>?NAME=<name>, one client per link at a time.
+ */
+
+namespace {
+
+struct bridge_options
+{
+  std::vector<std::pair<std::string, std::string>> links;  // name, uri
+  std::string host;                                         // empty: any address
+  uint16_t port = 0;
+  pilink::tcp::server_options server;
+};
+
+pilink::tcp::server *running = nullptr;
+
+using apps::parse_size;
+
+// "5025", "0.0.0.0:5025", "[::1]:5025"
+bool parse_listen(const std::string& value, bridge_options& options)
+{
+  std::string port = value;
+  auto colon = value.rfind(':');
+  if (colon != std::string::npos) {
+    options.host = value.substr(0, colon);
+    port = value.substr(colon + 1);
+    if (options.host.size() > 2 && options.host.front() == '[' && options.host.back() == ']')
+      options.host = options.host.substr(1, options.host.size() - 2);
+  }
+
+  uint64_t n = 0;
+  if (!parse_size(port.c_str(), n) || n == 0 || n > 65535)
+    return false;
+
+  options.port = static_cast<uint16_t>(n);
+  return true;
+}
+
+void usage()
+{
+  std::fprintf(stderr,
+    "usage: pilink-bridge --listen [HOST:]PORT --link NAME=URI [--link NAME=URI ...] [options]\n"
+    "  --listen [HOST:]PORT  address to serve on (all of the host's by default)\n"
+    "  --link NAME=URI       serve URI as TCP://<this host>:PORT?NAME=NAME\n"
+    "  --buffers N           IN transfers read ahead of the network (default 16)\n"
+    "  --buffer-size SIZE    largest IN transfer, rounded down to whole packets (default 256K)\n"
+    "  --zerocopy            send the IN stream with MSG_ZEROCOPY (pays off on real NICs)\n");
+}
+
+bool parse_options(int argc, char *argv[], bridge_options& options)
+{
+  for (int i = 1; i < argc; ++ i) {
+    std::string arg = argv[i];
+    bool has_value = (i + 1 < argc);
+
+    if (arg == "--listen" && has_value) {
+      if (!parse_listen(argv[++ i], options))
+        return false;
+    } else if (arg == "--link" && has_value) {
+      std::string value = argv[++ i];
+      auto eq = value.find('=');
+      if (eq == std::string::npos || eq == 0)
+        return false;
+      options.links.emplace_back(value.substr(0, eq), value.substr(eq + 1));
+    } else if (arg == "--buffers" && has_value) {
+      uint64_t n = 0;
+      if (!parse_size(argv[++ i], n) || n == 0)
+        return false;
+      options.server.buffers = static_cast<size_t>(n);
+    } else if (arg == "--buffer-size" && has_value) {
+      uint64_t n = 0;
+      if (!parse_size(argv[++ i], n) || n == 0)
+        return false;
+      options.server.buffer_size = static_cast<size_t>(n);
+    } else if (arg == "--zerocopy") {
+      options.server.zerocopy = true;
+    } else {
+      return false;
+    }
+  }
+
+  return !options.links.empty() && options.port != 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  bridge_options options;
+  if (!parse_options(argc, argv, options)) {
+    usage();
+    return 2;
+  }
+
+  pilink::tcp::server server(options.server);
+  std::vector<std::unique_ptr<pilink::pilink>> links;
+  int rc = 0;
+
+  for (const auto& [name, uri] : options.links) {
+    auto link = pilink::make_pilink(uri.c_str());
+    if (!link) {
+      std::fprintf(stderr, "pilink-bridge: out of memory\n");
+      rc = 1;
+      break;
+    }
+
+    std::error_code ec = link->connect(uri.c_str());
+    if (!ec)
+      ec = server.add(name.c_str(), *link);
+    if (ec) {
+      std::fprintf(stderr, "pilink-bridge: %s: %s\n", uri.c_str(), ec.message().c_str());
+      rc = 1;
+      break;
+    }
+
+    links.push_back(std::move(link));
+  }
+
+  if (rc == 0) {
+    std::error_code ec = server.listen(options.host.empty() ? nullptr : options.host.c_str(), options.port);
+    if (ec) {
+      std::fprintf(stderr, "pilink-bridge: listen: %s\n", ec.message().c_str());
+      rc = 1;
+    }
+  }
+
+  if (rc == 0) {
+    for (const auto& [name, uri] : options.links)
+      std::fprintf(stderr, "pilink-bridge: %s served as TCP://<host>:%u?NAME=%s\n",
+        uri.c_str(), static_cast<unsigned int>(server.port()), name.c_str());
+
+    running = &server;
+    auto handler = [](int) { running->stop(); };
+    std::signal(SIGINT, handler);
+    std::signal(SIGTERM, handler);
+
+    std::error_code ec = server.run();
+    if (ec) {
+      std::fprintf(stderr, "pilink-bridge: %s\n", ec.message().c_str());
+      rc = 1;
+    }
+  }
+
+  for (auto& link : links)
+    (void)link->disconnect();
+
+  return rc;
+}
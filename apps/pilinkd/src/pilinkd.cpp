@@ -0,0 +1,201 @@
+#include <pilink/pilink.hpp>
+#include <apps/options.hpp>
+#include <pilink/shm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Broker: owns links and publishes their IN streams in shared memory, where any number of local
+ * processes read them as SHM://?NAME=<name>. Transfers land straight in the published slots.
+ */
+
+namespace {
+
+struct broker_options
+{
+  std::vector<std::pair<std::string, std::string>> links;  // name, uri
+  uint64_t slots = 64;
+  uint64_t slot_size = 256 << 10;
+};
+
+struct published_link
+{
+  std::string name;
+  std::string uri;
+  std::unique_ptr<pilink::pilink> link;
+  pilink::shm::publisher publisher;
+  std::thread thread;
+  uint64_t published = 0;
+  std::error_code error;
+};
+
+std::atomic<bool> stop_requested{false};
+
+using apps::parse_size;
+
+void usage()
+{
+  std::fprintf(stderr,
+    "usage: pilinkd --link NAME=URI [--link NAME=URI ...] [options]\n"
+    "  --link NAME=URI    publish the IN stream of URI as SHM://?NAME=NAME\n"
+    "  --slots N          transfers kept in each ring (default 64)\n"
+    "  --slot-size SIZE   largest transfer, rounded down to whole packets (default 256K)\n");
+}
+
+bool parse_options(int argc, char *argv[], broker_options& options)
+{
+  for (int i = 1; i < argc; ++ i) {
+    std::string arg = argv[i];
+    bool has_value = (i + 1 < argc);
+
+    if (arg == "--link" && has_value) {
+      std::string value = argv[++ i];
+      auto eq = value.find('=');
+      if (eq == std::string::npos || eq == 0)
+        return false;
+      options.links.emplace_back(value.substr(0, eq), value.substr(eq + 1));
+    } else if (arg == "--slots" && has_value) {
+      if (!parse_size(argv[++ i], options.slots) || options.slots == 0)
+        return false;
+    } else if (arg == "--slot-size" && has_value) {
+      if (!parse_size(argv[++ i], options.slot_size) || options.slot_size == 0)
+        return false;
+    } else {
+      return false;
+    }
+  }
+
+  return !options.links.empty();
+}
+
+void publish_fn(published_link& p) noexcept
+{
+  size_t slot_size = p.publisher.slot_size();
+
+  while (!stop_requested.load()) {
+    unsigned char *slot = p.publisher.acquire();
+    size_t transferred = 0;
+    std::error_code ec = p.link->read_some(slot, slot_size, transferred, 1000);
+
+    // a short transfer or a timeout may still carry data
+    if (transferred != 0) {
+      p.publisher.commit(transferred);
+      p.published += transferred;
+    }
+
+    if (ec && ec != std::errc::timed_out && ec != std::errc::argument_out_of_domain) {
+      if (ec != std::errc::operation_canceled)
+        p.error = ec;
+      break;
+    }
+  }
+
+  // its readers learn right away
+  p.publisher.close();
+}
+
+bool start(published_link& p, const broker_options& options)
+{
+  p.link = pilink::make_pilink(p.uri.c_str());
+  if (!p.link) {
+    std::fprintf(stderr, "pilinkd: out of memory\n");
+    return false;
+  }
+
+  std::error_code ec = p.link->connect(p.uri.c_str());
+  if (ec) {
+    std::fprintf(stderr, "pilinkd: connect %s: %s\n", p.uri.c_str(), ec.message().c_str());
+    return false;
+  }
+
+  pilink::pilink::info_s info{};
+  ec = p.link->get_link_info(info);
+  if (ec) {
+    std::fprintf(stderr, "pilinkd: %s: %s\n", p.uri.c_str(), ec.message().c_str());
+    return false;
+  }
+
+  // whole packets, so that no transfer goes through the link's alignment buffer
+  uint64_t packet = std::max<uint64_t>(info.in.packet_size, 1);
+  uint64_t slot_size = std::max(options.slot_size / packet, uint64_t{1}) * packet;
+
+  ec = p.publisher.create(p.name.c_str(), static_cast<size_t>(options.slots), static_cast<size_t>(slot_size), info);
+  if (ec) {
+    std::fprintf(stderr, "pilinkd: publish %s: %s\n", p.name.c_str(), ec.message().c_str());
+    return false;
+  }
+
+  p.thread = std::thread(publish_fn, std::ref(p));
+  std::fprintf(stderr, "pilinkd: %s published as SHM://?NAME=%s (%llu slots of %llu B)\n",
+    p.uri.c_str(), p.name.c_str(),
+    static_cast<unsigned long long>(options.slots),
+    static_cast<unsigned long long>(slot_size));
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  broker_options options;
+  if (!parse_options(argc, argv, options)) {
+    usage();
+    return 2;
+  }
+
+  auto handler = [](int) { stop_requested.store(true); };
+  std::signal(SIGINT, handler);
+  std::signal(SIGTERM, handler);
+
+  std::vector<std::unique_ptr<published_link>> links;
+  bool started = true;
+  for (const auto& [name, uri] : options.links) {
+    auto p = std::make_unique<published_link>();
+    p->name = name;
+    p->uri = uri;
+    started = start(*p, options);
+    links.push_back(std::move(p));
+    if (!started)
+      break;
+  }
+
+  while (started && !stop_requested.load())
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  // the readers blocked in the links return right away
+  stop_requested.store(true);
+  for (auto& p : links) {
+    if (p->link)
+      p->link->cancel();
+  }
+
+  int rc = started ? 0 : 1;
+  for (auto& p : links) {
+    if (p->thread.joinable())
+      p->thread.join();
+
+    p->publisher.close();
+    if (p->link)
+      (void)p->link->disconnect();
+
+    if (p->error) {
+      std::fprintf(stderr, "pilinkd: %s: %s\n", p->uri.c_str(), p->error.message().c_str());
+      rc = 1;
+    }
+
+    std::fprintf(stderr, "pilinkd: %s: %.1f MB published\n", p->name.c_str(),
+      static_cast<double>(p->published) / (1024.0 * 1024.0));
+  }
+
+  return rc;
+}
@@ -0,0 +1,449 @@
+#ifndef PILINK_ASIO_HPP
+#define PILINK_ASIO_HPP
+
+#include <pilink/pilink.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/basic_waitable_timer.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/posix/basic_stream_descriptor.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <poll.h>
+
+namespace pilink {
+namespace asio {
+
+/*
+ * Boost.Asio AsyncReadStream / AsyncWriteStream over a pilink. Every operation is one
+ * asynchronous transfer of the link (async_read_some / async_write_some); the link's poll fds are
+ * watched by the stream's executor, which runs process_events when they turn ready, so no thread
+ * blocks in the transport. Completion tokens are the usual ones: callbacks, use_future,
+ * use_awaitable, ...
+ *
+ * The link must be connected, outlive the stream and its operations, and be left to the stream
+ * (no blocking calls from other threads meanwhile). One stream per link at a time: the stream owns
+ * the link's poll fd notifiers.
+ *
+ * The stream's state (detail::service) has no lock: its operations and handlers must all run on
+ * one thread, i.e. a single threaded io_context or a strand as the stream's executor.
+ */
+
+namespace detail {
+
+// boost::system view of pilink's own error category
+class link_category : public boost::system::error_category
+{
+public:
+  const char* name() const noexcept override
+  {
+    return "pilink";
+  }
+
+  std::string message(int e) const override
+  {
+    return pilink_category().message(e);
+  }
+};
+
+inline
+const link_category& link_category_inst() noexcept
+{
+  static const link_category category;
+  return category;
+}
+
+inline
+boost::system::error_code to_boost_error(std::error_code ec) noexcept
+{
+  if (!ec)
+    return {};
+
+  if (ec == std::errc::operation_canceled)
+    return boost::asio::error::operation_aborted;
+
+  if (ec.category() == std::system_category())
+    return boost::system::error_code(ec.value(), boost::system::system_category());
+
+  if (ec.category() == pilink_category())
+    return boost::system::error_code(ec.value(), link_category_inst());
+
+  // transport categories (libusb, ...) by their generic meaning
+  std::error_condition condition = ec.default_error_condition();
+  if (condition.category() == std::generic_category())
+    return boost::system::error_code(condition.value(), boost::system::generic_category());
+
+  return boost::system::error_code(EIO, boost::system::generic_category());
+}
+
+// Link, watches and timer of one stream. Not locked: everything runs on the stream's executor,
+// which must not run two of its handlers at once (single threaded, or a strand).
+template<typename Executor>
+class service : public std::enable_shared_from_this<service<Executor>>
+{
+private:
+  using descriptor_t = boost::asio::posix::basic_stream_descriptor<Executor>;
+  using timer_t = boost::asio::basic_waitable_timer<std::chrono::steady_clock,
+    boost::asio::wait_traits<std::chrono::steady_clock>, Executor>;
+
+  // the descriptor is the link's: released, never closed
+  struct watch
+  {
+    int fd;
+    short events;
+    descriptor_t descriptor;
+    bool waiting;
+
+    watch(const Executor& ex, int fd_, short events_)
+      : fd(fd_)
+      , events(events_)
+      , descriptor(ex, fd_)
+      , waiting(false)
+    {
+    }
+
+    ~watch()
+    {
+      if (descriptor.is_open())
+        (void)descriptor.release();
+    }
+  };
+
+  // an edge the reactor took while nothing waited is not reported again: poll now and then
+  static constexpr int fallback_poll_ms = 100;
+
+  pilink& link_;
+  Executor ex_;
+  std::vector<std::shared_ptr<watch>> watches_;
+  timer_t timer_;
+  bool timer_waiting_;
+  size_t pending_;
+  bool closed_;
+  bool detached_;
+
+  static void on_pollfd_added(int fd, short events, void *user_data) noexcept
+  {
+    static_cast<service*>(user_data)->add_watch(fd, events);
+  }
+
+  static void on_pollfd_removed(int fd, void *user_data) noexcept
+  {
+    static_cast<service*>(user_data)->remove_watch(fd);
+  }
+
+  void add_watch(int fd, short events) noexcept
+  {
+    try {
+      watches_.push_back(std::make_shared<watch>(ex_, fd, events));
+    } catch (...) {
+      return;   // the fallback poll still drives the link
+    }
+
+    arm();
+  }
+
+  void remove_watch(int fd) noexcept
+  {
+    auto it = std::find_if(watches_.begin(), watches_.end(), [fd](const std::shared_ptr<watch>& w) { return w->fd == fd; });
+    if (it != watches_.end())
+      watches_.erase(it);
+  }
+
+  void run() noexcept
+  {
+    if (detached_)
+      return;
+
+    (void)link_.process_events();
+    arm();
+  }
+
+  void arm() noexcept
+  {
+    if (pending_ == 0 || detached_)
+      return;
+
+    auto self = this->shared_from_this();
+
+    for (auto& w : watches_) {
+      if (w->waiting)
+        continue;
+
+      auto type = (w->events & POLLIN) ? descriptor_t::wait_read : descriptor_t::wait_write;
+      w->waiting = true;
+      w->descriptor.async_wait(type, [self, w](const boost::system::error_code& ec) {
+        w->waiting = false;
+        if (!ec)
+          self->run();
+      });
+    }
+
+    if (!timer_waiting_) {
+      int ms = -1;
+      if (link_.get_next_timeout(ms) || ms < 0 || ms > fallback_poll_ms)
+        ms = fallback_poll_ms;
+
+      timer_waiting_ = true;
+      timer_.expires_after(std::chrono::milliseconds(ms));
+      timer_.async_wait([self](const boost::system::error_code& ec) {
+        self->timer_waiting_ = false;
+        if (!ec)
+          self->run();
+      });
+    }
+  }
+
+  // nothing in flight: the waits would only keep this alive
+  void idle() noexcept
+  {
+    for (auto& w : watches_) {
+      boost::system::error_code ignored;
+      w->descriptor.cancel(ignored);
+    }
+
+    boost::system::error_code ignored;
+    timer_.cancel(ignored);
+  }
+
+  void detach() noexcept
+  {
+    detached_ = true;
+    (void)link_.set_pollfd_notifiers(nullptr, nullptr, nullptr);
+    watches_.clear();
+    idle();
+  }
+
+public:
+  service(const Executor& ex, pilink& link)
+    : link_(link)
+    , ex_(ex)
+    , watches_()
+    , timer_(ex)
+    , timer_waiting_(false)
+    , pending_(0)
+    , closed_(false)
+    , detached_(false)
+  {
+  }
+
+  // separate from the constructor: the notifiers may call back right away
+  void attach() noexcept
+  {
+    (void)link_.set_pollfd_notifiers(&on_pollfd_added, &on_pollfd_removed, this);
+  }
+
+  // the stream is gone: cancel what is in flight, let go of the link once it has completed
+  void close() noexcept
+  {
+    closed_ = true;
+    link_.cancel_async();
+    if (pending_ == 0)
+      detach();
+  }
+
+  pilink& link() noexcept
+  {
+    return link_;
+  }
+
+  const Executor& get_executor() const noexcept
+  {
+    return ex_;
+  }
+
+  void started() noexcept
+  {
+    ++ pending_;
+    arm();
+  }
+
+  void finished() noexcept
+  {
+    if (-- pending_ != 0)
+      return;
+
+    if (closed_)
+      detach();
+    else
+      idle();
+  }
+};
+
+template<typename Handler, typename Executor>
+struct operation
+{
+  std::shared_ptr<service<Executor>> svc;
+  Handler handler;
+
+  operation(std::shared_ptr<service<Executor>> s, Handler&& h)
+    : svc(std::move(s))
+    , handler(std::move(h))
+  {
+  }
+
+  // runs from process_events, on the stream's executor
+  static void complete(void *context, std::error_code ec, size_t transferred) noexcept
+  {
+    std::unique_ptr<operation> self(static_cast<operation*>(context));
+    auto svc = std::move(self->svc);
+
+    auto ex = boost::asio::get_associated_executor(self->handler, svc->get_executor());
+    boost::asio::dispatch(ex,
+      [handler = std::move(self->handler), error = to_boost_error(ec), transferred]() mutable {
+        handler(error, transferred);
+      });
+
+    svc->finished();
+  }
+};
+
+template<typename Executor>
+struct initiate_transfer
+{
+  std::shared_ptr<service<Executor>> svc;
+  bool in;
+
+  template<typename Handler, typename Buffers>
+  void operator()(Handler&& handler, const Buffers& buffers) const
+  {
+    using handler_t = std::decay_t<Handler>;
+    using operation_t = operation<handler_t, Executor>;
+
+    // one transfer, into or out of the first non-empty buffer
+    unsigned char *data = nullptr;
+    size_t size = 0;
+    for (auto it = boost::asio::buffer_sequence_begin(buffers); it != boost::asio::buffer_sequence_end(buffers); ++ it) {
+      boost::asio::const_buffer b(*it);
+      if (b.size() != 0) {
+        data = static_cast<unsigned char *>(const_cast<void *>(b.data()));
+        size = b.size();
+        break;
+      }
+    }
+
+    handler_t h(std::forward<Handler>(handler));
+    auto ex = boost::asio::get_associated_executor(h, svc->get_executor());
+
+    if (size == 0) {
+      boost::asio::post(ex, [h = std::move(h)]() mutable { h(boost::system::error_code(), 0); });
+      return;
+    }
+
+    std::unique_ptr<operation_t> op(new operation_t(svc, std::move(h)));
+
+    std::error_code ec = in
+      ? svc->link().async_read_some(data, size, &operation_t::complete, op.get())
+      : svc->link().async_write_some(data, size, &operation_t::complete, op.get());
+
+    if (ec) {
+      boost::asio::post(ex, [h = std::move(op->handler), error = to_boost_error(ec)]() mutable { h(error, 0); });
+      return;
+    }
+
+    (void)op.release();
+    svc->started();
+  }
+};
+
+} // namespace detail
+
+template<typename Executor = boost::asio::any_io_executor>
+class basic_stream
+{
+public:
+  using executor_type = Executor;
+
+  template<typename OtherExecutor>
+  struct rebind_executor
+  {
+    using other = basic_stream<OtherExecutor>;
+  };
+
+private:
+  std::shared_ptr<detail::service<Executor>> service_;
+
+public:
+  basic_stream(const executor_type& ex, pilink& link)
+    : service_(std::make_shared<detail::service<Executor>>(ex, link))
+  {
+    service_->attach();
+  }
+
+  template<typename ExecutionContext,
+    typename = std::enable_if_t<std::is_convertible<ExecutionContext&, boost::asio::execution_context&>::value>>
+  basic_stream(ExecutionContext& context, pilink& link)
+    : basic_stream(executor_type(context.get_executor()), link)
+  {
+  }
+
+  ~basic_stream()
+  {
+    if (service_)
+      service_->close();
+  }
+
+  basic_stream(basic_stream&&) noexcept = default;
+  basic_stream& operator=(basic_stream&&) = delete;
+
+  basic_stream(const basic_stream&) = delete;
+  basic_stream& operator=(const basic_stream&) = delete;
+
+  executor_type get_executor() const noexcept
+  {
+    return service_->get_executor();
+  }
+
+  pilink& link() noexcept
+  {
+    return service_->link();
+  }
+
+  // operations in flight complete with operation_aborted
+  void cancel() noexcept
+  {
+    service_->link().cancel_async();
+  }
+
+  /**
+   * @brief One IN transfer into the first non-empty buffer; completes with what the transfer
+   * brought in, possibly less than the buffer holds.
+   */
+  template<typename MutableBufferSequence, typename ReadToken>
+  auto async_read_some(const MutableBufferSequence& buffers, ReadToken&& token)
+  {
+    return boost::asio::async_initiate<ReadToken, void(boost::system::error_code, std::size_t)>(
+      detail::initiate_transfer<Executor>{ service_, true }, token, buffers);
+  }
+
+  /**
+   * @brief One OUT transfer from the first non-empty buffer; completes with what went out,
+   * possibly less than the buffer holds (at most the link's maximum transfer size).
+   * boost::asio::async_write loops over the rest.
+   */
+  template<typename ConstBufferSequence, typename WriteToken>
+  auto async_write_some(const ConstBufferSequence& buffers, WriteToken&& token)
+  {
+    return boost::asio::async_initiate<WriteToken, void(boost::system::error_code, std::size_t)>(
+      detail::initiate_transfer<Executor>{ service_, false }, token, buffers);
+  }
+};
+
+using stream = basic_stream<>;
+
+} // namespace asio
+} // namespace pilink
+
+#endif // PILINK_ASIO_HPP
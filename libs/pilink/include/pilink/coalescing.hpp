@@ -0,0 +1,77 @@
+#ifndef PILINK_COALESCING_HPP
+#define PILINK_COALESCING_HPP
+
+#include <pilink/pilink.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace pilink {
+
+struct coalescing_options
+{
+  size_t        threshold = 16 * 1024;   // pending bytes that trigger a transfer (rounded to packets)
+  unsigned int  max_delay_us = 1000;     // longest time a byte waits in the buffer
+  size_t        capacity = 256 * 1024;   // buffered bytes before write_some blocks
+  unsigned int  timeout = 1000;          // background transfer timeout, ms
+};
+
+/**
+ * @brief The coalescing_writer class
+ * Opt-in write side for high rates of small writes. write_some only appends to a buffer; a
+ * background thread sends packet-multiple transfers once threshold bytes are pending, and
+ * everything that is left once the oldest byte is max_delay old or flush() is called.
+ * Writes of threshold bytes or more bypass the buffer (after what is already queued). A transfer
+ * that is a whole number of packets is followed by a zero length packet, so the reader sees it
+ * end. Transfer errors of the background thread are returned by the next write_some/flush; what
+ * did not go out stays buffered, in order, and is sent again once the error has been returned
+ * (after a timeout, right away).
+ */
+class coalescing_writer
+{
+private:
+  using clock = std::chrono::steady_clock;
+
+  pilink& link_;
+  coalescing_options options_;
+  size_t packet_size_;
+
+  std::unique_ptr<unsigned char[]> fill_;  // producers append here
+  std::unique_ptr<unsigned char[]> send_;  // being written by the flusher
+  size_t fill_size_;
+  size_t sending_;                         // of send_, counted against capacity
+  clock::time_point oldest_;
+
+  std::thread flusher_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool started_;
+  bool stop_;
+  bool flush_requested_;
+  bool in_flight_;
+  std::error_code error_;
+
+  std::error_code start() noexcept;
+  std::error_code send(const unsigned char *data, size_t size, size_t& transferred) noexcept;
+  std::error_code take_error() noexcept;
+  void flusher_fn() noexcept;
+
+public:
+  explicit coalescing_writer(pilink& link, const coalescing_options& options = {}) noexcept;
+  ~coalescing_writer();
+
+  coalescing_writer(const coalescing_writer&) = delete;
+  coalescing_writer& operator=(const coalescing_writer&) = delete;
+
+  [[nodiscard]]
+  std::error_code write_some(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept;
+
+  // Sends everything buffered and waits until it is on the link.
+  [[nodiscard]]
+  std::error_code flush(unsigned int timeout) noexcept;
+};
+
+} // namespace pilink
+
+#endif // PILINK_COALESCING_HPP
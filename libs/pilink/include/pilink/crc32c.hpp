@@ -0,0 +1,19 @@
+#ifndef PILINK_CRC32C_HPP
+#define PILINK_CRC32C_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pilink {
+
+/**
+ * @brief crc32c
+ * CRC-32C (Castagnoli), as used by the link integrity stage. Pass the previous result as crc to
+ * continue a running checksum, 0 to start. Uses the SSE4.2 crc32 instruction when the CPU has it
+ * (selected once at runtime), table driven code otherwise.
+ */
+uint32_t crc32c(uint32_t crc, const unsigned char *data, size_t size) noexcept;
+
+} // namespace pilink
+
+#endif // PILINK_CRC32C_HPP
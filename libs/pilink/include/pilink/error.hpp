@@ -0,0 +1,42 @@
+#ifndef PILINK_ERROR_HPP
+#define PILINK_ERROR_HPP
+
+#include <system_error>
+
+namespace pilink {
+
+// Link level errors, not tied to any transport
+enum class error
+{
+  success             = 0,
+  integrity_mismatch  = 1,  // transfer failed its integrity check
+  cancelled           = 2,  // ended by pilink::cancel (or a disconnect) from another thread
+  lease_overwritten   = 3   // the producer reused a leased buffer before release, its data is void
+};
+
+class error_category : public std::error_category
+{
+public:
+  virtual const char* name() const noexcept override;
+  virtual std::string message(int e) const override;
+  virtual std::error_condition default_error_condition(int e) const noexcept override;
+}; // class error_category
+
+const std::error_category& pilink_category() noexcept;
+
+inline
+std::error_code make_error_code(error e) noexcept
+{
+  return std::error_code{ static_cast<int>(e), pilink_category() };
+}
+
+} // namespace pilink
+
+namespace std {
+
+template<>
+struct is_error_code_enum<pilink::error> : public true_type {};
+
+} // namespace std
+
+#endif // PILINK_ERROR_HPP
@@ -0,0 +1,148 @@
+#ifndef PILINK_FANOUT_HPP
+#define PILINK_FANOUT_HPP
+
+#include <pilink/pilink.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pilink {
+
+struct fanout_options
+{
+  size_t        queue_depth = 16;          // views a subscriber may have waiting
+  size_t        buffers = 32;              // own buffers, when the link cannot lend its own; queued
+                                           // views hold theirs, keep it above queue_depth
+  size_t        buffer_size = 256 * 1024;  // size of each of those (rounded to packets)
+  unsigned int  timeout = 100;             // background read timeout, ms
+};
+
+// what a subscriber with a full queue costs
+enum class fanout_policy
+{
+  drop,           // what comes meanwhile is not queued for it, counted in dropped()
+  backpressure    // the link is not read until it takes one
+};
+
+/**
+ * @brief The fanout class
+ * Opt-in read side for several consumers of one IN stream. A background thread reads the link
+ * and hands every completed transfer to each subscriber as a view: the same memory, reference
+ * counted, filled once however many subscribers there are. Where the link lends its transfer
+ * buffers (read_lease) and keeps them for the lease, views point into them and a buffer goes back
+ * to the link when its last view is gone. Otherwise transfers are read into a pool of own
+ * buffers: also from a link whose leases can be overwritten while held (SHM://, keeps_leases()
+ * false), so that the bytes of a view never change under a subscriber.
+ *
+ * Each subscriber has its own cursor (queue) and policy. The link is the fanout's while it runs;
+ * views must not outlive it. A read error ends the stream: subscribers get it once they have
+ * taken what was queued before.
+ */
+class fanout
+{
+private:
+  struct buffer
+  {
+    fanout                  *owner = nullptr;
+    std::atomic<unsigned int> refs{0};
+    const unsigned char     *data = nullptr;
+    size_t                   size = 0;
+    uint64_t                 sequence = 0;
+    bool                     leased = false;
+    pilink::lease_s          lease{};
+    std::unique_ptr<unsigned char[]> own;
+  };
+
+public:
+  class view
+  {
+  private:
+    buffer *buffer_;
+
+    friend class fanout;
+    explicit view(buffer *b) noexcept;
+
+  public:
+    view() noexcept;
+    view(const view& other) noexcept;
+    view(view&& other) noexcept;
+    view& operator=(view other) noexcept;
+    ~view();
+
+    void reset() noexcept;
+
+    explicit operator bool() const noexcept { return buffer_ != nullptr; }
+    const unsigned char *data() const noexcept { return buffer_ != nullptr ? buffer_->data : nullptr; }
+    size_t size() const noexcept { return buffer_ != nullptr ? buffer_->size : 0; }
+
+    // transfer number in the stream, gaps are what a dropping subscriber lost
+    uint64_t sequence() const noexcept { return buffer_ != nullptr ? buffer_->sequence : 0; }
+  };
+
+  class subscriber
+  {
+  private:
+    fanout          &owner_;
+    fanout_policy    policy_;
+    std::deque<view> queue_;
+    uint64_t         dropped_;
+
+    friend class fanout;
+
+  public:
+    subscriber(fanout& owner, fanout_policy policy) noexcept;
+
+    // the next view in stream order; timed_out when none came within timeout ms
+    [[nodiscard]]
+    std::error_code next(view& v, unsigned int timeout) noexcept;
+
+    uint64_t dropped() const noexcept;
+  };
+
+private:
+  pilink& link_;
+  fanout_options options_;
+
+  std::vector<std::unique_ptr<buffer>> buffers_;
+  std::vector<buffer *> free_;
+  std::vector<buffer *> returned_;    // last view gone, to be given back by the reader
+  std::vector<std::shared_ptr<subscriber>> subscribers_;
+  uint64_t sequence_;
+  bool lend_;                         // the link lends its buffers
+
+  std::thread reader_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool started_;
+  bool stop_;
+  bool ended_;
+  std::error_code error_;
+
+  std::error_code start() noexcept;
+  void reader_fn() noexcept;
+  void recycle(buffer *b) noexcept;
+  void give_back(std::vector<buffer *>& returned) noexcept;
+  buffer *take_buffer() noexcept;
+  buffer *fill(std::error_code& ec) noexcept;
+  bool held_up() const noexcept;
+
+public:
+  explicit fanout(pilink& link, const fanout_options& options = {}) noexcept;
+  ~fanout();
+
+  fanout(const fanout&) = delete;
+  fanout& operator=(const fanout&) = delete;
+
+  // starts reading with the first subscriber; a subscriber sees what is read after it came
+  [[nodiscard]]
+  std::error_code subscribe(fanout_policy policy, std::shared_ptr<subscriber>& s) noexcept;
+  void unsubscribe(const std::shared_ptr<subscriber>& s) noexcept;
+};
+
+} // namespace pilink
+
+#endif // PILINK_FANOUT_HPP
@@ -0,0 +1,110 @@
+#ifndef PILINK_FRAMING_HPP
+#define PILINK_FRAMING_HPP
+
+#include <pilink/pilink.hpp>
+#include <cstdint>
+
+namespace pilink {
+
+// The largest message on a framed link: frame_writer refuses larger ones, frame_reader skips them
+// (and any its buffer cannot hold) by their length, so the messages after them still parse.
+constexpr size_t max_message_size = 128 * 1024;
+
+/**
+ * @brief The message_view struct
+ * Received message, points into the frame_reader transfer buffer. Valid until the next
+ * frame_reader::read().
+ */
+struct message_view
+{
+  const unsigned char *data;
+  size_t size;
+};
+
+/**
+ * @brief The frame_writer class
+ * Batches length-prefixed messages (32 bit little endian length, then payload) into one buffer,
+ * so many small messages go out in a single write_some. A write that is a whole number of packets
+ * is followed by a zero length packet, so the reader does not wait for more.
+ */
+class frame_writer
+{
+private:
+  pilink& link_;
+  std::unique_ptr<unsigned char[]> batch_;
+  size_t batch_size_;
+  size_t packet_size_;
+  size_t pending_;
+  size_t prepared_;
+  bool preparing_;
+
+  std::error_code reserve(size_t size, unsigned int timeout) noexcept;
+  std::error_code send(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept;
+
+public:
+  static constexpr size_t header_size = 4;
+
+  explicit frame_writer(pilink& link, size_t batch_size = 64 * 1024) noexcept;
+
+  frame_writer(const frame_writer&) = delete;
+  frame_writer& operator=(const frame_writer&) = delete;
+
+  // Copies the message into the batch, flushes first if it does not fit. message_size above
+  // max_message_size.
+  [[nodiscard]]
+  std::error_code write(const unsigned char *data, size_t size, unsigned int timeout) noexcept;
+
+  // In-place construction: reserve up to max_size bytes in the batch, fill them, then commit()
+  // the actual size. Messages that do not fit in an empty batch can only go through write().
+  // commit() without a prepare() is invalid_argument.
+  [[nodiscard]]
+  std::error_code prepare(size_t max_size, unsigned char *&data, unsigned int timeout) noexcept;
+  [[nodiscard]]
+  std::error_code commit(size_t size) noexcept;
+
+  [[nodiscard]]
+  std::error_code flush(unsigned int timeout) noexcept;
+
+  size_t pending() const noexcept { return pending_; }
+};
+
+/**
+ * @brief The frame_reader class
+ * Reads the link in packet-multiple chunks and parses messages in place. A message split between
+ * reads is moved to the buffer front, everything else is handed out as message_view without copy.
+ * A message above max_message_size, or one the buffer cannot hold along with a packet of slack,
+ * is skipped and counted in dropped().
+ */
+class frame_reader
+{
+private:
+  pilink& link_;
+  std::unique_ptr<unsigned char[]> buffer_;
+  size_t buffer_size_;
+  size_t packet_size_;
+  size_t begin_;  // first unparsed byte
+  size_t end_;    // end of received data
+  size_t skip_;   // bytes of a skipped message still to come
+  uint64_t dropped_;
+
+public:
+  explicit frame_reader(pilink& link, size_t buffer_size = 256 * 1024) noexcept;
+
+  frame_reader(const frame_reader&) = delete;
+  frame_reader& operator=(const frame_reader&) = delete;
+
+  // Receives more data, invalidates views returned by next(). Data received before an error
+  // (e.g. timeout) is still available through next().
+  [[nodiscard]]
+  std::error_code read(unsigned int timeout) noexcept;
+
+  // Next complete message from the buffer, false when more data has to be read.
+  bool next(message_view& message) noexcept;
+
+  // Messages skipped for their size.
+  uint64_t dropped() const noexcept { return dropped_; }
+};
+
+} // namespace pilink
+
+#endif // PILINK_FRAMING_HPP
@@ -1,9 +1,13 @@
 #ifndef PILINK_HPP
 #define PILINK_HPP
 
+#include <cstdint>
 #include <system_error>
 #include <memory>
 #include <vector>
+#include <string>
+
+#include <pilink/error.hpp>
 
 namespace pilink {
 
@@ -26,6 +30,51 @@ public:
     struct pipe_info_s  out;
   };
 
+  // counters since connect, zero where a transport has no such thing
+  struct stats_s {
+    uint64_t iso_packets;         // isochronous packets completed
+    uint64_t iso_packet_errors;   // isochronous packets completed with an error status, data lost
+    uint64_t iso_underruns;       // moments with no isochronous transfer queued, microframes went unserved
+    uint64_t pipe_recoveries;     // stalls cleared on one endpoint without a reset
+    uint64_t recovery_bytes;      // bytes the stalled transfers still had to carry, requested or sent again
+    uint64_t outages;             // times the device went away and the link waited for it to come back
+    uint64_t outage_ms;           // time spent without the device
+    uint64_t outage_dropped_bytes;  // written meanwhile and dropped, the write buffer being full
+    uint64_t reader_overruns;     // slots a shared memory reader fell a ring behind on and lost
+    uint64_t lost_segments;       // striped segments that never arrived and were skipped
+  };
+
+  // vendor control request; transferred and status are filled in when it completes
+  struct vendor_request_s {
+    bool            in;           // device to host
+    unsigned char   request;
+    uint16_t        value;
+    uint16_t        index;
+    unsigned char  *data;
+    uint16_t        length;
+    size_t          transferred;
+    std::error_code status;       // operation_canceled when not issued
+  };
+
+  // read-only view of a completed IN transfer in transport owned memory, valid until release
+  struct lease_s {
+    const unsigned char *data;
+    size_t size;
+    size_t slot;                  // the transport's, identifies the buffer on release
+  };
+
+  // descriptor to wait on for the link's completions, events as in poll(2)
+  struct pollfd_s {
+    int   fd;
+    short events;
+  };
+
+  using pollfd_added_fn = void (*)(int fd, short events, void *user_data);
+  using pollfd_removed_fn = void (*)(int fd, void *user_data);
+
+  // completion of an asynchronous transfer
+  using completion_fn = void (*)(void *context, std::error_code ec, size_t transferred);
+
   virtual ~pilink() {}
 
   [[nodiscard]]
@@ -38,15 +87,159 @@ public:
   [[nodiscard]]
   virtual std::error_code get_link_info(struct info_s& link_info) noexcept = 0;
 
+  [[nodiscard]]
+  virtual std::error_code get_link_stats(struct stats_s& link_stats) noexcept
+  {
+    (void)link_stats;
+    return std::make_error_code(std::errc::operation_not_supported);
+  }
+
+  /**
+   * @brief Issues vendor control requests in order, several in flight at once and independent of
+   * the data pipes. Nothing is submitted after a request fails; requests already in flight are
+   * cancelled. Returns the first failure.
+   */
+  [[nodiscard]]
+  virtual std::error_code vendor_requests(vendor_request_s *requests, size_t count, unsigned int timeout) noexcept
+  {
+    (void)requests;
+    (void)count;
+    (void)timeout;
+    return std::make_error_code(std::errc::operation_not_supported);
+  }
+
   [[nodiscard]]
   virtual std::error_code reset() noexcept = 0;
 
+  /**
+   * @brief Writes up to size bytes, argument_out_of_domain when fewer went out. With size 0 a
+   * packet link (USB) sends a zero length packet, which ends a transfer that is a whole number of
+   * packets for the reader; stream links do nothing.
+   */
   [[nodiscard]]
   virtual std::error_code write_some(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept = 0;
 
+  /**
+   * @brief Reads up to size bytes, argument_out_of_domain when a short transfer ended it first.
+   * Here and in every call that takes one, timeout is in milliseconds and 0 waits without limit;
+   * timed_out may come with data already transferred.
+   */
   [[nodiscard]]
   virtual std::error_code read_some(unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept = 0;
 
+  /**
+   * @brief Zero copy read: lends the next completed IN transfer instead of copying it out.
+   * Transfers are kept queued in transport buffers; a leased buffer is queued again once it is
+   * released, so holding leases stalls the pipe (no_buffer_space when all are out). Leases are
+   * returned in stream order and must all be released before disconnect or reset. Not to be
+   * mixed with read_some.
+   */
+  [[nodiscard]]
+  virtual std::error_code read_lease(lease_s& lease, unsigned int timeout) noexcept
+  {
+    (void)lease;
+    (void)timeout;
+    return std::make_error_code(std::errc::operation_not_supported);
+  }
+
+  // lease_overwritten when the transport could not keep the data for the lease (shared memory:
+  // the broker reused the slot); what was read from it is to be dropped
+  virtual std::error_code release(lease_s& lease) noexcept
+  {
+    (void)lease;
+    return {};
+  }
+
+  // false where a lease can be overwritten before it is released (shared memory), so that a
+  // consumer holding leases for long copies the data out instead
+  virtual bool keeps_leases() const noexcept
+  {
+    return true;
+  }
+
+  /**
+   * @brief Event source for an external reactor. Instead of blocking in a call, wait on these
+   * descriptors (and no longer than get_next_timeout), then call process_events, which completes
+   * the asynchronous transfers (async_read_some, async_write_some). The set changes on connect;
+   * the notifiers keep a reactor up to date across that, and may be set before connect.
+   */
+  [[nodiscard]]
+  virtual std::error_code get_pollfds(std::vector<pollfd_s>& fds) noexcept
+  {
+    (void)fds;
+    return std::make_error_code(std::errc::operation_not_supported);
+  }
+
+  [[nodiscard]]
+  virtual std::error_code set_pollfd_notifiers(pollfd_added_fn added, pollfd_removed_fn removed, void *user_data) noexcept
+  {
+    (void)added;
+    (void)removed;
+    (void)user_data;
+    return std::make_error_code(std::errc::operation_not_supported);
+  }
+
+  // ms until process_events has to run even without fd activity, -1 for none
+  [[nodiscard]]
+  virtual std::error_code get_next_timeout(int& ms) noexcept
+  {
+    ms = -1;
+    return std::make_error_code(std::errc::operation_not_supported);
+  }
+
+  // completes whatever is ready, never blocks
+  [[nodiscard]]
+  virtual std::error_code process_events() noexcept
+  {
+    return std::make_error_code(std::errc::operation_not_supported);
+  }
+
+  /**
+   * @brief Asynchronous transfers, completed through the event source: fn runs from
+   * process_events (or from the disconnect, reset or connect that ends the transfer), never from
+   * the call that starts it, and not while another thread drives the same link with blocking
+   * calls. The buffer must stay valid until then. A read completes with what one transfer
+   * brought in, possibly less than size. A write sends at most one transfer (the link's maximum
+   * transfer size) and completes with what went out, possibly less than size: the rest is the
+   * caller's to write again. Writes of one link are sent in the order started. An error returned
+   * here means fn will not be called.
+   */
+  [[nodiscard]]
+  virtual std::error_code async_read_some(unsigned char *data, size_t size, completion_fn fn, void *context) noexcept
+  {
+    (void)data;
+    (void)size;
+    (void)fn;
+    (void)context;
+    return std::make_error_code(std::errc::operation_not_supported);
+  }
+
+  [[nodiscard]]
+  virtual std::error_code async_write_some(const unsigned char *data, size_t size, completion_fn fn, void *context) noexcept
+  {
+    (void)data;
+    (void)size;
+    (void)fn;
+    (void)context;
+    return std::make_error_code(std::errc::operation_not_supported);
+  }
+
+  // asynchronous transfers in flight complete with operation_canceled
+  virtual void cancel_async() noexcept
+  {
+  }
+
+  /**
+   * @brief Ends the blocking calls in progress on other threads within a bounded time (about
+   * 100 ms): their transfers are cancelled and they return error::cancelled. Asynchronous
+   * transfers are cancelled by the next process_events, which the wake up triggers. Calls made
+   * afterwards are not affected. disconnect does the same before it closes, and waits for those
+   * calls to leave.
+   */
+  virtual void cancel() noexcept
+  {
+  }
+
   //virtual std::error_code write(const unsigned char *data, size_t size) noexcept = 0;
   //virtual std::error_code read(unsigned char *data, size_t size) noexcept = 0;
 
@@ -63,6 +256,9 @@ public:
 
 std::unique_ptr<pilink> make_pilink(const char *uri);
 
+// Connect uris of the devices a LIBUSB:// or USBFS:// (Linux) filter selects, e.g.
+// LIBUSB://?VID=152a; keys are those of the connect uri. Other schemes name no enumerable device:
+// operation_not_supported.
 std::error_code enumerate(const char *filter, std::vector<std::string>& paths);
 
 
@@ -0,0 +1,58 @@
+#ifndef PILINK_SHM_HPP
+#define PILINK_SHM_HPP
+
+#include <pilink/pilink.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+
+namespace pilink {
+namespace shm {
+
+/**
+ * @brief The publisher class
+ * Producer side of a shared memory ring (Linux): a broker that owns a link publishes its IN
+ * stream under a name, and any number of local processes read it as SHM://?NAME=<name>, at full
+ * rate, without syscalls while there is data and without the broker copying: a transfer is read
+ * straight into the slot it is published from.
+ *
+ *   auto slot = publisher.acquire();
+ *   link.read_some(slot, publisher.slot_size(), transferred, timeout);
+ *   publisher.commit(transferred);
+ *
+ * A slot acquired and not committed is simply acquired again. Readers that fall more than
+ * slot_count slots behind lose the oldest; the producer never waits for them.
+ */
+class publisher
+{
+private:
+  void     *ring_;
+  size_t    bytes_;
+  uint64_t  next_;
+  char      name_[256];
+
+public:
+  publisher() noexcept;
+  ~publisher();
+
+  publisher(const publisher&) = delete;
+  publisher& operator=(const publisher&) = delete;
+
+  // replaces an object left behind under that name
+  [[nodiscard]]
+  std::error_code create(const char *name, size_t slot_count, size_t slot_size, const pilink::info_s& link_info) noexcept;
+
+  // readers get no_such_device once they have read what is left
+  void close() noexcept;
+
+  bool is_open() const noexcept;
+  size_t slot_size() const noexcept;
+
+  unsigned char *acquire() noexcept;
+  void commit(size_t size) noexcept;
+};
+
+} // namespace shm
+} // namespace pilink
+
+#endif // PILINK_SHM_HPP
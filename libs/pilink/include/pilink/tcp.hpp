@@ -0,0 +1,96 @@
+#ifndef PILINK_TCP_HPP
+#define PILINK_TCP_HPP
+
+#include <pilink/pilink.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace pilink {
+namespace tcp {
+
+struct server_options
+{
+  size_t  buffers = 16;               // IN transfers read ahead of the network, per session
+  size_t  buffer_size = 256 * 1024;   // largest of those (rounded to packets)
+  bool    zerocopy = false;           // MSG_ZEROCOPY for the IN stream, where the kernel has it
+};
+
+/**
+ * @brief The server class
+ * Bridge side of TCP:// (Linux): serves links it does not own to clients on other hosts, each
+ * link to one client at a time (TCP://<host>:<port>?NAME=<name>).
+ *
+ * A client session is two connections, so that IN and OUT never wait for each other. The IN
+ * stream is read ahead into a pool of buffers, and whatever has piled up while the network was
+ * busy goes out in one frame and one sendmsg, gathered from the buffers it was read into (with
+ * zerocopy, sent from them). Writes are passed on to the link in the client's transfer
+ * boundaries. Connections are accepted without waiting for their hello: a client that is slow
+ * to say who it is does not hold up the others.
+ *
+ *   server.add("unit0", link);
+ *   server.listen(nullptr, 5025);
+ *   server.run();                    // until stop, from a signal handler or another thread
+ */
+class server
+{
+private:
+  struct session;
+  struct pending;
+
+  struct entry
+  {
+    std::string  name;
+    pilink      *link;
+    bool         busy;
+  };
+
+  server_options    options_;
+  int               listen_fd_;
+  int               wake_fd_;
+  std::atomic<bool> stop_;
+  uint64_t          next_session_;
+
+  std::mutex        mutex_;
+  std::vector<entry> links_;
+  std::vector<std::unique_ptr<session>> sessions_;
+  std::vector<std::unique_ptr<pending>> pending_;   // run's own, no lock
+
+  void accept_client() noexcept;
+  bool receive_hello(pending& p) noexcept;
+  void handshake(pending& p) noexcept;
+  void reap(bool all) noexcept;
+
+public:
+  explicit server(const server_options& options = {}) noexcept;
+  ~server();
+
+  server(const server&) = delete;
+  server& operator=(const server&) = delete;
+
+  // the link stays the caller's, connected, and is not to be used elsewhere while served
+  [[nodiscard]]
+  std::error_code add(const char *name, pilink& link) noexcept;
+
+  // host nullptr: any address; port 0: one the system picks
+  [[nodiscard]]
+  std::error_code listen(const char *host, uint16_t port) noexcept;
+  uint16_t port() const noexcept;
+
+  // serves until stop; the sessions are ended before it returns
+  [[nodiscard]]
+  std::error_code run() noexcept;
+
+  // async-signal-safe
+  void stop() noexcept;
+};
+
+} // namespace tcp
+} // namespace pilink
+
+#endif // PILINK_TCP_HPP
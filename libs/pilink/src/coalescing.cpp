@@ -0,0 +1,251 @@
+#include <pilink/coalescing.hpp>
+#include <cstring>
+
+namespace pilink {
+
+coalescing_writer::coalescing_writer(pilink& link, const coalescing_options& options) noexcept
+  : link_{link}
+  , options_{options}
+  , packet_size_{1}
+  , fill_{}
+  , send_{}
+  , fill_size_{0}
+  , sending_{0}
+  , oldest_{}
+  , started_{false}
+  , stop_{false}
+  , flush_requested_{false}
+  , in_flight_{false}
+{
+}
+
+coalescing_writer::~coalescing_writer()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!started_)
+      return;
+    stop_ = true;
+  }
+  cv_.notify_all();
+
+  // the flusher sends what is left before it exits
+  flusher_.join();
+}
+
+std::error_code coalescing_writer::start() noexcept
+{
+  pilink::info_s info;
+  std::error_code ec = link_.get_link_info(info);
+  if (ec)
+    return ec;
+
+  packet_size_ = std::max<size_t>(info.out.packet_size, 1);
+
+  size_t packets = (options_.threshold + packet_size_ - 1) / packet_size_;
+  options_.threshold = std::max<size_t>(packets, 1) * packet_size_;
+  options_.capacity = std::max(options_.capacity, options_.threshold);
+
+  fill_.reset(::new (std::nothrow) unsigned char[options_.capacity]);
+  send_.reset(::new (std::nothrow) unsigned char[options_.capacity]);
+  if (!fill_ || !send_)
+    return std::make_error_code(std::errc::not_enough_memory);
+
+  try {
+    flusher_ = std::thread(&coalescing_writer::flusher_fn, this);
+  } catch (const std::system_error& e) {
+    return e.code();
+  }
+
+  started_ = true;
+  return {};
+}
+
+std::error_code coalescing_writer::send(const unsigned char *data, size_t size, size_t& transferred) noexcept
+{
+  std::error_code ec = link_.write_some(data, size, transferred, options_.timeout);
+  if (ec || size == 0 || size % packet_size_ != 0)
+    return ec;
+
+  size_t none = 0;
+  return link_.write_some(data, 0, none, options_.timeout);
+}
+
+// called locked; the flusher holds back after a failure until it has been reported
+std::error_code coalescing_writer::take_error() noexcept
+{
+  std::error_code ec;
+  std::swap(ec, error_);
+  cv_.notify_all();
+  return ec;
+}
+
+void coalescing_writer::flusher_fn() noexcept
+{
+  const auto max_delay = std::chrono::microseconds(options_.max_delay_us);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    cv_.wait(lock, [&] { return stop_ || (!in_flight_ && fill_size_ != 0 && !error_); });
+    if (fill_size_ == 0 || (stop_ && error_))
+      break;
+
+    if (in_flight_) {
+      cv_.wait(lock, [&] { return !in_flight_; });
+      continue;
+    }
+
+    auto deadline = oldest_ + max_delay;
+    cv_.wait_until(lock, deadline, [&] {
+      return stop_ || flush_requested_ || fill_size_ >= options_.threshold;
+    });
+
+    // threshold reached: whole packets only, the tail waits for more data or its deadline
+    bool everything = stop_ || flush_requested_ || clock::now() >= deadline;
+    size_t take = everything ? fill_size_ : fill_size_ / packet_size_ * packet_size_;
+    size_t rest = fill_size_ - take;
+    auto sent_oldest = oldest_;
+
+    std::swap(fill_, send_);
+    ::memcpy(fill_.get(), send_.get() + take, rest);
+    fill_size_ = rest;
+    sending_ = take;
+    if (rest != 0)
+      oldest_ = clock::now();
+
+    in_flight_ = true;
+    cv_.notify_all();
+    lock.unlock();
+
+    size_t transferred = 0;
+    std::error_code ec = send(send_.get(), take, transferred);
+
+    lock.lock();
+    in_flight_ = false;
+    sending_ = 0;
+
+    // what did not go out goes first again, ahead of what was appended meanwhile
+    if (transferred < take) {
+      size_t unsent = take - transferred;
+      ::memmove(fill_.get() + unsent, fill_.get(), fill_size_);
+      ::memcpy(fill_.get(), send_.get() + transferred, unsent);
+      fill_size_ += unsent;
+      oldest_ = sent_oldest;
+    }
+
+    if (ec && ec != std::errc::timed_out && !error_)
+      error_ = ec;
+    if (fill_size_ == 0)
+      flush_requested_ = false;
+    cv_.notify_all();
+
+    // on the way out nobody is left to report to or to wait for
+    if (ec && stop_)
+      break;
+  }
+}
+
+std::error_code coalescing_writer::write_some(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept
+{
+  transferred = 0;
+
+  std::error_code ec;
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!started_) {
+    ec = start();
+    if (ec)
+      return ec;
+  }
+
+  if (error_)
+    return take_error();
+
+  auto deadline = timeout != 0 ? clock::now() + std::chrono::milliseconds(timeout) : clock::time_point::max();
+
+  if (size >= options_.threshold) {
+    // nothing to gain from buffering, keep order and write directly
+    flush_requested_ = true;
+    cv_.notify_all();
+    bool idle = cv_.wait_until(lock, deadline, [&] {
+      return error_ || (fill_size_ == 0 && !in_flight_);
+    });
+
+    if (error_)
+      return take_error();
+
+    if (!idle)
+      return std::make_error_code(std::errc::timed_out);
+
+    in_flight_ = true;
+    lock.unlock();
+    ec = link_.write_some(data, size, transferred, timeout);
+    if (!ec && size % packet_size_ == 0) {
+      size_t none = 0;
+      ec = link_.write_some(data, 0, none, timeout);
+    }
+    lock.lock();
+    in_flight_ = false;
+    cv_.notify_all();
+
+    return ec;
+  }
+
+  while (size != 0) {
+    bool space = cv_.wait_until(lock, deadline, [&] {
+      return error_ || fill_size_ + sending_ < options_.capacity;
+    });
+
+    if (error_) {
+      ec = take_error();
+      break;
+    }
+
+    if (!space) {
+      ec = std::make_error_code(std::errc::timed_out);
+      break;
+    }
+
+    bool was_empty = (fill_size_ == 0);
+    if (was_empty)
+      oldest_ = clock::now();
+
+    size_t n = std::min(size, options_.capacity - fill_size_ - sending_);
+    ::memcpy(fill_.get() + fill_size_, data, n);
+    fill_size_ += n;
+    transferred += n;
+    data += n;
+    size -= n;
+
+    // wake the flusher only when it has something new to act on
+    if (was_empty || fill_size_ >= options_.threshold)
+      cv_.notify_all();
+  }
+
+  return ec;
+}
+
+std::error_code coalescing_writer::flush(unsigned int timeout) noexcept
+{
+  std::error_code ec;
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!started_)
+    return {};
+
+  flush_requested_ = true;
+  cv_.notify_all();
+
+  auto deadline = timeout != 0 ? clock::now() + std::chrono::milliseconds(timeout) : clock::time_point::max();
+  bool done = cv_.wait_until(lock, deadline, [&] {
+    return error_ || (fill_size_ == 0 && !in_flight_);
+  });
+
+  if (error_)
+    return take_error();
+
+  if (!done)
+    ec = std::make_error_code(std::errc::timed_out);
+
+  return ec;
+}
+
+} // namespace pilink
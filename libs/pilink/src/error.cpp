@@ -0,0 +1,53 @@
+#include <pilink/error.hpp>
+
+namespace pilink {
+
+const char *error_category::name() const noexcept
+{
+  return "pilink";
+}
+
+std::string error_category::message(int e) const
+{
+  switch (static_cast<error>(e))
+  {
+  case error::success:
+    return "Success (no error)";
+  case error::integrity_mismatch:
+    return "Transfer integrity check failed (data corrupted)";
+  case error::cancelled:
+    return "Operation cancelled";
+  case error::lease_overwritten:
+    return "Leased data overwritten before release";
+
+  default:
+    break;
+  }
+
+  return "unknown error";
+}
+
+std::error_condition error_category::default_error_condition(int e) const noexcept
+{
+  switch (static_cast<error>(e))
+  {
+  case error::integrity_mismatch:
+    return std::errc::bad_message;
+
+  case error::cancelled:
+    return std::errc::operation_canceled;
+
+  default:
+    break;
+  }
+
+  return std::error_condition(e, *this);
+}
+
+const std::error_category& pilink_category() noexcept
+{
+  static const error_category instance;
+  return instance;
+}
+
+} // namespace pilink
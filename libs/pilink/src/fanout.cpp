@@ -0,0 +1,390 @@
+#include <pilink/fanout.hpp>
+#include <algorithm>
+#include <chrono>
+
+namespace pilink {
+
+fanout::view::view() noexcept
+  : buffer_{nullptr}
+{
+}
+
+fanout::view::view(buffer *b) noexcept
+  : buffer_{b}
+{
+  ++ buffer_->refs;
+}
+
+fanout::view::view(const view& other) noexcept
+  : buffer_{other.buffer_}
+{
+  if (buffer_ != nullptr)
+    ++ buffer_->refs;
+}
+
+fanout::view::view(view&& other) noexcept
+  : buffer_{other.buffer_}
+{
+  other.buffer_ = nullptr;
+}
+
+fanout::view& fanout::view::operator=(view other) noexcept
+{
+  std::swap(buffer_, other.buffer_);
+  return *this;
+}
+
+fanout::view::~view()
+{
+  reset();
+}
+
+void fanout::view::reset() noexcept
+{
+  if (buffer_ != nullptr && -- buffer_->refs == 0)
+    buffer_->owner->recycle(buffer_);
+
+  buffer_ = nullptr;
+}
+
+fanout::subscriber::subscriber(fanout& owner, fanout_policy policy) noexcept
+  : owner_{owner}
+  , policy_{policy}
+  , queue_{}
+  , dropped_{0}
+{
+}
+
+// Views are destroyed outside the lock: the last one takes it to hand its buffer back.
+std::error_code fanout::subscriber::next(view& v, unsigned int timeout) noexcept
+{
+  view taken;
+  {
+    std::unique_lock<std::mutex> lock(owner_.mutex_);
+    auto ready = [&] { return !queue_.empty() || owner_.ended_ || owner_.stop_; };
+
+    // zero timeout waits for as long as it takes, as on a link
+    if (timeout == 0)
+      owner_.cv_.wait(lock, ready);
+    else
+      (void)owner_.cv_.wait_for(lock, std::chrono::milliseconds(timeout), ready);
+
+    if (queue_.empty()) {
+      if (owner_.ended_)
+        return owner_.error_;
+      if (owner_.stop_)
+        return std::make_error_code(std::errc::not_connected);
+      return std::make_error_code(std::errc::timed_out);
+    }
+
+    taken = std::move(queue_.front());
+    queue_.pop_front();
+
+    // a reader held up by this queue may go on
+    if (policy_ == fanout_policy::backpressure)
+      owner_.cv_.notify_all();
+  }
+
+  v = std::move(taken);
+  return {};
+}
+
+uint64_t fanout::subscriber::dropped() const noexcept
+{
+  std::lock_guard<std::mutex> lock(owner_.mutex_);
+  return dropped_;
+}
+
+fanout::fanout(pilink& link, const fanout_options& options) noexcept
+  : link_{link}
+  , options_{options}
+  , buffers_{}
+  , free_{}
+  , returned_{}
+  , subscribers_{}
+  , sequence_{0}
+  , lend_{true}
+  , started_{false}
+  , stop_{false}
+  , ended_{false}
+  , error_{}
+{
+}
+
+fanout::~fanout()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!started_)
+      return;
+    stop_ = true;
+  }
+  cv_.notify_all();
+  reader_.join();
+
+  std::vector<std::shared_ptr<subscriber>> subscribers;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    subscribers.swap(subscribers_);
+  }
+  for (auto& s : subscribers)
+    s->queue_.clear();
+
+  // the views are gone, the link gets its buffers back
+  give_back(returned_);
+}
+
+std::error_code fanout::start() noexcept
+{
+  pilink::info_s info;
+  std::error_code ec = link_.get_link_info(info);
+  if (ec)
+    return ec;
+
+  size_t packet_size = std::max<size_t>(info.in.packet_size, 1);
+  options_.buffer_size = std::max<size_t>(options_.buffer_size / packet_size, 1) * packet_size;
+  options_.queue_depth = std::max<size_t>(options_.queue_depth, 1);
+  options_.buffers = std::max<size_t>(options_.buffers, 1);
+  lend_ = link_.keeps_leases();
+
+  try {
+    reader_ = std::thread(&fanout::reader_fn, this);
+  } catch (const std::system_error& e) {
+    return e.code();
+  }
+
+  started_ = true;
+  return {};
+}
+
+std::error_code fanout::subscribe(fanout_policy policy, std::shared_ptr<subscriber>& s) noexcept
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!started_) {
+    std::error_code ec = start();
+    if (ec)
+      return ec;
+  }
+
+  try {
+    s = std::make_shared<subscriber>(*this, policy);
+    subscribers_.push_back(s);
+  } catch (...) {
+    s.reset();
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  return {};
+}
+
+void fanout::unsubscribe(const std::shared_ptr<subscriber>& s) noexcept
+{
+  std::deque<view> queue;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find(subscribers_.begin(), subscribers_.end(), s);
+    if (it == subscribers_.end())
+      return;
+
+    queue.swap(s->queue_);
+    subscribers_.erase(it);
+    cv_.notify_all();
+  }
+}
+
+void fanout::recycle(buffer *b) noexcept
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // capacity is kept at one entry per buffer: no allocation here
+  returned_.push_back(b);
+  cv_.notify_all();
+}
+
+// reader thread, or the destructor once it is gone: the link is not to be called from two threads
+void fanout::give_back(std::vector<buffer *>& returned) noexcept
+{
+  // leases here are only of links that keep them: release has nothing to report
+  for (buffer *b : returned) {
+    if (b->leased) {
+      (void)link_.release(b->lease);
+      b->leased = false;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.insert(free_.end(), returned.begin(), returned.end());
+  returned.clear();
+}
+
+// under mutex_
+fanout::buffer *fanout::take_buffer() noexcept
+{
+  if (!free_.empty()) {
+    buffer *b = free_.back();
+    free_.pop_back();
+    return b;
+  }
+
+  // leased buffers are bounded by the link, own ones by the options
+  if (!lend_ && buffers_.size() >= options_.buffers)
+    return nullptr;
+
+  try {
+    auto b = std::make_unique<buffer>();
+    b->owner = this;
+    if (!lend_)
+      b->own.reset(new unsigned char[options_.buffer_size]);
+
+    size_t count = buffers_.size() + 1;
+    free_.reserve(count);
+    returned_.reserve(count);
+    buffers_.push_back(std::move(b));
+  } catch (...) {
+    return nullptr;
+  }
+
+  return buffers_.back().get();
+}
+
+// nullptr with ec: timed_out (nothing yet), no_buffer_space (all with views) or the link's error
+fanout::buffer *fanout::fill(std::error_code& ec) noexcept
+{
+  if (lend_) {
+    pilink::lease_s lease;
+    ec = link_.read_lease(lease, options_.timeout);
+
+    if (ec == std::errc::operation_not_supported) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      lend_ = false;
+      buffers_.clear();
+      free_.clear();
+    } else if (ec) {
+      return nullptr;
+    } else {
+      buffer *b = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        b = take_buffer();
+      }
+
+      if (b == nullptr) {
+        (void)link_.release(lease);
+        ec = std::make_error_code(std::errc::not_enough_memory);
+        return nullptr;
+      }
+
+      b->leased = true;
+      b->lease = lease;
+      b->data = lease.data;
+      b->size = lease.size;
+      return b;
+    }
+  }
+
+  buffer *b = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    b = take_buffer();
+  }
+
+  if (b == nullptr) {
+    ec = std::make_error_code(std::errc::no_buffer_space);
+    return nullptr;
+  }
+
+  size_t transferred = 0;
+  ec = link_.read_some(b->own.get(), options_.buffer_size, transferred, options_.timeout);
+
+  // a short transfer ends a read, it is what a transfer is here
+  if (ec == std::errc::argument_out_of_domain)
+    ec = {};
+
+  if (transferred == 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(b);
+    if (!ec)
+      ec = std::make_error_code(std::errc::timed_out);
+    return nullptr;
+  }
+
+  b->data = b->own.get();
+  b->size = transferred;
+  return b;
+}
+
+// under mutex_
+bool fanout::held_up() const noexcept
+{
+  for (const auto& s : subscribers_) {
+    if (s->policy_ == fanout_policy::backpressure && s->queue_.size() >= options_.queue_depth)
+      return true;
+  }
+
+  return false;
+}
+
+void fanout::reader_fn() noexcept
+{
+  std::vector<buffer *> returned;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    if (!returned_.empty()) {
+      returned.swap(returned_);
+      returned_.reserve(returned.capacity());
+      lock.unlock();
+      give_back(returned);
+      lock.lock();
+      continue;
+    }
+
+    if (stop_)
+      break;
+
+    if (ended_ || held_up()) {
+      cv_.wait(lock);
+      continue;
+    }
+
+    lock.unlock();
+    std::error_code ec;
+    buffer *b = fill(ec);
+    lock.lock();
+
+    if (b == nullptr) {
+      if (ec == std::errc::no_buffer_space)
+        cv_.wait(lock, [&] { return stop_ || !returned_.empty(); });
+      else if (ec && ec != std::errc::timed_out) {
+        error_ = ec;
+        ended_ = true;
+        cv_.notify_all();
+      }
+      continue;
+    }
+
+    b->sequence = sequence_ ++;
+
+    // the reader holds the buffer while it hands it out, its last view may be gone before
+    view held(b);
+    for (auto& s : subscribers_) {
+      if (s->queue_.size() >= options_.queue_depth && s->policy_ == fanout_policy::drop) {
+        ++ s->dropped_;
+        continue;
+      }
+
+      try {
+        s->queue_.push_back(held);
+      } catch (...) {
+        ++ s->dropped_;
+      }
+    }
+    cv_.notify_all();
+
+    lock.unlock();
+    held.reset();
+    lock.lock();
+  }
+}
+
+} // namespace pilink
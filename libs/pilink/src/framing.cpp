@@ -0,0 +1,252 @@
+#include <pilink/framing.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace pilink {
+
+static inline
+void put_u32(unsigned char *p, uint32_t v) noexcept
+{
+  for (size_t i = 0; i < 4; ++ i)
+    p[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+static inline
+uint32_t get_u32(const unsigned char *p) noexcept
+{
+  uint32_t v = 0;
+  for (size_t i = 0; i < 4; ++ i)
+    v |= static_cast<uint32_t>(p[i]) << (8 * i);
+  return v;
+}
+
+// frame_writer
+
+frame_writer::frame_writer(pilink& link, size_t batch_size) noexcept
+  : link_{link}
+  , batch_{}
+  , batch_size_{batch_size}
+  , packet_size_{0}
+  , pending_{0}
+  , prepared_{0}
+  , preparing_{false}
+{
+}
+
+std::error_code frame_writer::reserve(size_t size, unsigned int timeout) noexcept
+{
+  if (!batch_) {
+    batch_.reset(::new (std::nothrow) unsigned char[batch_size_]);
+    if (!batch_)
+      return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  if (pending_ + size > batch_size_)
+    return flush(timeout);
+
+  return {};
+}
+
+std::error_code frame_writer::write(const unsigned char *data, size_t size, unsigned int timeout) noexcept
+{
+  if (size > max_message_size)
+    return std::make_error_code(std::errc::message_size);
+
+  std::error_code ec;
+
+  if (header_size + size > batch_size_) {
+    // does not fit in any batch: keep order, then send header and payload as is
+    ec = flush(timeout);
+    if (ec)
+      return ec;
+
+    unsigned char header[header_size];
+    put_u32(header, static_cast<uint32_t>(size));
+
+    size_t transferred = 0;
+    ec = send(header, header_size, transferred, timeout);
+    if (ec)
+      return ec;
+
+    return send(data, size, transferred, timeout);
+  }
+
+  ec = reserve(header_size + size, timeout);
+  if (ec)
+    return ec;
+
+  unsigned char *p = batch_.get() + pending_;
+  put_u32(p, static_cast<uint32_t>(size));
+  ::memcpy(p + header_size, data, size);
+  pending_ += header_size + size;
+
+  return {};
+}
+
+std::error_code frame_writer::prepare(size_t max_size, unsigned char *&data, unsigned int timeout) noexcept
+{
+  data = nullptr;
+  preparing_ = false;
+  if (max_size > max_message_size || header_size + max_size > batch_size_)
+    return std::make_error_code(std::errc::message_size);
+
+  std::error_code ec = reserve(header_size + max_size, timeout);
+  if (ec)
+    return ec;
+
+  data = batch_.get() + pending_ + header_size;
+  prepared_ = max_size;
+  preparing_ = true;
+  return {};
+}
+
+std::error_code frame_writer::commit(size_t size) noexcept
+{
+  if (!preparing_)
+    return std::make_error_code(std::errc::invalid_argument);
+
+  if (size > prepared_)
+    size = prepared_;
+
+  put_u32(batch_.get() + pending_, static_cast<uint32_t>(size));
+  pending_ += header_size + size;
+  prepared_ = 0;
+  preparing_ = false;
+  return {};
+}
+
+std::error_code frame_writer::flush(unsigned int timeout) noexcept
+{
+  if (pending_ == 0)
+    return {};
+
+  size_t transferred = 0;
+  std::error_code ec = send(batch_.get(), pending_, transferred, timeout);
+
+  // keep what did not go out, so a retry preserves the stream
+  if (transferred < pending_)
+    ::memmove(batch_.get(), batch_.get() + transferred, pending_ - transferred);
+  pending_ -= transferred;
+
+  return ec;
+}
+
+std::error_code frame_writer::send(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept
+{
+  if (packet_size_ == 0) {
+    pilink::info_s info;
+    std::error_code ec = link_.get_link_info(info);
+    if (ec)
+      return ec;
+
+    packet_size_ = std::max<size_t>(info.out.packet_size, 1);
+  }
+
+  std::error_code ec = link_.write_some(data, size, transferred, timeout);
+  if (ec || size % packet_size_ != 0)
+    return ec;
+
+  size_t none = 0;
+  return link_.write_some(data, 0, none, timeout);
+}
+
+// frame_reader
+
+frame_reader::frame_reader(pilink& link, size_t buffer_size) noexcept
+  : link_{link}
+  , buffer_{}
+  , buffer_size_{buffer_size}
+  , packet_size_{0}
+  , begin_{0}
+  , end_{0}
+  , skip_{0}
+  , dropped_{0}
+{
+}
+
+std::error_code frame_reader::read(unsigned int timeout) noexcept
+{
+  std::error_code ec;
+
+  if (packet_size_ == 0) {
+    pilink::info_s info;
+    ec = link_.get_link_info(info);
+    if (ec)
+      return ec;
+
+    packet_size_ = std::max<size_t>(info.in.packet_size, 1);
+  }
+
+  if (!buffer_) {
+    buffer_.reset(::new (std::nothrow) unsigned char[buffer_size_]);
+    if (!buffer_)
+      return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  // only the unparsed tail (at most one partial message) is moved
+  if (begin_ == end_) {
+    begin_ = end_ = 0;
+  } else if (begin_ != 0) {
+    ::memmove(buffer_.get(), buffer_.get() + begin_, end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+  }
+
+  // read_some must not be asked for a partial packet, it could not hold a full one
+  size_t space = (buffer_size_ - end_) / packet_size_ * packet_size_;
+  if (space == 0) {
+    begin_ = end_ = 0;
+    return std::make_error_code(std::errc::message_size);
+  }
+
+  size_t transferred = 0;
+  ec = link_.read_some(buffer_.get() + end_, space, transferred, timeout);
+  end_ += transferred;
+
+  // short transfer just ends the batch
+  if (ec == std::errc::argument_out_of_domain)
+    ec = {};
+
+  return ec;
+}
+
+bool frame_reader::next(message_view& message) noexcept
+{
+  // whole in the buffer after the partial packet a read may have to leave free
+  const size_t slack = frame_writer::header_size + packet_size_ - 1;
+  const size_t limit = std::min(max_message_size, buffer_size_ > slack ? buffer_size_ - slack : 0);
+
+  size_t available = end_ - begin_;
+  size_t size = 0;
+  const unsigned char *p = nullptr;
+
+  for (;;) {
+    size_t n = std::min(skip_, available);
+    begin_ += n;
+    available -= n;
+    skip_ -= n;
+    if (skip_ != 0 || available < frame_writer::header_size)
+      return false;
+
+    p = buffer_.get() + begin_;
+    size = get_u32(p);
+    if (size <= limit)
+      break;
+
+    begin_ += frame_writer::header_size;
+    available -= frame_writer::header_size;
+    skip_ = size;
+    ++ dropped_;
+  }
+
+  if (available - frame_writer::header_size < size)
+    return false;
+
+  message.data = p + frame_writer::header_size;
+  message.size = size;
+  begin_ += frame_writer::header_size + size;
+
+  return true;
+}
+
+} // namespace pilink
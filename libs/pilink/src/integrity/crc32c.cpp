@@ -0,0 +1,245 @@
+#include <pilink/crc32c.hpp>
+#include "integrity/crc32c.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PILINK_CRC32C_HW 1
+#include <nmmintrin.h>
+#endif
+
+namespace pilink {
+namespace integrity {
+
+// reflected Castagnoli polynomial
+constexpr uint32_t poly = 0x82F63B78;
+
+// slicing-by-8 tables
+struct crc32c_tables
+{
+  uint32_t t[8][256];
+
+  crc32c_tables() noexcept
+  {
+    for (uint32_t n = 0; n < 256; ++ n) {
+      uint32_t crc = n;
+      for (int k = 0; k < 8; ++ k)
+        crc = (crc & 1) ? (crc >> 1) ^ poly : (crc >> 1);
+      t[0][n] = crc;
+    }
+
+    for (uint32_t n = 0; n < 256; ++ n) {
+      uint32_t crc = t[0][n];
+      for (size_t k = 1; k < 8; ++ k) {
+        crc = t[0][crc & 0xff] ^ (crc >> 8);
+        t[k][n] = crc;
+      }
+    }
+  }
+};
+
+static const crc32c_tables tables;
+
+static inline
+uint64_t load_u64(const unsigned char *p) noexcept
+{
+  uint64_t v;
+  ::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint32_t crc32c_sw(uint32_t crc, const unsigned char *data, size_t size) noexcept
+{
+  const auto& t = tables.t;
+  uint64_t crc0 = crc ^ 0xFFFFFFFFu;
+
+  while (size != 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0) {
+    crc0 = t[0][(crc0 ^ *data++) & 0xff] ^ (crc0 >> 8);
+    -- size;
+  }
+
+  // little endian word loads, as the tables are laid out for
+  while (size >= 8) {
+    uint64_t w = load_u64(data) ^ crc0;
+    crc0 = t[7][w & 0xff] ^ t[6][(w >> 8) & 0xff] ^
+           t[5][(w >> 16) & 0xff] ^ t[4][(w >> 24) & 0xff] ^
+           t[3][(w >> 32) & 0xff] ^ t[2][(w >> 40) & 0xff] ^
+           t[1][(w >> 48) & 0xff] ^ t[0][w >> 56];
+    data += 8;
+    size -= 8;
+  }
+
+  while (size != 0) {
+    crc0 = t[0][(crc0 ^ *data++) & 0xff] ^ (crc0 >> 8);
+    -- size;
+  }
+
+  return static_cast<uint32_t>(crc0) ^ 0xFFFFFFFFu;
+}
+
+#ifdef PILINK_CRC32C_HW
+
+// Three independent crc32 streams hide the instruction latency; their results are merged by
+// shifting over the bytes that follow (multiplication by x^(8*len) mod P, done with tables).
+constexpr size_t long_block = 8192;
+constexpr size_t short_block = 256;
+
+// zeros operators: crc of len zero bytes appended, len must be a power of two
+struct crc32c_shift_tables
+{
+  uint32_t long_op[4][256];
+  uint32_t short_op[4][256];
+
+  static uint32_t matrix_times(const uint32_t *mat, uint32_t vec) noexcept
+  {
+    uint32_t sum = 0;
+    while (vec) {
+      if (vec & 1)
+        sum ^= *mat;
+      vec >>= 1;
+      ++ mat;
+    }
+    return sum;
+  }
+
+  static void matrix_square(uint32_t *square, const uint32_t *mat) noexcept
+  {
+    for (size_t n = 0; n < 32; ++ n)
+      square[n] = matrix_times(mat, mat[n]);
+  }
+
+  static void zeros_op(uint32_t *even, size_t len) noexcept
+  {
+    uint32_t odd[32];
+
+    // operator for one zero bit
+    uint32_t row = 1;
+    odd[0] = poly;
+    for (size_t n = 1; n < 32; ++ n) {
+      odd[n] = row;
+      row <<= 1;
+    }
+
+    matrix_square(even, odd);  // two bits
+    matrix_square(odd, even);  // four bits
+
+    // first pass gives one byte, every further one doubles
+    do {
+      matrix_square(even, odd);
+      len >>= 1;
+      if (len == 0)
+        return;
+      matrix_square(odd, even);
+      len >>= 1;
+    } while (len);
+
+    for (size_t n = 0; n < 32; ++ n)
+      even[n] = odd[n];
+  }
+
+  static void zeros(uint32_t table[][256], size_t len) noexcept
+  {
+    uint32_t op[32];
+    zeros_op(op, len);
+    for (uint32_t n = 0; n < 256; ++ n) {
+      table[0][n] = matrix_times(op, n);
+      table[1][n] = matrix_times(op, n << 8);
+      table[2][n] = matrix_times(op, n << 16);
+      table[3][n] = matrix_times(op, n << 24);
+    }
+  }
+
+  crc32c_shift_tables() noexcept
+  {
+    zeros(long_op, long_block);
+    zeros(short_op, short_block);
+  }
+};
+
+static const crc32c_shift_tables shift_tables;
+
+static inline
+uint64_t shift(const uint32_t table[][256], uint64_t crc) noexcept
+{
+  return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+         table[2][(crc >> 16) & 0xff] ^ table[3][(crc >> 24) & 0xff];
+}
+
+__attribute__((target("sse4.2")))
+static
+uint32_t crc32c_hw(uint32_t crc, const unsigned char *data, size_t size) noexcept
+{
+  uint64_t crc0 = crc ^ 0xFFFFFFFFu;
+
+  while (size != 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0) {
+    crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *data++);
+    -- size;
+  }
+
+  while (size >= long_block * 3) {
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    const unsigned char *end = data + long_block;
+    do {
+      crc0 = _mm_crc32_u64(crc0, load_u64(data));
+      crc1 = _mm_crc32_u64(crc1, load_u64(data + long_block));
+      crc2 = _mm_crc32_u64(crc2, load_u64(data + 2 * long_block));
+      data += 8;
+    } while (data < end);
+    crc0 = shift(shift_tables.long_op, crc0) ^ crc1;
+    crc0 = shift(shift_tables.long_op, crc0) ^ crc2;
+    data += 2 * long_block;
+    size -= 3 * long_block;
+  }
+
+  while (size >= short_block * 3) {
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    const unsigned char *end = data + short_block;
+    do {
+      crc0 = _mm_crc32_u64(crc0, load_u64(data));
+      crc1 = _mm_crc32_u64(crc1, load_u64(data + short_block));
+      crc2 = _mm_crc32_u64(crc2, load_u64(data + 2 * short_block));
+      data += 8;
+    } while (data < end);
+    crc0 = shift(shift_tables.short_op, crc0) ^ crc1;
+    crc0 = shift(shift_tables.short_op, crc0) ^ crc2;
+    data += 2 * short_block;
+    size -= 3 * short_block;
+  }
+
+  while (size >= 8) {
+    crc0 = _mm_crc32_u64(crc0, load_u64(data));
+    data += 8;
+    size -= 8;
+  }
+
+  while (size != 0) {
+    crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *data++);
+    -- size;
+  }
+
+  return static_cast<uint32_t>(crc0) ^ 0xFFFFFFFFu;
+}
+
+#endif // PILINK_CRC32C_HW
+
+crc32c_fn crc32c_hw_if_supported() noexcept
+{
+#ifdef PILINK_CRC32C_HW
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2"))
+    return &crc32c_hw;
+#endif
+  return nullptr;
+}
+
+} // namespace integrity
+
+uint32_t crc32c(uint32_t crc, const unsigned char *data, size_t size) noexcept
+{
+  static const integrity::crc32c_fn hw = integrity::crc32c_hw_if_supported();
+  static const integrity::crc32c_fn fn = hw != nullptr ? hw : &integrity::crc32c_sw;
+  return fn(crc, data, size);
+}
+
+} // namespace pilink
@@ -0,0 +1,20 @@
+#ifndef PILINK_INTEGRITY_CRC32C_HPP
+#define PILINK_INTEGRITY_CRC32C_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pilink {
+namespace integrity {
+
+// The two implementations behind pilink::crc32c, for checking one against the other.
+uint32_t crc32c_sw(uint32_t crc, const unsigned char *data, size_t size) noexcept;
+
+// nullptr where the CPU (or the build) has no SSE4.2
+using crc32c_fn = uint32_t (*)(uint32_t, const unsigned char *, size_t) noexcept;
+crc32c_fn crc32c_hw_if_supported() noexcept;
+
+} // namespace integrity
+} // namespace pilink
+
+#endif // PILINK_INTEGRITY_CRC32C_HPP
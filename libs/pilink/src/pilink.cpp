@@ -4,26 +4,56 @@
 #include <boost/url.hpp>
 #include <system_error>
 #include "transport/usb/libusb/enumerate.hpp"
+#include "transport/striped/striped.hpp"
+#include "transport/resilient/resilient.hpp"
+#ifdef __linux__
+#include "transport/usb/usbfs/enumerate.hpp"
+#include "transport/shm/shm.hpp"
+#include "transport/tcp/tcp.hpp"
+#endif
 
 namespace pilink {
 
-std::unique_ptr<pilink> make_pilink(const char * /* uri */)
+std::unique_ptr<pilink> make_pilink(const char *uri)
 {
+  auto parsed = boost::urls::parse_uri(uri != nullptr ? uri : "");
+  if (!parsed.has_error()) {
+    auto scheme = parsed.value().scheme();
+
+    if (scheme == "STRIPED")
+      return std::unique_ptr<pilink>(transport::striped::make_pilink_striped());
+    if (scheme == "RESILIENT")
+      return std::unique_ptr<pilink>(transport::resilient::make_pilink_resilient());
+    if (scheme == "REPLAY")
+      return std::unique_ptr<pilink>(transport::usb::make_pilink_usb_replay());
+#ifdef __linux__
+    if (scheme == "USBFS")
+      return std::unique_ptr<pilink>(transport::usb::make_pilink_usb_usbfs());
+    if (scheme == "SHM")
+      return std::unique_ptr<pilink>(transport::shm::make_pilink_shm());
+    if (scheme == "TCP")
+      return std::unique_ptr<pilink>(transport::tcp::make_pilink_tcp());
+#endif
+  }
+
   return std::unique_ptr<pilink>(transport::usb::make_pilink_usb_libusb());
 }
 
 std::error_code enumerate(const char *filter, std::vector<std::string> &paths)
 {
-  auto uri = boost::urls::parse_uri(filter);
-  auto uriView = uri.value();
-  
-  if (uriView.scheme() != "LIBUSB")
+  auto uri = boost::urls::parse_uri(filter != nullptr ? filter : "");
+  if (uri.has_error())
+    return std::make_error_code(std::errc::invalid_argument);
+
+  auto scheme = uri.value().scheme();
+  if (scheme == "LIBUSB")
     return transport::usb::libusb::enumerate_libusb(filter, paths);
-  // if (backe)
-  //   return std::error_code();
+#ifdef __linux__
+  if (scheme == "USBFS")
+    return transport::usb::usbfs::enumerate_usbfs(filter, paths);
+#endif
 
-  // TODO: return some error code
-  return std::make_error_code(std::errc::invalid_argument);
+  return std::make_error_code(std::errc::operation_not_supported);
 }
 
 } // namespace pilink
@@ -0,0 +1,445 @@
+#include "transport/resilient/resilient.hpp"
+#include <boost/url.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace pilink {
+namespace transport {
+namespace resilient {
+
+pilink_resilient::pilink_resilient() noexcept
+  : link_{}
+  , link_uri_{}
+  , buffer_size_{1024 * 1024}
+  , retry_ms_{100}
+  , outage_limit_ms_{0}
+  , timeout_{1000}
+  , info_{}
+  , connected_{false}
+  , stop_{true}
+  , up_{false}
+  , error_{}
+  , cancels_{0}
+  , ring_{}
+  , ring_head_{0}
+  , ring_size_{0}
+  , down_since_{}
+  , outages_{0}
+  , outage_ms_{0}
+  , dropped_bytes_{0}
+{
+}
+
+pilink_resilient::~pilink_resilient()
+{
+  if (is_connected())
+    (void)disconnect();
+}
+
+bool pilink_resilient::is_gone(std::error_code ec) noexcept
+{
+  return ec == std::errc::no_such_device;
+}
+
+void pilink_resilient::went_away() noexcept
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!up_)
+    return;
+
+  up_ = false;
+  ++ outages_;
+  down_since_ = clock::now();
+  cv_.notify_all();
+}
+
+// under mutex_
+void pilink_resilient::came_back() noexcept
+{
+  up_ = true;
+  outage_ms_ += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - down_since_).count());
+  cv_.notify_all();
+}
+
+// under mutex_
+void pilink_resilient::hold(const unsigned char *data, size_t size) noexcept
+{
+  size_t n = std::min(size, buffer_size_ - ring_size_);
+  dropped_bytes_ += size - n;
+
+  size_t tail = (ring_head_ + ring_size_) % buffer_size_;
+  size_t first = std::min(n, buffer_size_ - tail);
+  ::memcpy(ring_.get() + tail, data, first);
+  ::memcpy(ring_.get(), data + first, n - first);
+  ring_size_ += n;
+}
+
+// Sends what was held, oldest first, and marks the link up once nothing is left: a write that
+// comes meanwhile is held behind the rest, never sent ahead of it.
+std::error_code pilink_resilient::flush_held() noexcept
+{
+  for (;;) {
+    const unsigned char *data;
+    size_t size;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (ring_size_ == 0) {
+        came_back();
+        return {};
+      }
+
+      data = ring_.get() + ring_head_;
+      size = std::min(ring_size_, buffer_size_ - ring_head_);
+    }
+
+    size_t transferred = 0;
+    std::error_code ec;
+    {
+      std::shared_lock<std::shared_mutex> link_lock(link_mutex_);
+      ec = link_->write_some(data, size, transferred, timeout_);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ring_head_ = (ring_head_ + transferred) % buffer_size_;
+      ring_size_ -= transferred;
+    }
+
+    if (ec)
+      return ec;
+  }
+}
+
+std::error_code pilink_resilient::reattach() noexcept
+{
+  std::unique_lock<std::shared_mutex> link_lock(link_mutex_);
+  (void)link_->disconnect();
+  return link_->connect(link_uri_.c_str());
+}
+
+void pilink_resilient::reconnector_fn() noexcept
+{
+  bool attached = false;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    cv_.wait(lock, [this] { return stop_ || (!up_ && !error_); });
+    if (stop_)
+      break;
+
+    lock.unlock();
+    std::error_code ec{};
+    if (!attached) {
+      ec = reattach();
+      attached = !ec;
+    }
+
+    // a flush that fails short of losing the device again is retried on the same connection
+    if (attached) {
+      ec = flush_held();
+      attached = !is_gone(ec);
+    }
+    lock.lock();
+
+    if (!ec) {
+      attached = false;
+      continue;
+    }
+
+    if (outage_limit_ms_ != 0 && clock::now() - down_since_ >= std::chrono::milliseconds(outage_limit_ms_)) {
+      error_ = std::make_error_code(std::errc::no_such_device);
+      outage_ms_ += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - down_since_).count());
+      cv_.notify_all();
+      continue;
+    }
+
+    cv_.wait_for(lock, std::chrono::milliseconds(retry_ms_), [this] { return stop_; });
+  }
+}
+
+std::error_code pilink_resilient::connect(const char *uri) noexcept
+{
+  if (is_connected())
+    (void)disconnect();
+
+  std::string link;
+  try {
+    auto parsed = boost::urls::parse_uri(uri != nullptr ? uri : "");
+    if (parsed.has_error() || parsed.value().scheme() != "RESILIENT")
+      return std::make_error_code(std::errc::invalid_argument);
+
+    for (const auto param : parsed.value().params()) {
+      if (param.key == "LINK") {
+        link = param.value;
+      } else if (param.key == "BUFFER") {
+        buffer_size_ = std::strtoul(param.value.c_str(), nullptr, 10);
+      } else if (param.key == "RETRY") {
+        retry_ms_ = static_cast<unsigned int>(std::strtoul(param.value.c_str(), nullptr, 10));
+      } else if (param.key == "OUTAGE") {
+        outage_limit_ms_ = static_cast<unsigned int>(std::strtoul(param.value.c_str(), nullptr, 10));
+      } else {
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+    }
+
+    if (link.empty() || buffer_size_ == 0 || retry_ms_ == 0)
+      return std::make_error_code(std::errc::invalid_argument);
+
+    // the address is given anew when the device comes back
+    auto link_parsed = boost::urls::parse_uri(link);
+    if (link_parsed.has_error())
+      return std::make_error_code(std::errc::invalid_argument);
+
+    boost::urls::url reconnect_uri(link_parsed.value());
+    reconnect_uri.params().erase("ADDR");
+    link_uri_ = std::string(reconnect_uri.buffer());
+  } catch (...) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  link_ = make_pilink(link.c_str());
+  ring_.reset(::new (std::nothrow) unsigned char[buffer_size_]);
+  if (!link_ || !ring_)
+    return std::make_error_code(std::errc::not_enough_memory);
+
+  std::error_code ec = link_->connect(link.c_str());
+  if (ec)
+    return ec;
+
+  ec = link_->get_link_info(info_);
+  if (ec) {
+    (void)link_->disconnect();
+    return ec;
+  }
+
+  ring_head_ = 0;
+  ring_size_ = 0;
+  outages_ = 0;
+  outage_ms_ = 0;
+  dropped_bytes_ = 0;
+  error_ = {};
+  up_ = true;
+  stop_ = false;
+
+  try {
+    reconnector_ = std::thread(&pilink_resilient::reconnector_fn, this);
+  } catch (const std::system_error& e) {
+    (void)link_->disconnect();
+    return e.code();
+  }
+
+  connected_ = true;
+  return {};
+}
+
+std::error_code pilink_resilient::disconnect() noexcept
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    cv_.notify_all();
+  }
+
+  if (reconnector_.joinable())
+    reconnector_.join();
+
+  std::error_code ec;
+  if (link_)
+    ec = link_->disconnect();
+
+  ring_size_ = 0;
+  connected_ = false;
+
+  // the device may be away, which is what this link is for
+  return is_gone(ec) ? std::error_code{} : ec;
+}
+
+bool pilink_resilient::is_connected() const noexcept
+{
+  return connected_;
+}
+
+std::error_code pilink_resilient::get_link_info(info_s &link_info) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  // kept from connect, the same unit comes back
+  link_info = info_;
+  return {};
+}
+
+std::error_code pilink_resilient::get_link_stats(stats_s &link_stats) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  link_stats = stats_s{};
+  {
+    std::shared_lock<std::shared_mutex> link_lock(link_mutex_, std::try_to_lock);
+    if (link_lock.owns_lock())
+      (void)link_->get_link_stats(link_stats);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  link_stats.outages = outages_;
+  link_stats.outage_ms = outage_ms_;
+  if (!up_ && !error_)
+    link_stats.outage_ms += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - down_since_).count());
+  link_stats.outage_dropped_bytes = dropped_bytes_;
+
+  return {};
+}
+
+std::error_code pilink_resilient::reset() noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error_)
+      return error_;
+
+    // the reconnect resets
+    if (!up_)
+      return {};
+  }
+
+  std::error_code ec;
+  {
+    std::shared_lock<std::shared_mutex> link_lock(link_mutex_);
+    ec = link_->reset();
+  }
+
+  if (!is_gone(ec))
+    return ec;
+
+  went_away();
+  return {};
+}
+
+std::error_code pilink_resilient::write_some(const unsigned char *data, size_t size, size_t &transferred, unsigned int timeout) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  size_t total = 0;
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (error_) {
+        transferred = total;
+        return error_;
+      }
+
+      if (!up_) {
+        hold(data, size);
+        transferred = total + size;
+        return {};
+      }
+    }
+
+    size_t current = 0;
+    std::error_code ec;
+    {
+      std::shared_lock<std::shared_mutex> link_lock(link_mutex_);
+      ec = link_->write_some(data, size, current, timeout);
+    }
+
+    total += current;
+    if (!is_gone(ec)) {
+      transferred = total;
+      return ec;
+    }
+
+    // the rest is held
+    went_away();
+    data += current;
+    size -= current;
+  }
+}
+
+std::error_code pilink_resilient::read_some(unsigned char *data, size_t size, size_t &transferred, unsigned int timeout) noexcept
+{
+  transferred = 0;
+
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  auto deadline = clock::now() + std::chrono::milliseconds(timeout);
+
+  for (;;) {
+    unsigned int remaining = timeout;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      uint64_t cancels = cancels_;
+      auto ready = [&] { return up_ || error_ || stop_ || cancels_ != cancels; };
+
+      // zero timeout waits for as long as it takes, as on the member link
+      if (timeout == 0)
+        cv_.wait(lock, ready);
+      else
+        (void)cv_.wait_until(lock, deadline, ready);
+
+      if (error_)
+        return error_;
+
+      if (stop_)
+        return std::make_error_code(std::errc::not_connected);
+
+      if (cancels_ != cancels)
+        return make_error_code(error::cancelled);
+
+      if (!up_)
+        return std::make_error_code(std::errc::timed_out);
+    }
+
+    if (timeout != 0) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+      remaining = static_cast<unsigned int>(std::max<long long>(left, 1));
+    }
+
+    std::error_code ec;
+    {
+      std::shared_lock<std::shared_mutex> link_lock(link_mutex_);
+      ec = link_->read_some(data, size, transferred, remaining);
+    }
+
+    if (!is_gone(ec))
+      return ec;
+
+    went_away();
+
+    // what came in before the device went is a short transfer
+    if (transferred != 0)
+      return std::make_error_code(std::errc::argument_out_of_domain);
+  }
+}
+
+void pilink_resilient::cancel() noexcept
+{
+  if (!is_connected())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++ cancels_;
+    cv_.notify_all();
+  }
+
+  // no call is inside the member while a reconnect holds it
+  std::shared_lock<std::shared_mutex> link_lock(link_mutex_, std::try_to_lock);
+  if (link_lock.owns_lock())
+    link_->cancel();
+}
+
+pilink *make_pilink_resilient() noexcept
+{
+  return ::new(std::nothrow) pilink_resilient;
+}
+
+} // namespace resilient
+} // namespace transport
+} // namespace pilink
@@ -0,0 +1,104 @@
+#ifndef PILINK_TRANSPORT_RESILIENT_HPP
+#define PILINK_TRANSPORT_RESILIENT_HPP
+
+#include <pilink/pilink.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+
+namespace pilink {
+namespace transport {
+namespace resilient {
+
+/**
+ * @brief The pilink_resilient class
+ * Link that outlives its device: when the member link reports the device gone (no_such_device,
+ * after a cable glitch or a hub reset), it is reconnected in the background and streaming goes on.
+ *
+ * URI: RESILIENT://?LINK=<member uri>&BUFFER=<bytes>&RETRY=<ms>&OUTAGE=<ms>
+ * (member uri percent-encoded).
+ *
+ * The unit is found again by the member uri without its ADDR, which changes on re-enumeration:
+ * BUS and PORT pin the port it sits on (PORT is the whole chain of hub ports, e.g. PORT=2.4, as
+ * enumeration gives it, so a unit on another hub's port 4 is not taken for it), a serial number
+ * in the uri pins the unit itself. connect
+ * runs again, and with it reset. Meanwhile writes are accepted into a ring of BUFFER bytes
+ * (1 MiB by default) and sent, in order, before anything written after the device is back; what
+ * does not fit is dropped and counted. Reads wait for the device within their timeout. Every
+ * RETRY ms (100) another attempt is made; after OUTAGE ms (0: never) the link gives up and calls
+ * fail with no_such_device.
+ */
+class pilink_resilient : public pilink
+{
+private:
+  using clock = std::chrono::steady_clock;
+
+  std::unique_ptr<pilink> link_;
+  std::string   link_uri_;      // the one reconnects use, without ADDR
+  size_t        buffer_size_;
+  unsigned int  retry_ms_;
+  unsigned int  outage_limit_ms_;
+  unsigned int  timeout_;
+  info_s        info_;
+  bool          connected_;
+
+  // calls into link_ hold it shared, the reconnect holds it exclusive
+  std::shared_mutex link_mutex_;
+
+  std::mutex              mutex_;
+  std::condition_variable cv_;
+  std::thread             reconnector_;
+  bool                    stop_;
+  bool                    up_;
+  std::error_code         error_;       // gave up
+  uint64_t                cancels_;
+
+  // writes held while the device is away; the newest is dropped on overflow, so what is being
+  // flushed is never overwritten
+  std::unique_ptr<unsigned char[]> ring_;
+  size_t                  ring_head_;
+  size_t                  ring_size_;
+
+  clock::time_point       down_since_;
+  uint64_t                outages_;
+  uint64_t                outage_ms_;
+  uint64_t                dropped_bytes_;
+
+  static bool is_gone(std::error_code ec) noexcept;
+
+  void went_away() noexcept;
+  void came_back() noexcept;
+  void hold(const unsigned char *data, size_t size) noexcept;
+  std::error_code flush_held() noexcept;
+  std::error_code reattach() noexcept;
+  void reconnector_fn() noexcept;
+
+public:
+  pilink_resilient() noexcept;
+  ~pilink_resilient();
+
+  virtual std::error_code connect(const char *uri) noexcept override;
+  virtual std::error_code disconnect() noexcept override;
+  virtual bool is_connected() const noexcept override;
+
+  virtual std::error_code get_link_info(struct info_s& link_info) noexcept override;
+  virtual std::error_code get_link_stats(struct stats_s& link_stats) noexcept override;
+
+  virtual std::error_code reset() noexcept override;
+  virtual std::error_code write_some(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override;
+  virtual std::error_code read_some(unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override;
+
+  virtual void cancel() noexcept override;
+};
+
+pilink *make_pilink_resilient() noexcept;
+
+} // namespace resilient
+} // namespace transport
+} // namespace pilink
+
+#endif // PILINK_TRANSPORT_RESILIENT_HPP
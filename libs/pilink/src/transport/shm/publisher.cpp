@@ -0,0 +1,178 @@
+#include <pilink/shm.hpp>
+#include "transport/shm/ring.hpp"
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace pilink {
+namespace transport {
+namespace shm {
+
+std::error_code object_name(const char *name, char *buffer, size_t size) noexcept
+{
+  if (name == nullptr || *name == '\0' || std::strchr(name, '/') != nullptr)
+    return std::make_error_code(std::errc::invalid_argument);
+
+  int n = std::snprintf(buffer, size, "/pilink-%s", name);
+  if (n < 0 || static_cast<size_t>(n) >= size)
+    return std::make_error_code(std::errc::filename_too_long);
+
+  return {};
+}
+
+void wait_word(std::atomic<uint32_t>& word, uint32_t expected, unsigned int timeout_ms) noexcept
+{
+  timespec ts{};
+  ts.tv_sec = static_cast<time_t>(timeout_ms / 1000);
+  ts.tv_nsec = static_cast<long>(timeout_ms % 1000) * 1000000L;
+
+  (void)::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+void wake_word(std::atomic<uint32_t>& word) noexcept
+{
+  (void)::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+} // namespace shm
+} // namespace transport
+
+namespace shm {
+
+using transport::shm::ring_header;
+using transport::shm::slot_header;
+
+publisher::publisher() noexcept
+  : ring_{nullptr}
+  , bytes_{0}
+  , next_{0}
+  , name_{}
+{
+}
+
+publisher::~publisher()
+{
+  close();
+}
+
+std::error_code publisher::create(const char *name, size_t slot_count, size_t slot_size, const pilink::info_s& link_info) noexcept
+{
+  close();
+
+  if (slot_count == 0 || slot_size == 0)
+    return std::make_error_code(std::errc::invalid_argument);
+
+  std::error_code ec = transport::shm::object_name(name, name_, sizeof(name_));
+  if (ec)
+    return ec;
+
+  // readers still mapping an old object keep it, they see it closed
+  (void)::shm_unlink(name_);
+
+  int fd = ::shm_open(name_, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0660);
+  if (fd < 0)
+    return std::error_code(errno, std::system_category());
+
+  size_t bytes = transport::shm::ring_bytes(slot_count, slot_size);
+  void *ring = MAP_FAILED;
+
+  do {
+    if (::ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+      ec = std::error_code(errno, std::system_category());
+      break;
+    }
+
+    ring = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED)
+      ec = std::error_code(errno, std::system_category());
+
+  } while (false);
+
+  ::close(fd);
+
+  if (ec) {
+    (void)::shm_unlink(name_);
+    return ec;
+  }
+
+  // a fresh object is zero filled: the slots' sequences say nothing is published
+  auto header = ::new (ring) ring_header{};
+  header->slot_count = slot_count;
+  header->slot_size = slot_size;
+  header->in_packet_size = link_info.in.packet_size;
+  header->out_packet_size = link_info.out.packet_size;
+  for (size_t i = 0; i < slot_count; ++ i)
+    (void)::new (transport::shm::slot_at(header, i)) slot_header{};
+  header->version = transport::shm::ring_version;
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = transport::shm::ring_magic;
+
+  ring_ = ring;
+  bytes_ = bytes;
+  next_ = 0;
+  return {};
+}
+
+void publisher::close() noexcept
+{
+  if (ring_ == nullptr)
+    return;
+
+  auto header = static_cast<ring_header *>(ring_);
+  header->closed.store(1);
+  header->wake.fetch_add(1);
+  transport::shm::wake_word(header->wake);
+
+  (void)::munmap(ring_, bytes_);
+  (void)::shm_unlink(name_);
+  ring_ = nullptr;
+}
+
+bool publisher::is_open() const noexcept
+{
+  return ring_ != nullptr;
+}
+
+size_t publisher::slot_size() const noexcept
+{
+  return ring_ != nullptr ? static_cast<ring_header *>(ring_)->slot_size : 0;
+}
+
+unsigned char *publisher::acquire() noexcept
+{
+  auto header = static_cast<ring_header *>(ring_);
+  slot_header *slot = transport::shm::slot_at(header, next_);
+
+  // a reader copying the old contents sees the change and drops them
+  slot->sequence.store(2 * next_ + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return transport::shm::slot_data(slot);
+}
+
+void publisher::commit(size_t size) noexcept
+{
+  auto header = static_cast<ring_header *>(ring_);
+  slot_header *slot = transport::shm::slot_at(header, next_);
+
+  slot->size = size;
+  slot->sequence.store(2 * next_ + 2, std::memory_order_release);
+  header->head.store(++ next_);
+
+  if (header->waiters.load() != 0) {
+    header->wake.fetch_add(1);
+    transport::shm::wake_word(header->wake);
+  }
+}
+
+} // namespace shm
+} // namespace pilink
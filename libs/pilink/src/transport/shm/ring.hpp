@@ -0,0 +1,86 @@
+#ifndef PILINK_TRANSPORT_SHM_RING_HPP
+#define PILINK_TRANSPORT_SHM_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+
+namespace pilink {
+namespace transport {
+namespace shm {
+
+/*
+ * Layout of the POSIX shared memory object a broker publishes one link's IN stream in: a header,
+ * then slot_count slots of slot_size bytes, each one transfer as it came off the link. One
+ * producer, any number of readers; readers never hold the producer up: one that falls more than
+ * slot_count slots behind loses the oldest ones (the seqlock on every slot tells it so).
+ */
+
+constexpr uint32_t ring_magic = 0x4D48534C;   // "LSHM"
+constexpr uint32_t ring_version = 1;
+constexpr size_t   cache_line = 64;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared across processes");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared across processes");
+
+struct alignas(cache_line) ring_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t slot_count;
+  uint64_t slot_size;             // data bytes of a slot
+  uint64_t in_packet_size;        // the link's, for get_link_info
+  uint64_t out_packet_size;
+
+  alignas(cache_line) std::atomic<uint64_t> head;   // slots published so far
+
+  // readers with nothing to read sleep on wake (futex) once they have said so in waiters, the
+  // producer makes the syscall only then
+  alignas(cache_line) std::atomic<uint32_t> wake;
+  std::atomic<uint32_t> waiters;
+  std::atomic<uint32_t> closed;   // the broker stopped publishing
+};
+
+struct alignas(cache_line) slot_header
+{
+  std::atomic<uint64_t> sequence; // 2n + 1 while slot n is written, 2n + 2 once it is published
+  uint64_t size;
+};
+
+constexpr size_t slot_stride(size_t slot_size) noexcept
+{
+  return (sizeof(slot_header) + slot_size + cache_line - 1) / cache_line * cache_line;
+}
+
+constexpr size_t ring_bytes(size_t slot_count, size_t slot_size) noexcept
+{
+  return sizeof(ring_header) + slot_count * slot_stride(slot_size);
+}
+
+inline
+slot_header *slot_at(ring_header *ring, uint64_t n) noexcept
+{
+  auto base = reinterpret_cast<unsigned char *>(ring) + sizeof(ring_header);
+  return reinterpret_cast<slot_header *>(base + (n % ring->slot_count) * slot_stride(ring->slot_size));
+}
+
+inline
+unsigned char *slot_data(slot_header *slot) noexcept
+{
+  return reinterpret_cast<unsigned char *>(slot) + sizeof(slot_header);
+}
+
+// "/pilink-<name>", the object under /dev/shm
+[[nodiscard]]
+std::error_code object_name(const char *name, char *buffer, size_t size) noexcept;
+
+// futex on a word in shared memory, so not the process private flavour
+void wait_word(std::atomic<uint32_t>& word, uint32_t expected, unsigned int timeout_ms) noexcept;
+void wake_word(std::atomic<uint32_t>& word) noexcept;
+
+} // namespace shm
+} // namespace transport
+} // namespace pilink
+
+#endif // PILINK_TRANSPORT_SHM_RING_HPP
@@ -0,0 +1,356 @@
+#include "transport/shm/shm.hpp"
+#include <boost/url.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pilink {
+namespace transport {
+namespace shm {
+
+pilink_shm::pilink_shm() noexcept
+  : ring_{nullptr}
+  , bytes_{0}
+  , cursor_{0}
+  , offset_{0}
+  , overruns_{0}
+  , cancel_generation_{0}
+{
+}
+
+pilink_shm::~pilink_shm()
+{
+  if (is_connected())
+    (void)disconnect();
+}
+
+std::error_code pilink_shm::connect(const char *uri) noexcept
+{
+  if (is_connected())
+    (void)disconnect();
+
+  std::string name;
+  try {
+    auto parsed = boost::urls::parse_uri(uri != nullptr ? uri : "");
+    if (parsed.has_error() || parsed.value().scheme() != "SHM")
+      return std::make_error_code(std::errc::invalid_argument);
+
+    for (const auto param : parsed.value().params()) {
+      if (param.key == "NAME")
+        name = param.value;
+      else
+        return std::make_error_code(std::errc::invalid_argument);
+    }
+  } catch (...) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  char object[256];
+  std::error_code ec = object_name(name.c_str(), object, sizeof(object));
+  if (ec)
+    return ec;
+
+  int fd = ::shm_open(object, O_RDWR | O_CLOEXEC, 0);
+  if (fd < 0)
+    return errno == ENOENT ? std::make_error_code(std::errc::no_such_device) : std::error_code(errno, std::system_category());
+
+  void *ring = MAP_FAILED;
+  size_t bytes = 0;
+
+  do {
+    struct stat st{};
+    if (::fstat(fd, &st) != 0) {
+      ec = std::error_code(errno, std::system_category());
+      break;
+    }
+
+    bytes = static_cast<size_t>(st.st_size);
+    if (bytes < sizeof(ring_header)) {
+      ec = std::make_error_code(std::errc::protocol_error);
+      break;
+    }
+
+    ring = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+      ec = std::error_code(errno, std::system_category());
+      break;
+    }
+
+    // published by the broker once the rest of the header is
+    auto header = static_cast<ring_header *>(ring);
+    uint32_t magic = header->magic;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (magic != ring_magic || header->version != ring_version
+      || header->slot_count == 0 || bytes < ring_bytes(header->slot_count, header->slot_size)) {
+      ec = std::make_error_code(std::errc::protocol_error);
+      break;
+    }
+
+  } while (false);
+
+  ::close(fd);
+
+  if (ec) {
+    if (ring != MAP_FAILED)
+      (void)::munmap(ring, bytes);
+    return ec;
+  }
+
+  ring_ = static_cast<ring_header *>(ring);
+  bytes_ = bytes;
+  cursor_ = ring_->head.load();
+  offset_ = 0;
+  overruns_ = 0;
+  return {};
+}
+
+std::error_code pilink_shm::disconnect() noexcept
+{
+  if (ring_ != nullptr) {
+    (void)::munmap(ring_, bytes_);
+    ring_ = nullptr;
+  }
+
+  return {};
+}
+
+bool pilink_shm::is_connected() const noexcept
+{
+  return ring_ != nullptr;
+}
+
+std::error_code pilink_shm::get_link_info(info_s &link_info) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  link_info.in.packet_size = ring_->in_packet_size;
+  link_info.in.baud_rate = 0;
+  link_info.out.packet_size = ring_->out_packet_size;
+  link_info.out.baud_rate = 0;
+  return {};
+}
+
+std::error_code pilink_shm::get_link_stats(stats_s &link_stats) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  link_stats = stats_s{};
+  link_stats.reader_overruns = overruns_;
+  return {};
+}
+
+std::error_code pilink_shm::reset() noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  // the device is the broker's, what is queued here is this reader's
+  cursor_ = ring_->head.load();
+  offset_ = 0;
+  return {};
+}
+
+std::error_code pilink_shm::write_some(const unsigned char *data, size_t size, size_t &transferred, unsigned int timeout) noexcept
+{
+  (void)data;
+  (void)size;
+  (void)timeout;
+  transferred = 0;
+  return std::make_error_code(std::errc::operation_not_supported);
+}
+
+// Spins first: at full rate the next slot is a few microseconds away and a sleep would cost more
+// than it saves. The futex is slept on in slices, so that cancel is seen.
+std::error_code pilink_shm::wait_for_data(unsigned int timeout, unsigned int generation) noexcept
+{
+  for (unsigned int i = 0; i < spin_count; ++ i) {
+    if (ring_->head.load(std::memory_order_acquire) != cursor_)
+      return {};
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+  for (;;) {
+    if (cancel_generation_.load() != generation)
+      return make_error_code(error::cancelled);
+
+    uint32_t wake = ring_->wake.load();
+    ring_->waiters.fetch_add(1);
+
+    unsigned int slice = wait_slice_ms;
+    if (timeout != 0) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+      slice = static_cast<unsigned int>(std::clamp<long long>(left, 0, wait_slice_ms));
+    }
+
+    // the producer either sees the waiter or published before the head is looked at
+    if (ring_->head.load() == cursor_ && ring_->closed.load() == 0 && slice != 0)
+      wait_word(ring_->wake, wake, slice);
+
+    ring_->waiters.fetch_sub(1);
+
+    if (ring_->head.load(std::memory_order_acquire) != cursor_)
+      return {};
+
+    if (ring_->closed.load() != 0)
+      return std::make_error_code(std::errc::no_such_device);
+
+    if (timeout != 0 && std::chrono::steady_clock::now() >= deadline)
+      return std::make_error_code(std::errc::timed_out);
+  }
+}
+
+// The slot at the cursor once it is published, after the slots lost to the producer are skipped
+// (counted as overruns).
+slot_header *pilink_shm::next_slot(unsigned int timeout, unsigned int generation, std::error_code& ec) noexcept
+{
+  uint64_t count = ring_->slot_count;
+
+  for (;;) {
+    uint64_t head = ring_->head.load(std::memory_order_acquire);
+    if (head == cursor_) {
+      ec = wait_for_data(timeout, generation);
+      if (ec)
+        return nullptr;
+
+      continue;
+    }
+
+    if (head - cursor_ > count) {
+      overruns_ += head - cursor_ - count;
+      cursor_ = head - count;
+      offset_ = 0;
+    }
+
+    slot_header *slot = slot_at(ring_, cursor_);
+    if (slot->sequence.load(std::memory_order_acquire) == 2 * cursor_ + 2)
+      return slot;
+
+    ++ overruns_;
+    ++ cursor_;
+    offset_ = 0;
+  }
+}
+
+// Slots are copied out under their seqlock: a copy the producer overwrote meanwhile is void and
+// the slot counts as lost.
+std::error_code pilink_shm::read_some(unsigned char *data, size_t size, size_t &transferred, unsigned int timeout) noexcept
+{
+  transferred = 0;
+
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  unsigned int generation = cancel_generation_.load();
+  size_t total = 0;
+
+  while (size != 0) {
+    // block for the first slot only, take what else is already there
+    if (total != 0 && ring_->head.load(std::memory_order_acquire) == cursor_)
+      break;
+
+    std::error_code ec;
+    slot_header *slot = next_slot(timeout, generation, ec);
+    if (slot == nullptr)
+      return ec;
+
+    uint64_t sequence = 2 * cursor_ + 2;
+    size_t length = std::min<size_t>(slot->size, ring_->slot_size);
+    size_t n = std::min(size, length - std::min(offset_, length));
+    ::memcpy(data, slot_data(slot) + offset_, n);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot->sequence.load(std::memory_order_relaxed) != sequence) {
+      ++ overruns_;
+      ++ cursor_;
+      offset_ = 0;
+      continue;
+    }
+
+    data += n;
+    size -= n;
+    total += n;
+    offset_ += n;
+
+    if (offset_ >= length) {
+      ++ cursor_;
+      offset_ = 0;
+    }
+  }
+
+  transferred = total;
+  if (size != 0)
+    return std::make_error_code(std::errc::argument_out_of_domain);
+
+  return {};
+}
+
+// The slot at the cursor is lent as it is; its seqlock is read again on release.
+std::error_code pilink_shm::read_lease(lease_s &lease, unsigned int timeout) noexcept
+{
+  lease = lease_s{};
+
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  std::error_code ec;
+  slot_header *slot = next_slot(timeout, cancel_generation_.load(), ec);
+  if (slot == nullptr)
+    return ec;
+
+  size_t length = std::min<size_t>(slot->size, ring_->slot_size);
+  size_t offset = std::min(offset_, length);
+
+  lease.data = slot_data(slot) + offset;
+  lease.size = length - offset;
+  lease.slot = static_cast<size_t>(cursor_);
+
+  ++ cursor_;
+  offset_ = 0;
+  return {};
+}
+
+std::error_code pilink_shm::release(lease_s &lease) noexcept
+{
+  if (!is_connected() || lease.data == nullptr)
+    return {};
+
+  uint64_t n = lease.slot;
+  lease = lease_s{};
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (slot_at(ring_, n)->sequence.load(std::memory_order_relaxed) == 2 * n + 2)
+    return {};
+
+  ++ overruns_;
+  return make_error_code(error::lease_overwritten);
+}
+
+void pilink_shm::cancel() noexcept
+{
+  if (!is_connected())
+    return;
+
+  // wakes the other readers too, they go back to sleep
+  ++ cancel_generation_;
+  ring_->wake.fetch_add(1);
+  wake_word(ring_->wake);
+}
+
+pilink *make_pilink_shm() noexcept
+{
+  return ::new(std::nothrow) pilink_shm;
+}
+
+} // namespace shm
+} // namespace transport
+} // namespace pilink
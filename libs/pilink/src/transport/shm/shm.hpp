@@ -0,0 +1,70 @@
+#ifndef PILINK_TRANSPORT_SHM_HPP
+#define PILINK_TRANSPORT_SHM_HPP
+
+#include <pilink/pilink.hpp>
+#include <atomic>
+#include <cstdint>
+#include "transport/shm/ring.hpp"
+
+namespace pilink {
+namespace transport {
+namespace shm {
+
+/**
+ * @brief The pilink_shm class
+ * Reader of a link's IN stream that a broker publishes in shared memory (pilink::shm::publisher).
+ *
+ * URI: SHM://?NAME=<name>
+ *
+ * Reading starts at what is published after connect. read_some copies out of the slots straight
+ * into the caller's buffer, with no syscall while data is there; with nothing there it spins for
+ * a while, then sleeps on a futex in the ring. read_lease lends a slot in place instead, without
+ * holding the broker up: release checks the slot's seqlock and is lease_overwritten (and counts
+ * an overrun) when the slot was reused meanwhile, so what was read from it is void. A reader more than a ring behind loses the oldest
+ * slots, counted in reader_overruns. The OUT pipe stays with the broker: write_some is not
+ * supported. reset skips to the newest data. When the broker stops, reads return no_such_device.
+ */
+class pilink_shm : public pilink
+{
+private:
+  static constexpr unsigned int spin_count = 4096;
+  static constexpr unsigned int wait_slice_ms = 100;
+
+  ring_header *ring_;
+  size_t bytes_;
+  uint64_t cursor_;     // slot being read
+  size_t offset_;       // bytes of it already read
+  uint64_t overruns_;
+  std::atomic<unsigned int> cancel_generation_;
+
+  std::error_code wait_for_data(unsigned int timeout, unsigned int generation) noexcept;
+  slot_header *next_slot(unsigned int timeout, unsigned int generation, std::error_code& ec) noexcept;
+
+public:
+  pilink_shm() noexcept;
+  ~pilink_shm();
+
+  virtual std::error_code connect(const char *uri) noexcept override;
+  virtual std::error_code disconnect() noexcept override;
+  virtual bool is_connected() const noexcept override;
+
+  virtual std::error_code get_link_info(struct info_s& link_info) noexcept override;
+  virtual std::error_code get_link_stats(struct stats_s& link_stats) noexcept override;
+
+  virtual std::error_code reset() noexcept override;
+  virtual std::error_code write_some(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override;
+  virtual std::error_code read_some(unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override;
+  virtual std::error_code read_lease(lease_s& lease, unsigned int timeout) noexcept override;
+  virtual std::error_code release(lease_s& lease) noexcept override;
+  virtual bool keeps_leases() const noexcept override { return false; }
+
+  virtual void cancel() noexcept override;
+};
+
+pilink *make_pilink_shm() noexcept;
+
+} // namespace shm
+} // namespace transport
+} // namespace pilink
+
+#endif // PILINK_TRANSPORT_SHM_HPP
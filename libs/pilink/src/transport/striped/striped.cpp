@@ -0,0 +1,595 @@
+#include "transport/striped/striped.hpp"
+#include <boost/url.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+
+namespace pilink {
+namespace transport {
+namespace striped {
+
+using clock = std::chrono::steady_clock;
+
+static inline
+void put_u32(unsigned char *p, uint32_t v) noexcept
+{
+  for (size_t i = 0; i < 4; ++ i)
+    p[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+static inline
+void put_u64(unsigned char *p, uint64_t v) noexcept
+{
+  for (size_t i = 0; i < 8; ++ i)
+    p[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+static inline
+uint32_t get_u32(const unsigned char *p) noexcept
+{
+  uint32_t v = 0;
+  for (size_t i = 0; i < 4; ++ i)
+    v |= static_cast<uint32_t>(p[i]) << (8 * i);
+  return v;
+}
+
+static inline
+uint64_t get_u64(const unsigned char *p) noexcept
+{
+  uint64_t v = 0;
+  for (size_t i = 0; i < 8; ++ i)
+    v |= static_cast<uint64_t>(p[i]) << (8 * i);
+  return v;
+}
+
+pilink_striped::pilink_striped() noexcept
+  : members_{}
+  , segment_size_{64 * 1024}
+  , timeout_{1000}
+  , connected_{false}
+  , stop_{true}
+  , out_sequence_{0}
+  , in_sequence_{0}
+  , in_gap_since_{}
+  , lost_segments_{0}
+{
+}
+
+pilink_striped::~pilink_striped()
+{
+  if (is_connected())
+    (void)disconnect();
+}
+
+pilink_striped::buffer_t pilink_striped::acquire_buffer()
+{
+  if (pool_.empty())
+    return buffer_t(segment_size_);
+
+  buffer_t buffer = std::move(pool_.back());
+  pool_.pop_back();
+  return buffer;
+}
+
+void pilink_striped::release_buffer(buffer_t&& buffer)
+{
+  pool_.push_back(std::move(buffer));
+}
+
+size_t pilink_striped::select_member(size_t size) const noexcept
+{
+  // unmeasured members are assumed as fast as the fastest one, so they get probed
+  double fastest = 1.0;
+  for (const auto& m : members_)
+    fastest = std::max(fastest, m->out_rate);
+
+  size_t best = 0;
+  double best_cost = std::numeric_limits<double>::max();
+  for (size_t i = 0; i < members_.size(); ++ i) {
+    const auto& m = *members_[i];
+    double rate = (m.out_rate > 0.0) ? m.out_rate : fastest;
+    double cost = static_cast<double>(m.out_queued_bytes + size) / rate;
+    if (cost < best_cost) {
+      best_cost = cost;
+      best = i;
+    }
+  }
+
+  return best;
+}
+
+bool pilink_striped::skip_gap(clock::time_point now) noexcept
+{
+  if (in_segments_.empty() || in_segments_.begin()->first == in_sequence_) {
+    in_gap_since_ = {};
+    return false;
+  }
+
+  if (in_gap_since_ == clock::time_point{})
+    in_gap_since_ = now;
+
+  // a full window gets nothing more in: the missing one is not coming
+  bool full = in_segments_.size() >= members_.size() * queue_depth;
+  if (!full && now - in_gap_since_ < std::chrono::milliseconds(timeout_))
+    return false;
+
+  uint64_t next = in_segments_.begin()->first;
+  lost_segments_ += next - in_sequence_;
+  in_sequence_ = next;
+  in_gap_since_ = {};
+  in_cv_.notify_all();
+  return true;
+}
+
+void pilink_striped::reader_fn(member& m) noexcept
+{
+  buffer_t buffer;
+  try {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer = acquire_buffer();
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_error_ = std::make_error_code(std::errc::not_enough_memory);
+    in_cv_.notify_all();
+    return;
+  }
+
+  auto fail = [this](std::error_code ec) {
+    if (!in_error_)
+      in_error_ = ec;
+    in_cv_.notify_all();
+  };
+
+  size_t filled = 0;  // received bytes in buffer, from the start of a segment
+  for (bool running = true; running; ) {
+    size_t transferred = 0;
+    std::error_code ec = m.link->read_some(buffer.data() + filled, segment_size_ - filled, transferred, poll_timeout);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stop_)
+      break;
+
+    // argument_out_of_domain is a short transfer indication, i.e. a short segment
+    if (ec && ec != std::errc::argument_out_of_domain && ec != std::errc::timed_out) {
+      fail(ec);
+      break;
+    }
+
+    filled += transferred;
+
+    // a read ends inside a segment or, on a stream member, runs into the next one
+    while (filled >= header_size) {
+      const unsigned char *header = buffer.data();
+      if (get_u32(header) != header_magic || get_u32(header + 4) > segment_size_ - header_size) {
+        fail(std::make_error_code(std::errc::protocol_error));
+        running = false;
+        break;
+      }
+
+      size_t size = header_size + get_u32(header + 4);
+      uint64_t sequence = get_u64(header + 8);
+      if (filled < size)
+        break;
+
+      // bound the reorder window, but never block the segment the consumer waits for
+      in_cv_.wait(lock, [&] {
+        return stop_
+          || in_segments_.size() < members_.size() * queue_depth
+          || sequence == in_sequence_;
+      });
+      if (stop_) {
+        running = false;
+        break;
+      }
+
+      // what follows the segment starts the next buffer
+      try {
+        buffer_t next = acquire_buffer();
+        ::memcpy(next.data(), buffer.data() + size, filled - size);
+        filled -= size;
+
+        if (sequence >= in_sequence_)
+          in_segments_.emplace(sequence, segment{ sequence, std::move(buffer), size, 0 });
+        else
+          release_buffer(std::move(buffer));  // stale (before reset) or skipped as lost
+
+        buffer = std::move(next);
+      } catch (...) {
+        fail(std::make_error_code(std::errc::not_enough_memory));
+        running = false;
+        break;
+      }
+      in_cv_.notify_all();
+    }
+  }
+}
+
+void pilink_striped::writer_fn(member& m) noexcept
+{
+  for (;;) {
+    segment s;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      out_cv_.wait(lock, [&] { return stop_ || !m.out_queue.empty(); });
+      if (stop_)
+        break;
+
+      s = std::move(m.out_queue.front());
+      m.out_queue.pop_front();
+    }
+
+    size_t transferred = 0;
+    auto start = clock::now();
+    std::error_code ec = m.link->write_some(s.data.data(), s.size, transferred, timeout_);
+
+    // ends the segment for the reader, it would run into the next otherwise
+    if (!ec && s.size % m.out_packet_size == 0) {
+      size_t none = 0;
+      ec = m.link->write_some(s.data.data(), 0, none, timeout_);
+    }
+
+    std::chrono::duration<double> elapsed = clock::now() - start;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    m.out_queued_bytes -= s.size;
+    if (!ec && elapsed.count() > 0.0) {
+      double rate = static_cast<double>(transferred) / elapsed.count();
+      m.out_rate = (m.out_rate > 0.0) ? (0.75 * m.out_rate + 0.25 * rate) : rate;
+    }
+    release_buffer(std::move(s.data));
+    out_cv_.notify_all();
+
+    if (ec) {
+      if (!out_error_)
+        out_error_ = ec;
+      break;
+    }
+  }
+}
+
+void pilink_striped::stop_workers() noexcept
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  in_cv_.notify_all();
+  out_cv_.notify_all();
+
+  for (auto& m : members_) {
+    if (m->reader.joinable())
+      m->reader.join();
+    if (m->writer.joinable())
+      m->writer.join();
+  }
+}
+
+void pilink_striped::clear_queues() noexcept
+{
+  for (auto& m : members_) {
+    for (auto& s : m->out_queue)
+      release_buffer(std::move(s.data));
+    m->out_queue.clear();
+    m->out_queued_bytes = 0;
+  }
+
+  for (auto& s : in_segments_)
+    release_buffer(std::move(s.second.data));
+  in_segments_.clear();
+
+  out_sequence_ = 0;
+  in_sequence_ = 0;
+  in_gap_since_ = {};
+  in_error_ = {};
+  out_error_ = {};
+}
+
+std::error_code pilink_striped::connect(const char *uri) noexcept
+{
+  if (is_connected())
+    (void)disconnect();
+
+  std::vector<std::string> links;
+  try {
+    auto parsed = boost::urls::parse_uri(uri != nullptr ? uri : "");
+    if (parsed.has_error() || parsed.value().scheme() != "STRIPED")
+      return std::make_error_code(std::errc::invalid_argument);
+
+    for (const auto param : parsed.value().params()) {
+      if (param.key == "LINK") {
+        links.push_back(param.value);
+      } else if (param.key == "SEGMENT") {
+        segment_size_ = std::strtoul(param.value.c_str(), nullptr, 10);
+      } else {
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+    }
+  } catch (...) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  if (links.empty() || segment_size_ <= header_size || segment_size_ - header_size > std::numeric_limits<uint32_t>::max())
+    return std::make_error_code(std::errc::invalid_argument);
+
+  std::error_code ec;
+  try {
+    for (const auto& link_uri : links) {
+      auto m = std::make_unique<member>();
+      m->link = make_pilink(link_uri.c_str());
+      m->out_queued_bytes = 0;
+      m->out_rate = 0.0;
+      m->out_packet_size = 1;
+
+      if (!m->link) {
+        ec = std::make_error_code(std::errc::not_enough_memory);
+        break;
+      }
+
+      ec = m->link->connect(link_uri.c_str());
+      if (ec)
+        break;
+
+      info_s info;
+      ec = m->link->get_link_info(info);
+      if (ec) {
+        (void)m->link->disconnect();
+        break;
+      }
+      m->out_packet_size = std::max<size_t>(info.out.packet_size, 1);
+
+      members_.push_back(std::move(m));
+    }
+
+    if (!ec) {
+      clear_queues();
+      lost_segments_ = 0;
+      stop_ = false;
+      for (auto& m : members_) {
+        m->reader = std::thread(&pilink_striped::reader_fn, this, std::ref(*m));
+        m->writer = std::thread(&pilink_striped::writer_fn, this, std::ref(*m));
+      }
+    }
+  } catch (const std::system_error& e) {
+    ec = e.code();
+  } catch (...) {
+    ec = std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  connected_ = true;
+  if (ec)
+    (void)disconnect();
+
+  return ec;
+}
+
+std::error_code pilink_striped::disconnect() noexcept
+{
+  stop_workers();
+
+  std::error_code ec;
+  for (auto& m : members_) {
+    std::error_code member_ec = m->link->disconnect();
+    if (member_ec && !ec)
+      ec = member_ec;
+  }
+
+  clear_queues();
+  members_.clear();
+  connected_ = false;
+
+  return ec;
+}
+
+bool pilink_striped::is_connected() const noexcept
+{
+  return connected_;
+}
+
+std::error_code pilink_striped::get_link_info(info_s &link_info) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  link_info.in.packet_size = segment_size_ - header_size;
+  link_info.in.baud_rate = 0;
+  link_info.out.packet_size = segment_size_ - header_size;
+  link_info.out.baud_rate = 0;
+
+  for (auto& m : members_) {
+    info_s member_info;
+    std::error_code ec = m->link->get_link_info(member_info);
+    if (ec)
+      return ec;
+
+    link_info.in.baud_rate += member_info.in.baud_rate;
+    link_info.out.baud_rate += member_info.out.baud_rate;
+  }
+
+  return {};
+}
+
+std::error_code pilink_striped::get_link_stats(stats_s &link_stats) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  link_stats = stats_s{};
+  link_stats.lost_segments = lost_segments_;
+  return {};
+}
+
+std::error_code pilink_striped::reset() noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  stop_workers();
+
+  std::error_code ec;
+  for (auto& m : members_) {
+    ec = m->link->reset();
+    if (ec)
+      break;
+  }
+
+  clear_queues();
+  if (ec)
+    return ec;
+
+  try {
+    stop_ = false;
+    for (auto& m : members_) {
+      m->reader = std::thread(&pilink_striped::reader_fn, this, std::ref(*m));
+      m->writer = std::thread(&pilink_striped::writer_fn, this, std::ref(*m));
+    }
+  } catch (const std::system_error& e) {
+    stop_workers();
+    ec = e.code();
+  }
+
+  return ec;
+}
+
+std::error_code pilink_striped::write_some(const unsigned char *data, size_t size, size_t &transferred, unsigned int timeout) noexcept
+{
+  transferred = 0;
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  const size_t payload_size = segment_size_ - header_size;
+  const size_t queue_limit = members_.size() * queue_depth;
+  auto deadline = timeout != 0 ? clock::now() + std::chrono::milliseconds(timeout) : clock::time_point::max();
+
+  auto queued = [this] {
+    size_t n = 0;
+    for (const auto& m : members_)
+      n += m->out_queue.size();
+    return n;
+  };
+
+  std::error_code ec;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (size != 0) {
+    bool ready = out_cv_.wait_until(lock, deadline, [&] {
+      return stop_ || out_error_ || queued() < queue_limit;
+    });
+
+    if (out_error_) {
+      ec = out_error_;
+      break;
+    }
+
+    if (stop_) {
+      ec = std::make_error_code(std::errc::not_connected);
+      break;
+    }
+
+    if (!ready) {
+      ec = std::make_error_code(std::errc::timed_out);
+      break;
+    }
+
+    size_t chunk = std::min(size, payload_size);
+    segment s;
+    try {
+      s.data = acquire_buffer();
+    } catch (...) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+      break;
+    }
+
+    s.sequence = out_sequence_++;
+    s.size = header_size + chunk;
+    s.offset = 0;
+
+    unsigned char *header = s.data.data();
+    put_u32(header, header_magic);
+    put_u32(header + 4, static_cast<uint32_t>(chunk));
+    put_u64(header + 8, s.sequence);
+    ::memcpy(header + header_size, data, chunk);
+
+    auto& m = *members_[select_member(s.size)];
+    m.out_queued_bytes += s.size;
+    m.out_queue.push_back(std::move(s));
+    out_cv_.notify_all();
+
+    transferred += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+
+  return ec;
+}
+
+std::error_code pilink_striped::read_some(unsigned char *data, size_t size, size_t &transferred, unsigned int timeout) noexcept
+{
+  transferred = 0;
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  const size_t payload_size = segment_size_ - header_size;
+  auto deadline = timeout != 0 ? clock::now() + std::chrono::milliseconds(timeout) : clock::time_point::max();
+
+  auto head_ready = [this] {
+    return !in_segments_.empty() && in_segments_.begin()->first == in_sequence_;
+  };
+
+  // a gap in the sequence is waited on up to its own deadline, then skipped
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_ && !in_error_ && !head_ready() && !skip_gap(clock::now())) {
+    auto until = deadline;
+    if (in_gap_since_ != clock::time_point{})
+      until = std::min(until, in_gap_since_ + std::chrono::milliseconds(timeout_));
+
+    if (clock::now() >= deadline)
+      break;
+    (void)in_cv_.wait_until(lock, until);
+  }
+
+  if (!head_ready()) {
+    if (in_error_)
+      return in_error_;
+    if (stop_)
+      return std::make_error_code(std::errc::not_connected);
+    return std::make_error_code(std::errc::timed_out);
+  }
+
+  while (size != 0 && head_ready()) {
+    auto it = in_segments_.begin();
+    segment& s = it->second;
+    size_t segment_payload = s.size - header_size;
+    size_t n = std::min(segment_payload - s.offset, size);
+
+    ::memcpy(data, s.data.data() + header_size + s.offset, n);
+    s.offset += n;
+    transferred += n;
+    data += n;
+    size -= n;
+
+    if (s.offset == segment_payload) {
+      bool short_segment = (segment_payload < payload_size);
+      release_buffer(std::move(s.data));
+      in_segments_.erase(it);
+      ++ in_sequence_;
+      in_cv_.notify_all();
+
+      if (short_segment)
+        break;
+    }
+  }
+
+  return {};
+}
+
+pilink *make_pilink_striped() noexcept
+{
+  return ::new(std::nothrow) pilink_striped;
+}
+
+} // namespace striped
+} // namespace transport
+} // namespace pilink
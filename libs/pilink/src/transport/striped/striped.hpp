@@ -0,0 +1,125 @@
+#ifndef PILINK_TRANSPORT_STRIPED_HPP
+#define PILINK_TRANSPORT_STRIPED_HPP
+
+#include <pilink/pilink.hpp>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace pilink {
+namespace transport {
+namespace striped {
+
+/**
+ * @brief The pilink_striped class
+ * Aggregate link: one logical stream striped over N member links.
+ *
+ * URI: STRIPED://?SEGMENT=<bytes>&LINK=<member uri>&LINK=<member uri>...
+ * (member uris are percent-encoded).
+ *
+ * Every segment goes to the wire as one transfer: 16 byte header (magic, payload length, sequence
+ * number) followed by up to SEGMENT - 16 bytes of payload. Writes are queued to the member with the
+ * least expected completion time (queued bytes / measured throughput), so faster links carry more
+ * segments. Reads are reassembled by sequence number. A short segment ends read_some, as a short
+ * transfer does on a plain link.
+ *
+ * A segment that is a whole number of the member's packets is followed by a zero length packet,
+ * so a read never runs into the next one; when it does anyway (a stream member), the reader cuts
+ * segments by their headers and keeps what follows for the next.
+ *
+ * A segment that never arrives (a transfer lost on a member, or a peer writer that failed after
+ * numbering it) is waited for while later ones are pending, until the reorder window is full or
+ * the gap is older than the member timeout. Then read_some skips to the lowest pending sequence
+ * number and counts the missing segments in lost_segments.
+ */
+class pilink_striped : public pilink
+{
+private:
+  using buffer_t = std::vector<unsigned char>;
+  using clock = std::chrono::steady_clock;
+
+  struct segment
+  {
+    uint64_t  sequence;
+    buffer_t  data;     // header + payload, segment_size_ bytes
+    size_t    size;     // used bytes in data
+    size_t    offset;   // consumed payload bytes (read side)
+  };
+
+  struct member
+  {
+    std::unique_ptr<pilink> link;
+    std::thread             reader;
+    std::thread             writer;
+
+    std::deque<segment>     out_queue;
+    size_t                  out_queued_bytes;
+
+    double                  out_rate;   // bytes per second, moving average
+    size_t                  out_packet_size;
+  };
+
+  static constexpr size_t   header_size = 16;
+  static constexpr uint32_t header_magic = 0x53534C50; // "PLSS"
+
+  static constexpr unsigned int poll_timeout = 100;
+  static constexpr size_t   queue_depth = 4;   // per member, both directions
+
+  std::vector<std::unique_ptr<member>> members_;
+  size_t        segment_size_;
+  unsigned int  timeout_;
+  bool          connected_;
+
+  std::mutex              mutex_;
+  std::condition_variable in_cv_;
+  std::condition_variable out_cv_;
+  bool                    stop_;
+  std::error_code         in_error_;
+  std::error_code         out_error_;
+
+  uint64_t                        out_sequence_;
+  uint64_t                        in_sequence_;
+  std::map<uint64_t, segment>     in_segments_;
+  clock::time_point               in_gap_since_;  // head missing, later segments pending since; epoch when none
+  uint64_t                        lost_segments_;
+  std::vector<buffer_t>           pool_;
+
+  buffer_t acquire_buffer();
+  void release_buffer(buffer_t&& buffer);
+
+  void reader_fn(member& m) noexcept;
+  void writer_fn(member& m) noexcept;
+
+  size_t select_member(size_t size) const noexcept;
+  bool skip_gap(clock::time_point now) noexcept;
+
+  void stop_workers() noexcept;
+  void clear_queues() noexcept;
+
+public:
+  pilink_striped() noexcept;
+  ~pilink_striped();
+
+  virtual std::error_code connect(const char *uri) noexcept override;
+  virtual std::error_code disconnect() noexcept override;
+  virtual bool is_connected() const noexcept override;
+
+  virtual std::error_code get_link_info(struct info_s& link_info) noexcept override;
+  virtual std::error_code get_link_stats(struct stats_s& link_stats) noexcept override;
+
+  virtual std::error_code reset() noexcept override;
+  virtual std::error_code write_some(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override;
+  virtual std::error_code read_some(unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override;
+};
+
+pilink *make_pilink_striped() noexcept;
+
+} // namespace striped
+} // namespace transport
+} // namespace pilink
+
+#endif // PILINK_TRANSPORT_STRIPED_HPP
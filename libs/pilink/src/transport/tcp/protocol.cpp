@@ -0,0 +1,37 @@
+#include "transport/tcp/protocol.hpp"
+#include <cerrno>
+
+namespace pilink {
+namespace transport {
+namespace tcp {
+
+int32_t to_wire(std::error_code ec) noexcept
+{
+  if (!ec)
+    return 0;
+
+  if (ec.category() == pilink_category())
+    return -ec.value();
+
+  // system and backend codes by what they mean
+  std::error_condition condition = ec.default_error_condition();
+  if (condition.category() == std::generic_category())
+    return condition.value();
+
+  return EIO;
+}
+
+std::error_code from_wire(int32_t status) noexcept
+{
+  if (status == 0)
+    return {};
+
+  if (status < 0)
+    return std::error_code(-status, pilink_category());
+
+  return std::error_code(status, std::generic_category());
+}
+
+} // namespace tcp
+} // namespace transport
+} // namespace pilink
@@ -0,0 +1,87 @@
+#ifndef PILINK_TRANSPORT_TCP_PROTOCOL_HPP
+#define PILINK_TRANSPORT_TCP_PROTOCOL_HPP
+
+#include <pilink/pilink.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+
+/*
+ * Bridge wire format. A session is two TCP connections, so that neither direction waits behind
+ * the other: the control connection carries writes, reset and stats (and their answers), the IN
+ * connection the IN stream. Each opens with a hello, answered by a welcome; the IN connection
+ * names the session the control connection was given. Then frames: a header, size bytes of
+ * payload. Little endian throughout, as both ends are.
+ */
+
+namespace pilink {
+namespace transport {
+namespace tcp {
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "the bridge protocol is sent as is");
+
+constexpr uint32_t protocol_magic = 0x43544c50;     // "PLTC"
+constexpr uint16_t protocol_version = 1;
+constexpr size_t   name_size = 64;
+constexpr size_t   max_frame_size = 4 << 20;        // writes larger than this go as several frames
+
+enum channel : uint8_t
+{
+  channel_control = 0,
+  channel_in      = 1
+};
+
+enum frame_type : uint8_t
+{
+  frame_write     = 1,    // client: OUT data
+  frame_reset     = 2,    // client: reset the link; answered by frame_done
+  frame_stats     = 3,    // client: get_link_stats; answered by frame_stats, payload stats_s
+  frame_done      = 4,    // bridge: status of a reset
+  frame_status    = 5,    // bridge: a write failed (control), the stream ended (IN)
+  frame_data      = 6,    // bridge: IN data, one or more transfers
+  frame_reset_mark = 7    // bridge: IN data from before a reset ends here
+};
+
+struct hello_s
+{
+  uint32_t magic;
+  uint16_t version;
+  uint8_t  channel;
+  uint8_t  reserved;
+  uint64_t session;         // channel_in: the one the welcome on the control connection gave
+  char     name[name_size]; // channel_control: the link, empty for the bridge's first
+};
+
+struct welcome_s
+{
+  uint32_t magic;
+  int32_t  status;
+  uint64_t session;
+  uint64_t in_packet_size;
+  uint64_t in_baud_rate;
+  uint64_t out_packet_size;
+  uint64_t out_baud_rate;
+};
+
+struct frame_header_s
+{
+  uint8_t  type;
+  uint8_t  reserved[3];
+  int32_t  status;
+  uint64_t size;
+};
+
+static_assert(sizeof(hello_s) == 16 + name_size, "hello_s is sent as is");
+static_assert(sizeof(welcome_s) == 48, "welcome_s is sent as is");
+static_assert(sizeof(frame_header_s) == 16, "frame_header_s is sent as is");
+static_assert(sizeof(pilink::stats_s) % sizeof(uint64_t) == 0, "stats_s is sent as is");
+
+// errors cross as errno values, link level ones (pilink::error) negated
+int32_t to_wire(std::error_code ec) noexcept;
+std::error_code from_wire(int32_t status) noexcept;
+
+} // namespace tcp
+} // namespace transport
+} // namespace pilink
+
+#endif // PILINK_TRANSPORT_TCP_PROTOCOL_HPP
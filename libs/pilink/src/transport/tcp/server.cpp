@@ -0,0 +1,973 @@
+#include <pilink/tcp.hpp>
+#include "transport/tcp/protocol.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <new>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace pilink {
+namespace tcp {
+
+using namespace transport::tcp;
+
+namespace {
+
+constexpr unsigned int handshake_timeout_ms = 1000;
+constexpr size_t max_pending = 32;                // connections waited on for their hello
+constexpr unsigned int link_timeout_ms = 100;
+constexpr size_t write_chunk_size = 256 * 1024;
+constexpr size_t max_batch = 64;                  // transfers in one frame
+constexpr size_t zerocopy_threshold = 16 * 1024;  // below that a copy is cheaper than the bookkeeping
+
+std::error_code last_error() noexcept
+{
+  return std::error_code(errno, std::system_category());
+}
+
+bool send_all(int fd, const void *data, size_t size) noexcept
+{
+  auto p = static_cast<const unsigned char *>(data);
+  while (size != 0) {
+    ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+
+    p += n;
+    size -= static_cast<size_t>(n);
+  }
+
+  return true;
+}
+
+bool recv_all(int fd, void *data, size_t size) noexcept
+{
+  auto p = static_cast<unsigned char *>(data);
+  while (size != 0) {
+    ssize_t n = ::recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+
+    p += n;
+    size -= static_cast<size_t>(n);
+  }
+
+  return true;
+}
+
+bool send_frame(int fd, uint8_t type, std::error_code ec, const void *payload = nullptr, size_t size = 0) noexcept
+{
+  frame_header_s header{};
+  header.type = type;
+  header.status = to_wire(ec);
+  header.size = size;
+  return send_all(fd, &header, sizeof(header)) && send_all(fd, payload, size);
+}
+
+} // namespace
+
+/*
+ * One client: the control thread serves the control connection and writes to the link; once the
+ * IN connection is there, the reader thread reads the link into the pool and the sender thread
+ * sends what was read.
+ */
+struct server::session
+{
+  struct outgoing
+  {
+    uint8_t type;
+    int32_t status;
+    size_t  buffer;
+    size_t  size;
+  };
+
+  // sent with MSG_ZEROCOPY, held until the kernel is done with them
+  struct in_flight
+  {
+    uint32_t last;
+    std::vector<size_t> buffers;
+  };
+
+  size_t            index;        // in links_
+  pilink           &link;
+  uint64_t          id;
+  int               control_fd;
+  int               in_fd;
+  size_t            buffer_size;
+  size_t            stride;       // a frame header in front of each buffer
+  size_t            chunk_size;
+  bool              zerocopy;
+  uint32_t          zerocopy_sent;
+
+  std::unique_ptr<unsigned char[]> pool;
+  std::unique_ptr<unsigned char[]> chunk;
+  std::vector<size_t> free;
+  std::deque<outgoing> queue;
+  std::deque<in_flight> sent;     // sender thread's
+
+  std::mutex        mutex;
+  std::condition_variable cv;
+  bool              stop;
+  bool              paused;       // for a reset
+  bool              parked;
+  bool              reading;
+
+  std::thread       control;
+  std::thread       reader;
+  std::thread       sender;
+  std::atomic<bool> ending;
+  std::atomic<bool> done;
+
+  session(size_t index, pilink& link, uint64_t id, int control_fd) noexcept;
+  ~session();
+
+  unsigned char *header_of(size_t b) noexcept { return pool.get() + b * stride; }
+  unsigned char *data_of(size_t b) noexcept { return header_of(b) + sizeof(frame_header_s); }
+
+  std::error_code prepare(const server_options& options) noexcept;
+  bool attach(int fd, bool want_zerocopy) noexcept;
+  void end() noexcept;
+  bool client_gone() noexcept;
+
+  std::error_code write_all(const unsigned char *data, size_t size) noexcept;
+  std::error_code reset_link() noexcept;
+  void control_fn() noexcept;
+  void reader_fn() noexcept;
+  bool send_batch(iovec *iov, size_t count, size_t total) noexcept;
+  void completed() noexcept;
+  void sender_fn() noexcept;
+};
+
+// Accepted, its hello not all in yet.
+struct server::pending
+{
+  using clock = std::chrono::steady_clock;
+
+  int               fd;
+  size_t            received;
+  hello_s           hello;
+  clock::time_point deadline;
+
+  explicit pending(int fd) noexcept
+    : fd{fd}
+    , received{0}
+    , hello{}
+    , deadline{clock::now() + std::chrono::milliseconds(handshake_timeout_ms)}
+  {
+  }
+
+  ~pending()
+  {
+    if (fd >= 0)
+      ::close(fd);
+  }
+
+  pending(const pending&) = delete;
+  pending& operator=(const pending&) = delete;
+};
+
+server::session::session(size_t index, pilink& link, uint64_t id, int control_fd) noexcept
+  : index{index}
+  , link{link}
+  , id{id}
+  , control_fd{control_fd}
+  , in_fd{-1}
+  , buffer_size{0}
+  , stride{0}
+  , chunk_size{0}
+  , zerocopy{false}
+  , zerocopy_sent{0}
+  , stop{false}
+  , paused{false}
+  , parked{false}
+  , reading{false}
+  , ending{false}
+  , done{false}
+{
+}
+
+server::session::~session()
+{
+  if (control.joinable()) {
+    end();
+    control.join();
+  }
+
+  if (control_fd >= 0)
+    ::close(control_fd);
+  if (in_fd >= 0)
+    ::close(in_fd);
+}
+
+std::error_code server::session::prepare(const server_options& options) noexcept
+{
+  pilink::info_s info{};
+  std::error_code ec = link.get_link_info(info);
+  if (ec)
+    return ec;
+
+  // whole packets, so that no transfer is split where the device did not split it
+  size_t in_packet = std::max<size_t>(info.in.packet_size, 1);
+  size_t out_packet = std::max<size_t>(info.out.packet_size, 1);
+  buffer_size = std::max<size_t>(options.buffer_size / in_packet, 1) * in_packet;
+  stride = sizeof(frame_header_s) + buffer_size;
+  chunk_size = std::max<size_t>(write_chunk_size / out_packet, 1) * out_packet;
+
+  size_t count = std::max<size_t>(options.buffers, 1);
+  pool.reset(new(std::nothrow) unsigned char[count * stride]);
+  chunk.reset(new(std::nothrow) unsigned char[chunk_size]);
+  if (!pool || !chunk)
+    return std::make_error_code(std::errc::not_enough_memory);
+
+  try {
+    for (size_t b = 0; b < count; ++ b)
+      free.push_back(b);
+  } catch (...) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  return {};
+}
+
+bool server::session::attach(int fd, bool want_zerocopy) noexcept
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (stop || in_fd >= 0)
+    return false;
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+  int one = 1;
+  zerocopy = want_zerocopy && ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#else
+  (void)want_zerocopy;
+#endif
+
+  in_fd = fd;
+  try {
+    reading = true;
+    reader = std::thread(&session::reader_fn, this);
+    sender = std::thread(&session::sender_fn, this);
+  } catch (...) {
+    // the control thread ends it
+    stop = true;
+    reading = false;
+    cv.notify_all();
+  }
+
+  return true;
+}
+
+void server::session::end() noexcept
+{
+  ending.store(true);
+  (void)::shutdown(control_fd, SHUT_RDWR);
+  link.cancel();
+}
+
+bool server::session::client_gone() noexcept
+{
+  pollfd pfd{control_fd, POLLRDHUP, 0};
+  return ::poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR)) != 0;
+}
+
+// a link that takes its time is waited for, as long as the client is there
+std::error_code server::session::write_all(const unsigned char *data, size_t size) noexcept
+{
+  while (size != 0) {
+    size_t transferred = 0;
+    std::error_code ec = link.write_some(data, size, transferred, link_timeout_ms);
+    data += transferred;
+    size -= transferred;
+
+    if (ec == std::errc::timed_out && !ending.load() && !client_gone())
+      continue;
+    if (ec)
+      return ec;
+  }
+
+  return {};
+}
+
+// The reader is stopped for it; what it read before is marked stale for the client.
+std::error_code server::session::reset_link() noexcept
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    paused = true;
+    cv.notify_all();
+  }
+  link.cancel();
+
+  std::error_code ec;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return parked || !reading; });
+  }
+
+  ec = link.reset();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (in_fd >= 0 && !stop) {
+    try {
+      queue.push_back({frame_reset_mark, 0, 0, 0});
+
+      // a stream that ended on an error starts over
+      if (!reading) {
+        if (reader.joinable())
+          reader.join();
+        reading = true;
+        reader = std::thread(&session::reader_fn, this);
+      }
+    } catch (...) {
+      reading = false;
+      ec = std::make_error_code(std::errc::not_enough_memory);
+    }
+  }
+  paused = false;
+  cv.notify_all();
+  return ec;
+}
+
+void server::session::control_fn() noexcept
+{
+  frame_header_s header{};
+  bool ok = true;
+
+  while (ok && recv_all(control_fd, &header, sizeof(header))) {
+    switch (header.type) {
+    case frame_write: {
+      if (header.size > max_frame_size) {
+        ok = false;
+        break;
+      }
+
+      // the rest of the frame is taken in even when the link failed it; an empty one is the
+      // client's zero length packet
+      std::error_code ec;
+      uint64_t left = header.size;
+      if (left == 0) {
+        size_t transferred = 0;
+        ec = link.write_some(chunk.get(), 0, transferred, link_timeout_ms);
+      }
+
+      while (ok && left != 0) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(left, chunk_size));
+        ok = recv_all(control_fd, chunk.get(), n);
+        if (ok && !ec)
+          ec = write_all(chunk.get(), n);
+        left -= n;
+      }
+
+      if (ok && ec)
+        ok = send_frame(control_fd, frame_status, ec);
+      break;
+    }
+
+    case frame_reset:
+      ok = send_frame(control_fd, frame_done, reset_link());
+      break;
+
+    case frame_stats: {
+      pilink::stats_s stats{};
+      std::error_code ec = link.get_link_stats(stats);
+      ok = send_frame(control_fd, frame_stats, ec, &stats, ec ? 0 : sizeof(stats));
+      break;
+    }
+
+    default:
+      ok = false;
+      break;
+    }
+  }
+
+  int fd;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+    fd = in_fd;
+    cv.notify_all();
+  }
+
+  link.cancel();
+  if (fd >= 0)
+    (void)::shutdown(fd, SHUT_RDWR);
+
+  if (reader.joinable())
+    reader.join();
+  if (sender.joinable())
+    sender.join();
+
+  done.store(true);
+}
+
+void server::session::reader_fn() noexcept
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stop) {
+    if (paused) {
+      parked = true;
+      cv.notify_all();
+      cv.wait(lock);
+      continue;
+    }
+
+    parked = false;
+    if (free.empty()) {
+      cv.wait(lock);
+      continue;
+    }
+
+    size_t b = free.back();
+    free.pop_back();
+    lock.unlock();
+
+    size_t transferred = 0;
+    std::error_code ec = link.read_some(data_of(b), buffer_size, transferred, link_timeout_ms);
+
+    lock.lock();
+    if (transferred != 0) {
+      queue.push_back({frame_data, 0, b, transferred});
+      cv.notify_all();
+    } else {
+      free.push_back(b);
+    }
+
+    // cancelled: for a reset or the end, both seen above
+    if (ec && ec != std::errc::timed_out && ec != std::errc::argument_out_of_domain && ec != error::cancelled) {
+      queue.push_back({frame_status, to_wire(ec), 0, 0});
+      cv.notify_all();
+      break;
+    }
+  }
+
+  reading = false;
+  cv.notify_all();
+}
+
+// One sendmsg for the lot where the socket takes it; with zerocopy each call is numbered, and
+// the batch is done with once the last one is.
+bool server::session::send_batch(iovec *iov, size_t count, size_t total) noexcept
+{
+  int flags = MSG_NOSIGNAL;
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+  bool copy = !zerocopy || total < zerocopy_threshold;
+  if (!copy)
+    flags |= MSG_ZEROCOPY;
+#else
+  (void)total;
+#endif
+
+  while (count != 0) {
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    ssize_t n = ::sendmsg(in_fd, &msg, flags);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY) != 0) {
+      // out of locked memory for pinning: the rest goes as a copy
+      flags &= ~MSG_ZEROCOPY;
+      continue;
+    }
+    if (n < 0)
+      return false;
+
+    if ((flags & MSG_ZEROCOPY) != 0)
+      ++ zerocopy_sent;
+
+    auto left = static_cast<size_t>(n);
+    while (count != 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      ++ iov;
+      -- count;
+    }
+
+    if (count != 0) {
+      iov->iov_base = static_cast<unsigned char *>(iov->iov_base) + left;
+      iov->iov_len -= left;
+    }
+  }
+
+  return true;
+}
+
+// sender thread: buffers the kernel no longer needs go back to the reader
+void server::session::completed() noexcept
+{
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+  while (!sent.empty()) {
+    char control_buffer[128];
+    msghdr msg{};
+    msg.msg_control = control_buffer;
+    msg.msg_controllen = sizeof(control_buffer);
+
+    if (::recvmsg(in_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+      break;
+
+    for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+      bool recverr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+        || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+      if (!recverr)
+        continue;
+
+      sock_extended_err err;
+      std::memcpy(&err, CMSG_DATA(cm), sizeof(err));
+      if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+
+      // sends complete in order: [ee_info, ee_data] done means everything up to ee_data is
+      std::lock_guard<std::mutex> lock(mutex);
+      while (!sent.empty() && static_cast<int32_t>(sent.front().last - err.ee_data) <= 0) {
+        free.insert(free.end(), sent.front().buffers.begin(), sent.front().buffers.end());
+        sent.pop_front();
+      }
+      cv.notify_all();
+    }
+  }
+#endif
+}
+
+void server::session::sender_fn() noexcept
+{
+  std::vector<iovec> iov;
+  std::vector<size_t> batch;
+  try {
+    iov.reserve(max_batch);
+    batch.reserve(max_batch);
+  } catch (...) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stop) {
+    if (queue.empty()) {
+      if (sent.empty()) {
+        cv.wait(lock);
+      } else {
+        // completions come on the socket's error queue, not through the cv
+        (void)cv.wait_for(lock, std::chrono::milliseconds(1));
+        lock.unlock();
+        completed();
+        lock.lock();
+      }
+      continue;
+    }
+
+    outgoing next = queue.front();
+    frame_header_s header{};
+    iov.clear();
+    batch.clear();
+
+    // what piled up goes out as one frame, the header in front of the first buffer
+    size_t total = 0;
+    if (next.type == frame_data) {
+      while (!queue.empty() && queue.front().type == frame_data && batch.size() < max_batch
+        && total + queue.front().size <= max_frame_size) {
+        const outgoing& o = queue.front();
+        iov.push_back({data_of(o.buffer), o.size});
+        batch.push_back(o.buffer);
+        total += o.size;
+        queue.pop_front();
+      }
+
+      header.type = frame_data;
+      header.size = total;
+      std::memcpy(header_of(batch.front()), &header, sizeof(header));
+      iov.front().iov_base = header_of(batch.front());
+      iov.front().iov_len += sizeof(header);
+    } else {
+      queue.pop_front();
+      header.type = next.type;
+      header.status = next.status;
+      iov.push_back({&header, sizeof(header)});
+    }
+    lock.unlock();
+
+    uint32_t before = zerocopy_sent;
+    bool ok = send_batch(iov.data(), iov.size(), total + sizeof(header));
+
+    lock.lock();
+    if (zerocopy_sent != before) {
+      try {
+        sent.push_back({zerocopy_sent - 1, batch});
+      } catch (...) {
+        // the kernel may still read them: never reused
+      }
+    } else {
+      free.insert(free.end(), batch.begin(), batch.end());
+    }
+    cv.notify_all();
+
+    if (!ok)
+      break;
+
+    if (!sent.empty()) {
+      lock.unlock();
+      completed();
+      lock.lock();
+    }
+  }
+}
+
+server::server(const server_options& options) noexcept
+  : options_{options}
+  , listen_fd_{-1}
+  , wake_fd_{::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)}
+  , stop_{false}
+  , next_session_{0}
+  , links_{}
+  , sessions_{}
+  , pending_{}
+{
+}
+
+server::~server()
+{
+  reap(true);
+
+  if (listen_fd_ >= 0)
+    ::close(listen_fd_);
+  if (wake_fd_ >= 0)
+    ::close(wake_fd_);
+}
+
+std::error_code server::add(const char *name, pilink& link) noexcept
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (name == nullptr || std::strlen(name) >= name_size)
+    return std::make_error_code(std::errc::invalid_argument);
+
+  try {
+    links_.push_back({name, &link, false});
+  } catch (...) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  return {};
+}
+
+std::error_code server::listen(const char *host, uint16_t port) noexcept
+{
+  if (listen_fd_ >= 0)
+    return std::make_error_code(std::errc::already_connected);
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  char service[8];
+  std::snprintf(service, sizeof(service), "%u", static_cast<unsigned int>(port));
+  addrinfo *found = nullptr;
+  int rc = ::getaddrinfo(host, service, &hints, &found);
+  if (rc != 0)
+    return rc == EAI_SYSTEM ? last_error() : std::make_error_code(std::errc::address_not_available);
+
+  std::error_code ec = std::make_error_code(std::errc::address_not_available);
+  for (addrinfo *ai = found; ai != nullptr; ai = ai->ai_next) {
+    int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd < 0) {
+      ec = last_error();
+      continue;
+    }
+
+    int one = 1;
+    (void)::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (::bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || ::listen(fd, 16) != 0) {
+      ec = last_error();
+      ::close(fd);
+      continue;
+    }
+
+    listen_fd_ = fd;
+    ec = {};
+    break;
+  }
+
+  ::freeaddrinfo(found);
+  return ec;
+}
+
+uint16_t server::port() const noexcept
+{
+  sockaddr_storage address{};
+  socklen_t length = sizeof(address);
+  if (listen_fd_ < 0 || ::getsockname(listen_fd_, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+    return 0;
+
+  if (address.ss_family == AF_INET6)
+    return ntohs(reinterpret_cast<const sockaddr_in6 *>(&address)->sin6_port);
+
+  return ntohs(reinterpret_cast<const sockaddr_in *>(&address)->sin_port);
+}
+
+void server::accept_client() noexcept
+{
+  int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  int one = 1;
+  (void)::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  // room is reserved in run, only the allocation can fail
+  std::unique_ptr<pending> p(new(std::nothrow) pending(fd));
+  if (!p) {
+    ::close(fd);
+    return;
+  }
+
+  pending_.push_back(std::move(p));
+}
+
+// what is there, without blocking; false when the client is gone
+bool server::receive_hello(pending &p) noexcept
+{
+  auto data = reinterpret_cast<unsigned char *>(&p.hello);
+  while (p.received < sizeof(p.hello)) {
+    ssize_t n = ::recv(p.fd, data + p.received, sizeof(p.hello) - p.received, MSG_DONTWAIT);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return true;
+    if (n <= 0)
+      return false;
+
+    p.received += static_cast<size_t>(n);
+  }
+
+  return true;
+}
+
+// The hello is all in. mutex_ is held only to look the link or the session up and to book it;
+// sessions_ shrinks in reap alone, on this same thread, so a session found stays there meanwhile.
+void server::handshake(pending& p) noexcept
+{
+  int fd = p.fd;
+  p.fd = -1;
+
+  hello_s& hello = p.hello;
+  welcome_s welcome{};
+  welcome.magic = protocol_magic;
+
+  std::error_code ec;
+
+  if (hello.magic != protocol_magic || hello.version != protocol_version) {
+    ec = std::make_error_code(std::errc::protocol_error);
+  } else if (hello.channel == channel_in) {
+    session *found = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = std::find_if(sessions_.begin(), sessions_.end(),
+        [&](const std::unique_ptr<session>& s) { return s->id == hello.session && !s->done.load(); });
+      if (it != sessions_.end())
+        found = it->get();
+    }
+
+    // the welcome goes first, the stream follows on the same socket
+    if (found != nullptr) {
+      welcome.session = hello.session;
+      if (send_all(fd, &welcome, sizeof(welcome)) && found->attach(fd, options_.zerocopy))
+        return;
+      ::close(fd);
+      return;
+    }
+
+    ec = std::make_error_code(std::errc::invalid_argument);
+  } else if (hello.channel == channel_control) {
+    hello.name[name_size - 1] = '\0';
+
+    size_t index = 0;
+    pilink *link = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = std::find_if(links_.begin(), links_.end(),
+        [&](const entry& e) { return hello.name[0] == '\0' || e.name == hello.name; });
+
+      if (it == links_.end()) {
+        ec = std::make_error_code(std::errc::no_such_device);
+      } else if (it->busy) {
+        ec = std::make_error_code(std::errc::device_or_resource_busy);
+      } else {
+        it->busy = true;
+        index = static_cast<size_t>(it - links_.begin());
+        link = it->link;
+      }
+    }
+
+    if (link != nullptr) {
+      pilink::info_s info{};
+      std::unique_ptr<session> s(new(std::nothrow) session(index, *link, ++ next_session_, fd));
+
+      if (!s)
+        ec = std::make_error_code(std::errc::not_enough_memory);
+      if (!ec)
+        ec = s->prepare(options_);
+      if (!ec)
+        ec = link->get_link_info(info);
+
+      if (!ec) {
+        welcome.session = s->id;
+        welcome.in_packet_size = info.in.packet_size;
+        welcome.in_baud_rate = info.in.baud_rate;
+        welcome.out_packet_size = info.out.packet_size;
+        welcome.out_baud_rate = info.out.baud_rate;
+
+        // the session owns fd from here and closes it, here or in reap
+        if (send_all(fd, &welcome, sizeof(welcome))) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          try {
+            sessions_.push_back(std::move(s));
+          } catch (...) {
+            links_[index].busy = false;
+            return;
+          }
+
+          session& added = *sessions_.back();
+          try {
+            added.control = std::thread(&session::control_fn, &added);
+          } catch (...) {
+            added.done.store(true);
+          }
+          return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        links_[index].busy = false;
+        return;
+      }
+
+      // not taken over, closed below
+      if (s)
+        s->control_fd = -1;
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      links_[index].busy = false;
+    }
+  } else {
+    ec = std::make_error_code(std::errc::protocol_error);
+  }
+
+  welcome.status = to_wire(ec);
+  (void)send_all(fd, &welcome, sizeof(welcome));
+  ::close(fd);
+}
+
+void server::reap(bool all) noexcept
+{
+  std::vector<std::unique_ptr<session>> ended;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = sessions_.begin(); it != sessions_.end();) {
+      if (all || (*it)->done.load()) {
+        links_[(*it)->index].busy = false;
+        ended.push_back(std::move(*it));
+        it = sessions_.erase(it);
+      } else {
+        ++ it;
+      }
+    }
+  }
+
+  // ended and joined by the destructors, outside the lock
+  ended.clear();
+}
+
+// A client that does not say who it is within a second is dropped.
+std::error_code server::run() noexcept
+{
+  if (listen_fd_ < 0)
+    return std::make_error_code(std::errc::not_connected);
+
+  try {
+    pending_.reserve(max_pending);
+  } catch (...) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  std::error_code ec;
+  while (!stop_.load()) {
+    pollfd fds[2 + max_pending];
+    fds[0] = {listen_fd_, static_cast<short>(pending_.size() < max_pending ? POLLIN : 0), 0};
+    fds[1] = {wake_fd_, POLLIN, 0};
+
+    auto now = pending::clock::now();
+    int wait = 1000;
+    for (size_t i = 0; i < pending_.size(); ++ i) {
+      fds[2 + i] = {pending_[i]->fd, POLLIN, 0};
+
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(pending_[i]->deadline - now).count();
+      if (left < wait)
+        wait = left < 0 ? 0 : static_cast<int>(left) + 1;
+    }
+
+    int n = ::poll(fds, static_cast<nfds_t>(2 + pending_.size()), wait);
+
+    reap(false);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      ec = last_error();
+      break;
+    }
+
+    // from the back, so that the ones still to go keep their fds entry
+    now = pending::clock::now();
+    for (size_t i = pending_.size(); i -- > 0;) {
+      pending& p = *pending_[i];
+      bool gone = false;
+
+      if (fds[2 + i].revents != 0)
+        gone = !receive_hello(p);
+
+      if (!gone && p.received == sizeof(p.hello))
+        handshake(p);
+      else if (!gone && now < p.deadline)
+        continue;
+
+      pending_.erase(pending_.begin() + static_cast<std::ptrdiff_t>(i));
+    }
+
+    if ((fds[0].revents & POLLIN) != 0)
+      accept_client();
+  }
+
+  pending_.clear();
+  reap(true);
+  return ec;
+}
+
+void server::stop() noexcept
+{
+  stop_.store(true);
+
+  uint64_t one = 1;
+  if (wake_fd_ >= 0)
+    (void)::write(wake_fd_, &one, sizeof(one));
+}
+
+} // namespace tcp
+} // namespace pilink
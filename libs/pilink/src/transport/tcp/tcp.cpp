@@ -0,0 +1,640 @@
+#include "transport/tcp/tcp.hpp"
+#include <boost/url.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace pilink {
+namespace transport {
+namespace tcp {
+
+namespace {
+
+std::error_code last_error() noexcept
+{
+  return std::error_code(errno, std::system_category());
+}
+
+// handshake on a non-blocking socket, before the link is there
+std::error_code transfer_all(int fd, void *data, size_t size, bool out, unsigned int timeout) noexcept
+{
+  auto p = static_cast<unsigned char *>(data);
+  while (size != 0) {
+    ssize_t n = out ? ::send(fd, p, size, MSG_NOSIGNAL) : ::recv(fd, p, size, 0);
+    if (n > 0) {
+      p += n;
+      size -= static_cast<size_t>(n);
+      continue;
+    }
+
+    if (n == 0)
+      return std::make_error_code(std::errc::connection_reset);
+    if (errno == EINTR)
+      continue;
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      return last_error();
+
+    pollfd pfd{fd, static_cast<short>(out ? POLLOUT : POLLIN), 0};
+    int rc = ::poll(&pfd, 1, static_cast<int>(timeout));
+    if (rc == 0)
+      return std::make_error_code(std::errc::timed_out);
+    if (rc < 0 && errno != EINTR)
+      return last_error();
+  }
+
+  return {};
+}
+
+} // namespace
+
+pilink_tcp::pilink_tcp() noexcept
+  : control_fd_{-1}
+  , in_fd_{-1}
+  , wake_fd_{-1}
+  , info_{}
+  , cancel_generation_{0}
+  , broken_{false}
+  , in_header_{}
+  , in_header_size_{0}
+  , in_left_{0}
+  , discarding_{false}
+  , in_error_{}
+  , write_error_{}
+{
+}
+
+pilink_tcp::~pilink_tcp()
+{
+  if (is_connected())
+    (void)disconnect();
+
+  if (wake_fd_ >= 0)
+    ::close(wake_fd_);
+}
+
+// the frames of both connections are out of step: every call fails from here
+void pilink_tcp::break_connection() noexcept
+{
+  broken_.store(true);
+  (void)::shutdown(control_fd_, SHUT_RDWR);
+  (void)::shutdown(in_fd_, SHUT_RDWR);
+}
+
+// Sleeps in slices, so that a cancel is seen even when its wake up went to another caller.
+std::error_code pilink_tcp::wait(int fd, short events, clock::time_point deadline, unsigned int generation) noexcept
+{
+  for (;;) {
+    if (broken_.load())
+      return std::make_error_code(std::errc::connection_aborted);
+    if (cancel_generation_.load() != generation)
+      return make_error_code(error::cancelled);
+
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+    if (left <= 0)
+      return std::make_error_code(std::errc::timed_out);
+
+    pollfd fds[2] = {{fd, events, 0}, {wake_fd_, POLLIN, 0}};
+    int n = ::poll(fds, 2, static_cast<int>(std::min<long long>(left, wait_slice_ms)));
+    if (n < 0 && errno != EINTR)
+      return last_error();
+
+    // errors and hang ups too: the call that follows finds out what
+    if (n > 0 && fds[0].revents != 0)
+      return {};
+
+    // left over from a cancel before this call started
+    if ((fds[1].revents & POLLIN) != 0 && cancel_generation_.load() == generation) {
+      uint64_t count;
+      (void)::read(wake_fd_, &count, sizeof(count));
+    }
+  }
+}
+
+std::error_code pilink_tcp::open_channel(const char *host, const char *port, hello_s& hello, welcome_s& welcome, int& fd) noexcept
+{
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo *found = nullptr;
+  int rc = ::getaddrinfo(host, port, &hints, &found);
+  if (rc != 0)
+    return rc == EAI_SYSTEM ? last_error() : std::make_error_code(std::errc::host_unreachable);
+
+  std::error_code ec = std::make_error_code(std::errc::host_unreachable);
+  fd = -1;
+
+  for (addrinfo *ai = found; ai != nullptr && fd < 0; ai = ai->ai_next) {
+    int s = ::socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+    if (s < 0) {
+      ec = last_error();
+      continue;
+    }
+
+    do {
+      if (::connect(s, ai->ai_addr, ai->ai_addrlen) != 0) {
+        if (errno != EINPROGRESS) {
+          ec = last_error();
+          break;
+        }
+
+        pollfd pfd{s, POLLOUT, 0};
+        if (::poll(&pfd, 1, static_cast<int>(control_timeout_ms)) <= 0) {
+          ec = std::make_error_code(std::errc::timed_out);
+          break;
+        }
+
+        int err = 0;
+        socklen_t length = sizeof(err);
+        (void)::getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &length);
+        if (err != 0) {
+          ec = std::error_code(err, std::system_category());
+          break;
+        }
+      }
+
+      // frames are complete when sent, nothing to wait for
+      int one = 1;
+      (void)::setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+      ec = transfer_all(s, &hello, sizeof(hello), true, control_timeout_ms);
+      if (ec)
+        break;
+
+      ec = transfer_all(s, &welcome, sizeof(welcome), false, control_timeout_ms);
+      if (ec)
+        break;
+
+      if (welcome.magic != protocol_magic) {
+        ec = std::make_error_code(std::errc::protocol_error);
+        break;
+      }
+
+      ec = from_wire(welcome.status);
+      if (ec)
+        break;
+
+      fd = s;
+    } while (false);
+
+    if (fd < 0)
+      ::close(s);
+  }
+
+  ::freeaddrinfo(found);
+  return ec;
+}
+
+std::error_code pilink_tcp::connect(const char *uri) noexcept
+{
+  if (is_connected())
+    (void)disconnect();
+
+  std::string host;
+  std::string port;
+  std::string name;
+  try {
+    auto parsed = boost::urls::parse_uri(uri != nullptr ? uri : "");
+    if (parsed.has_error() || parsed.value().scheme() != "TCP" || !parsed.value().has_port())
+      return std::make_error_code(std::errc::invalid_argument);
+
+    host = parsed.value().host();
+    port = parsed.value().port();
+
+    // [::1]
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']')
+      host = host.substr(1, host.size() - 2);
+
+    for (const auto param : parsed.value().params()) {
+      if (param.key == "NAME")
+        name = param.value;
+      else
+        return std::make_error_code(std::errc::invalid_argument);
+    }
+  } catch (...) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  if (name.size() >= name_size)
+    return std::make_error_code(std::errc::invalid_argument);
+
+  if (wake_fd_ < 0) {
+    wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0)
+      return last_error();
+  }
+
+  hello_s hello{};
+  hello.magic = protocol_magic;
+  hello.version = protocol_version;
+  hello.channel = channel_control;
+  std::memcpy(hello.name, name.c_str(), name.size());
+
+  welcome_s welcome{};
+  std::error_code ec = open_channel(host.c_str(), port.c_str(), hello, welcome, control_fd_);
+  if (ec)
+    return ec;
+
+  hello.channel = channel_in;
+  hello.session = welcome.session;
+  welcome_s in_welcome{};
+  ec = open_channel(host.c_str(), port.c_str(), hello, in_welcome, in_fd_);
+  if (ec) {
+    ::close(control_fd_);
+    control_fd_ = -1;
+    return ec;
+  }
+
+  info_.in.packet_size = static_cast<size_t>(welcome.in_packet_size);
+  info_.in.baud_rate = static_cast<size_t>(welcome.in_baud_rate);
+  info_.out.packet_size = static_cast<size_t>(welcome.out_packet_size);
+  info_.out.baud_rate = static_cast<size_t>(welcome.out_baud_rate);
+
+  broken_.store(false);
+  in_header_size_ = 0;
+  in_left_ = 0;
+  discarding_ = false;
+  in_error_ = {};
+  write_error_ = {};
+  return {};
+}
+
+std::error_code pilink_tcp::disconnect() noexcept
+{
+  // the bridge ends the session when the control connection goes
+  if (in_fd_ >= 0) {
+    ::close(in_fd_);
+    in_fd_ = -1;
+  }
+
+  if (control_fd_ >= 0) {
+    ::close(control_fd_);
+    control_fd_ = -1;
+  }
+
+  return {};
+}
+
+bool pilink_tcp::is_connected() const noexcept
+{
+  return control_fd_ >= 0;
+}
+
+std::error_code pilink_tcp::get_link_info(info_s &link_info) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  link_info = info_;
+  return {};
+}
+
+// One sendmsg for header and data where the socket takes it. Once a frame has started it is
+// finished whatever the timeout, or the connection is broken.
+std::error_code pilink_tcp::send_frame(iovec *iov, size_t count, unsigned int timeout, unsigned int generation) noexcept
+{
+  auto deadline = timeout != 0 ? clock::now() + std::chrono::milliseconds(timeout) : clock::time_point::max();
+  bool started = false;
+
+  while (count != 0) {
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    ssize_t n = ::sendmsg(control_fd_, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      std::error_code ec;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        ec = wait(control_fd_, POLLOUT, started ? clock::time_point::max() : deadline, generation);
+      else
+        ec = last_error();
+
+      if (ec && started)
+        break_connection();
+      if (ec)
+        return ec;
+      continue;
+    }
+
+    started = true;
+    auto left = static_cast<size_t>(n);
+    while (count != 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      ++ iov;
+      -- count;
+    }
+
+    if (count != 0) {
+      iov->iov_base = static_cast<unsigned char *>(iov->iov_base) + left;
+      iov->iov_len -= left;
+    }
+  }
+
+  return {};
+}
+
+// answers are waited for: one that does not come leaves the control connection out of step
+std::error_code pilink_tcp::recv_control(void *data, size_t size, unsigned int generation) noexcept
+{
+  auto deadline = clock::now() + std::chrono::milliseconds(control_timeout_ms);
+  auto p = static_cast<unsigned char *>(data);
+
+  while (size != 0) {
+    ssize_t n = ::recv(control_fd_, p, size, MSG_DONTWAIT);
+    if (n > 0) {
+      p += n;
+      size -= static_cast<size_t>(n);
+      continue;
+    }
+
+    std::error_code ec;
+    if (n == 0)
+      ec = std::make_error_code(std::errc::connection_reset);
+    else if (errno == EINTR)
+      continue;
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      ec = wait(control_fd_, POLLIN, deadline, generation);
+    else
+      ec = last_error();
+
+    if (ec) {
+      break_connection();
+      return ec;
+    }
+  }
+
+  return {};
+}
+
+// Takes the write failures the bridge reported; with block, up to the next frame of another
+// type, left in header (type 0 when there was none).
+std::error_code pilink_tcp::take_status(bool block, frame_header_s& header, unsigned int generation) noexcept
+{
+  for (;;) {
+    header = frame_header_s{};
+    if (!block) {
+      pollfd pfd{control_fd_, POLLIN, 0};
+      if (::poll(&pfd, 1, 0) <= 0)
+        return {};
+    }
+
+    std::error_code ec = recv_control(&header, sizeof(header), generation);
+    if (ec)
+      return ec;
+
+    if (header.type != frame_status) {
+      if (block)
+        return {};
+
+      break_connection();
+      return std::make_error_code(std::errc::protocol_error);
+    }
+
+    if (!write_error_)
+      write_error_ = from_wire(header.status);
+  }
+}
+
+std::error_code pilink_tcp::request(uint8_t type, void *payload, size_t size, std::error_code& status) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+  if (broken_.load())
+    return std::make_error_code(std::errc::connection_aborted);
+
+  unsigned int generation = cancel_generation_.load();
+
+  frame_header_s header{};
+  header.type = type;
+  iovec iov{&header, sizeof(header)};
+  std::error_code ec = send_frame(&iov, 1, control_timeout_ms, generation);
+  if (ec)
+    return ec;
+
+  ec = take_status(true, header, generation);
+  if (ec)
+    return ec;
+
+  uint8_t expected = type == frame_stats ? frame_stats : frame_done;
+  if (header.type != expected) {
+    break_connection();
+    return std::make_error_code(std::errc::protocol_error);
+  }
+
+  // a bridge that knows more than this side: the rest is skipped
+  uint64_t left = header.size;
+  size_t n = static_cast<size_t>(std::min<uint64_t>(left, size));
+  ec = recv_control(payload, n, generation);
+  left -= n;
+
+  while (!ec && left != 0) {
+    unsigned char skip[256];
+    n = static_cast<size_t>(std::min<uint64_t>(left, sizeof(skip)));
+    ec = recv_control(skip, n, generation);
+    left -= n;
+  }
+
+  status = from_wire(header.status);
+  return ec;
+}
+
+std::error_code pilink_tcp::get_link_stats(stats_s &link_stats) noexcept
+{
+  stats_s stats{};
+  std::error_code status;
+  std::error_code ec = request(frame_stats, &stats, sizeof(stats), status);
+  if (ec)
+    return ec;
+  if (status)
+    return status;
+
+  link_stats = stats;
+  return {};
+}
+
+std::error_code pilink_tcp::reset() noexcept
+{
+  std::error_code status;
+  std::error_code ec = request(frame_reset, nullptr, 0, status);
+  if (ec)
+    return ec;
+
+  // what the bridge read before is still on its way: dropped up to the mark
+  discarding_ = true;
+  in_error_ = {};
+  write_error_ = {};
+  return status;
+}
+
+std::error_code pilink_tcp::write_some(const unsigned char *data, size_t size, size_t &transferred, unsigned int timeout) noexcept
+{
+  transferred = 0;
+
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+  if (broken_.load())
+    return std::make_error_code(std::errc::connection_aborted);
+
+  unsigned int generation = cancel_generation_.load();
+
+  frame_header_s header{};
+  std::error_code ec = take_status(false, header, generation);
+  if (!ec && write_error_) {
+    ec = write_error_;
+    write_error_ = {};
+  }
+  if (ec)
+    return ec;
+
+  // an empty frame, the bridge's link sends a zero length packet
+  if (size == 0) {
+    header = frame_header_s{};
+    header.type = frame_write;
+    iovec iov[1] = {{&header, sizeof(header)}};
+    return send_frame(iov, 1, timeout, generation);
+  }
+
+  while (size != 0) {
+    size_t n = std::min(size, max_frame_size);
+    header = frame_header_s{};
+    header.type = frame_write;
+    header.size = n;
+
+    iovec iov[2] = {{&header, sizeof(header)}, {const_cast<unsigned char *>(data), n}};
+    ec = send_frame(iov, 2, timeout, generation);
+    if (ec)
+      return ec;
+
+    data += n;
+    size -= n;
+    transferred += n;
+  }
+
+  return {};
+}
+
+std::error_code pilink_tcp::read_some(unsigned char *data, size_t size, size_t &transferred, unsigned int timeout) noexcept
+{
+  transferred = 0;
+
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+  if (broken_.load())
+    return std::make_error_code(std::errc::connection_aborted);
+  if (in_error_)
+    return in_error_;
+
+  unsigned int generation = cancel_generation_.load();
+  auto deadline = timeout != 0 ? clock::now() + std::chrono::milliseconds(timeout) : clock::time_point::max();
+  size_t total = 0;
+
+  while (size != 0) {
+    ssize_t n;
+
+    if (in_left_ == 0) {
+      auto header = reinterpret_cast<unsigned char *>(&in_header_);
+      n = ::recv(in_fd_, header + in_header_size_, sizeof(in_header_) - in_header_size_, MSG_DONTWAIT);
+      if (n > 0) {
+        in_header_size_ += static_cast<size_t>(n);
+        if (in_header_size_ < sizeof(in_header_))
+          continue;
+
+        in_header_size_ = 0;
+        switch (in_header_.type) {
+        case frame_data:
+          in_left_ = in_header_.size;
+          break;
+        case frame_reset_mark:
+          discarding_ = false;
+          break;
+        case frame_status:
+          if (!discarding_)
+            in_error_ = from_wire(in_header_.status);
+          break;
+        default:
+          break_connection();
+          return std::make_error_code(std::errc::protocol_error);
+        }
+
+        if (in_error_)
+          break;
+        continue;
+      }
+    } else {
+      // stale data is read into the caller's buffer and not counted
+      size_t want = static_cast<size_t>(std::min<uint64_t>(in_left_, size));
+      n = ::recv(in_fd_, data, want, MSG_DONTWAIT);
+      if (n > 0) {
+        in_left_ -= static_cast<uint64_t>(n);
+        if (!discarding_) {
+          data += n;
+          size -= static_cast<size_t>(n);
+          total += static_cast<size_t>(n);
+        }
+        continue;
+      }
+    }
+
+    if (n == 0) {
+      in_error_ = std::make_error_code(std::errc::connection_reset);
+      break;
+    }
+
+    if (errno == EINTR)
+      continue;
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      in_error_ = last_error();
+      break;
+    }
+
+    // block for the first bytes only, take what else is already there
+    if (total != 0)
+      break;
+
+    std::error_code ec = wait(in_fd_, POLLIN, deadline, generation);
+    if (ec)
+      return ec;
+  }
+
+  transferred = total;
+  if (total == 0 && in_error_)
+    return in_error_;
+
+  if (size != 0)
+    return std::make_error_code(std::errc::argument_out_of_domain);
+
+  return {};
+}
+
+void pilink_tcp::cancel() noexcept
+{
+  if (wake_fd_ < 0)
+    return;
+
+  ++ cancel_generation_;
+  uint64_t one = 1;
+  (void)::write(wake_fd_, &one, sizeof(one));
+}
+
+pilink *make_pilink_tcp() noexcept
+{
+  return ::new(std::nothrow) pilink_tcp;
+}
+
+} // namespace tcp
+} // namespace transport
+} // namespace pilink
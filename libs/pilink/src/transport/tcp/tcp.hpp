@@ -0,0 +1,84 @@
+#ifndef PILINK_TRANSPORT_TCP_HPP
+#define PILINK_TRANSPORT_TCP_HPP
+
+#include <pilink/pilink.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sys/uio.h>
+#include "transport/tcp/protocol.hpp"
+
+namespace pilink {
+namespace transport {
+namespace tcp {
+
+/**
+ * @brief The pilink_tcp class
+ * Link served by a bridge on another host (pilink::tcp::server, the pilink-bridge app).
+ *
+ * URI: TCP://<host>:<port>?NAME=<name> (NAME: the bridge's name for the link, its first without)
+ *
+ * IN and OUT go over connections of their own, so a busy direction never holds up the other.
+ * read_some takes the IN stream as the bridge sends it: it blocks for the first bytes only and
+ * returns what else is already there (argument_out_of_domain when short). write_some completes
+ * once the data is on its way, each call one transfer at the far end; a write the device then
+ * fails is reported by the next write_some. A timeout counts until a write starts going out,
+ * after that it is finished (cancel breaks the connection). reset drops IN data read before it.
+ */
+class pilink_tcp : public pilink
+{
+private:
+  using clock = std::chrono::steady_clock;
+
+  static constexpr unsigned int wait_slice_ms = 100;
+  static constexpr unsigned int control_timeout_ms = 5000;
+
+  int control_fd_;
+  int in_fd_;
+  int wake_fd_;
+  info_s info_;
+  std::atomic<unsigned int> cancel_generation_;
+  std::atomic<bool> broken_;      // cancelled in the middle of a frame
+
+  // IN stream: where in the frames it is
+  frame_header_s in_header_;
+  size_t in_header_size_;
+  uint64_t in_left_;
+  bool discarding_;               // until the bridge marks the reset
+  std::error_code in_error_;      // the bridge's read ended
+
+  std::error_code write_error_;   // the bridge's write failed, for the next write_some
+
+  void break_connection() noexcept;
+  std::error_code wait(int fd, short events, clock::time_point deadline, unsigned int generation) noexcept;
+  std::error_code open_channel(const char *host, const char *port, hello_s& hello, welcome_s& welcome, int& fd) noexcept;
+  std::error_code send_frame(iovec *iov, size_t count, unsigned int timeout, unsigned int generation) noexcept;
+  std::error_code recv_control(void *data, size_t size, unsigned int generation) noexcept;
+  std::error_code take_status(bool block, frame_header_s& header, unsigned int generation) noexcept;
+  std::error_code request(uint8_t type, void *payload, size_t size, std::error_code& status) noexcept;
+
+public:
+  pilink_tcp() noexcept;
+  ~pilink_tcp();
+
+  virtual std::error_code connect(const char *uri) noexcept override;
+  virtual std::error_code disconnect() noexcept override;
+  virtual bool is_connected() const noexcept override;
+
+  virtual std::error_code get_link_info(struct info_s& link_info) noexcept override;
+  virtual std::error_code get_link_stats(struct stats_s& link_stats) noexcept override;
+
+  virtual std::error_code reset() noexcept override;
+  virtual std::error_code write_some(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override;
+  virtual std::error_code read_some(unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override;
+
+  virtual void cancel() noexcept override;
+};
+
+pilink *make_pilink_tcp() noexcept;
+
+} // namespace tcp
+} // namespace transport
+} // namespace pilink
+
+#endif // PILINK_TRANSPORT_TCP_HPP
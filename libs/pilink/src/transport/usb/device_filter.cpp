@@ -0,0 +1,105 @@
+#include "transport/usb/device_filter.hpp"
+#include <cstdlib>
+#include <string>
+#include <boost/url.hpp>
+
+namespace pilink {
+namespace transport {
+namespace usb {
+
+static
+bool parse_int(const std::string& s, int base, int& value) noexcept
+{
+  if (s.empty())
+    return false;
+
+  char *end = nullptr;
+  long v = std::strtol(s.c_str(), &end, base);
+  if (*end != '\0' || v < 0 || v > 0xFFFF)
+    return false;
+
+  value = static_cast<int>(v);
+  return true;
+}
+
+bool parse_port_chain(const std::string& s, std::vector<uint8_t>& port)
+{
+  constexpr size_t max_depth = 7;   // tiers below the root hub
+
+  port.clear();
+  size_t begin = 0;
+  for (;;) {
+    size_t end = s.find('.', begin);
+    int hop = 0;
+    if (!parse_int(s.substr(begin, end == std::string::npos ? std::string::npos : end - begin), 10, hop) ||
+        hop == 0 || hop > 0xFF || port.size() == max_depth)
+      return false;
+
+    port.push_back(static_cast<uint8_t>(hop));
+    if (end == std::string::npos)
+      return true;
+
+    begin = end + 1;
+  }
+}
+
+std::string format_port_chain(const uint8_t *port, size_t depth)
+{
+  std::string s;
+  for (size_t i = 0; i < depth; ++ i) {
+    if (i != 0)
+      s += '.';
+    s += std::to_string(static_cast<unsigned int>(port[i]));
+  }
+
+  return s;
+}
+
+std::error_code parse_device_filter(const char *uri, const char *scheme, device_filter& filter, bool strict) noexcept
+{
+  filter = device_filter{};
+
+  if (uri == nullptr)
+    return {};
+
+  try {
+    auto parsed = boost::urls::parse_uri(uri);
+    if (parsed.has_error())
+      return std::make_error_code(std::errc::invalid_argument);
+
+    auto uriView = parsed.value();
+    if (uriView.scheme() != scheme)
+      return std::make_error_code(std::errc::invalid_argument);
+
+    for (const auto queryParam : uriView.params()) {
+      bool valid = true;
+      if (queryParam.key == "VID") {
+        valid = parse_int(queryParam.value, 16, filter.vid);
+      } else if (queryParam.key == "PID") {
+        valid = parse_int(queryParam.value, 16, filter.pid);
+      } else if (queryParam.key == "BUS") {
+        valid = parse_int(queryParam.value, 10, filter.bus);
+      } else if (queryParam.key == "PORT") {
+        valid = parse_port_chain(queryParam.value, filter.port);
+      } else if (queryParam.key == "ADDR") {
+        valid = parse_int(queryParam.value, 10, filter.addr);
+      } else if (queryParam.key == "SERIAL") {
+        filter.serial = queryParam.value;
+        valid = !filter.serial.empty();
+      } else if (strict) {
+        valid = false;
+      }
+
+      if (!valid)
+        return std::make_error_code(std::errc::invalid_argument);
+    }
+  } catch (...) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  return {};
+}
+
+} // namespace usb
+} // namespace transport
+} // namespace pilink
@@ -0,0 +1,40 @@
+#ifndef PILINK_TRANSPORT_USB_DEVICE_FILTER_HPP
+#define PILINK_TRANSPORT_USB_DEVICE_FILTER_HPP
+
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace pilink {
+namespace transport {
+namespace usb {
+
+// Device selection parsed from <SCHEME>://?VID=..&PID=..&BUS=..&PORT=..&ADDR=..&SERIAL=..
+// Negative value (empty serial) means "any". Shared by the USB backends, each with its own scheme.
+struct device_filter
+{
+  int vid  = -1;
+  int pid  = -1;
+  int bus  = -1;
+  std::vector<uint8_t> port;  // PORT=2.4: the ports from the root hub down, as sysfs names 1-2.4
+  int addr = -1;
+  std::string serial;   // iSerialNumber, compared as is; stays with the unit when cables move
+};
+
+// "2.4" as { 2, 4 }; at most 7 hops, each 1..255
+[[nodiscard]]
+bool parse_port_chain(const std::string& s, std::vector<uint8_t>& port);
+
+std::string format_port_chain(const uint8_t *port, size_t depth);
+
+// strict: unknown query keys are an error (enumeration), otherwise they are
+// left for the link layer (connect).
+[[nodiscard]]
+std::error_code parse_device_filter(const char *uri, const char *scheme, device_filter& filter, bool strict) noexcept;
+
+} // namespace usb
+} // namespace transport
+} // namespace pilink
+
+#endif // PILINK_TRANSPORT_USB_DEVICE_FILTER_HPP
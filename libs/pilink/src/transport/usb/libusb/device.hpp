@@ -2,12 +2,18 @@
 #define PILINK_TRANSPORT_USB_LIBUSB_HPP
 
 #include <libusb-1.0/libusb.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
 #include <memory>
+#include <vector>
 #include <system_error>
 #include <assert.h>
 
 #include "transport/usb/usb_base.hpp"
 #include "transport/usb/libusb/error.hpp"
+#include "transport/usb/libusb/enumerate.hpp"
+#include "transport/usb/libusb/serial_cache.hpp"
 
 namespace pilink {
 namespace transport {
@@ -105,8 +111,134 @@ public:
 
 };
 
+/**
+ * @brief Multi packet isochronous transfer.
+ * Allocated once and resubmitted as is, so the per packet status stays readable after completion.
+ */
+class iso_transfer
+{
+private:
+public:
+  libusb_transfer* ptransfer_;
+  device* owner_;
+  std::unique_ptr<unsigned char[]> buffer_;
+  size_t packet_size_;
+  int completed_;
+
+public:
+  iso_transfer() noexcept
+    : ptransfer_ { nullptr }
+    , owner_ { nullptr }
+    , buffer_ {}
+    , packet_size_ { 0 }
+    , completed_ { 1 }
+  {
+  }
+
+  ~iso_transfer() noexcept
+  {
+    release();
+  }
+
+  iso_transfer(const iso_transfer&) = delete;
+  iso_transfer& operator=(const iso_transfer&) = delete;
+
+  error_code_t allocate(size_t packets, size_t packet_size) noexcept
+  {
+    assert(ptransfer_ == nullptr);
+
+    buffer_.reset(::new (std::nothrow) unsigned char[packets * packet_size]);
+    if (!buffer_)
+      return error::no_mem;
+
+    ptransfer_ = libusb_alloc_transfer(static_cast<int>(packets));
+    if (ptransfer_ == nullptr) {
+      buffer_.reset();
+      return error::no_mem;
+    }
+
+    packet_size_ = packet_size;
+    ptransfer_->num_iso_packets = static_cast<int>(packets);
+    ptransfer_->buffer = buffer_.get();
+    ptransfer_->length = static_cast<int>(packets * packet_size);
+    ptransfer_->timeout = 0;
+    ptransfer_->callback = &transfer_callback_fn;
+    ptransfer_->user_data = this;
+    return {};
+  }
+
+  void release() noexcept
+  {
+    if (ptransfer_ != nullptr) {
+      assert(is_completed());
+      libusb_free_transfer(ptransfer_);
+      ptransfer_ = nullptr;
+    }
+    buffer_.reset();
+  }
+
+  bool is_completed() const noexcept
+  {
+    return (completed_ != 0);
+  }
+
+  static void transfer_callback_fn(struct libusb_transfer* t) noexcept
+  {
+    iso_transfer* self = static_cast<iso_transfer*>(t->user_data);
+    self->completed_ = 1;
+  }
+
+  error_code_t status() const noexcept
+  {
+    if (!is_completed())
+      return std::make_error_code(std::errc::operation_would_block);
+
+    return make_libusb_transfer_error(ptransfer_->status);
+  }
+
+  size_t packets() const noexcept
+  {
+    return static_cast<size_t>(ptransfer_->num_iso_packets);
+  }
+
+  error_code_t packet_status(size_t i) const noexcept
+  {
+    return make_libusb_transfer_error(ptransfer_->iso_packet_desc[i].status);
+  }
+
+  size_t packet_length(size_t i) const noexcept
+  {
+    return ptransfer_->iso_packet_desc[i].actual_length;
+  }
+
+  // packets are laid out at fixed packet_size strides whatever their actual length
+  const unsigned char* packet_data(size_t i) const noexcept
+  {
+    return buffer_.get() + i * packet_size_;
+  }
+
+  error_code_t wait(unsigned int ms) noexcept;
+
+  error_code_t cancel() noexcept
+  {
+    if (is_completed())
+      return {};
+
+    int status;
+    status = libusb_cancel_transfer(ptransfer_);
+    return make_libusb_error(status);
+  }
+};
+
 class device
 {
+public:
+  using transfer_t = transfer;
+  using iso_transfer_t = iso_transfer;
+
+  // submit_control expects the setup packet in front of the data stage in the transfer buffer
+  static constexpr size_t control_setup_size = LIBUSB_CONTROL_SETUP_SIZE;
+
 private:
 public:
   libusb_context* context_;
@@ -114,6 +246,126 @@ public:
   libusb_device_handle* device_handle_;
   interface_info  ii_;
 
+  pollfd_added_fn pollfd_added_;
+  pollfd_removed_fn pollfd_removed_;
+  void* pollfd_user_data_;
+
+  // bumped by interrupt(): blocking transfers started before give up
+  std::atomic<unsigned int> cancel_generation_;
+
+  // waits are cut in slices so an interrupt is seen even when its wake up went to another thread
+  static constexpr unsigned int interrupt_slice_ms = 100;
+
+  static error_code_t make_sync_error(int transfer_status) noexcept
+  {
+    switch (transfer_status)
+    {
+    case LIBUSB_TRANSFER_COMPLETED: return make_libusb_error(LIBUSB_SUCCESS);
+    case LIBUSB_TRANSFER_TIMED_OUT: return make_libusb_error(LIBUSB_ERROR_TIMEOUT);
+    case LIBUSB_TRANSFER_STALL:     return make_libusb_error(LIBUSB_ERROR_PIPE);
+    case LIBUSB_TRANSFER_OVERFLOW:  return make_libusb_error(LIBUSB_ERROR_OVERFLOW);
+    case LIBUSB_TRANSFER_NO_DEVICE: return make_libusb_error(LIBUSB_ERROR_NO_DEVICE);
+    default:                        return make_libusb_error(LIBUSB_ERROR_IO);
+    }
+  }
+
+  // Same results as libusb_bulk_transfer and libusb_interrupt_transfer, on top of the
+  // asynchronous API so that interrupt() can end it.
+  error_code_t sync_transfer(unsigned char type, unsigned char endpoint,
+    unsigned char* data, size_t length, size_t& transferred, unsigned int timeout) noexcept
+  {
+    assert(is_open());
+
+    transferred = 0;
+    unsigned int generation = cancel_generation_.load(std::memory_order_acquire);
+
+    transfer t;
+    t.buffer_ = data;
+    t.size_ = length;
+
+    error_code_t ec = t.prepare(this);
+    if (ec)
+      return ec;
+
+    t.ptransfer_->endpoint = endpoint;
+    t.ptransfer_->type = type;
+    t.ptransfer_->timeout = timeout;
+
+    t.completed_ = 0;
+    int status = libusb_submit_transfer(t.ptransfer_);
+    if (status != LIBUSB_SUCCESS) {
+      t.completed_ = 1;
+      return make_libusb_error(status);
+    }
+
+    bool cancelled = false;
+    while (!t.is_completed()) {
+      if (!cancelled && cancel_generation_.load(std::memory_order_acquire) != generation) {
+        cancelled = true;
+        (void)t.cancel();
+      }
+
+      timeval tv;
+      tv.tv_sec   = 0;
+      tv.tv_usec  = static_cast<long int>(interrupt_slice_ms * 1000);
+
+      // as libusb's own synchronous calls: the transfer cannot be left behind, keep going
+      status = libusb_handle_events_timeout_completed(context_, &tv, &t.completed_);
+      if (status != LIBUSB_SUCCESS && status != LIBUSB_ERROR_INTERRUPTED && !cancelled) {
+        cancelled = true;
+        (void)t.cancel();
+      }
+    }
+
+    transferred = t.transferred();
+    if (cancelled && t.status_ == LIBUSB_TRANSFER_CANCELLED)
+      return std::make_error_code(std::errc::operation_canceled);
+
+    return make_sync_error(t.status_);
+  }
+
+  static void LIBUSB_CALL pollfd_added_cb(int fd, short events, void* user_data) noexcept
+  {
+    auto self = static_cast<device*>(user_data);
+    if (self->pollfd_added_ != nullptr)
+      self->pollfd_added_(fd, events, self->pollfd_user_data_);
+  }
+
+  static void LIBUSB_CALL pollfd_removed_cb(int fd, void* user_data) noexcept
+  {
+    auto self = static_cast<device*>(user_data);
+    if (self->pollfd_removed_ != nullptr)
+      self->pollfd_removed_(fd, self->pollfd_user_data_);
+  }
+
+  // libusb only reports changes: the descriptors already there are announced (or withdrawn) here
+  void announce_pollfds(bool added) noexcept
+  {
+    const libusb_pollfd** list = libusb_get_pollfds(context_);
+    if (list == nullptr)
+      return;
+
+    for (const libusb_pollfd** p = list; *p != nullptr; ++ p) {
+      if (added)
+        pollfd_added_cb((*p)->fd, (*p)->events, this);
+      else
+        pollfd_removed_cb((*p)->fd, this);
+    }
+
+    libusb_free_pollfds(list);
+  }
+
+  void watch_pollfds() noexcept
+  {
+    if (pollfd_added_ == nullptr && pollfd_removed_ == nullptr) {
+      libusb_set_pollfd_notifiers(context_, nullptr, nullptr, nullptr);
+      return;
+    }
+
+    libusb_set_pollfd_notifiers(context_, &pollfd_added_cb, &pollfd_removed_cb, this);
+    announce_pollfds(true);
+  }
+
   int fill_interface_info() noexcept
   {
     int status;
@@ -161,6 +413,12 @@ public:
       }
 
       ed.maximum_packet_size = es.wMaxPacketSize;
+      if (ed.type == endpoint_type::isochronous) {
+        // high bandwidth endpoints move several transactions per microframe
+        int iso_packet_size = libusb_get_max_iso_packet_size(device_, ed.address);
+        if (iso_packet_size > 0)
+          ed.maximum_packet_size = static_cast<unsigned short>(iso_packet_size);
+      }
       ed.maximum_transfer_size = 2 * 1024 * 1024; // TODO: get maximum transfer size from underlaying system
     }
 
@@ -190,7 +448,7 @@ public:
     return make_libusb_error(status);
   }
 
-  error_code_t create_fds(const char * /* uri */) noexcept
+  error_code_t create_fds(const char *uri) noexcept
   {
     assert(context_ == NULL);
     assert(device_ == NULL);
@@ -211,6 +469,16 @@ public:
     int matched_index = 0;
     ssize_t ndev;
 
+    device_filter filter;
+    ec = parse_device_filter(uri, filter, false);
+    if (ec)
+      return ec;
+
+    if (filter.vid < 0 && filter.pid < 0) {
+      filter.vid = KSD_MPL1_VID;
+      filter.pid = KSD_MPL1_PID;
+    }
+
     status = libusb_init(&context);
     if (status != 0)
       goto cleanup0;
@@ -224,6 +492,9 @@ public:
     if (ndev < 0)
       goto cleanup1;
 
+    if (!filter.serial.empty())
+      prune_serial_numbers(list, ndev);
+
     for (ssize_t i = 0; i < ndev; ++i) {
       libusb_device* device = list[i];
 
@@ -232,7 +503,7 @@ public:
       if (status != 0)
         goto cleanup2;
 
-      if (device_descriptor.idVendor == KSD_MPL1_VID && device_descriptor.idProduct == KSD_MPL1_PID) {
+      if (match_device(filter, device, device_descriptor)) {
         if (matched_index == index) {
           status = libusb_open(device, &device_handle);
           if (status != 0)
@@ -267,6 +538,11 @@ public:
     : context_{nullptr}
     , device_{nullptr}
     , device_handle_{nullptr}
+    , ii_{}
+    , pollfd_added_{nullptr}
+    , pollfd_removed_{nullptr}
+    , pollfd_user_data_{nullptr}
+    , cancel_generation_{0}
   {
   }
 
@@ -293,6 +569,9 @@ public:
       libusb_close(device_handle_);
       device_handle_ = nullptr;
 
+      libusb_set_pollfd_notifiers(context_, nullptr, nullptr, nullptr);
+      announce_pollfds(false);
+
       libusb_exit(context_);
       context_ = nullptr;
 
@@ -316,8 +595,10 @@ public:
     ec = configure_device();
     if (ec) {
       close();
+      return ec;
     }
 
+    watch_pollfds();
     return ec;
   }
 
@@ -334,6 +615,101 @@ public:
     return make_libusb_error(result);
   }
 
+  /**
+   * @brief Ends the blocking transfers in progress (operation_canceled) and wakes the threads
+   * waiting for events; callable from any thread while the device is open.
+   */
+  void interrupt() noexcept
+  {
+    assert(is_open());
+
+    cancel_generation_.fetch_add(1, std::memory_order_acq_rel);
+    libusb_interrupt_event_handler(context_);
+  }
+
+  unsigned int cancel_generation() const noexcept
+  {
+    return cancel_generation_.load(std::memory_order_acquire);
+  }
+
+  error_code_t get_pollfds(std::vector<pollfd_info>& fds) noexcept
+  {
+    assert(is_open());
+
+    const libusb_pollfd** list = libusb_get_pollfds(context_);
+    if (list == nullptr)
+      return make_libusb_error(LIBUSB_ERROR_NOT_SUPPORTED);
+
+    error_code_t ec{};
+    try {
+      fds.clear();
+      for (const libusb_pollfd** p = list; *p != nullptr; ++ p)
+        fds.push_back(pollfd_info{ (*p)->fd, (*p)->events });
+    } catch (...) {
+      ec = error::no_mem;
+    }
+
+    libusb_free_pollfds(list);
+    return ec;
+  }
+
+  error_code_t set_pollfd_notifiers(pollfd_added_fn added, pollfd_removed_fn removed, void* user_data) noexcept
+  {
+    pollfd_added_ = added;
+    pollfd_removed_ = removed;
+    pollfd_user_data_ = user_data;
+
+    if (is_open())
+      watch_pollfds();
+
+    return {};
+  }
+
+  error_code_t get_next_timeout(int& ms) noexcept
+  {
+    assert(is_open());
+
+    timeval tv{};
+    int result = libusb_get_next_timeout(context_, &tv);
+    if (result < 0)
+      return make_libusb_error(result);
+
+    // rounded up, an early wake up would only come back here
+    ms = (result == 0) ? -1 : static_cast<int>(tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000);
+    return {};
+  }
+
+  error_code_t process_events() noexcept
+  {
+    assert(is_open());
+
+    timeval tv{};
+    int result = libusb_handle_events_timeout_completed(context_, &tv, nullptr);
+    return make_libusb_error(result);
+  }
+
+  // Memory for transfers the transport owns: libusb maps it from usbfs where the platform has
+  // that, so the controller transfers into it without a bounce copy; page aligned heap otherwise.
+  unsigned char* allocate_buffer(size_t size, bool& mapped) noexcept
+  {
+    constexpr size_t page_size = 4096;
+
+    unsigned char* p = libusb_dev_mem_alloc(device_handle_, size);
+    mapped = (p != nullptr);
+    if (mapped)
+      return p;
+
+    return static_cast<unsigned char*>(std::aligned_alloc(page_size, (size + page_size - 1) / page_size * page_size));
+  }
+
+  void free_buffer(unsigned char* buffer, size_t size, bool mapped) noexcept
+  {
+    if (mapped)
+      (void)libusb_dev_mem_free(device_handle_, buffer, size);
+    else
+      std::free(buffer);
+  }
+
   error_code_t submit_bulk(unsigned char endpoint, transfer& transfer) noexcept
   {
     assert(is_open());
@@ -355,6 +731,119 @@ public:
     return make_libusb_error(status);
   }
 
+  error_code_t submit_interrupt(unsigned char endpoint, transfer& transfer) noexcept
+  {
+    assert(is_open());
+
+    error_code_t ec = transfer.prepare(this);
+    if (ec)
+      return ec;
+
+    transfer.ptransfer_->endpoint = endpoint;
+    transfer.ptransfer_->type = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+
+    int status;
+    transfer.completed_ = 0;
+    status = libusb_submit_transfer(transfer.ptransfer_);
+    if (status != LIBUSB_SUCCESS) {
+      transfer.completed_ = 1;
+    }
+
+    return make_libusb_error(status);
+  }
+
+  error_code_t submit_control(transfer& transfer,
+      unsigned char bmRequestType, unsigned char bRequest, unsigned short wValue, unsigned short wIndex, unsigned short wLength,
+      unsigned int timeout) noexcept
+  {
+    assert(is_open());
+    assert(transfer.size_ >= control_setup_size + wLength);
+
+    error_code_t ec = transfer.prepare(this);
+    if (ec)
+      return ec;
+
+    libusb_fill_control_setup(transfer.buffer_, bmRequestType, bRequest, wValue, wIndex, wLength);
+    transfer.ptransfer_->endpoint = 0;
+    transfer.ptransfer_->type = LIBUSB_TRANSFER_TYPE_CONTROL;
+    transfer.ptransfer_->length = static_cast<int>(control_setup_size + wLength);
+    transfer.ptransfer_->timeout = timeout;
+
+    int status;
+    transfer.completed_ = 0;
+    status = libusb_submit_transfer(transfer.ptransfer_);
+    if (status != LIBUSB_SUCCESS) {
+      transfer.completed_ = 1;
+    }
+
+    return make_libusb_error(status);
+  }
+
+  error_code_t submit_iso(unsigned char endpoint, iso_transfer& transfer) noexcept
+  {
+    assert(is_open());
+    assert(transfer.is_completed());
+    assert(transfer.ptransfer_ != nullptr);
+
+    transfer.owner_ = this;
+    transfer.ptransfer_->dev_handle = device_handle_;
+    transfer.ptransfer_->endpoint = endpoint;
+    transfer.ptransfer_->type = LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
+    libusb_set_iso_packet_lengths(transfer.ptransfer_, static_cast<unsigned int>(transfer.packet_size_));
+
+    int status;
+    transfer.completed_ = 0;
+    status = libusb_submit_transfer(transfer.ptransfer_);
+    if (status != LIBUSB_SUCCESS) {
+      transfer.completed_ = 1;
+    }
+
+    return make_libusb_error(status);
+  }
+
+  /**
+   * @brief Reaps a set of in-flight transfers (transfer or iso_transfer) in batches.
+   * Waits up to ms for the first completion; every event loop pass handles all transfers that
+   * finished meanwhile. The indices of all completed transfers of the set go to completed[], at
+   * most max_completed of them. Null entries are skipped.
+   */
+  template<typename T>
+  error_code_t wait_some(T* const* transfers, size_t n, size_t* completed, size_t max_completed, size_t& count, unsigned int ms) noexcept
+  {
+    assert(is_open());
+
+    auto collect = [&]() noexcept {
+      count = 0;
+      for (size_t i = 0; i < n && count < max_completed; ++ i) {
+        if (transfers[i] != nullptr && transfers[i]->is_completed())
+          completed[count ++] = i;
+      }
+      return count != 0;
+    };
+
+    if (collect())
+      return {};
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    for (;;) {
+      auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+      if (remaining.count() <= 0)
+        return error::timeout;
+
+      timeval tv;
+      tv.tv_sec   = static_cast<long int>(remaining.count() / 1000000);
+      tv.tv_usec  = static_cast<long int>(remaining.count() % 1000000);
+
+      int result;
+      result = libusb_handle_events_timeout_completed(context_, &tv, nullptr);
+      if (result != LIBUSB_SUCCESS)
+        return make_libusb_error(result);
+
+      if (collect())
+        return {};
+    }
+  }
+
   error_code_t control_transfer(
       unsigned char bmRequestType, unsigned char bRequest, unsigned short wValue, unsigned short wIndex, unsigned short wLength,
       unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept
@@ -382,11 +871,13 @@ public:
   error_code_t bulk_transfer(unsigned char endpoint,
     unsigned char* data, size_t length, size_t& transferred, unsigned int timeout) noexcept
   {
-    int status;
-    int actual_length = 0;
-    status = libusb_bulk_transfer(device_handle_, endpoint, data, static_cast<int>(length), &actual_length, timeout);
-    transferred = static_cast<size_t>(actual_length);
-    return make_libusb_error(status);
+    return sync_transfer(LIBUSB_TRANSFER_TYPE_BULK, endpoint, data, length, transferred, timeout);
+  }
+
+  error_code_t interrupt_transfer(unsigned char endpoint,
+    unsigned char* data, size_t length, size_t& transferred, unsigned int timeout) noexcept
+  {
+    return sync_transfer(LIBUSB_TRANSFER_TYPE_INTERRUPT, endpoint, data, length, transferred, timeout);
   }
 };
 
@@ -402,13 +893,13 @@ error_code_t transfer::prepare(device* owner) noexcept
 
     ptransfer_->dev_handle = owner->device_handle_;
     ptransfer_->flags = LIBUSB_TRANSFER_FREE_TRANSFER;
-    ptransfer_->timeout = 0;
     ptransfer_->callback = &transfer_callback_fn;
     ptransfer_->user_data = this;
   }
 
   owner_ = owner;
   transferred_ = 0;
+  ptransfer_->timeout = 0;
   ptransfer_->actual_length = 0;
   ptransfer_->buffer = buffer_;
   ptransfer_->length = static_cast<int>(size_);
@@ -441,6 +932,29 @@ error_code_t transfer::wait(unsigned int ms) noexcept
   return status();
 }
 
+inline
+error_code_t iso_transfer::wait(unsigned int ms) noexcept
+{
+  if (is_completed())
+    return status();
+
+  assert(owner_ != nullptr);
+
+  timeval tv;
+  tv.tv_sec   = static_cast<long int>(ms / 1000);
+  tv.tv_usec  = static_cast<long int>((ms % 1000) * 1000);
+
+  int result;
+  result = libusb_handle_events_timeout_completed(owner_->context_, &tv, &completed_);
+
+  if (result != LIBUSB_SUCCESS)
+    return make_libusb_error(result);
+
+  if (!completed_)
+    return error::timeout;
+
+  return status();
+}
 
 } // namespace libusb
 } // namespace usb
@@ -1,49 +1,86 @@
 #include "enumerate.hpp"
-#include <iostream>
+#include <algorithm>
 #include <libusb-1.0/libusb.h>
-#include <boost/url.hpp>
 #include "error.hpp"
+#include "serial_cache.hpp"
 
 namespace pilink {
 namespace transport {
 namespace usb {
 namespace libusb {
 
+[[nodiscard]]
+std::error_code parse_device_filter(const char* uri, device_filter& filter, bool strict) noexcept
+{
+    if (usb::parse_device_filter(uri, "LIBUSB", filter, strict))
+        return std::error_code(LIBUSB_ERROR_INVALID_PARAM, error_category_inst);
+
+    return {};
+}
+
+bool match_device(const device_filter& filter, libusb_device* device, const libusb_device_descriptor& desc) noexcept
+{
+    if (filter.vid >= 0 && filter.vid != desc.idVendor)
+        return false;
+    if (filter.pid >= 0 && filter.pid != desc.idProduct)
+        return false;
+    if (filter.bus >= 0 && filter.bus != libusb_get_bus_number(device))
+        return false;
+    if (!filter.port.empty()) {
+        uint8_t port[7];
+        int depth = libusb_get_port_numbers(device, port, sizeof(port));
+        if (depth < 0 || static_cast<size_t>(depth) != filter.port.size() ||
+            !std::equal(filter.port.begin(), filter.port.end(), port))
+            return false;
+    }
+    if (filter.addr >= 0 && filter.addr != libusb_get_device_address(device))
+        return false;
+
+    // last: the one that may have to open the device
+    if (!filter.serial.empty()) {
+        std::string serial;
+        if (get_serial_number(device, desc, serial) || serial != filter.serial)
+            return false;
+    }
+
+    return true;
+}
+
 [[nodiscard]]
 std::error_code enumerate_libusb(const char *format, std::vector<std::string> &v)
 {
-    using std::cout;
-    using std::endl;
+    device_filter filter;
+    if (auto ec = parse_device_filter(format, filter, true); ec)
+        return ec;
 
-    auto uri = boost::urls::parse_uri(format);
-    auto uriView = uri.value();
-    
-    if (uriView.scheme() != "LIBUSB")
-        return std::error_code(LIBUSB_ERROR_INVALID_PARAM, error_category_inst);
-    
     //  LIBUSB
     if (int code = libusb_init(NULL); code < 0)
         return std::error_code(code, error_category_inst);
-    
+
     libusb_device **list;
     ssize_t cnt = libusb_get_device_list(NULL, &list);
     if (cnt < 0){
         libusb_exit(NULL);
         return std::error_code(static_cast<int>(cnt), error_category_inst);
     }
+    if (!filter.serial.empty())
+        prune_serial_numbers(list, cnt);
+
     for (ssize_t i = 0; i < cnt; i++) {
         libusb_device *device = list[i];
         libusb_device_descriptor desc;
-        if (libusb_get_device_descriptor(device, &desc) != 0) continue; 
+        if (libusb_get_device_descriptor(device, &desc) != 0) continue;
+        if (!match_device(filter, device, desc)) continue;
+
         char vidStr [5];
         char pidStr [5];
         int bus = static_cast<int>(libusb_get_bus_number(device));
-        int port = static_cast<int>(libusb_get_port_number(device));
+        uint8_t port[7];
+        int depth = libusb_get_port_numbers(device, port, sizeof(port));
         int addr = static_cast<int>(libusb_get_device_address(device));
-        
+
         int nv = snprintf ( vidStr, 5, "%x", desc.idVendor );
         int np = snprintf ( pidStr, 5, "%x", desc.idProduct );
-        // cout << vidStr << ' ' << pidStr << ' ' << bus << ' ' << port << ' ' << addr << ' ' << nv << ' ' << np << endl;
         if (nv <= 0 && np <= 0) {
             libusb_free_device_list(list, 1);
             libusb_exit(NULL);
@@ -52,44 +89,17 @@ std::error_code enumerate_libusb(const char *format, std::vector<std::string> &v
         std::string vidString(vidStr);
         std::string pidString(pidStr);
 
-        bool isCorrect = true;
-        for (const auto queryParam : uriView.params()){
-            if (queryParam.key == "VID"){
-                if (queryParam.value != vidString) 
-                    isCorrect = false;
-            } else if (queryParam.key == "PID"){
-                if (queryParam.value != pidString) 
-                    isCorrect = false;
-            } else if (queryParam.key == "BUS"){
-                if (atoi(queryParam.value.c_str()) != static_cast<int>(bus))
-                    isCorrect = false;
-            } else if (queryParam.key == "PORT"){
-                if (atoi(queryParam.value.c_str()) != static_cast<int>(port))
-                    isCorrect = false;
-            } else if (queryParam.key == "ADDR"){
-                if (atoi(queryParam.value.c_str()) != static_cast<int>(addr))
-                    isCorrect = false;
-            } else {
-                libusb_free_device_list(list, 1);
-                libusb_exit(NULL);
-                return std::error_code(LIBUSB_ERROR_INVALID_PARAM, error_category_inst);
-            }
-        }
-        if (isCorrect){
-            std::string ss("LIBUSB://?");
-            ss += "VID=" + vidString + "&PID=" + pidString + 
-                "&BUS=" + std::to_string(bus) + "&PORT=" + 
-                std::to_string(port) + "&ADDR=" + std::to_string(addr);
-            v.push_back(std::move(ss));
-        }
-
+        std::string ss("LIBUSB://?");
+        ss += "VID=" + vidString + "&PID=" + pidString +
+            "&BUS=" + std::to_string(bus) + "&PORT=" +
+            format_port_chain(port, depth > 0 ? static_cast<size_t>(depth) : 0) + "&ADDR=" + std::to_string(addr);
+        v.push_back(std::move(ss));
     }
     libusb_free_device_list(list, 1);
     libusb_exit(NULL);
     return {};
 }
 
-
 } // namespace libusb
 } // namespace usb
 } // namespace transport
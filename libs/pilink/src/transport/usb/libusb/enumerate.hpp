@@ -2,12 +2,23 @@
 #include <system_error>
 #include <vector>
 #include <string>
+#include <libusb-1.0/libusb.h>
+#include "transport/usb/device_filter.hpp"
 
 namespace pilink {
 namespace transport {
 namespace usb {
 namespace libusb {
 
+using device_filter = usb::device_filter;
+
+// strict: unknown query keys are an error (enumeration), otherwise they are
+// left for the link layer (connect).
+[[nodiscard]]
+std::error_code parse_device_filter(const char* uri, device_filter& filter, bool strict) noexcept;
+
+bool match_device(const device_filter& filter, libusb_device* device, const libusb_device_descriptor& desc) noexcept;
+
 [[nodiscard]]
 std::error_code enumerate_libusb(const char* format, std::vector<std::string> &v);
 
@@ -0,0 +1,125 @@
+#include "transport/usb/libusb/serial_cache.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "transport/usb/device_filter.hpp"
+#include "transport/usb/libusb/error.hpp"
+
+namespace pilink {
+namespace transport {
+namespace usb {
+namespace libusb {
+
+namespace {
+
+struct serial_entry
+{
+  uint8_t address;
+  uint16_t vid;
+  uint16_t pid;
+  std::string serial;
+};
+
+struct serial_cache
+{
+  std::mutex mutex;
+  std::unordered_map<std::string, serial_entry> entries;   // by port path
+};
+
+serial_cache& cache() noexcept
+{
+  static serial_cache instance;
+  return instance;
+}
+
+// as sysfs names it: 1-2.4 is bus 1, ports 2 then 4
+std::string port_path(libusb_device* device)
+{
+  uint8_t ports[8];
+  int depth = libusb_get_port_numbers(device, ports, sizeof(ports));
+
+  std::string path = std::to_string(static_cast<unsigned int>(libusb_get_bus_number(device)));
+  if (depth > 0)
+    path += '-' + format_port_chain(ports, static_cast<size_t>(depth));
+
+  return path;
+}
+
+} // namespace
+
+std::error_code get_serial_number(libusb_device* device, const libusb_device_descriptor& desc, std::string& serial) noexcept
+{
+  auto& c = cache();
+  uint8_t address = libusb_get_device_address(device);
+
+  try {
+    std::string path = port_path(device);
+
+    {
+      std::lock_guard<std::mutex> lock(c.mutex);
+      auto it = c.entries.find(path);
+      if (it != c.entries.end()) {
+        const auto& e = it->second;
+        if (e.address == address && e.vid == desc.idVendor && e.pid == desc.idProduct) {
+          serial = e.serial;
+          return {};
+        }
+
+        c.entries.erase(it);
+      }
+    }
+
+    // opened without the lock: other scans go on meanwhile
+    serial.clear();
+    if (desc.iSerialNumber != 0) {
+      libusb_device_handle* handle = nullptr;
+      int status = libusb_open(device, &handle);
+      if (status != 0)
+        return make_libusb_error(status);
+
+      unsigned char buffer[256];
+      int length = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, buffer, sizeof(buffer));
+      libusb_close(handle);
+      if (length < 0)
+        return make_libusb_error(length);
+
+      serial.assign(reinterpret_cast<const char*>(buffer), static_cast<size_t>(length));
+    }
+
+    std::lock_guard<std::mutex> lock(c.mutex);
+    c.entries[path] = serial_entry{ address, desc.idVendor, desc.idProduct, serial };
+  } catch (...) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  return {};
+}
+
+void prune_serial_numbers(libusb_device* const* list, ssize_t count) noexcept
+{
+  auto& c = cache();
+
+  try {
+    std::vector<std::string> present;
+    present.reserve(static_cast<size_t>(count));
+    for (ssize_t i = 0; i < count; ++ i)
+      present.push_back(port_path(list[i]));
+
+    std::lock_guard<std::mutex> lock(c.mutex);
+    for (auto it = c.entries.begin(); it != c.entries.end(); ) {
+      if (std::find(present.begin(), present.end(), it->first) == present.end())
+        it = c.entries.erase(it);
+      else
+        ++ it;
+    }
+  } catch (...) {
+    // stale entries are harmless, the address check catches them
+  }
+}
+
+} // namespace libusb
+} // namespace usb
+} // namespace transport
+} // namespace pilink
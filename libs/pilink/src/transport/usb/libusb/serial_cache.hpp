@@ -0,0 +1,34 @@
+#ifndef PILINK_TRANSPORT_USB_LIBUSB_SERIAL_CACHE_HPP
+#define PILINK_TRANSPORT_USB_LIBUSB_SERIAL_CACHE_HPP
+
+#include <string>
+#include <system_error>
+#include <libusb-1.0/libusb.h>
+
+namespace pilink {
+namespace transport {
+namespace usb {
+namespace libusb {
+
+/*
+ * Serial numbers by port path, process wide: reading one opens the device and costs milliseconds,
+ * a SERIAL= selection pays that once per device instead of once per device and connect.
+ *
+ * An entry holds while the device at that port keeps its address; the host gives a new one on
+ * every attach, so a device plugged in again or swapped for another is read anew. A scan drops
+ * the ports no longer present.
+ */
+
+// serial is empty for a device without iSerialNumber
+[[nodiscard]]
+std::error_code get_serial_number(libusb_device* device, const libusb_device_descriptor& desc, std::string& serial) noexcept;
+
+// the devices a scan found, the others are forgotten
+void prune_serial_numbers(libusb_device* const* list, ssize_t count) noexcept;
+
+} // namespace libusb
+} // namespace usb
+} // namespace transport
+} // namespace pilink
+
+#endif // PILINK_TRANSPORT_USB_LIBUSB_SERIAL_CACHE_HPP
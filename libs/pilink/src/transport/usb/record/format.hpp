@@ -0,0 +1,105 @@
+#ifndef PILINK_TRANSPORT_USB_RECORD_FORMAT_HPP
+#define PILINK_TRANSPORT_USB_RECORD_FORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+
+namespace pilink {
+namespace transport {
+namespace usb {
+namespace record {
+
+/*
+ * Recording of the transfers a pilink_usb link completed, written by recorder and played back by
+ * the REPLAY:// device. Host byte order, every structure a multiple of 8 bytes:
+ *
+ *   file_header_s, endpoint_s[endpoint_count]
+ *   { record_header_s, packet_s[packets], data[length], padding to 8 } ...
+ *
+ * Data is what moved: received for IN, sent for OUT and for control requests of either direction.
+ * For isochronous transfers length is the sum of the packets' lengths, their data back to back.
+ */
+
+constexpr char magic[4] = { 'P', 'L', 'R', 'C' };
+constexpr uint16_t version = 1;
+
+struct file_header_s
+{
+  char magic[4];
+  uint16_t version;
+  uint16_t endpoint_count;
+  uint64_t start_time_ns;         // system clock at the start, for the reader's information only
+  uint8_t interface_number;
+  uint8_t alternate_setting;
+  uint8_t interface_class;
+  uint8_t interface_subclass;
+  uint8_t interface_protocol;
+  uint8_t reserved[3];
+};
+
+struct endpoint_s
+{
+  uint8_t address;
+  uint8_t type;                   // endpoint_type
+  uint16_t maximum_packet_size;
+  uint32_t maximum_transfer_size;
+};
+
+struct record_header_s
+{
+  uint64_t time_ns;               // since the start, when the link took the completion
+  uint8_t endpoint;               // 0 for control requests
+  uint8_t type;                   // transfer_type
+  uint16_t reserved;
+  int32_t status;                 // errno value, 0 on success
+  uint32_t length;
+  uint32_t packets;               // isochronous only
+  uint8_t setup[8];               // control only
+};
+
+struct packet_s
+{
+  int32_t status;
+  uint32_t length;
+};
+
+static_assert(sizeof(file_header_s) == 24, "file_header_s layout");
+static_assert(sizeof(endpoint_s) == 8, "endpoint_s layout");
+static_assert(sizeof(record_header_s) == 32, "record_header_s layout");
+static_assert(sizeof(packet_s) == 8, "packet_s layout");
+
+constexpr size_t padded(size_t size) noexcept
+{
+  return (size + 7) & ~size_t{7};
+}
+
+// statuses as in the device layer: a device error code stands for its errno meaning
+inline
+int32_t to_record(std::error_code ec) noexcept
+{
+  if (!ec)
+    return 0;
+
+  std::error_condition condition = ec.default_error_condition();
+  if (condition.category() == std::generic_category())
+    return condition.value();
+
+  return static_cast<int32_t>(std::errc::io_error);
+}
+
+inline
+std::error_code from_record(int32_t status) noexcept
+{
+  if (status == 0)
+    return {};
+
+  return std::error_code(status, std::generic_category());
+}
+
+} // namespace record
+} // namespace usb
+} // namespace transport
+} // namespace pilink
+
+#endif // PILINK_TRANSPORT_USB_RECORD_FORMAT_HPP
@@ -0,0 +1,200 @@
+#include "transport/usb/record/recorder.hpp"
+#include <cerrno>
+
+namespace pilink {
+namespace transport {
+namespace usb {
+namespace record {
+
+recorder::recorder() noexcept
+  : file_{nullptr}
+  , start_{}
+  , writer_{}
+  , mutex_{}
+  , data_cv_{}
+  , space_cv_{}
+  , active_{}
+  , stop_{false}
+  , error_{}
+{
+}
+
+recorder::~recorder()
+{
+  (void)close();
+}
+
+std::error_code recorder::open(const char *path, const interface_info& ii) noexcept
+{
+  if (file_ != nullptr)
+    return std::make_error_code(std::errc::already_connected);
+
+  file_header_s h{};
+  ::memcpy(h.magic, magic, sizeof(h.magic));
+  h.version = version;
+  h.endpoint_count = ii.bNumEndpoints;
+  h.start_time_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count());
+  h.interface_number = ii.bInterfaceNumber;
+  h.alternate_setting = ii.bAlternateSetting;
+  h.interface_class = ii.bInterfaceClass;
+  h.interface_subclass = ii.bInterfaceSubClass;
+  h.interface_protocol = ii.bInterfaceProtocol;
+
+  std::error_code ec;
+
+  do {
+    file_ = std::fopen(path, "wb");
+    if (file_ == nullptr) {
+      ec = std::error_code(errno, std::generic_category());
+      break;
+    }
+
+    bool written = (std::fwrite(&h, sizeof(h), 1, file_) == 1);
+    for (size_t i = 0; written && i < ii.bNumEndpoints; ++ i) {
+      const auto& e = ii.endpoints[i];
+      endpoint_s endpoint{ e.address, static_cast<uint8_t>(e.type), e.maximum_packet_size, e.maximum_transfer_size };
+      written = (std::fwrite(&endpoint, sizeof(endpoint), 1, file_) == 1);
+    }
+
+    if (!written) {
+      ec = std::make_error_code(std::errc::io_error);
+      break;
+    }
+
+    try {
+      active_.reserve(buffer_size);
+      stop_ = false;
+      error_ = {};
+      start_ = clock::now();
+      writer_ = std::thread(&recorder::writer_fn, this);
+    } catch (...) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+    }
+  } while (false);
+
+  if (ec && file_ != nullptr) {
+    std::fclose(file_);
+    file_ = nullptr;
+  }
+
+  return ec;
+}
+
+std::error_code recorder::close() noexcept
+{
+  if (file_ == nullptr)
+    return {};
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  data_cv_.notify_one();
+  space_cv_.notify_all();
+  writer_.join();
+
+  std::error_code ec = error_;
+  if (std::fclose(file_) != 0 && !ec)
+    ec = std::make_error_code(std::errc::io_error);
+
+  file_ = nullptr;
+  active_.clear();
+  return ec;
+}
+
+void recorder::writer_fn() noexcept
+{
+  std::vector<unsigned char> pending;
+  try {
+    pending.reserve(buffer_size);
+  } catch (...) {
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    data_cv_.wait_for(lock, std::chrono::milliseconds(flush_ms),
+      [this]() { return stop_ || active_.size() >= buffer_size / 2; });
+
+    if (active_.empty()) {
+      if (stop_)
+        break;
+      continue;
+    }
+
+    active_.swap(pending);
+    space_cv_.notify_all();
+
+    bool failed = static_cast<bool>(error_);
+    lock.unlock();
+
+    bool written = failed || std::fwrite(pending.data(), 1, pending.size(), file_) == pending.size();
+    pending.clear();
+
+    lock.lock();
+    if (!written)
+      error_ = std::make_error_code(std::errc::io_error);
+  }
+}
+
+// Space for a record at the end of the buffer, zeroed; waits while the writer is a buffer behind.
+unsigned char* recorder::append(std::unique_lock<std::mutex>& lock, size_t size) noexcept
+{
+  if (file_ == nullptr)
+    return nullptr;
+
+  while (!stop_ && !active_.empty() && active_.size() + size > buffer_size) {
+    data_cv_.notify_one();
+    space_cv_.wait(lock);
+  }
+
+  if (stop_)
+    return nullptr;
+
+  size_t at = active_.size();
+  try {
+    active_.resize(at + size);
+  } catch (...) {
+    if (!error_)
+      error_ = std::make_error_code(std::errc::not_enough_memory);
+    return nullptr;
+  }
+
+  if (active_.size() >= buffer_size / 2)
+    data_cv_.notify_one();
+
+  return active_.data() + at;
+}
+
+record_header_s recorder::header(unsigned char endpoint, transfer_type type, std::error_code status) const noexcept
+{
+  record_header_s h{};
+  h.time_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start_).count());
+  h.endpoint = endpoint;
+  h.type = static_cast<uint8_t>(type);
+  h.status = to_record(status);
+  return h;
+}
+
+void recorder::add(unsigned char endpoint, transfer_type type, std::error_code status,
+  const unsigned char *data, size_t length, const unsigned char *setup) noexcept
+{
+  record_header_s h = header(endpoint, type, status);
+  h.length = static_cast<uint32_t>(length);
+  if (setup != nullptr)
+    ::memcpy(h.setup, setup, sizeof(h.setup));
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  unsigned char *p = append(lock, sizeof(h) + padded(length));
+  if (p == nullptr)
+    return;
+
+  ::memcpy(p, &h, sizeof(h));
+  if (length != 0)
+    ::memcpy(p + sizeof(h), data, length);
+}
+
+} // namespace record
+} // namespace usb
+} // namespace transport
+} // namespace pilink
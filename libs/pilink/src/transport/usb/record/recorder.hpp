@@ -0,0 +1,106 @@
+#ifndef PILINK_TRANSPORT_USB_RECORD_RECORDER_HPP
+#define PILINK_TRANSPORT_USB_RECORD_RECORDER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <system_error>
+#include "transport/usb/usb_base.hpp"
+#include "transport/usb/record/format.hpp"
+
+namespace pilink {
+namespace transport {
+namespace usb {
+namespace record {
+
+/**
+ * @brief Writes the transfers of a link to a recording (record/format.hpp).
+ * Transfers are appended to a buffer under a lock and written out by a thread of its own, so the
+ * link's threads never wait for the disk unless it falls a whole buffer behind; then they do,
+ * rather than leave a gap in the recording.
+ */
+class recorder
+{
+private:
+  using clock = std::chrono::steady_clock;
+
+  static constexpr size_t buffer_size = 4 * 1024 * 1024;
+  static constexpr unsigned int flush_ms = 100;
+
+  std::FILE *file_;
+  clock::time_point start_;
+  std::thread writer_;
+  std::mutex mutex_;
+  std::condition_variable data_cv_;     // for the writer
+  std::condition_variable space_cv_;    // for the link's threads
+  std::vector<unsigned char> active_;   // appended to while the writer writes the other one
+  bool stop_;
+  std::error_code error_;               // the first write that failed, later transfers are lost
+
+  void writer_fn() noexcept;
+  unsigned char* append(std::unique_lock<std::mutex>& lock, size_t size) noexcept;
+  record_header_s header(unsigned char endpoint, transfer_type type, std::error_code status) const noexcept;
+
+public:
+  recorder() noexcept;
+  ~recorder();
+
+  recorder(const recorder&) = delete;
+  recorder& operator=(const recorder&) = delete;
+
+  [[nodiscard]]
+  std::error_code open(const char *path, const interface_info& ii) noexcept;
+
+  // writes out what is buffered; the result of the writing as a whole
+  std::error_code close() noexcept;
+
+  // setup: the 8 bytes of a control request, null for the other types
+  void add(unsigned char endpoint, transfer_type type, std::error_code status,
+    const unsigned char *data, size_t length, const unsigned char *setup = nullptr) noexcept;
+
+  template<typename iso_transfer>
+  void add_iso(unsigned char endpoint, const iso_transfer& t) noexcept;
+};
+
+template<typename iso_transfer>
+void recorder::add_iso(unsigned char endpoint, const iso_transfer& t) noexcept
+{
+  record_header_s h = header(endpoint, transfer_type::isochronous, t.status());
+
+  size_t length = 0;
+  for (size_t i = 0; i < t.packets(); ++ i)
+    length += t.packet_length(i);
+
+  h.length = static_cast<uint32_t>(length);
+  h.packets = static_cast<uint32_t>(t.packets());
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  unsigned char *p = append(lock, sizeof(h) + t.packets() * sizeof(packet_s) + padded(length));
+  if (p == nullptr)
+    return;
+
+  ::memcpy(p, &h, sizeof(h));
+  p += sizeof(h);
+
+  for (size_t i = 0; i < t.packets(); ++ i) {
+    packet_s packet{ to_record(t.packet_status(i)), static_cast<uint32_t>(t.packet_length(i)) };
+    ::memcpy(p, &packet, sizeof(packet));
+    p += sizeof(packet);
+  }
+
+  for (size_t i = 0; i < t.packets(); ++ i) {
+    ::memcpy(p, t.packet_data(i), t.packet_length(i));
+    p += t.packet_length(i);
+  }
+}
+
+} // namespace record
+} // namespace usb
+} // namespace transport
+} // namespace pilink
+
+#endif // PILINK_TRANSPORT_USB_RECORD_RECORDER_HPP
@@ -0,0 +1,833 @@
+#ifndef PILINK_TRANSPORT_USB_REPLAY_HPP
+#define PILINK_TRANSPORT_USB_REPLAY_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <system_error>
+
+#include "transport/usb/usb_base.hpp"
+#include "transport/usb/record/format.hpp"
+#include "transport/usb/replay/recording.hpp"
+
+namespace pilink {
+namespace transport {
+namespace usb {
+namespace replay {
+
+/*
+ * Device for pilink_usb<device> that plays a recording back (record/recorder.hpp), same interface
+ * as libusb::device: REPLAY://?FILE=<path>&SPEED=<factor>.
+ *
+ * Each endpoint's transfers take that endpoint's recorded transfers in order: IN data and status
+ * as recorded, a recorded transfer larger than the one asking split over as many as it takes;
+ * OUT and control requests the recorded status (control IN its data). A transfer completes no
+ * earlier than its record did, counted from open and scaled by SPEED, so a faster consumer is
+ * held to the recorded pace and a slower one gets the backlog at once. Once an endpoint's
+ * recording is over its IN transfers fail with no_such_device, OUT ones succeed. Nothing checks
+ * that what is written matches what was.
+ */
+
+using error_code_t = std::error_code;
+
+class device;
+
+// where a stream is read: record, and bytes of it (packets and their bytes, isochronous) taken
+struct cursor
+{
+  size_t record = 0;
+  size_t offset = 0;
+  size_t data = 0;
+};
+
+inline
+bool is_before(const cursor& a, const cursor& b) noexcept
+{
+  return a.record < b.record || (a.record == b.record && a.offset < b.offset);
+}
+
+// a submitted transfer: its outcome is decided at submission, it completes once due
+class pending
+{
+private:
+public:
+  device* owner_;
+  pending* prev_;
+  pending* next_;
+  std::chrono::steady_clock::time_point due_;
+  size_t stream_;
+  cursor taken_from_;     // given back if cancelled before due
+  bool cancelled_;
+  error_code_t status_;
+  size_t transferred_;
+  std::atomic<int> completed_;
+
+public:
+  pending() noexcept
+    : owner_ { nullptr }
+    , prev_ { nullptr }
+    , next_ { nullptr }
+    , due_ {}
+    , stream_ { 0 }
+    , taken_from_ {}
+    , cancelled_ { false }
+    , status_ {}
+    , transferred_ { 0 }
+    , completed_ { 1 }
+  {
+  }
+
+  pending(const pending&) = delete;
+  pending& operator=(const pending&) = delete;
+
+  bool is_completed() const noexcept
+  {
+    return (completed_.load(std::memory_order_acquire) != 0);
+  }
+
+  error_code_t status() const noexcept
+  {
+    if (!is_completed())
+      return std::make_error_code(std::errc::operation_would_block);
+
+    return status_;
+  }
+};
+
+class transfer : public pending
+{
+public:
+  unsigned char* buffer_;
+  size_t size_;
+
+public:
+  transfer() noexcept
+    : pending {}
+    , buffer_ { nullptr }
+    , size_ { 0 }
+  {
+  }
+
+  ~transfer() noexcept
+  {
+    assert(is_completed());
+  }
+
+  size_t transferred() const noexcept
+  {
+    return transferred_;
+  }
+
+  error_code_t wait(unsigned int ms) noexcept;
+
+  error_code_t cancel() noexcept;
+};
+
+class iso_transfer : public pending
+{
+private:
+public:
+  std::unique_ptr<unsigned char[]> buffer_;
+  std::unique_ptr<record::packet_s[]> descriptors_;
+  size_t packets_;
+  size_t packet_size_;
+
+public:
+  iso_transfer() noexcept
+    : pending {}
+    , buffer_ {}
+    , descriptors_ {}
+    , packets_ { 0 }
+    , packet_size_ { 0 }
+  {
+  }
+
+  ~iso_transfer() noexcept
+  {
+    assert(is_completed());
+  }
+
+  error_code_t allocate(size_t packets, size_t packet_size) noexcept
+  {
+    assert(!descriptors_);
+
+    buffer_.reset(::new (std::nothrow) unsigned char[packets * packet_size]);
+    descriptors_.reset(::new (std::nothrow) record::packet_s[packets]);
+    if (!buffer_ || !descriptors_) {
+      release();
+      return std::make_error_code(std::errc::not_enough_memory);
+    }
+
+    packets_ = packets;
+    packet_size_ = packet_size;
+    return {};
+  }
+
+  void release() noexcept
+  {
+    assert(is_completed());
+
+    buffer_.reset();
+    descriptors_.reset();
+    packets_ = 0;
+  }
+
+  size_t packets() const noexcept
+  {
+    return packets_;
+  }
+
+  error_code_t packet_status(size_t i) const noexcept
+  {
+    return record::from_record(descriptors_[i].status);
+  }
+
+  size_t packet_length(size_t i) const noexcept
+  {
+    return descriptors_[i].length;
+  }
+
+  const unsigned char* packet_data(size_t i) const noexcept
+  {
+    return buffer_.get() + i * packet_size_;
+  }
+
+  error_code_t wait(unsigned int ms) noexcept;
+
+  error_code_t cancel() noexcept;
+};
+
+class device
+{
+public:
+  using transfer_t = transfer;
+  using iso_transfer_t = iso_transfer;
+
+  static constexpr size_t control_setup_size = 8;
+
+private:
+public:
+  using clock = std::chrono::steady_clock;
+
+  // waits are cut in slices so an interrupt is seen even when its wake up went to another thread
+  static constexpr unsigned int interrupt_slice_ms = 100;
+
+  recording recording_;
+  bool open_;
+  double speed_;              // 0: no pacing
+  clock::time_point origin_;  // the recording's start, here
+
+  // under mutex_: where each stream is read, the last due time handed out on it (a stream
+  // completes in order) and the transfers not yet completed
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  cursor cursors_[recording::stream_count];
+  clock::time_point last_due_[recording::stream_count];
+  pending* pending_;
+
+  // bumped by interrupt(): blocking transfers started before give up
+  std::atomic<unsigned int> cancel_generation_;
+
+  clock::time_point due_at(const record::record_header_s& r, size_t stream) noexcept
+  {
+    auto due = origin_;
+    if (speed_ > 0.0)
+      due += std::chrono::nanoseconds(static_cast<int64_t>(static_cast<double>(r.time_ns) / speed_));
+
+    due = std::max(due, last_due_[stream]);
+    last_due_[stream] = due;
+    return due;
+  }
+
+  clock::time_point due_now(size_t stream) noexcept
+  {
+    last_due_[stream] = std::max(clock::now(), last_due_[stream]);
+    return last_due_[stream];
+  }
+
+  void take_in(pending& t, unsigned char* data, size_t size) noexcept
+  {
+    const auto& stream = recording_.stream(t.stream_);
+    auto& c = cursors_[t.stream_];
+
+    if (c.record >= stream.size()) {
+      t.status_ = std::make_error_code(std::errc::no_such_device);
+      t.due_ = due_now(t.stream_);
+      return;
+    }
+
+    const auto& e = stream[c.record];
+    size_t n = std::min(size, e.header->length - c.offset);
+    if (n != 0)
+      ::memcpy(data, e.data + c.offset, n);
+
+    t.transferred_ = n;
+    t.due_ = due_at(*e.header, t.stream_);
+
+    // the status goes with the last part of the record
+    c.offset += n;
+    if (c.offset == e.header->length) {
+      t.status_ = record::from_record(e.header->status);
+      ++ c.record;
+      c.offset = 0;
+    }
+  }
+
+  void take_out(pending& t, size_t size) noexcept
+  {
+    const auto& stream = recording_.stream(t.stream_);
+    auto& c = cursors_[t.stream_];
+
+    if (c.record >= stream.size()) {
+      t.transferred_ = size;
+      t.due_ = due_now(t.stream_);
+      return;
+    }
+
+    const auto& e = stream[c.record ++];
+    t.status_ = record::from_record(e.header->status);
+    t.transferred_ = t.status_ ? std::min<size_t>(size, e.header->length) : size;
+    t.due_ = due_at(*e.header, t.stream_);
+  }
+
+  void take_control(pending& t, bool in, unsigned char* data, size_t length) noexcept
+  {
+    const auto& stream = recording_.stream(t.stream_);
+    auto& c = cursors_[t.stream_];
+
+    if (c.record >= stream.size()) {
+      t.transferred_ = in ? 0 : length;
+      t.due_ = due_now(t.stream_);
+      return;
+    }
+
+    const auto& e = stream[c.record ++];
+    t.status_ = record::from_record(e.header->status);
+    t.due_ = due_at(*e.header, t.stream_);
+
+    if (!in) {
+      t.transferred_ = t.status_ ? std::min<size_t>(length, e.header->length) : length;
+      return;
+    }
+
+    t.transferred_ = std::min<size_t>(length, e.header->length);
+    if (t.transferred_ != 0)
+      ::memcpy(data, e.data, t.transferred_);
+  }
+
+  void take_iso(iso_transfer& t) noexcept
+  {
+    const auto& stream = recording_.stream(t.stream_);
+    auto& c = cursors_[t.stream_];
+
+    for (size_t i = 0; i < t.packets_; ++ i) {
+      while (c.record < stream.size() && c.offset == stream[c.record].header->packets) {
+        ++ c.record;
+        c.offset = 0;
+        c.data = 0;
+      }
+
+      // the packets left over are empty, a transfer with none fails
+      if (c.record >= stream.size()) {
+        if (i == 0) {
+          t.status_ = std::make_error_code(std::errc::no_such_device);
+          t.due_ = due_now(t.stream_);
+        }
+
+        for (; i < t.packets_; ++ i)
+          t.descriptors_[i] = record::packet_s{ 0, 0 };
+        break;
+      }
+
+      const auto& e = stream[c.record];
+      const auto& packet = e.packets[c.offset];
+      uint32_t length = std::min(packet.length, static_cast<uint32_t>(t.packet_size_));
+
+      ::memcpy(t.buffer_.get() + i * t.packet_size_, e.data + c.data, length);
+      t.descriptors_[i] = record::packet_s{ packet.status, length };
+      t.status_ = record::from_record(e.header->status);
+      t.due_ = due_at(*e.header, t.stream_);
+
+      ++ c.offset;
+      c.data += packet.length;
+    }
+  }
+
+  void link(pending& t) noexcept
+  {
+    t.owner_ = this;
+    t.prev_ = nullptr;
+    t.next_ = pending_;
+    if (pending_ != nullptr)
+      pending_->prev_ = &t;
+    pending_ = &t;
+
+    t.completed_.store(0, std::memory_order_release);
+  }
+
+  void finish(pending& t, bool cancelled) noexcept
+  {
+    if (t.prev_ != nullptr)
+      t.prev_->next_ = t.next_;
+    else
+      pending_ = t.next_;
+    if (t.next_ != nullptr)
+      t.next_->prev_ = t.prev_;
+
+    // what it took is there for the next transfer
+    if (cancelled) {
+      t.status_ = std::make_error_code(std::errc::operation_canceled);
+      t.transferred_ = 0;
+      if (is_before(t.taken_from_, cursors_[t.stream_]))
+        cursors_[t.stream_] = t.taken_from_;
+    }
+
+    t.completed_.store(1, std::memory_order_release);
+  }
+
+  // under mutex_
+  void complete_due(clock::time_point now) noexcept
+  {
+    bool any = false;
+    for (pending* t = pending_; t != nullptr; ) {
+      pending* next = t->next_;
+      if (t->due_ <= now || t->cancelled_) {
+        finish(*t, t->due_ > now);
+        any = true;
+      }
+      t = next;
+    }
+
+    if (any)
+      cv_.notify_all();
+  }
+
+  // under mutex_
+  clock::time_point next_due() const noexcept
+  {
+    auto due = clock::time_point::max();
+    for (const pending* t = pending_; t != nullptr; t = t->next_)
+      due = std::min(due, t->due_);
+
+    return due;
+  }
+
+  void prepare(pending& t, unsigned char endpoint, transfer_type type) noexcept
+  {
+    assert(is_open());
+    assert(t.is_completed());
+
+    t.stream_ = recording::stream_of(endpoint, type);
+    t.taken_from_ = cursors_[t.stream_];
+    t.cancelled_ = false;
+    t.status_ = {};
+    t.transferred_ = 0;
+  }
+
+  error_code_t submit(transfer& transfer, unsigned char endpoint, transfer_type type) noexcept
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    prepare(transfer, endpoint, type);
+
+    if ((endpoint & 0x80) != 0)
+      take_in(transfer, transfer.buffer_, transfer.size_);
+    else
+      take_out(transfer, transfer.size_);
+
+    link(transfer);
+    return {};
+  }
+
+  error_code_t sync_transfer(unsigned char endpoint, transfer_type type,
+    unsigned char* data, size_t length, size_t& transferred, unsigned int timeout, const unsigned char* setup = nullptr) noexcept
+  {
+    transferred = 0;
+    unsigned int generation = cancel_generation();
+
+    transfer t;
+    t.buffer_ = data;
+    t.size_ = length;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      prepare(t, endpoint, type);
+
+      if (type == transfer_type::control)
+        take_control(t, (setup[0] & 0x80) != 0, data, length);
+      else if ((endpoint & 0x80) != 0)
+        take_in(t, data, length);
+      else
+        take_out(t, length);
+
+      link(t);
+    }
+
+    auto deadline = (timeout != 0) ? clock::now() + std::chrono::milliseconds(timeout) : clock::time_point::max();
+    bool expired = false;
+    bool interrupted = false;
+
+    while (!t.is_completed()) {
+      auto now = clock::now();
+      if (!interrupted && cancel_generation() != generation) {
+        interrupted = true;
+        (void)t.cancel();
+      } else if (!expired && now >= deadline) {
+        expired = true;
+        (void)t.cancel();
+      }
+
+      (void)wait_until(std::min(deadline, now + std::chrono::milliseconds(interrupt_slice_ms)),
+        [&t]() noexcept { return t.is_completed(); });
+    }
+
+    transferred = t.transferred_;
+    error_code_t ec = t.status_;
+    if (expired && !interrupted && ec == std::errc::operation_canceled)
+      ec = std::make_error_code(std::errc::timed_out);
+
+    return ec;
+  }
+
+public:
+  device() noexcept
+    : recording_{}
+    , open_{false}
+    , speed_{1.0}
+    , origin_{}
+    , mutex_{}
+    , cv_{}
+    , cursors_{}
+    , last_due_{}
+    , pending_{nullptr}
+    , cancel_generation_{0}
+  {
+  }
+
+  ~device()
+  {
+    if (is_open())
+      close();
+  }
+
+  bool is_open() const noexcept
+  {
+    return open_;
+  }
+
+  error_code_t close() noexcept
+  {
+    if (!is_open())
+      return std::make_error_code(std::errc::not_connected);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (pending_ != nullptr)
+      finish(*pending_, true);
+
+    recording_.clear();
+    open_ = false;
+    return {};
+  }
+
+  error_code_t open(const char* uri) noexcept
+  {
+    if (is_open())
+      return std::make_error_code(std::errc::already_connected);
+
+    std::string path;
+    error_code_t ec;
+    try {
+      ec = parse_replay_uri(uri, path, speed_);
+      if (!ec)
+        ec = recording_.load(path.c_str());
+    } catch (...) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+    }
+
+    if (ec)
+      return ec;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < recording::stream_count; ++ i) {
+      cursors_[i] = cursor{};
+      last_due_[i] = clock::time_point{};
+    }
+
+    origin_ = clock::now();
+    open_ = true;
+    return {};
+  }
+
+  const interface_info* get_interface_info() const noexcept
+  {
+    assert(is_open());
+    return &recording_.interface();
+  }
+
+  error_code_t reset_pipe(unsigned char) noexcept
+  {
+    return {};
+  }
+
+  // nothing to watch: completions come with time, see get_next_timeout
+  error_code_t get_pollfds(std::vector<pollfd_info>& fds) noexcept
+  {
+    fds.clear();
+    return {};
+  }
+
+  error_code_t set_pollfd_notifiers(pollfd_added_fn, pollfd_removed_fn, void*) noexcept
+  {
+    return {};
+  }
+
+  error_code_t get_next_timeout(int& ms) noexcept
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto due = next_due();
+    if (due == clock::time_point::max()) {
+      ms = -1;
+      return {};
+    }
+
+    auto left = std::chrono::duration_cast<std::chrono::microseconds>(due - clock::now()).count();
+    ms = (left <= 0) ? 0 : static_cast<int>(std::min<long long>((left + 999) / 1000, 0x7FFFFFFF));
+    return {};
+  }
+
+  error_code_t process_events() noexcept
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    complete_due(clock::now());
+    return {};
+  }
+
+  unsigned char* allocate_buffer(size_t size, bool& mapped) noexcept
+  {
+    mapped = false;
+    return ::new (std::nothrow) unsigned char[size];
+  }
+
+  void free_buffer(unsigned char* buffer, size_t, bool) noexcept
+  {
+    delete[] buffer;
+  }
+
+  /**
+   * @brief Completes what is due, then waits for done() until deadline or an interrupt,
+   * waking as each pending transfer falls due.
+   */
+  template<typename predicate>
+  bool wait_until(clock::time_point deadline, predicate done) noexcept
+  {
+    unsigned int generation = cancel_generation();
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    for (;;) {
+      auto now = clock::now();
+      complete_due(now);
+      if (done())
+        return true;
+
+      if (now >= deadline || cancel_generation() != generation)
+        return false;
+
+      cv_.wait_until(lock, std::min(deadline, next_due()));
+    }
+  }
+
+  void interrupt() noexcept
+  {
+    assert(is_open());
+
+    cancel_generation_.fetch_add(1, std::memory_order_acq_rel);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    cv_.notify_all();
+  }
+
+  unsigned int cancel_generation() const noexcept
+  {
+    return cancel_generation_.load(std::memory_order_acquire);
+  }
+
+  error_code_t submit_bulk(unsigned char endpoint, transfer& transfer) noexcept
+  {
+    return submit(transfer, endpoint, transfer_type::bulk);
+  }
+
+  error_code_t submit_interrupt(unsigned char endpoint, transfer& transfer) noexcept
+  {
+    return submit(transfer, endpoint, transfer_type::interrupt);
+  }
+
+  // timeouts are left to the caller: a control request due later than that is cancelled
+  error_code_t submit_control(transfer& transfer,
+      unsigned char bmRequestType, unsigned char bRequest, unsigned short wValue, unsigned short wIndex, unsigned short wLength,
+      unsigned int) noexcept
+  {
+    assert(transfer.size_ >= control_setup_size + wLength);
+
+    unsigned char* setup = transfer.buffer_;
+    setup[0] = bmRequestType;
+    setup[1] = bRequest;
+    setup[2] = static_cast<unsigned char>(wValue & 0xFF);
+    setup[3] = static_cast<unsigned char>(wValue >> 8);
+    setup[4] = static_cast<unsigned char>(wIndex & 0xFF);
+    setup[5] = static_cast<unsigned char>(wIndex >> 8);
+    setup[6] = static_cast<unsigned char>(wLength & 0xFF);
+    setup[7] = static_cast<unsigned char>(wLength >> 8);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    prepare(transfer, 0, transfer_type::control);
+    take_control(transfer, (bmRequestType & 0x80) != 0, transfer.buffer_ + control_setup_size, wLength);
+    link(transfer);
+    return {};
+  }
+
+  error_code_t submit_iso(unsigned char endpoint, iso_transfer& transfer) noexcept
+  {
+    assert(transfer.descriptors_);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    prepare(transfer, endpoint, transfer_type::isochronous);
+    take_iso(transfer);
+    link(transfer);
+    return {};
+  }
+
+  /**
+   * @brief Waits up to ms for any of a set of in-flight transfers (transfer or iso_transfer).
+   * The indices of all completed transfers of the set go to completed[], at most max_completed
+   * of them. Null entries are skipped.
+   */
+  template<typename T>
+  error_code_t wait_some(T* const* transfers, size_t n, size_t* completed, size_t max_completed, size_t& count, unsigned int ms) noexcept
+  {
+    assert(is_open());
+
+    auto any = [&]() noexcept {
+      for (size_t i = 0; i < n; ++ i) {
+        if (transfers[i] != nullptr && transfers[i]->is_completed())
+          return true;
+      }
+      return false;
+    };
+
+    (void)wait_until(clock::now() + std::chrono::milliseconds(ms), any);
+
+    count = 0;
+    for (size_t i = 0; i < n && count < max_completed; ++ i) {
+      if (transfers[i] != nullptr && transfers[i]->is_completed())
+        completed[count ++] = i;
+    }
+
+    if (count == 0)
+      return std::make_error_code(std::errc::timed_out);
+
+    return {};
+  }
+
+  error_code_t control_transfer(
+      unsigned char bmRequestType, unsigned char bRequest, unsigned short wValue, unsigned short wIndex, unsigned short wLength,
+      unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept
+  {
+    const unsigned char setup[control_setup_size] = {
+      bmRequestType, bRequest,
+      static_cast<unsigned char>(wValue & 0xFF), static_cast<unsigned char>(wValue >> 8),
+      static_cast<unsigned char>(wIndex & 0xFF), static_cast<unsigned char>(wIndex >> 8),
+      static_cast<unsigned char>(wLength & 0xFF), static_cast<unsigned char>(wLength >> 8)
+    };
+
+    return sync_transfer(0, transfer_type::control, data, std::min<size_t>(size, wLength), transferred, timeout, setup);
+  }
+
+  error_code_t bulk_transfer(unsigned char endpoint,
+    unsigned char* data, size_t length, size_t& transferred, unsigned int timeout) noexcept
+  {
+    return sync_transfer(endpoint, transfer_type::bulk, data, length, transferred, timeout);
+  }
+
+  error_code_t interrupt_transfer(unsigned char endpoint,
+    unsigned char* data, size_t length, size_t& transferred, unsigned int timeout) noexcept
+  {
+    return sync_transfer(endpoint, transfer_type::interrupt, data, length, transferred, timeout);
+  }
+};
+
+inline
+error_code_t transfer::wait(unsigned int ms) noexcept
+{
+  if (is_completed())
+    return status();
+
+  assert(owner_ != nullptr);
+
+  (void)owner_->wait_until(device::clock::now() + std::chrono::milliseconds(ms),
+    [this]() noexcept { return is_completed(); });
+
+  if (!is_completed())
+    return std::make_error_code(std::errc::timed_out);
+
+  return status();
+}
+
+inline
+error_code_t transfer::cancel() noexcept
+{
+  if (is_completed())
+    return {};
+
+  assert(owner_ != nullptr);
+
+  // one already due completes as it is
+  std::lock_guard<std::mutex> lock(owner_->mutex_);
+  cancelled_ = true;
+  owner_->complete_due(device::clock::now());
+  return {};
+}
+
+inline
+error_code_t iso_transfer::wait(unsigned int ms) noexcept
+{
+  if (is_completed())
+    return status();
+
+  assert(owner_ != nullptr);
+
+  (void)owner_->wait_until(device::clock::now() + std::chrono::milliseconds(ms),
+    [this]() noexcept { return is_completed(); });
+
+  if (!is_completed())
+    return std::make_error_code(std::errc::timed_out);
+
+  return status();
+}
+
+inline
+error_code_t iso_transfer::cancel() noexcept
+{
+  if (is_completed())
+    return {};
+
+  assert(owner_ != nullptr);
+
+  std::lock_guard<std::mutex> lock(owner_->mutex_);
+  cancelled_ = true;
+  owner_->complete_due(device::clock::now());
+  return {};
+}
+
+} // namespace replay
+} // namespace usb
+} // namespace transport
+} // namespace pilink
+
+#endif // #ifndef PILINK_TRANSPORT_USB_REPLAY_HPP
@@ -0,0 +1,164 @@
+#include "transport/usb/replay/recording.hpp"
+#include <boost/url.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace pilink {
+namespace transport {
+namespace usb {
+namespace replay {
+
+std::error_code parse_replay_uri(const char *uri, std::string& path, double& speed) noexcept
+{
+  path.clear();
+  speed = 1.0;
+
+  if (uri == nullptr)
+    return std::make_error_code(std::errc::invalid_argument);
+
+  try {
+    auto parsed = boost::urls::parse_uri(uri);
+    if (parsed.has_error() || parsed.value().scheme() != "REPLAY")
+      return std::make_error_code(std::errc::invalid_argument);
+
+    for (const auto param : parsed.value().params()) {
+      if (param.key == "FILE") {
+        path = param.value;
+      } else if (param.key == "SPEED") {
+        char *end = nullptr;
+        speed = std::strtod(param.value.c_str(), &end);
+        if (end == param.value.c_str() || *end != '\0' || !(speed >= 0.0))
+          return std::make_error_code(std::errc::invalid_argument);
+      }
+    }
+  } catch (...) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  if (path.empty())
+    return std::make_error_code(std::errc::invalid_argument);
+
+  return {};
+}
+
+recording::recording() noexcept
+  : data_{}
+  , ii_{}
+  , streams_{}
+{
+}
+
+void recording::clear() noexcept
+{
+  for (auto& s : streams_)
+    s.clear();
+
+  data_.reset();
+  ii_ = interface_info{};
+}
+
+std::error_code recording::load(const char *path) noexcept
+{
+  using namespace record;
+
+  clear();
+
+  std::FILE *file = std::fopen(path, "rb");
+  if (file == nullptr)
+    return std::error_code(errno, std::generic_category());
+
+  std::error_code ec;
+  size_t size = 0;
+
+  do {
+    long end = -1;
+    if (std::fseek(file, 0, SEEK_END) == 0)
+      end = std::ftell(file);
+    if (end < 0 || std::fseek(file, 0, SEEK_SET) != 0) {
+      ec = std::make_error_code(std::errc::io_error);
+      break;
+    }
+
+    size = static_cast<size_t>(end);
+    data_.reset(::new (std::nothrow) unsigned char[size + 1]);
+    if (!data_) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+      break;
+    }
+
+    if (std::fread(data_.get(), 1, size, file) != size)
+      ec = std::make_error_code(std::errc::io_error);
+  } while (false);
+
+  std::fclose(file);
+
+  const unsigned char *d = data_.get();
+  size_t pos = sizeof(file_header_s);
+
+  file_header_s h{};
+  if (!ec) {
+    if (size >= sizeof(h))
+      ::memcpy(&h, d, sizeof(h));
+
+    if (size < sizeof(h) || ::memcmp(h.magic, magic, sizeof(h.magic)) != 0 || h.version != version ||
+        h.endpoint_count > 32 || size < pos + h.endpoint_count * sizeof(endpoint_s))
+      ec = std::make_error_code(std::errc::illegal_byte_sequence);
+  }
+
+  if (ec) {
+    clear();
+    return ec;
+  }
+
+  ii_.bInterfaceNumber = h.interface_number;
+  ii_.bAlternateSetting = h.alternate_setting;
+  ii_.bInterfaceClass = h.interface_class;
+  ii_.bInterfaceSubClass = h.interface_subclass;
+  ii_.bInterfaceProtocol = h.interface_protocol;
+  ii_.bNumEndpoints = static_cast<unsigned char>(h.endpoint_count);
+
+  for (size_t i = 0; i < h.endpoint_count; ++ i, pos += sizeof(endpoint_s)) {
+    endpoint_s e{};
+    ::memcpy(&e, d + pos, sizeof(e));
+
+    auto& ed = ii_.endpoints[i];
+    ed.address = e.address;
+    ed.type = static_cast<endpoint_type>(e.type & 0x03);
+    ed.maximum_packet_size = e.maximum_packet_size;
+    ed.maximum_transfer_size = e.maximum_transfer_size;
+  }
+
+  // a recording cut short (the recording process died) ends at its last whole record
+  try {
+    while (pos + sizeof(record_header_s) <= size) {
+      const auto *r = reinterpret_cast<const record_header_s*>(d + pos);
+      size_t packets_size = r->packets * sizeof(packet_s);
+      size_t next = pos + sizeof(*r) + packets_size + padded(r->length);
+      if (next > size)
+        break;
+
+      auto type = static_cast<transfer_type>(r->type & 0x03);
+      std::error_code status = from_record(r->status);
+      bool waited = r->length == 0 && (status == std::errc::operation_canceled || status == std::errc::timed_out);
+
+      if (!waited) {
+        const auto *packets = reinterpret_cast<const packet_s*>(d + pos + sizeof(*r));
+        streams_[stream_of(r->endpoint, type)].push_back(entry{ r, packets, d + pos + sizeof(*r) + packets_size });
+      }
+
+      pos = next;
+    }
+  } catch (...) {
+    clear();
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  return {};
+}
+
+} // namespace replay
+} // namespace usb
+} // namespace transport
+} // namespace pilink
@@ -0,0 +1,81 @@
+#ifndef PILINK_TRANSPORT_USB_REPLAY_RECORDING_HPP
+#define PILINK_TRANSPORT_USB_REPLAY_RECORDING_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include <system_error>
+#include "transport/usb/usb_base.hpp"
+#include "transport/usb/record/format.hpp"
+
+namespace pilink {
+namespace transport {
+namespace usb {
+namespace replay {
+
+// REPLAY://?FILE=<path>&SPEED=<factor>: SPEED=2 plays twice as fast, SPEED=0 as fast as the
+// link takes it (1 by default). Other keys are left to the link layer.
+[[nodiscard]]
+std::error_code parse_replay_uri(const char *uri, std::string& path, double& speed) noexcept;
+
+/**
+ * @brief A recording (record/format.hpp) loaded in memory, its records split by endpoint.
+ * Transfers that ended without moving anything because they were cancelled or timed out are
+ * left out: they are how the recorded link waited, not what the device did.
+ */
+class recording
+{
+public:
+  struct entry
+  {
+    const record::record_header_s *header;
+    const record::packet_s *packets;    // isochronous only
+    const unsigned char *data;
+  };
+
+  static constexpr size_t stream_count = 33;
+
+  // IN and OUT endpoints by number, then control requests
+  static size_t stream_of(unsigned char endpoint, transfer_type type) noexcept
+  {
+    if (type == transfer_type::control)
+      return stream_count - 1;
+
+    return (endpoint & 0x0Fu) | ((endpoint & 0x80u) != 0 ? 0x10u : 0x00u);
+  }
+
+private:
+  std::unique_ptr<unsigned char[]> data_;
+  interface_info ii_;
+  std::vector<entry> streams_[stream_count];
+
+public:
+  recording() noexcept;
+
+  [[nodiscard]]
+  std::error_code load(const char *path) noexcept;
+  void clear() noexcept;
+
+  bool is_loaded() const noexcept
+  {
+    return static_cast<bool>(data_);
+  }
+
+  const interface_info& interface() const noexcept
+  {
+    return ii_;
+  }
+
+  const std::vector<entry>& stream(size_t index) const noexcept
+  {
+    return streams_[index];
+  }
+};
+
+} // namespace replay
+} // namespace usb
+} // namespace transport
+} // namespace pilink
+
+#endif // PILINK_TRANSPORT_USB_REPLAY_RECORDING_HPP
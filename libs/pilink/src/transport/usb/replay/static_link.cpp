@@ -0,0 +1,15 @@
+#include "transport/usb/static_link.hpp"
+#include "transport/usb/replay/device.hpp"
+
+namespace pilink {
+namespace transport {
+namespace usb {
+
+// Built with the library against the replay device, so that static_link and the device interface
+// it relies on keep compiling together; a recording then drives it without hardware.
+template class static_link<replay::device, 512>;
+template class static_link<replay::device, 64, 64, endpoint_type::interrupt>;
+
+} // namespace usb
+} // namespace transport
+} // namespace pilink
@@ -0,0 +1,297 @@
+#ifndef PILINK_TRANSPORT_USB_STATIC_LINK_HPP
+#define PILINK_TRANSPORT_USB_STATIC_LINK_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <system_error>
+#include <pilink/error.hpp>
+#include <pilink/crc32c.hpp>
+#include "transport/usb/usb_base.hpp"
+#include "transport/usb/usb_options.hpp"
+
+namespace pilink {
+namespace transport {
+namespace usb {
+
+/**
+ * @brief Link handle bound to its device type at compile time, for hot loops of small transfers.
+ * Same connect uri, reset and read_some/write_some semantics as pilink_usb<device> with a bulk or
+ * interrupt profile, without the virtual calls: the packet size, the largest single transfer
+ * (chunk_size) and the pipe type are template parameters, and connect fails with
+ * protocol_not_supported when the device's endpoints do not match them. Transfers require a
+ * connected link (asserted, not checked).
+ *
+ * Options that need pilink_usb's machinery are refused with operation_not_supported: a PROFILE=
+ * other than pipe (isochronous needs its queues), LATENCY=LOW, RECOVERY=AUTO and RECORD=.
+ */
+template<typename device, size_t packet_size, size_t chunk_size = 64 * packet_size,
+  endpoint_type pipe = endpoint_type::bulk>
+class static_link
+{
+  static_assert(packet_size != 0, "packet size");
+  static_assert(chunk_size >= packet_size && chunk_size % packet_size == 0, "chunks are whole packets");
+  static_assert(pipe == endpoint_type::bulk || pipe == endpoint_type::interrupt, "bulk or interrupt pipe");
+
+private:
+  device device_;
+  unsigned int timeout_;
+  unsigned char in_;
+  unsigned char out_;
+  bool integrity_;
+
+  std::error_code transfer(unsigned char endpoint, unsigned char *data, size_t length, size_t& transferred, unsigned int timeout) noexcept
+  {
+    if constexpr (pipe == endpoint_type::interrupt)
+      return device_.interrupt_transfer(endpoint, data, length, transferred, timeout);
+    else
+      return device_.bulk_transfer(endpoint, data, length, transferred, timeout);
+  }
+
+  // CRC32C trailer, as pilink_usb::check_integrity; per transfer of at most chunk_size, with the
+  // device contract of usb_options::integrity
+  static std::error_code check_integrity(const unsigned char *data, size_t& transferred) noexcept
+  {
+    constexpr size_t crc_size = 4;
+
+    if (transferred == 0)
+      return {};
+
+    if (transferred < crc_size) {
+      transferred = 0;
+      return make_error_code(error::integrity_mismatch);
+    }
+
+    size_t payload = transferred - crc_size;
+    const unsigned char *trailer = data + payload;
+    uint32_t expected = static_cast<uint32_t>(trailer[0])
+      | (static_cast<uint32_t>(trailer[1]) << 8)
+      | (static_cast<uint32_t>(trailer[2]) << 16)
+      | (static_cast<uint32_t>(trailer[3]) << 24);
+
+    if (crc32c(0, data, payload) != expected) {
+      transferred = 0;
+      return make_error_code(error::integrity_mismatch);
+    }
+
+    transferred = payload;
+    return {};
+  }
+
+public:
+  static_link() noexcept
+    : device_{}
+    , timeout_{1000}
+    , in_{0}
+    , out_{0}
+    , integrity_{false}
+  {
+  }
+
+  static_link(const static_link&) = delete;
+  static_link& operator=(const static_link&) = delete;
+
+  ~static_link()
+  {
+    if (device_.is_open())
+      device_.close();
+  }
+
+  std::error_code connect(const char *uri) noexcept
+  {
+    if (device_.is_open())
+      device_.close();
+
+    usb_options options;
+    std::error_code ec = parse_usb_options(uri, options);
+    if (ec)
+      return ec;
+
+    if (options.pipe != pipe || options.low_latency || options.recovery || !options.record.empty())
+      return std::make_error_code(std::errc::operation_not_supported);
+
+    integrity_ = options.integrity;
+
+    ec = device_.open(uri);
+    if (ec)
+      return ec;
+
+    auto ii = device_.get_interface_info();
+    bool in_found = false;
+    bool out_found = false;
+
+    for (size_t i = 0; i < ii->bNumEndpoints; ++ i) {
+      auto& e = ii->endpoints[i];
+      if (e.type != pipe || e.maximum_packet_size != packet_size || e.maximum_transfer_size < chunk_size)
+        continue;
+
+      if (!in_found && (e.address & 0x80) != 0) {
+        in_ = e.address;
+        in_found = true;
+      }
+
+      if (!out_found && (e.address & 0x80) == 0) {
+        out_ = e.address;
+        out_found = true;
+      }
+    }
+
+    if (!in_found || !out_found) {
+      device_.close();
+      return std::make_error_code(std::errc::protocol_not_supported);
+    }
+
+    ec = reset();
+    if (ec)
+      device_.close();
+
+    return ec;
+  }
+
+  std::error_code disconnect() noexcept
+  {
+    return device_.close();
+  }
+
+  bool is_connected() const noexcept
+  {
+    return device_.is_open();
+  }
+
+  std::error_code reset() noexcept
+  {
+    if (!is_connected())
+      return std::make_error_code(std::errc::not_connected);
+
+    constexpr unsigned char host_to_device   = 0x00;
+    constexpr unsigned char type_vendor      = 0x40;
+    constexpr unsigned char recipient_device = 0x00;
+
+    size_t transferred = 0;
+    std::error_code ec = device_.control_transfer(
+      host_to_device | type_vendor | recipient_device,
+      0x00, 0x0000, 0x0000, 0x0000,
+      nullptr, 0, transferred,
+      timeout_);
+    if (ec)
+      return ec;
+
+    ec = device_.reset_pipe(in_);
+    if (ec)
+      return ec;
+
+    return device_.reset_pipe(out_);
+  }
+
+  std::error_code write_some(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept
+  {
+    assert(is_connected());
+
+    std::error_code ec{};
+    unsigned char *buffer = const_cast<unsigned char *>(data);
+    size_t total = 0;
+
+    // zero length packet, as pilink_usb
+    if (size == 0) {
+      transferred = 0;
+      return transfer(out_, buffer, 0, total, timeout);
+    }
+
+    while (size != 0) {
+      size_t length = std::min(size, chunk_size);
+      size_t current = 0;
+      ec = transfer(out_, buffer, length, current, timeout);
+      total += current;
+
+      if (ec)
+        break;
+
+      if (current != length) {
+        ec = std::make_error_code(std::errc::argument_out_of_domain);
+        break;
+      }
+
+      buffer += current;
+      size -= current;
+    }
+
+    transferred = total;
+    return ec;
+  }
+
+  std::error_code read_some(unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept
+  {
+    assert(is_connected());
+
+    std::error_code ec{};
+    size_t total = 0;
+
+    // whole packets land in place
+    while (size >= packet_size) {
+      size_t length = std::min(size, chunk_size) / packet_size * packet_size;
+      size_t current = 0;
+
+      ec = transfer(in_, data, length, current, timeout);
+      size_t received = current;
+
+      if (integrity_) {
+        if (ec)
+          current = 0;
+        else
+          ec = check_integrity(data, current);
+      }
+
+      total += current;
+      if (ec)
+        break;
+
+      if (received != length) {
+        ec = std::make_error_code(std::errc::argument_out_of_domain);
+        break;
+      }
+
+      data += current;
+      size -= current;
+    }
+
+    // less than a packet left: one packet through the stack
+    do {
+      if (ec || size == 0)
+        break;
+
+      unsigned char align_buffer[packet_size];
+      size_t current = 0;
+
+      ec = transfer(in_, align_buffer, packet_size, current, timeout);
+      if (ec && current == 0)
+        break;
+
+      if (integrity_) {
+        if (ec)
+          break;
+
+        ec = check_integrity(align_buffer, current);
+        if (ec)
+          break;
+      }
+
+      if (current > size) {
+        ec = std::make_error_code(std::errc::argument_list_too_long);
+        current = size;
+      }
+
+      ::memcpy(data, align_buffer, current);
+      total += current;
+
+    } while (false);
+
+    transferred = total;
+    return ec;
+  }
+};
+
+} // namespace usb
+} // namespace transport
+} // namespace pilink
+
+#endif // #ifndef PILINK_TRANSPORT_USB_STATIC_LINK_HPP
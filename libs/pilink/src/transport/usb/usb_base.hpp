@@ -57,6 +57,16 @@ namespace usb {
     endpoint_info  endpoints[32];
   };
 
+  // descriptor an external event loop waits on for the device's completions, poll(2) events
+  struct pollfd_info
+  {
+    int   fd;
+    short events;
+  };
+
+  using pollfd_added_fn = void (*)(int fd, short events, void *user_data);
+  using pollfd_removed_fn = void (*)(int fd, void *user_data);
+
 } // namespace usb
 } // namespace transport
 } // namespace pilink
@@ -1,10 +1,22 @@
 #ifndef PILINK_TRANSPORT_USB_USB_IMPL_HPP
 #define PILINK_TRANSPORT_USB_USB_IMPL_HPP
 
+#include <atomic>
+#include <chrono>
 #include <cstring>
+#include <memory>
+#include <thread>
 #include <pilink/pilink.hpp>
+#include <pilink/error.hpp>
+#include <pilink/crc32c.hpp>
 #include "transport/usb/usb_base.hpp"
+#include "transport/usb/usb_options.hpp"
+#include "transport/usb/record/recorder.hpp"
 #include "transport/usb/libusb/device.hpp"
+#include "transport/usb/replay/device.hpp"
+#ifdef __linux__
+#include "transport/usb/usbfs/device.hpp"
+#endif
 
 namespace pilink {
 namespace transport {
@@ -22,6 +34,97 @@ private:
   transport::usb::endpoint_info in_;
   transport::usb::endpoint_info out_;
 
+  usb_options options_;
+
+  // LATENCY=LOW: IN transfer kept submitted between read_some calls
+  std::unique_ptr<typename device::transfer_t> read_ahead_;   // left to the device if it cannot be taken back
+  std::unique_ptr<unsigned char[]> read_ahead_buffer_;
+  size_t read_ahead_size_;
+  size_t read_ahead_offset_;
+  bool read_ahead_pending_;
+  bool read_ahead_harvested_;
+
+  // PROFILE=ISOCHRONOUS: ring of transfers kept queued on the IN pipe, read in order
+  std::unique_ptr<typename device::iso_transfer_t[]> iso_;
+  size_t iso_count_;
+  size_t iso_head_;       // transfer being read
+  size_t iso_packet_;     // packet being read in it
+  size_t iso_offset_;     // bytes of that packet already read
+  bool iso_harvested_;
+
+  // read_lease: IN transfers into device memory, queued in ring order and lent in that order
+  struct lease_slot {
+    typename device::transfer_t transfer;
+    unsigned char* buffer = nullptr;
+    bool mapped = false;
+    bool leased = false;
+  };
+  std::unique_ptr<lease_slot[]> lease_;
+  size_t lease_count_;
+  size_t lease_size_;
+  size_t lease_head_;     // next to lend, the oldest queued
+  size_t lease_queued_;
+
+  // async_read_some/async_write_some: transfers in flight, completed in the order started
+  struct async_slot {
+    typename device::transfer_t transfer;
+    completion_fn fn = nullptr;
+    void* context = nullptr;
+    unsigned char* data = nullptr;        // the caller's
+    size_t size = 0;
+    bool in = false;
+    uint64_t sequence = 0;
+    std::unique_ptr<unsigned char[]> bounce;  // a read shorter than a packet lands here first
+  };
+  static constexpr size_t max_async = 32;
+  std::unique_ptr<async_slot[]> async_;
+  uint64_t async_sequence_;
+
+  stats_s stats_;
+
+  // blocking calls in progress, disconnect waits for them to leave
+  std::atomic<unsigned int> active_calls_;
+  std::atomic<bool> async_cancel_;
+
+  // RECOVERY=AUTO, counted apart from stats_: both directions recover, each on its own thread
+  std::atomic<uint64_t> pipe_recoveries_;
+  std::atomic<uint64_t> recovery_bytes_;
+
+  // RECORD=<path>: null when not recording
+  std::unique_ptr<record::recorder> recorder_;
+
+  struct call_scope {
+    std::atomic<unsigned int>& calls;
+    explicit call_scope(std::atomic<unsigned int>& c) noexcept : calls(c) { ++ calls; }
+    ~call_scope() { -- calls; }
+  };
+
+  std::error_code cancelled_since(unsigned int generation, std::error_code ec) noexcept;
+  template<typename transfer>
+  std::error_code wait_transfer(transfer& t, unsigned int timeout, unsigned int generation) noexcept;
+  std::error_code check_integrity(const unsigned char *data, size_t& transferred) noexcept;
+  bool is_recoverable(std::error_code ec) const noexcept;
+  std::error_code recover_pipe(unsigned char endpoint, size_t affected) noexcept;
+  std::error_code pipe_transfer(unsigned char endpoint, unsigned char *data, size_t length, size_t& transferred, unsigned int timeout) noexcept;
+  void record_transfer(unsigned char endpoint, std::error_code status, const unsigned char *data, size_t length) noexcept;
+  std::error_code submit_in(typename device::transfer_t& transfer) noexcept;
+  std::error_code submit_out(typename device::transfer_t& transfer) noexcept;
+  std::error_code submit_read_ahead() noexcept;
+  void cancel_read_ahead() noexcept;
+  std::error_code read_low_latency(unsigned char *data, size_t size, size_t& transferred, unsigned int timeout, unsigned int generation) noexcept;
+  std::error_code start_iso() noexcept;
+  void stop_iso() noexcept;
+  std::error_code resubmit_iso_head() noexcept;
+  std::error_code read_isochronous(unsigned char *data, size_t size, size_t& transferred, unsigned int timeout, unsigned int generation) noexcept;
+  std::error_code start_lease() noexcept;
+  std::error_code queue_leases() noexcept;
+  void stop_lease() noexcept;
+  std::error_code recover_lease() noexcept;
+  std::error_code acquire_async_slot(async_slot*& slot) noexcept;
+  void complete_async() noexcept;
+  void stop_async() noexcept;
+  void cancel_pending() noexcept;
+
 public:
   pilink_usb() noexcept;
   ~pilink_usb();
@@ -31,10 +134,24 @@ public:
   virtual bool is_connected() const noexcept override;
 
   virtual std::error_code get_link_info(struct info_s& link_info) noexcept override;
+  virtual std::error_code get_link_stats(struct stats_s& link_stats) noexcept override;
 
+  virtual std::error_code vendor_requests(vendor_request_s *requests, size_t count, unsigned int timeout) noexcept override;
   virtual std::error_code reset() noexcept override;
   virtual std::error_code write_some(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override;
   virtual std::error_code read_some(unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override;
+  virtual std::error_code read_lease(lease_s& lease, unsigned int timeout) noexcept override;
+  virtual std::error_code release(lease_s& lease) noexcept override;
+
+  virtual std::error_code get_pollfds(std::vector<pollfd_s>& fds) noexcept override;
+  virtual std::error_code set_pollfd_notifiers(pollfd_added_fn added, pollfd_removed_fn removed, void *user_data) noexcept override;
+  virtual std::error_code get_next_timeout(int& ms) noexcept override;
+  virtual std::error_code process_events() noexcept override;
+
+  virtual std::error_code async_read_some(unsigned char *data, size_t size, completion_fn fn, void *context) noexcept override;
+  virtual std::error_code async_write_some(const unsigned char *data, size_t size, completion_fn fn, void *context) noexcept override;
+  virtual void cancel_async() noexcept override;
+  virtual void cancel() noexcept override;
 };
 
 template<typename device>
@@ -43,14 +160,42 @@ pilink_usb<device>::pilink_usb() noexcept
   , timeout_{1000}
   , in_{}
   , out_{}
+  , options_{}
+  , read_ahead_{}
+  , read_ahead_buffer_{}
+  , read_ahead_size_{0}
+  , read_ahead_offset_{0}
+  , read_ahead_pending_{false}
+  , read_ahead_harvested_{false}
+  , iso_{}
+  , iso_count_{0}
+  , iso_head_{0}
+  , iso_packet_{0}
+  , iso_offset_{0}
+  , iso_harvested_{false}
+  , lease_{}
+  , lease_count_{0}
+  , lease_size_{0}
+  , lease_head_{0}
+  , lease_queued_{0}
+  , async_{}
+  , async_sequence_{0}
+  , stats_{}
+  , active_calls_{0}
+  , async_cancel_{false}
+  , pipe_recoveries_{0}
+  , recovery_bytes_{0}
+  , recorder_{}
 {
 }
 
 template<typename device>
 pilink_usb<device>::~pilink_usb()
 {
-  if (device_.is_open())
+  if (device_.is_open()) {
+    cancel_pending();
     device_.close();
+  }
 }
 
 static inline
@@ -71,43 +216,68 @@ std::error_code  pilink_usb<device>::connect(const char *uri) noexcept
   std::error_code ec;
 
   if (device_.is_open()) {
+    cancel_pending();
     device_.close();
   }
 
+  recorder_.reset();
+  stats_ = stats_s{};
+  pipe_recoveries_ = 0;
+  recovery_bytes_ = 0;
+
+  ec = parse_usb_options(uri, options_);
+  if (ec)
+    return ec;
+
   ec = device_.open(uri);
   if (ec)
     return ec;
 
   auto ii = device_.get_interface_info();
+
+  if (!options_.record.empty()) {
+    recorder_.reset(::new (std::nothrow) record::recorder);
+    ec = recorder_ ? recorder_->open(options_.record.c_str(), *ii) : std::make_error_code(std::errc::not_enough_memory);
+    if (ec) {
+      recorder_.reset();
+      device_.close();
+      return ec;
+    }
+  }
+
   bool in_pipe_found = false;
   bool out_pipe_found = false;
 
+  // isochronous streams in only, commands still go out on the bulk pipe
+  endpoint_type in_type = options_.pipe;
+  endpoint_type out_type = (options_.pipe == endpoint_type::isochronous) ? endpoint_type::bulk : options_.pipe;
+
   for (size_t i = 0; i < ii->bNumEndpoints; ++ i) {
     auto& e = ii->endpoints[i];
-    if (e.type == transport::usb::endpoint_type::bulk) {
 
-      if (!in_pipe_found && is_in_endpoint(e.address)) {
-        in_ = e;
-        in_pipe_found = true;
-      }
-
-      if (!out_pipe_found && is_out_endpoint(e.address)) {
-        out_ = e;
-        out_pipe_found = true;
-      }
+    if (!in_pipe_found && e.type == in_type && is_in_endpoint(e.address)) {
+      in_ = e;
+      in_pipe_found = true;
+    }
 
-      if (in_pipe_found && out_pipe_found)
-        break;
+    if (!out_pipe_found && e.type == out_type && is_out_endpoint(e.address)) {
+      out_ = e;
+      out_pipe_found = true;
     }
+
+    if (in_pipe_found && out_pipe_found)
+      break;
   }
 
   if (!in_pipe_found || !out_pipe_found) {
+    recorder_.reset();
     device_.close();
-    ec = std::make_error_code(std::errc::protocol_not_supported);
+    return std::make_error_code(std::errc::protocol_not_supported);
   }
 
   ec = reset();
   if (ec) {
+    recorder_.reset();
     device_.close();
   }
 
@@ -117,7 +287,31 @@ std::error_code  pilink_usb<device>::connect(const char *uri) noexcept
 template<typename device>
 std::error_code  pilink_usb<device>::disconnect() noexcept
 {
-  return device_.close();
+  if (device_.is_open()) {
+    // callers blocked on other threads leave within a slice; one that slipped in after the
+    // cancel is caught by the next
+    cancel();
+    for (unsigned int i = 1; active_calls_.load() != 0; ++ i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      if (i % 100 == 0)
+        device_.interrupt();
+    }
+
+    async_cancel_ = false;
+    cancel_pending();
+  }
+
+  std::error_code ec = device_.close();
+
+  // the recording is whole only once written out
+  if (recorder_) {
+    std::error_code record_ec = recorder_->close();
+    recorder_.reset();
+    if (!ec)
+      ec = record_ec;
+  }
+
+  return ec;
 }
 
 template<typename device>
@@ -129,9 +323,28 @@ bool pilink_usb<device>::is_connected() const noexcept
 template<typename device>
 std::error_code  pilink_usb<device>::get_link_info(info_s &link_info) noexcept
 {
-  // TODO:
-  (void)link_info;
-  return std::make_error_code(std::errc::operation_not_supported);
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  // baud_rate 0: unknown, the device types do not report the negotiated bus speed
+  link_info.in.packet_size = in_.maximum_packet_size;
+  link_info.in.baud_rate = 0;
+  link_info.out.packet_size = out_.maximum_packet_size;
+  link_info.out.baud_rate = 0;
+
+  return {};
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::get_link_stats(stats_s &link_stats) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  link_stats = stats_;
+  link_stats.pipe_recoveries = pipe_recoveries_.load();
+  link_stats.recovery_bytes = recovery_bytes_.load();
+  return {};
 }
 
 template<typename device>
@@ -142,6 +355,9 @@ std::error_code  pilink_usb<device>::reset() noexcept
 
   std::error_code ec{};
 
+  // the pipes are cleared below, a submitted transfer must not survive that
+  cancel_pending();
+
   constexpr unsigned char host_to_device   = 0x00;
   constexpr unsigned char type_vendor      = 0x40;
   constexpr unsigned char recipient_device = 0x00;
@@ -157,13 +373,22 @@ std::error_code  pilink_usb<device>::reset() noexcept
       nullptr, 0, transferred,
       timeout_
     );
-    if (ec)
-      break;
 
-    ec = device_.reset_pipe(in_.address);
+    if (recorder_) {
+      const unsigned char setup[8] = { host_to_device | type_vendor | recipient_device };
+      recorder_->add(0, transfer_type::control, ec, nullptr, 0, setup);
+    }
+
     if (ec)
       break;
 
+    // isochronous endpoints do not halt
+    if (in_.type != endpoint_type::isochronous) {
+      ec = device_.reset_pipe(in_.address);
+      if (ec)
+        break;
+    }
+
     ec = device_.reset_pipe(out_.address);
     if (ec)
       break;
@@ -173,12 +398,92 @@ std::error_code  pilink_usb<device>::reset() noexcept
   return ec;
 }
 
+template<typename device>
+bool  pilink_usb<device>::is_recoverable(std::error_code ec) const noexcept
+{
+  return options_.recovery && ec == std::errc::broken_pipe;
+}
+
+// Clears the halt on this endpoint only: the other pipe, the interface and what is queued on
+// either stay as they are, and the device gets no vendor reset.
+template<typename device>
+std::error_code  pilink_usb<device>::recover_pipe(unsigned char endpoint, size_t affected) noexcept
+{
+  std::error_code ec = device_.reset_pipe(endpoint);
+  if (ec)
+    return ec;
+
+  ++ pipe_recoveries_;
+  recovery_bytes_ += affected;
+  return {};
+}
+
+// RECOVERY=AUTO: a stalled transfer goes on once more from where it stopped
+template<typename device>
+std::error_code  pilink_usb<device>::pipe_transfer(unsigned char endpoint, unsigned char *data, size_t length, size_t &transferred, unsigned int timeout) noexcept
+{
+  auto transfer = [this, endpoint, timeout](unsigned char *buffer, size_t size, size_t& done) {
+    std::error_code ec = (options_.pipe == endpoint_type::interrupt)
+      ? device_.interrupt_transfer(endpoint, buffer, size, done, timeout)
+      : device_.bulk_transfer(endpoint, buffer, size, done, timeout);
+
+    record_transfer(endpoint, ec, buffer, done);
+    return ec;
+  };
+
+  std::error_code ec = transfer(data, length, transferred);
+  if (!is_recoverable(ec))
+    return ec;
+
+  size_t done = transferred;
+  ec = recover_pipe(endpoint, length - done);
+  if (ec)
+    return ec;
+
+  size_t rest = 0;
+  ec = transfer(data + done, length - done, rest);
+  transferred = done + rest;
+  return ec;
+}
+
+// RECORD=<path>: a completed transfer on the data pipes, as the device handed it over
+template<typename device>
+void  pilink_usb<device>::record_transfer(unsigned char endpoint, std::error_code status, const unsigned char *data, size_t length) noexcept
+{
+  if (!recorder_)
+    return;
+
+  transfer_type type = (options_.pipe == endpoint_type::interrupt) ? transfer_type::interrupt : transfer_type::bulk;
+  recorder_->add(endpoint, type, status, data, length);
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::submit_in(typename device::transfer_t& transfer) noexcept
+{
+  if (options_.pipe == endpoint_type::interrupt)
+    return device_.submit_interrupt(in_.address, transfer);
+
+  return device_.submit_bulk(in_.address, transfer);
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::submit_out(typename device::transfer_t& transfer) noexcept
+{
+  if (options_.pipe == endpoint_type::interrupt)
+    return device_.submit_interrupt(out_.address, transfer);
+
+  return device_.submit_bulk(out_.address, transfer);
+}
+
 template<typename device>
 std::error_code  pilink_usb<device>::write_some(const unsigned char *data, size_t size, size_t &transferred, unsigned int timeout) noexcept
 {
   if (!is_connected())
     return std::make_error_code(std::errc::not_connected);
 
+  call_scope scope(active_calls_);
+  unsigned int generation = device_.cancel_generation();
+
   std::error_code ec{};
   unsigned char endpoint = out_.address;
   size_t max_transfer_size = out_.maximum_transfer_size;
@@ -186,10 +491,21 @@ std::error_code  pilink_usb<device>::write_some(const unsigned char *data, size_
   // calculate chunk size from link output baudrate
   size_t really_transferred = 0;
   unsigned char *buffer = const_cast<unsigned char *>(data);
+
+  // an empty write is a zero length packet: it ends a transfer that is a whole number of packets
+  if (size == 0) {
+    ec = pipe_transfer(endpoint, buffer, 0, really_transferred, timeout);
+    transferred = 0;
+    return cancelled_since(generation, ec);
+  }
+
   while (size != 0) {
     size_t current_transfer_size = std::min(size, max_transfer_size);
     size_t current_transferred = 0;
-    ec = device_.bulk_transfer(endpoint, buffer, current_transfer_size, current_transferred, timeout);
+    ec = pipe_transfer(endpoint, buffer, current_transfer_size, current_transferred, timeout);
+
+    // a timed out or short transfer may still carry data: count it
+    really_transferred += current_transferred;
     if (ec)
       break;
 
@@ -198,21 +514,108 @@ std::error_code  pilink_usb<device>::write_some(const unsigned char *data, size_
       break;
     }
 
-    really_transferred += current_transferred;
     buffer += current_transferred;
     size -= current_transferred;
   }
 
   transferred = really_transferred;
+  return cancelled_since(generation, ec);
+}
+
+// A call that fails once cancel ran since it started was ended by it, whatever the transport
+// made of the interrupted transfer.
+template<typename device>
+std::error_code  pilink_usb<device>::cancelled_since(unsigned int generation, std::error_code ec) noexcept
+{
+  if (ec && device_.cancel_generation() != generation)
+    return make_error_code(error::cancelled);
+
   return ec;
 }
 
+// Waits in slices of at most 100 ms, so that a cancel is seen within one. A zero timeout waits
+// without limit, as a synchronous transfer does.
+template<typename device>
+template<typename transfer>
+std::error_code  pilink_usb<device>::wait_transfer(transfer& t, unsigned int timeout, unsigned int generation) noexcept
+{
+  using clock = std::chrono::steady_clock;
+  constexpr unsigned int slice_ms = 100;
+  auto deadline = timeout != 0 ? clock::now() + std::chrono::milliseconds(timeout) : clock::time_point::max();
+
+  for (;;) {
+    if (t.is_completed())
+      return {};
+
+    if (device_.cancel_generation() != generation)
+      return make_error_code(error::cancelled);
+
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+    unsigned int ms = left <= 0 ? 0 : static_cast<unsigned int>(std::min<long long>(left, slice_ms));
+
+    std::error_code ec = t.wait(ms);
+    if (t.is_completed())
+      return {};
+
+    if (ec && ec != std::errc::timed_out)
+      return cancelled_since(generation, ec);
+
+    if (timeout != 0 && clock::now() >= deadline)
+      return cancelled_since(generation, std::make_error_code(std::errc::timed_out));
+  }
+}
+
+// Integrity stage: the last 4 bytes of a transfer are CRC32C (little endian) of the bytes before
+// them. The trailer is dropped from transferred, so the next transfer lands over it. The device
+// ends each such transfer with a short packet (see usb_options::integrity).
+template<typename device>
+std::error_code  pilink_usb<device>::check_integrity(const unsigned char *data, size_t &transferred) noexcept
+{
+  constexpr size_t crc_size = 4;
+
+  if (transferred == 0)
+    return {};
+
+  if (transferred < crc_size) {
+    transferred = 0;
+    return make_error_code(error::integrity_mismatch);
+  }
+
+  size_t payload = transferred - crc_size;
+  const unsigned char *trailer = data + payload;
+  uint32_t expected = static_cast<uint32_t>(trailer[0])
+    | (static_cast<uint32_t>(trailer[1]) << 8)
+    | (static_cast<uint32_t>(trailer[2]) << 16)
+    | (static_cast<uint32_t>(trailer[3]) << 24);
+
+  if (crc32c(0, data, payload) != expected) {
+    transferred = 0;
+    return make_error_code(error::integrity_mismatch);
+  }
+
+  transferred = payload;
+  return {};
+}
+
 template<typename device>
 std::error_code  pilink_usb<device>::read_some(unsigned char *data, size_t size, size_t &transferred, unsigned int timeout) noexcept
 {
   if (!is_connected())
     return std::make_error_code(std::errc::not_connected);
 
+  call_scope scope(active_calls_);
+  unsigned int generation = device_.cancel_generation();
+
+  if (options_.pipe == endpoint_type::isochronous)
+    return read_isochronous(data, size, transferred, timeout, generation);
+
+  if (options_.low_latency)
+    return read_low_latency(data, size, transferred, timeout, generation);
+
+  // the leased ring owns the pipe
+  if (lease_)
+    return std::make_error_code(std::errc::operation_in_progress);
+
   std::error_code ec{};
   unsigned char endpoint = in_.address;
   size_t max_transfer_size = in_.maximum_transfer_size;
@@ -226,16 +629,27 @@ std::error_code  pilink_usb<device>::read_some(unsigned char *data, size_t size,
     size_t current_transfer_size = std::min(size, max_transfer_size);
     size_t current_transferred = 0;
 
-    ec = device_.bulk_transfer(endpoint, buffer, current_transfer_size, current_transferred, timeout);
+    ec = pipe_transfer(endpoint, buffer, current_transfer_size, current_transferred, timeout);
+    size_t received = current_transferred;
+
+    if (options_.integrity) {
+      // a transfer cut by an error cannot be verified
+      if (ec)
+        current_transferred = 0;
+      else
+        ec = check_integrity(buffer, current_transferred);
+    }
+
+    // a timed out or short transfer may still carry data: count it
+    really_transferred += current_transferred;
     if (ec)
       break;
 
-    if (current_transferred != current_transfer_size) {
+    if (received != current_transfer_size) {
       ec = std::make_error_code(std::errc::argument_out_of_domain);
       break;
     }
 
-    really_transferred += current_transferred;
     buffer += current_transferred;
     size -= current_transferred;
   }
@@ -259,10 +673,19 @@ std::error_code  pilink_usb<device>::read_some(unsigned char *data, size_t size,
     }
 
     size_t current_transferred = 0;
-    ec = device_.bulk_transfer(endpoint, align_buffer, packet_size, current_transferred, timeout);
-    if (ec)
+    ec = pipe_transfer(endpoint, align_buffer, packet_size, current_transferred, timeout);
+    if (ec && current_transferred == 0)
       break;
 
+    if (options_.integrity) {
+      if (ec)
+        break;
+
+      ec = check_integrity(align_buffer, current_transferred);
+      if (ec)
+        break;
+    }
+
     if (current_transferred > size) {
       ec = std::make_error_code(std::errc::argument_list_too_long); // TODO:
       current_transferred = size;
@@ -275,12 +698,911 @@ std::error_code  pilink_usb<device>::read_some(unsigned char *data, size_t size,
 
 
   transferred = really_transferred;
+  return cancelled_since(generation, ec);
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::submit_read_ahead() noexcept
+{
+  size_t packet_size = in_.maximum_packet_size;
+
+  if (!read_ahead_) {
+    read_ahead_.reset(::new (std::nothrow) typename device::transfer_t);
+    if (!read_ahead_)
+      return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  if (!read_ahead_buffer_) {
+    read_ahead_buffer_.reset(::new (std::nothrow) unsigned char[packet_size]);
+    if (!read_ahead_buffer_)
+      return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  read_ahead_->buffer_ = read_ahead_buffer_.get();
+  read_ahead_->size_ = packet_size;
+  read_ahead_size_ = 0;
+  read_ahead_offset_ = 0;
+  read_ahead_harvested_ = false;
+
+  std::error_code ec = submit_in(*read_ahead_);
+  read_ahead_pending_ = !ec;
   return ec;
 }
 
-pilink *make_pilink_usb_libusb() noexcept
+template<typename device>
+void  pilink_usb<device>::cancel_read_ahead() noexcept
 {
-  return ::new(std::nothrow) pilink_usb<libusb::device>;
+  read_ahead_pending_ = false;
+  if (!read_ahead_)
+    return;
+
+  if (!read_ahead_->is_completed()) {
+    (void)read_ahead_->cancel();
+
+    // the cancellation completes through the event loop
+    for (int i = 0; i < 10 && !read_ahead_->is_completed(); ++ i)
+      (void)read_ahead_->wait(100);
+  }
+
+  // a transfer the device still holds is left to it, with its buffer, as stop_iso does
+  if (read_ahead_->is_completed()) {
+    read_ahead_.reset();
+    read_ahead_buffer_.reset();
+  } else {
+    (void)read_ahead_.release();
+    (void)read_ahead_buffer_.release();
+  }
+}
+
+// One packet sized transfer is always in flight. A read copies out of it and resubmits it right
+// away, and waits by polling the event loop without blocking, so no wake up lies on the path.
+template<typename device>
+std::error_code  pilink_usb<device>::read_low_latency(unsigned char *data, size_t size, size_t &transferred, unsigned int timeout, unsigned int generation) noexcept
+{
+  std::error_code ec{};
+  transferred = 0;
+
+  if (size == 0)
+    return ec;
+
+  if (!read_ahead_pending_) {
+    ec = submit_read_ahead();
+    if (ec)
+      return ec;
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+  for (;;) {
+    if (read_ahead_->is_completed()) {
+      if (!read_ahead_harvested_) {
+        read_ahead_harvested_ = true;
+        read_ahead_size_ = read_ahead_->transferred();
+
+        ec = read_ahead_->status();
+        record_transfer(in_.address, ec, read_ahead_buffer_.get(), read_ahead_size_);
+        if (!ec && options_.integrity)
+          ec = check_integrity(read_ahead_buffer_.get(), read_ahead_size_);
+
+        if (ec) {
+          // resubmitted by the next read
+          read_ahead_pending_ = false;
+          return ec;
+        }
+      }
+
+      size_t n = std::min(size, read_ahead_size_ - read_ahead_offset_);
+      ::memcpy(data, read_ahead_buffer_.get() + read_ahead_offset_, n);
+      read_ahead_offset_ += n;
+      transferred = n;
+
+      if (read_ahead_offset_ == read_ahead_size_)
+        ec = submit_read_ahead();
+
+      if (ec)
+        return ec;
+
+      if (n != 0) {
+        if (n != size)
+          ec = std::make_error_code(std::errc::argument_out_of_domain);
+        return ec;
+      }
+
+      // zero length packet: keep waiting for data
+      continue;
+    }
+
+    ec = read_ahead_->wait(0);
+    if (ec && ec != std::errc::timed_out && !read_ahead_->is_completed())
+      return cancelled_since(generation, ec);
+
+    if (device_.cancel_generation() != generation)
+      return make_error_code(error::cancelled);
+
+    if (timeout != 0 && std::chrono::steady_clock::now() >= deadline)
+      return std::make_error_code(std::errc::timed_out);
+  }
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::vendor_requests(vendor_request_s *requests, size_t count, unsigned int timeout) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  call_scope scope(active_calls_);
+  unsigned int generation = device_.cancel_generation();
+
+  constexpr size_t window = 16;
+  constexpr size_t setup_size = device::control_setup_size;
+
+  constexpr unsigned char device_to_host   = 0x80;
+  constexpr unsigned char type_vendor      = 0x40;
+  constexpr unsigned char recipient_device = 0x00;
+
+  struct slot {
+    typename device::transfer_t transfer;
+    std::unique_ptr<unsigned char[]> buffer;
+    size_t capacity = 0;
+  };
+
+  for (size_t i = 0; i < count; ++ i) {
+    requests[i].transferred = 0;
+    requests[i].status = std::make_error_code(std::errc::operation_canceled);
+  }
+
+  if (count == 0)
+    return {};
+
+  std::unique_ptr<slot[]> slots(::new (std::nothrow) slot[window]);
+  if (!slots)
+    return std::make_error_code(std::errc::not_enough_memory);
+
+  std::error_code ec{};
+  size_t submitted = 0;
+  size_t completed = 0;
+  bool cancelled = false;
+
+  for (;;) {
+    // keep the window full while all is well
+    while (!ec && submitted < count && submitted - completed < window) {
+      auto& r = requests[submitted];
+      auto& s = slots[submitted % window];
+
+      size_t need = setup_size + r.length;
+      if (s.capacity < need) {
+        s.buffer.reset(::new (std::nothrow) unsigned char[need]);
+        s.capacity = s.buffer ? need : 0;
+        if (!s.buffer) {
+          ec = std::make_error_code(std::errc::not_enough_memory);
+          break;
+        }
+      }
+
+      if (!r.in && r.length != 0)
+        ::memcpy(s.buffer.get() + setup_size, r.data, r.length);
+
+      auto request_type = static_cast<unsigned char>((r.in ? device_to_host : 0x00) | type_vendor | recipient_device);
+
+      s.transfer.buffer_ = s.buffer.get();
+      s.transfer.size_ = need;
+      ec = device_.submit_control(s.transfer, request_type, r.request, r.value, r.index, r.length, timeout);
+      if (ec) {
+        r.status = ec;
+        break;
+      }
+
+      ++ submitted;
+    }
+
+    if (completed == submitted)
+      break;
+
+    // complete in order
+    auto& r = requests[completed];
+    auto& s = slots[completed % window];
+
+    int attempts = 0;
+    while (!s.transfer.is_completed()) {
+      if (!cancelled && device_.cancel_generation() != generation) {
+        cancelled = true;
+        if (!ec)
+          ec = make_error_code(error::cancelled);
+
+        for (size_t i = completed; i < submitted; ++ i)
+          (void)slots[i % window].transfer.cancel();
+      }
+
+      std::error_code wait_ec = s.transfer.wait(100);
+      if (wait_ec && wait_ec != std::errc::timed_out && !s.transfer.is_completed() && ++ attempts >= 10) {
+        // the event loop is gone: the transfers still belong to libusb, leave them be
+        (void)slots.release();
+        return ec ? ec : wait_ec;
+      }
+    }
+
+    r.status = s.transfer.status();
+    r.transferred = s.transfer.transferred();
+    if (recorder_)
+      recorder_->add(0, transfer_type::control, r.status, s.buffer.get() + setup_size, r.transferred, s.buffer.get());
+    if (!r.status && r.in)
+      ::memcpy(r.data, s.buffer.get() + setup_size, r.transferred);
+
+    ++ completed;
+
+    if (r.status && !ec) {
+      ec = r.status;
+
+      // what follows was meant to run after a successful request
+      for (size_t i = completed; i < submitted; ++ i)
+        (void)slots[i % window].transfer.cancel();
+    }
+  }
+
+  return ec;
+}
+
+template<typename device>
+void  pilink_usb<device>::cancel_pending() noexcept
+{
+  cancel_read_ahead();
+  stop_iso();
+  stop_lease();
+  stop_async();
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::start_iso() noexcept
+{
+  std::error_code ec{};
+
+  size_t count = options_.iso_transfers;
+  iso_.reset(::new (std::nothrow) typename device::iso_transfer_t[count]);
+  if (!iso_)
+    return std::make_error_code(std::errc::not_enough_memory);
+
+  iso_count_ = count;
+  iso_head_ = 0;
+  iso_packet_ = 0;
+  iso_offset_ = 0;
+  iso_harvested_ = false;
+
+  for (size_t i = 0; i < count; ++ i) {
+    ec = iso_[i].allocate(options_.iso_packets, in_.maximum_packet_size);
+    if (ec)
+      break;
+
+    ec = device_.submit_iso(in_.address, iso_[i]);
+    if (ec)
+      break;
+  }
+
+  if (ec)
+    stop_iso();
+
+  return ec;
+}
+
+template<typename device>
+void  pilink_usb<device>::stop_iso() noexcept
+{
+  if (!iso_)
+    return;
+
+  constexpr size_t max_iso_transfers = 256;
+  typename device::iso_transfer_t* pending[max_iso_transfers];
+  size_t reaped[max_iso_transfers];
+
+  for (size_t i = 0; i < iso_count_; ++ i)
+    (void)iso_[i].cancel();
+
+  // the cancellations complete through the event loop, reap them together
+  bool all_completed = false;
+  for (int attempt = 0; attempt < 10 && !all_completed; ++ attempt) {
+    size_t n = 0;
+    for (size_t i = 0; i < iso_count_ && n < max_iso_transfers; ++ i) {
+      if (!iso_[i].is_completed())
+        pending[n ++] = &iso_[i];
+    }
+
+    all_completed = (n == 0);
+    if (!all_completed) {
+      size_t count = 0;
+      (void)device_.wait_some(pending, n, reaped, n, count, 100);
+    }
+  }
+
+  // a transfer libusb still holds must not be freed
+  if (all_completed)
+    iso_.reset();
+  else
+    (void)iso_.release();
+
+  iso_count_ = 0;
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::resubmit_iso_head() noexcept
+{
+  // nothing else queued: the bus had no buffer for the microframes until now
+  bool queued = false;
+  for (size_t i = 0; i < iso_count_; ++ i)
+    queued = queued || (i != iso_head_ && !iso_[i].is_completed());
+  if (!queued)
+    ++ stats_.iso_underruns;
+
+  std::error_code ec = device_.submit_iso(in_.address, iso_[iso_head_]);
+
+  iso_head_ = (iso_head_ + 1) % iso_count_;
+  iso_packet_ = 0;
+  iso_offset_ = 0;
+  iso_harvested_ = false;
+  return ec;
+}
+
+// Packets are returned in order; a packet completed with an error is dropped and counted, the
+// stream goes on (no retransmission on isochronous pipes).
+template<typename device>
+std::error_code  pilink_usb<device>::read_isochronous(unsigned char *data, size_t size, size_t &transferred, unsigned int timeout, unsigned int generation) noexcept
+{
+  std::error_code ec{};
+  transferred = 0;
+
+  if (!iso_) {
+    ec = start_iso();
+    if (ec)
+      return ec;
+  }
+
+  size_t really_transferred = 0;
+  while (size != 0) {
+    auto& t = iso_[iso_head_];
+
+    // block for the first transfer only, take what else is already there
+    if (!t.is_completed()) {
+      if (really_transferred != 0)
+        break;
+
+      ec = wait_transfer(t, timeout, generation);
+      if (ec)
+        break;
+    }
+
+    if (!iso_harvested_) {
+      iso_harvested_ = true;
+      ec = t.status();
+      if (recorder_)
+        recorder_->add_iso(in_.address, t);
+      if (ec)
+        break;
+
+      for (size_t i = 0; i < t.packets(); ++ i) {
+        ++ stats_.iso_packets;
+        if (t.packet_status(i))
+          ++ stats_.iso_packet_errors;
+      }
+    }
+
+    while (size != 0 && iso_packet_ < t.packets()) {
+      size_t length = t.packet_status(iso_packet_) ? 0 : t.packet_length(iso_packet_);
+      size_t n = std::min(size, length - iso_offset_);
+
+      ::memcpy(data, t.packet_data(iso_packet_) + iso_offset_, n);
+      data += n;
+      size -= n;
+      really_transferred += n;
+      iso_offset_ += n;
+
+      if (iso_offset_ == length) {
+        ++ iso_packet_;
+        iso_offset_ = 0;
+      }
+    }
+
+    if (iso_packet_ == t.packets()) {
+      ec = resubmit_iso_head();
+      if (ec)
+        break;
+    }
+  }
+
+  transferred = really_transferred;
+  if (!ec && size != 0)
+    ec = std::make_error_code(std::errc::argument_out_of_domain);
+
+  return ec;
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::start_lease() noexcept
+{
+  std::error_code ec{};
+
+  size_t packet_size = in_.maximum_packet_size;
+  size_t size = std::min<size_t>(options_.lease_size, in_.maximum_transfer_size) / packet_size * packet_size;
+
+  size_t count = options_.lease_transfers;
+  lease_.reset(::new (std::nothrow) lease_slot[count]);
+  if (!lease_)
+    return std::make_error_code(std::errc::not_enough_memory);
+
+  lease_count_ = count;
+  lease_size_ = std::max(size, packet_size);
+  lease_head_ = 0;
+  lease_queued_ = 0;
+
+  for (size_t i = 0; i < count; ++ i) {
+    auto& slot = lease_[i];
+    slot.buffer = device_.allocate_buffer(lease_size_, slot.mapped);
+    if (slot.buffer == nullptr) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+      break;
+    }
+  }
+
+  if (!ec)
+    ec = queue_leases();
+
+  if (ec)
+    stop_lease();
+
+  return ec;
+}
+
+// Queues released buffers behind the ones in flight, in ring order: a buffer released out of
+// order waits until those lent before it are back.
+template<typename device>
+std::error_code  pilink_usb<device>::queue_leases() noexcept
+{
+  while (lease_queued_ < lease_count_) {
+    auto& slot = lease_[(lease_head_ + lease_queued_) % lease_count_];
+    if (slot.leased)
+      break;
+
+    slot.transfer.buffer_ = slot.buffer;
+    slot.transfer.size_ = lease_size_;
+    std::error_code ec = submit_in(slot.transfer);
+    if (ec)
+      return ec;
+
+    ++ lease_queued_;
+  }
+
+  return {};
+}
+
+template<typename device>
+void  pilink_usb<device>::stop_lease() noexcept
+{
+  if (!lease_)
+    return;
+
+  constexpr size_t max_lease_transfers = 64;
+  typename device::transfer_t* pending[max_lease_transfers];
+  size_t reaped[max_lease_transfers];
+
+  for (size_t i = 0; i < lease_count_; ++ i)
+    (void)lease_[i].transfer.cancel();
+
+  bool all_completed = false;
+  for (int attempt = 0; attempt < 10 && !all_completed; ++ attempt) {
+    size_t n = 0;
+    for (size_t i = 0; i < lease_count_ && n < max_lease_transfers; ++ i) {
+      if (!lease_[i].transfer.is_completed())
+        pending[n ++] = &lease_[i].transfer;
+    }
+
+    all_completed = (n == 0);
+    if (!all_completed) {
+      size_t count = 0;
+      (void)device_.wait_some(pending, n, reaped, n, count, 100);
+    }
+  }
+
+  // memory the device may still transfer into must not be freed
+  if (all_completed) {
+    for (size_t i = 0; i < lease_count_; ++ i) {
+      if (lease_[i].buffer != nullptr)
+        device_.free_buffer(lease_[i].buffer, lease_size_, lease_[i].mapped);
+    }
+    lease_.reset();
+  } else {
+    (void)lease_.release();
+  }
+
+  lease_count_ = 0;
+  lease_queued_ = 0;
+}
+
+// The head transfer stalled and those behind it sit on a halted endpoint: they are taken back,
+// the halt is cleared and the ring is queued again from the head, in the same order.
+template<typename device>
+std::error_code  pilink_usb<device>::recover_lease() noexcept
+{
+  constexpr size_t max_lease_transfers = 64;
+  typename device::transfer_t* pending[max_lease_transfers];
+  size_t reaped[max_lease_transfers];
+
+  size_t queued = lease_queued_;
+  for (size_t i = 1; i < queued; ++ i)
+    (void)lease_[(lease_head_ + i) % lease_count_].transfer.cancel();
+
+  bool all_completed = false;
+  for (int attempt = 0; attempt < 10 && !all_completed; ++ attempt) {
+    size_t n = 0;
+    for (size_t i = 1; i < queued; ++ i) {
+      auto& t = lease_[(lease_head_ + i) % lease_count_].transfer;
+      if (!t.is_completed())
+        pending[n ++] = &t;
+    }
+
+    all_completed = (n == 0);
+    if (!all_completed) {
+      size_t count = 0;
+      (void)device_.wait_some(pending, n, reaped, n, count, 100);
+    }
+  }
+
+  if (!all_completed)
+    return std::make_error_code(std::errc::broken_pipe);
+
+  std::error_code ec = recover_pipe(in_.address, queued * lease_size_);
+  if (ec)
+    return ec;
+
+  lease_queued_ = 0;
+  return queue_leases();
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::read_lease(lease_s &lease, unsigned int timeout) noexcept
+{
+  lease = lease_s{};
+
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  if (options_.pipe == endpoint_type::isochronous || options_.low_latency)
+    return std::make_error_code(std::errc::operation_not_supported);
+
+  call_scope scope(active_calls_);
+  unsigned int generation = device_.cancel_generation();
+
+  std::error_code ec{};
+  if (!lease_) {
+    ec = start_lease();
+    if (ec)
+      return ec;
+  }
+
+  // a failed submission is retried here, it matters only once nothing is left in flight
+  ec = queue_leases();
+  if (lease_queued_ == 0)
+    return ec ? ec : std::make_error_code(std::errc::no_buffer_space);
+
+  size_t index = lease_head_;
+  auto& slot = lease_[index];
+
+  ec = wait_transfer(slot.transfer, timeout, generation);
+  if (ec)
+    return ec;
+
+  if (is_recoverable(slot.transfer.status())) {
+    record_transfer(in_.address, slot.transfer.status(), slot.buffer, slot.transfer.transferred());
+    ec = recover_lease();
+    if (ec)
+      return ec;
+
+    ec = wait_transfer(slot.transfer, timeout, generation);
+    if (ec)
+      return ec;
+  }
+
+  lease_head_ = (lease_head_ + 1) % lease_count_;
+  -- lease_queued_;
+
+  size_t transferred = slot.transfer.transferred();
+  ec = slot.transfer.status();
+  record_transfer(in_.address, ec, slot.buffer, transferred);
+  if (!ec && options_.integrity)
+    ec = check_integrity(slot.buffer, transferred);
+
+  // nothing to lend: the buffer goes back in the queue
+  if (ec)
+    return ec;
+
+  slot.leased = true;
+  lease.data = slot.buffer;
+  lease.size = transferred;
+  lease.slot = index;
+
+  return {};
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::release(lease_s &lease) noexcept
+{
+  if (!lease_ || lease.data == nullptr || lease.slot >= lease_count_ || lease_[lease.slot].buffer != lease.data)
+    return {};
+
+  lease_[lease.slot].leased = false;
+  lease = lease_s{};
+
+  (void)queue_leases();
+  return {};
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::get_pollfds(std::vector<pollfd_s> &fds) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  std::vector<pollfd_info> device_fds;
+  std::error_code ec = device_.get_pollfds(device_fds);
+  if (ec)
+    return ec;
+
+  try {
+    fds.clear();
+    for (const auto& fd : device_fds)
+      fds.push_back(pollfd_s{ fd.fd, fd.events });
+  } catch (...) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  return {};
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::set_pollfd_notifiers(pollfd_added_fn added, pollfd_removed_fn removed, void *user_data) noexcept
+{
+  return device_.set_pollfd_notifiers(added, removed, user_data);
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::get_next_timeout(int &ms) noexcept
+{
+  ms = -1;
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  return device_.get_next_timeout(ms);
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::process_events() noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  // cancel runs on another thread, the slots are this one's
+  if (async_cancel_.exchange(false))
+    cancel_async();
+
+  std::error_code ec = device_.process_events();
+  complete_async();
+  return ec;
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::acquire_async_slot(async_slot*& slot) noexcept
+{
+  if (!async_) {
+    async_.reset(::new (std::nothrow) async_slot[max_async]);
+    if (!async_)
+      return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  for (size_t i = 0; i < max_async; ++ i) {
+    if (async_[i].fn == nullptr) {
+      slot = &async_[i];
+      return {};
+    }
+  }
+
+  return std::make_error_code(std::errc::resource_unavailable_try_again);
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::async_read_some(unsigned char *data, size_t size, completion_fn fn, void *context) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  if (options_.pipe == endpoint_type::isochronous || options_.low_latency)
+    return std::make_error_code(std::errc::operation_not_supported);
+
+  if (lease_)
+    return std::make_error_code(std::errc::operation_in_progress);
+
+  if (size == 0 || fn == nullptr)
+    return std::make_error_code(std::errc::invalid_argument);
+
+  async_slot* slot = nullptr;
+  std::error_code ec = acquire_async_slot(slot);
+  if (ec)
+    return ec;
+
+  size_t packet_size = in_.maximum_packet_size;
+
+  // whole packets straight into the caller's buffer, less than one through the bounce buffer
+  if (size >= packet_size) {
+    slot->transfer.buffer_ = data;
+    slot->transfer.size_ = std::min<size_t>(size, in_.maximum_transfer_size) / packet_size * packet_size;
+  } else {
+    if (!slot->bounce) {
+      slot->bounce.reset(::new (std::nothrow) unsigned char[packet_size]);
+      if (!slot->bounce)
+        return std::make_error_code(std::errc::not_enough_memory);
+    }
+    slot->transfer.buffer_ = slot->bounce.get();
+    slot->transfer.size_ = packet_size;
+  }
+
+  ec = submit_in(slot->transfer);
+  if (ec)
+    return ec;
+
+  slot->fn = fn;
+  slot->context = context;
+  slot->data = data;
+  slot->size = size;
+  slot->in = true;
+  slot->sequence = async_sequence_ ++;
+  return {};
+}
+
+template<typename device>
+std::error_code  pilink_usb<device>::async_write_some(const unsigned char *data, size_t size, completion_fn fn, void *context) noexcept
+{
+  if (!is_connected())
+    return std::make_error_code(std::errc::not_connected);
+
+  if (size == 0 || fn == nullptr)
+    return std::make_error_code(std::errc::invalid_argument);
+
+  async_slot* slot = nullptr;
+  std::error_code ec = acquire_async_slot(slot);
+  if (ec)
+    return ec;
+
+  slot->transfer.buffer_ = const_cast<unsigned char *>(data);
+  slot->transfer.size_ = std::min<size_t>(size, out_.maximum_transfer_size);
+
+  ec = submit_out(slot->transfer);
+  if (ec)
+    return ec;
+
+  slot->fn = fn;
+  slot->context = context;
+  slot->data = const_cast<unsigned char *>(data);
+  slot->size = size;
+  slot->in = false;
+  slot->sequence = async_sequence_ ++;
+  return {};
+}
+
+template<typename device>
+void  pilink_usb<device>::cancel_async() noexcept
+{
+  if (!async_)
+    return;
+
+  for (size_t i = 0; i < max_async; ++ i) {
+    if (async_[i].fn != nullptr)
+      (void)async_[i].transfer.cancel();
+  }
+}
+
+template<typename device>
+void  pilink_usb<device>::cancel() noexcept
+{
+  if (!is_connected())
+    return;
+
+  async_cancel_ = true;
+  device_.interrupt();
+}
+
+// Completions are handed out oldest first; a slot is free again before its fn runs, so fn may
+// start the next transfer.
+template<typename device>
+void  pilink_usb<device>::complete_async() noexcept
+{
+  if (!async_)
+    return;
+
+  for (;;) {
+    async_slot* next = nullptr;
+    for (size_t i = 0; i < max_async; ++ i) {
+      auto& s = async_[i];
+      if (s.fn != nullptr && s.transfer.is_completed() && (next == nullptr || s.sequence < next->sequence))
+        next = &s;
+    }
+
+    if (next == nullptr)
+      break;
+
+    size_t transferred = next->transfer.transferred();
+    std::error_code ec = next->transfer.status();
+    record_transfer(next->in ? in_.address : out_.address, ec, next->transfer.buffer_, transferred);
+
+    // the transfers behind it go on; this one completes with the stall
+    if (is_recoverable(ec))
+      (void)recover_pipe(next->in ? in_.address : out_.address, next->transfer.size_ - transferred);
+
+    if (next->in) {
+      unsigned char *buffer = next->transfer.buffer_;
+      if (!ec && options_.integrity)
+        ec = check_integrity(buffer, transferred);
+      else if (ec)
+        transferred = 0;
+
+      if (buffer != next->data) {
+        if (transferred > next->size) {
+          ec = std::make_error_code(std::errc::argument_list_too_long);
+          transferred = next->size;
+        }
+        ::memcpy(next->data, buffer, transferred);
+      }
+    }
+
+    completion_fn fn = next->fn;
+    void* context = next->context;
+    next->fn = nullptr;
+
+    fn(context, ec, transferred);
+  }
+}
+
+template<typename device>
+void  pilink_usb<device>::stop_async() noexcept
+{
+  if (!async_)
+    return;
+
+  typename device::transfer_t* pending[max_async];
+  size_t reaped[max_async];
+
+  cancel_async();
+
+  bool all_completed = false;
+  for (int attempt = 0; attempt < 10 && !all_completed; ++ attempt) {
+    size_t n = 0;
+    for (size_t i = 0; i < max_async; ++ i) {
+      if (async_[i].fn != nullptr && !async_[i].transfer.is_completed())
+        pending[n ++] = &async_[i].transfer;
+    }
+
+    all_completed = (n == 0);
+    if (!all_completed) {
+      size_t count = 0;
+      (void)device_.wait_some(pending, n, reaped, n, count, 100);
+    }
+  }
+
+  if (all_completed)
+    complete_async();
+  else
+    (void)async_.release();   // the transfers still belong to the device, and so do their callers
+}
+
+pilink *make_pilink_usb_libusb() noexcept
+{
+  return ::new(std::nothrow) pilink_usb<libusb::device>;
+}
+
+#ifdef __linux__
+pilink *make_pilink_usb_usbfs() noexcept
+{
+  return ::new(std::nothrow) pilink_usb<usbfs::device>;
+}
+#endif
+
+pilink *make_pilink_usb_replay() noexcept
+{
+  return ::new(std::nothrow) pilink_usb<replay::device>;
 }
 
 } // namespace usb
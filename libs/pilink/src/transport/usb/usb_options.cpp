@@ -0,0 +1,91 @@
+#include "transport/usb/usb_options.hpp"
+#include <boost/url.hpp>
+#include <cstdlib>
+
+namespace pilink {
+namespace transport {
+namespace usb {
+
+static
+bool parse_count(const std::string& value, size_t max, size_t& count) noexcept
+{
+  char *end = nullptr;
+  unsigned long long v = std::strtoull(value.c_str(), &end, 10);
+  if (end == value.c_str() || *end != '\0' || v == 0 || v > max)
+    return false;
+
+  count = static_cast<size_t>(v);
+  return true;
+}
+
+std::error_code parse_usb_options(const char *uri, usb_options& options) noexcept
+{
+  options = usb_options{};
+
+  if (uri == nullptr)
+    return {};
+
+  try {
+    auto parsed = boost::urls::parse_uri(uri);
+    if (parsed.has_error())
+      return {};
+
+    for (const auto param : parsed.value().params()) {
+      if (param.key == "INTEGRITY") {
+        if (param.value == "CRC32C")
+          options.integrity = true;
+        else if (param.value == "NONE")
+          options.integrity = false;
+        else
+          return std::make_error_code(std::errc::invalid_argument);
+      } else if (param.key == "PROFILE") {
+        if (param.value == "BULK")
+          options.pipe = endpoint_type::bulk;
+        else if (param.value == "INTERRUPT")
+          options.pipe = endpoint_type::interrupt;
+        else if (param.value == "ISOCHRONOUS")
+          options.pipe = endpoint_type::isochronous;
+        else
+          return std::make_error_code(std::errc::invalid_argument);
+      } else if (param.key == "ISO_TRANSFERS") {
+        if (!parse_count(param.value, 256, options.iso_transfers))
+          return std::make_error_code(std::errc::invalid_argument);
+      } else if (param.key == "ISO_PACKETS") {
+        if (!parse_count(param.value, 1024, options.iso_packets))
+          return std::make_error_code(std::errc::invalid_argument);
+      } else if (param.key == "LEASE_TRANSFERS") {
+        if (!parse_count(param.value, 64, options.lease_transfers))
+          return std::make_error_code(std::errc::invalid_argument);
+      } else if (param.key == "LEASE_SIZE") {
+        if (!parse_count(param.value, 16 * 1024 * 1024, options.lease_size))
+          return std::make_error_code(std::errc::invalid_argument);
+      } else if (param.key == "LATENCY") {
+        if (param.value == "LOW")
+          options.low_latency = true;
+        else if (param.value == "NORMAL")
+          options.low_latency = false;
+        else
+          return std::make_error_code(std::errc::invalid_argument);
+      } else if (param.key == "RECOVERY") {
+        if (param.value == "AUTO")
+          options.recovery = true;
+        else if (param.value == "OFF")
+          options.recovery = false;
+        else
+          return std::make_error_code(std::errc::invalid_argument);
+      } else if (param.key == "RECORD") {
+        if (param.value.empty())
+          return std::make_error_code(std::errc::invalid_argument);
+        options.record = param.value;
+      }
+    }
+  } catch (...) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  return {};
+}
+
+} // namespace usb
+} // namespace transport
+} // namespace pilink
@@ -0,0 +1,60 @@
+#ifndef PILINK_TRANSPORT_USB_OPTIONS_HPP
+#define PILINK_TRANSPORT_USB_OPTIONS_HPP
+
+#include <cstddef>
+#include <string>
+#include <system_error>
+#include "transport/usb/usb_base.hpp"
+
+namespace pilink {
+namespace transport {
+namespace usb {
+
+// Link options carried in the connect uri next to the device selection, e.g.
+// LIBUSB://?VID=152a&PID=82c0&INTEGRITY=CRC32C
+struct usb_options
+{
+  // INTEGRITY=CRC32C: every IN transfer ends with CRC32C (little endian) of its payload. The CRC
+  // is checked per host transfer, so the device must send each CRC message as one transfer that
+  // ends with a short packet, or a zero length packet when it is a whole number of packets, and
+  // keep it within the maximum transfer size; the reader must ask for at least that much. A
+  // message split across host transfers, or two in one, fails as integrity_mismatch.
+  bool integrity = false;
+
+  // PROFILE=BULK|INTERRUPT|ISOCHRONOUS: which pair of endpoints carries the link; with
+  // ISOCHRONOUS the IN stream is isochronous and OUT stays on the bulk pipe
+  endpoint_type pipe = endpoint_type::bulk;
+
+  // ISO_TRANSFERS=n, ISO_PACKETS=n: isochronous transfers kept queued and packets in each;
+  // together they are the stream's tolerance to a late reader, in (micro)frames
+  size_t iso_transfers = 8;
+  size_t iso_packets = 32;
+
+  // LATENCY=LOW: one IN transfer is kept submitted and read_some busy-polls its completion
+  // instead of sleeping in the event loop; costs a core while a read waits
+  bool low_latency = false;
+
+  // LEASE_TRANSFERS=n, LEASE_SIZE=bytes: IN transfers kept queued for read_lease and the size
+  // of each, rounded down to whole packets
+  size_t lease_transfers = 8;
+  size_t lease_size = 256 * 1024;
+
+  // RECOVERY=AUTO|OFF: a stalled transfer clears the halt on its own endpoint and goes on,
+  // instead of failing until reset
+  bool recovery = false;
+
+  // RECORD=<path>: every transfer the link completes is written to a recording there, to be
+  // played back as REPLAY://?FILE=<path>
+  std::string record;
+};
+
+// Keys that are not link options are left to the device (selection); a uri that cannot be
+// parsed leaves the defaults.
+[[nodiscard]]
+std::error_code parse_usb_options(const char *uri, usb_options& options) noexcept;
+
+} // namespace usb
+} // namespace transport
+} // namespace pilink
+
+#endif // PILINK_TRANSPORT_USB_OPTIONS_HPP
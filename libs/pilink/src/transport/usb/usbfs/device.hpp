@@ -0,0 +1,1055 @@
+#ifndef PILINK_TRANSPORT_USB_USBFS_HPP
+#define PILINK_TRANSPORT_USB_USBFS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <system_error>
+
+#include <fcntl.h>
+#include <linux/usbdevice_fs.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "transport/usb/usb_base.hpp"
+#include "transport/usb/device_filter.hpp"
+#include "transport/usb/usbfs/enumerate.hpp"
+
+namespace pilink {
+namespace transport {
+namespace usb {
+namespace usbfs {
+
+/*
+ * Linux usbfs device for pilink_usb<device>, same interface as libusb::device. Transfers are
+ * URBs submitted with USBDEVFS_SUBMITURB and reaped with USBDEVFS_REAPURBNDELAY when epoll
+ * reports the node writable; buffers owned by the transport are mmap'ed from the node so the
+ * kernel does DMA into them without a bounce copy.
+ */
+
+using error_code_t = std::error_code;
+
+inline
+error_code_t make_errno_error(int e) noexcept
+{
+  if (e == 0)
+    return {};
+
+  return error_code_t(e, std::generic_category());
+}
+
+// URB completion status (negative errno); a short IN transfer is not an error
+inline
+error_code_t make_urb_error(int status) noexcept
+{
+  switch (-status)
+  {
+  case 0:
+  case EREMOTEIO:
+    return {};
+
+  case ENOENT:
+  case ECONNRESET:
+    return std::make_error_code(std::errc::operation_canceled);
+
+  case ENODEV:
+  case ESHUTDOWN:
+    return std::make_error_code(std::errc::no_such_device);
+
+  case EPIPE:
+    return std::make_error_code(std::errc::broken_pipe);
+
+  case EOVERFLOW:
+    return std::make_error_code(std::errc::value_too_large);
+
+  case ETIMEDOUT:
+    return std::make_error_code(std::errc::timed_out);
+
+  default:
+    return make_errno_error(-status);
+  }
+}
+
+class device;
+
+class transfer
+{
+private:
+public:
+  // usbdevfs_urb ends in a flexible array, it cannot be a member as such
+  alignas(usbdevfs_urb) unsigned char urb_storage_[sizeof(usbdevfs_urb)];
+  device* owner_;
+
+  std::chrono::steady_clock::time_point deadline_;
+  bool has_deadline_;
+  bool timed_out_;
+
+public:
+  unsigned char* buffer_;
+  size_t size_;
+  size_t transferred_;
+  int status_;
+  std::atomic<int> completed_;
+
+public:
+  transfer() noexcept
+    : urb_storage_ {}
+    , owner_ { nullptr }
+    , deadline_ {}
+    , has_deadline_ { false }
+    , timed_out_ { false }
+    , buffer_ { nullptr }
+    , size_ { 0 }
+    , transferred_ { 0 }
+    , status_ { 0 }
+    , completed_ { 1 }
+  {
+  }
+
+  ~transfer() noexcept
+  {
+    // the kernel still points at this object
+    assert(is_completed());
+  }
+
+  transfer(const transfer&) = delete;
+  transfer& operator=(const transfer&) = delete;
+
+  usbdevfs_urb* urb() noexcept
+  {
+    return reinterpret_cast<usbdevfs_urb*>(urb_storage_);
+  }
+
+  bool is_completed() const noexcept
+  {
+    return (completed_.load(std::memory_order_acquire) != 0);
+  }
+
+  void complete(const usbdevfs_urb* urb) noexcept
+  {
+    transferred_ = static_cast<size_t>(urb->actual_length);
+    status_ = urb->status;
+    completed_.store(1, std::memory_order_release);
+  }
+
+  error_code_t status() const noexcept
+  {
+    if (!is_completed())
+      return std::make_error_code(std::errc::operation_would_block);
+
+    if (timed_out_)
+      return std::make_error_code(std::errc::timed_out);
+
+    return make_urb_error(status_);
+  }
+
+  size_t transferred() const noexcept
+  {
+    return transferred_;
+  }
+
+  error_code_t wait(unsigned int ms) noexcept;
+
+  error_code_t cancel() noexcept;
+};
+
+/**
+ * @brief Multi packet isochronous URB.
+ * Allocated once and resubmitted as is; the data buffer is mapped from the device at the first
+ * submission.
+ */
+class iso_transfer
+{
+private:
+public:
+  std::unique_ptr<unsigned char[]> urb_storage_;  // usbdevfs_urb followed by the packet descriptors
+  device* owner_;
+  unsigned char* buffer_;
+  size_t buffer_size_;
+  bool mapped_;
+  size_t packets_;
+  size_t packet_size_;
+  std::atomic<int> completed_;
+
+  usbdevfs_urb* urb() const noexcept
+  {
+    return reinterpret_cast<usbdevfs_urb*>(urb_storage_.get());
+  }
+
+public:
+  iso_transfer() noexcept
+    : urb_storage_ {}
+    , owner_ { nullptr }
+    , buffer_ { nullptr }
+    , buffer_size_ { 0 }
+    , mapped_ { false }
+    , packets_ { 0 }
+    , packet_size_ { 0 }
+    , completed_ { 1 }
+  {
+  }
+
+  ~iso_transfer() noexcept
+  {
+    release();
+  }
+
+  iso_transfer(const iso_transfer&) = delete;
+  iso_transfer& operator=(const iso_transfer&) = delete;
+
+  error_code_t allocate(size_t packets, size_t packet_size) noexcept
+  {
+    assert(!urb_storage_);
+
+    size_t size = sizeof(usbdevfs_urb) + packets * sizeof(usbdevfs_iso_packet_desc);
+    urb_storage_.reset(::new (std::nothrow) unsigned char[size]);
+    if (!urb_storage_)
+      return std::make_error_code(std::errc::not_enough_memory);
+
+    ::memset(urb_storage_.get(), 0, size);
+    packets_ = packets;
+    packet_size_ = packet_size;
+    return {};
+  }
+
+  void release() noexcept;
+
+  bool is_completed() const noexcept
+  {
+    return (completed_.load(std::memory_order_acquire) != 0);
+  }
+
+  void complete(const usbdevfs_urb*) noexcept
+  {
+    completed_.store(1, std::memory_order_release);
+  }
+
+  error_code_t status() const noexcept
+  {
+    if (!is_completed())
+      return std::make_error_code(std::errc::operation_would_block);
+
+    return make_urb_error(urb()->status);
+  }
+
+  size_t packets() const noexcept
+  {
+    return packets_;
+  }
+
+  error_code_t packet_status(size_t i) const noexcept
+  {
+    return make_urb_error(static_cast<int>(urb()->iso_frame_desc[i].status));
+  }
+
+  size_t packet_length(size_t i) const noexcept
+  {
+    return urb()->iso_frame_desc[i].actual_length;
+  }
+
+  const unsigned char* packet_data(size_t i) const noexcept
+  {
+    return buffer_ + i * packet_size_;
+  }
+
+  error_code_t wait(unsigned int ms) noexcept;
+
+  error_code_t cancel() noexcept;
+};
+
+class device
+{
+public:
+  using transfer_t = transfer;
+  using iso_transfer_t = iso_transfer;
+
+  static constexpr size_t control_setup_size = 8;
+
+private:
+public:
+  // a synchronous transfer is cut in URBs of this size, all queued at once
+  static constexpr size_t max_urb_size = 256 * 1024;
+  static constexpr size_t max_transfer_size = 16 * max_urb_size;
+
+  int fd_;
+  int epoll_fd_;
+  int wake_fd_;           // in the epoll set, written by interrupt()
+  interface_info ii_;
+
+  // bumped by interrupt(): blocking transfers started before give up
+  std::atomic<unsigned int> cancel_generation_;
+
+  // waits are cut in slices so an interrupt is seen even when its wake up went to another thread
+  static constexpr unsigned int interrupt_slice_ms = 100;
+
+  // one thread reaps at a time, the others wait for it to hand out their completions
+  std::mutex events_mutex_;
+  std::condition_variable events_cv_;
+  bool reaping_;
+
+  pollfd_added_fn pollfd_added_;
+  pollfd_removed_fn pollfd_removed_;
+  void* pollfd_user_data_;
+
+  error_code_t fill_interface_info(int configuration) noexcept
+  {
+    constexpr size_t max_descriptors = 64 * 1024;
+    std::unique_ptr<unsigned char[]> buffer(::new (std::nothrow) unsigned char[max_descriptors]);
+    if (!buffer)
+      return std::make_error_code(std::errc::not_enough_memory);
+
+    // the node reads as the device descriptor followed by every configuration descriptor
+    ssize_t n = ::pread(fd_, buffer.get(), max_descriptors, 0);
+    if (n < 0)
+      return make_errno_error(errno);
+
+    const unsigned char* d = buffer.get();
+    size_t size = static_cast<size_t>(n);
+    size_t pos = (size > 0) ? d[0] : 0;
+
+    size_t config_end = 0;
+    while (pos + 9 <= size && d[pos + 1] == 0x02) {
+      size_t total = static_cast<size_t>(d[pos + 2] | (d[pos + 3] << 8));
+      if (configuration <= 0 || d[pos + 5] == configuration) {
+        config_end = std::min(size, pos + total);
+        break;
+      }
+      pos += total;
+    }
+
+    if (config_end == 0)
+      return std::make_error_code(std::errc::no_such_device);
+
+    ii_ = interface_info{};
+    bool in_interface = false;
+    size_t count = 0;
+
+    for (pos += d[pos]; pos + 2 <= config_end && d[pos] != 0; pos += d[pos]) {
+      const unsigned char* e = d + pos;
+
+      switch (e[1])
+      {
+      case 0x04: // interface: only the first one, default alternate setting
+        in_interface = (e[2] == 0 && e[3] == 0);
+        if (in_interface) {
+          ii_.bInterfaceNumber    = e[2];
+          ii_.bAlternateSetting   = e[3];
+          ii_.bInterfaceClass     = e[5];
+          ii_.bInterfaceSubClass  = e[6];
+          ii_.bInterfaceProtocol  = e[7];
+        }
+        break;
+
+      case 0x05: // endpoint
+        if (in_interface && count < 32) {
+          auto& ed = ii_.endpoints[count ++];
+          unsigned int mps = static_cast<unsigned int>(e[4] | (e[5] << 8));
+
+          ed.address = e[2];
+          switch (e[3] & 0x03)
+          {
+          case 0: ed.type = endpoint_type::control; break;
+          case 1: ed.type = endpoint_type::isochronous; break;
+          case 2: ed.type = endpoint_type::bulk; break;
+          default: ed.type = endpoint_type::interrupt; break;
+          }
+
+          // high bandwidth periodic endpoints move up to 3 transactions per microframe
+          unsigned int size = mps & 0x7FF;
+          if (ed.type == endpoint_type::isochronous || ed.type == endpoint_type::interrupt)
+            size *= ((mps >> 11) & 0x03) + 1;
+
+          ed.maximum_packet_size = static_cast<unsigned short>(size);
+          ed.maximum_transfer_size = max_transfer_size;
+        }
+        break;
+
+      case 0x30: // SuperSpeed endpoint companion: bursts per service interval
+        if (in_interface && count != 0) {
+          auto& ed = ii_.endpoints[count - 1];
+          if (ed.type == endpoint_type::isochronous) {
+            unsigned int size = static_cast<unsigned int>(ed.maximum_packet_size) * (e[2] + 1u) * ((e[3] & 0x03) + 1u);
+            ed.maximum_packet_size = static_cast<unsigned short>(std::min(size, 0xFFFFu));
+          }
+        }
+        break;
+
+      default:
+        break;
+      }
+    }
+
+    ii_.bNumEndpoints = static_cast<unsigned char>(count);
+    return {};
+  }
+
+  // completes everything the kernel has finished, never blocks
+  void reap_all() noexcept
+  {
+    for (;;) {
+      usbdevfs_urb* urb = nullptr;
+      if (::ioctl(fd_, USBDEVFS_REAPURBNDELAY, &urb) != 0 || urb == nullptr)
+        break;
+
+      if (urb->type == USBDEVFS_URB_TYPE_ISO)
+        static_cast<iso_transfer*>(urb->usercontext)->complete(urb);
+      else
+        static_cast<transfer*>(urb->usercontext)->complete(urb);
+    }
+  }
+
+  error_code_t submit(transfer& transfer, unsigned char type, unsigned char endpoint, unsigned int flags) noexcept
+  {
+    assert(is_open());
+    assert(transfer.is_completed());
+
+    auto& urb = *transfer.urb();
+    ::memset(&urb, 0, sizeof(urb));
+    urb.type = type;
+    urb.endpoint = endpoint;
+    urb.flags = flags;
+    urb.buffer = transfer.buffer_;
+    urb.buffer_length = static_cast<int>(transfer.size_);
+    urb.usercontext = &transfer;
+
+    transfer.owner_ = this;
+    transfer.transferred_ = 0;
+    transfer.status_ = 0;
+    transfer.has_deadline_ = false;
+    transfer.timed_out_ = false;
+    transfer.completed_.store(0, std::memory_order_release);
+
+    if (::ioctl(fd_, USBDEVFS_SUBMITURB, &urb) != 0) {
+      int err = errno;
+      transfer.completed_.store(1, std::memory_order_release);
+      return make_errno_error(err);
+    }
+
+    return {};
+  }
+
+  error_code_t sync_transfer(unsigned char type, unsigned char endpoint,
+    unsigned char* data, size_t length, size_t& transferred, unsigned int timeout) noexcept
+  {
+    constexpr size_t max_urbs = max_transfer_size / max_urb_size;
+
+    transferred = 0;
+    length = std::min(length, max_transfer_size);
+    unsigned int generation = cancel_generation_.load(std::memory_order_acquire);
+
+    // an IN transfer stops at the first short URB: the kernel cancels the ones queued behind it
+    bool in = (endpoint & 0x80) != 0;
+    bool split = in && type == USBDEVFS_URB_TYPE_BULK;
+
+    transfer urbs[max_urbs];
+    size_t n = (length == 0) ? 1 : (length + max_urb_size - 1) / max_urb_size;
+    size_t submitted = 0;
+
+    error_code_t ec;
+    for (; submitted < n; ++ submitted) {
+      auto& t = urbs[submitted];
+      t.buffer_ = data + submitted * max_urb_size;
+      t.size_ = std::min(max_urb_size, length - submitted * max_urb_size);
+
+      unsigned int flags = 0;
+      if (split && submitted + 1 < n)
+        flags |= USBDEVFS_URB_SHORT_NOT_OK;
+      if (split && submitted != 0)
+        flags |= USBDEVFS_URB_BULK_CONTINUATION;
+
+      ec = submit(t, type, endpoint, flags);
+      if (ec)
+        break;
+    }
+
+    if (submitted == 0)
+      return ec;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    bool expired = false;
+    bool interrupted = false;
+
+    for (size_t i = 0; i < submitted; ++ i) {
+      while (!urbs[i].is_completed()) {
+        unsigned int wait_ms = interrupt_slice_ms;
+
+        if (!expired && !interrupted && cancel_generation_.load(std::memory_order_acquire) != generation) {
+          interrupted = true;
+          for (size_t j = i; j < submitted; ++ j)
+            (void)urbs[j].cancel();
+        }
+
+        if (timeout != 0 && !expired && !interrupted) {
+          auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+          if (remaining.count() <= 0) {
+            expired = true;
+            for (size_t j = i; j < submitted; ++ j)
+              (void)urbs[j].cancel();
+          } else {
+            wait_ms = std::min(wait_ms, static_cast<unsigned int>(remaining.count()));
+          }
+        }
+
+        (void)handle_events(wait_ms, &urbs[i].completed_);
+      }
+    }
+
+    for (size_t i = 0; i < submitted; ++ i) {
+      auto& t = urbs[i];
+      transferred += t.transferred_;
+
+      if (t.status_ != 0) {
+        if (t.status_ == -EREMOTEIO)
+          break;
+
+        error_code_t urb_ec = make_urb_error(t.status_);
+        if (expired && !interrupted && urb_ec == std::errc::operation_canceled)
+          urb_ec = std::make_error_code(std::errc::timed_out);
+        if (!ec)
+          ec = urb_ec;
+        break;
+      }
+
+      if (t.transferred_ != t.size_)
+        break;
+    }
+
+    return ec;
+  }
+
+public:
+  device() noexcept
+    : fd_{-1}
+    , epoll_fd_{-1}
+    , wake_fd_{-1}
+    , ii_{}
+    , cancel_generation_{0}
+    , events_mutex_{}
+    , events_cv_{}
+    , reaping_{false}
+    , pollfd_added_{nullptr}
+    , pollfd_removed_{nullptr}
+    , pollfd_user_data_{nullptr}
+  {
+  }
+
+  ~device()
+  {
+    if (is_open())
+      close();
+  }
+
+  bool is_open() const noexcept
+  {
+    return (fd_ >= 0);
+  }
+
+  error_code_t close() noexcept
+  {
+    if (fd_ >= 0) {
+      unsigned int interface = 0;
+      ::ioctl(fd_, USBDEVFS_RELEASEINTERFACE, &interface);
+
+      if (pollfd_removed_ != nullptr)
+        pollfd_removed_(epoll_fd_, pollfd_user_data_);
+
+      ::close(epoll_fd_);
+      epoll_fd_ = -1;
+
+      ::close(wake_fd_);
+      wake_fd_ = -1;
+
+      ::close(fd_);
+      fd_ = -1;
+    }
+
+    return {};
+  }
+
+  error_code_t open(const char* uri) noexcept
+  {
+    if (is_open())
+      return std::make_error_code(std::errc::already_connected);
+
+    constexpr int KSD_MPL1_VID = 0x152A;
+    constexpr int KSD_MPL1_PID = 0x82C0;
+
+    device_filter filter;
+    error_code_t ec = parse_device_filter(uri, "USBFS", filter, false);
+    if (ec)
+      return ec;
+
+    if (filter.vid < 0 && filter.pid < 0) {
+      filter.vid = KSD_MPL1_VID;
+      filter.pid = KSD_MPL1_PID;
+    }
+
+    sysfs_device found;
+    ec = find_device(filter, 0, found);
+    if (ec)
+      return ec;
+
+    do {
+      fd_ = ::open(found.node.c_str(), O_RDWR | O_CLOEXEC);
+      if (fd_ < 0) {
+        ec = make_errno_error(errno);
+        break;
+      }
+
+      ec = fill_interface_info(found.configuration);
+      if (ec)
+        break;
+
+      unsigned int interface = 0;
+      if (::ioctl(fd_, USBDEVFS_CLAIMINTERFACE, &interface) != 0) {
+        ec = make_errno_error(errno);
+        break;
+      }
+
+      // usbfs signals reapable URBs as writable
+      epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+      if (epoll_fd_ < 0) {
+        ec = make_errno_error(errno);
+        break;
+      }
+
+      epoll_event ev{};
+      ev.events = EPOLLOUT;
+      ev.data.fd = fd_;
+      if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd_, &ev) != 0) {
+        ec = make_errno_error(errno);
+        break;
+      }
+
+      wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (wake_fd_ < 0) {
+        ec = make_errno_error(errno);
+        break;
+      }
+
+      ev.events = EPOLLIN;
+      ev.data.fd = wake_fd_;
+      if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) != 0) {
+        ec = make_errno_error(errno);
+        break;
+      }
+
+    } while (false);
+
+    if (ec) {
+      if (wake_fd_ >= 0)
+        ::close(wake_fd_);
+      wake_fd_ = -1;
+
+      if (epoll_fd_ >= 0)
+        ::close(epoll_fd_);
+      epoll_fd_ = -1;
+
+      if (fd_ >= 0)
+        ::close(fd_);
+      fd_ = -1;
+      return ec;
+    }
+
+    if (pollfd_added_ != nullptr)
+      pollfd_added_(epoll_fd_, POLLIN, pollfd_user_data_);
+
+    return ec;
+  }
+
+  const interface_info* get_interface_info() const noexcept
+  {
+    assert(is_open());
+    return &ii_;
+  }
+
+  error_code_t reset_pipe(unsigned char endpoint) noexcept
+  {
+    unsigned int ep = endpoint;
+    if (::ioctl(fd_, USBDEVFS_CLEAR_HALT, &ep) != 0)
+      return make_errno_error(errno);
+
+    return {};
+  }
+
+  // the epoll set is the one descriptor to watch, readable when URBs are ready to reap
+  error_code_t get_pollfds(std::vector<pollfd_info>& fds) noexcept
+  {
+    assert(is_open());
+
+    try {
+      fds.assign(1, pollfd_info{ epoll_fd_, POLLIN });
+    } catch (...) {
+      return std::make_error_code(std::errc::not_enough_memory);
+    }
+
+    return {};
+  }
+
+  error_code_t set_pollfd_notifiers(pollfd_added_fn added, pollfd_removed_fn removed, void* user_data) noexcept
+  {
+    pollfd_added_ = added;
+    pollfd_removed_ = removed;
+    pollfd_user_data_ = user_data;
+
+    if (is_open() && pollfd_added_ != nullptr)
+      pollfd_added_(epoll_fd_, POLLIN, pollfd_user_data_);
+
+    return {};
+  }
+
+  // usbfs keeps no timers; control timeouts are enforced by transfer::wait
+  error_code_t get_next_timeout(int& ms) noexcept
+  {
+    ms = -1;
+    return {};
+  }
+
+  error_code_t process_events() noexcept
+  {
+    return handle_events(0, nullptr);
+  }
+
+  // Memory the kernel transfers into directly; falls back to page aligned heap on kernels
+  // without usbfs mmap support.
+  unsigned char* allocate_buffer(size_t size, bool& mapped) noexcept
+  {
+    constexpr size_t page_size = 4096;
+
+    void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    mapped = (p != MAP_FAILED);
+    if (mapped)
+      return static_cast<unsigned char*>(p);
+
+    return static_cast<unsigned char*>(std::aligned_alloc(page_size, (size + page_size - 1) / page_size * page_size));
+  }
+
+  void free_buffer(unsigned char* buffer, size_t size, bool mapped) noexcept
+  {
+    if (mapped)
+      ::munmap(buffer, size);
+    else
+      std::free(buffer);
+  }
+
+  /**
+   * @brief Runs one reaping pass: waits up to ms for the node to signal completions, then
+   * completes every finished URB. Returns at once if *completed is already set; while another
+   * thread reaps, waits for it instead.
+   */
+  error_code_t handle_events(unsigned int ms, const std::atomic<int>* completed) noexcept
+  {
+    std::unique_lock<std::mutex> lock(events_mutex_);
+    if (completed != nullptr && completed->load(std::memory_order_acquire) != 0)
+      return {};
+
+    if (reaping_) {
+      events_cv_.wait_for(lock, std::chrono::milliseconds(ms));
+      return {};
+    }
+
+    reaping_ = true;
+    lock.unlock();
+
+    epoll_event ev[2];
+    int n = ::epoll_wait(epoll_fd_, ev, 2, static_cast<int>(ms));
+    int err = (n < 0 && errno != EINTR) ? errno : 0;
+
+    for (int i = 0; i < n; ++ i) {
+      if (ev[i].data.fd == wake_fd_) {
+        uint64_t count;
+        (void)::read(wake_fd_, &count, sizeof(count));
+      }
+    }
+
+    reap_all();
+
+    lock.lock();
+    reaping_ = false;
+    events_cv_.notify_all();
+
+    return make_errno_error(err);
+  }
+
+  /**
+   * @brief Ends the blocking transfers in progress (operation_canceled) and wakes the threads
+   * waiting for events; callable from any thread while the device is open.
+   */
+  void interrupt() noexcept
+  {
+    assert(is_open());
+
+    cancel_generation_.fetch_add(1, std::memory_order_acq_rel);
+
+    uint64_t one = 1;
+    (void)::write(wake_fd_, &one, sizeof(one));
+
+    std::lock_guard<std::mutex> lock(events_mutex_);
+    events_cv_.notify_all();
+  }
+
+  unsigned int cancel_generation() const noexcept
+  {
+    return cancel_generation_.load(std::memory_order_acquire);
+  }
+
+  error_code_t submit_bulk(unsigned char endpoint, transfer& transfer) noexcept
+  {
+    return submit(transfer, USBDEVFS_URB_TYPE_BULK, endpoint, 0);
+  }
+
+  error_code_t submit_interrupt(unsigned char endpoint, transfer& transfer) noexcept
+  {
+    return submit(transfer, USBDEVFS_URB_TYPE_INTERRUPT, endpoint, 0);
+  }
+
+  error_code_t submit_control(transfer& transfer,
+      unsigned char bmRequestType, unsigned char bRequest, unsigned short wValue, unsigned short wIndex, unsigned short wLength,
+      unsigned int timeout) noexcept
+  {
+    assert(transfer.size_ >= control_setup_size + wLength);
+
+    unsigned char* setup = transfer.buffer_;
+    setup[0] = bmRequestType;
+    setup[1] = bRequest;
+    setup[2] = static_cast<unsigned char>(wValue & 0xFF);
+    setup[3] = static_cast<unsigned char>(wValue >> 8);
+    setup[4] = static_cast<unsigned char>(wIndex & 0xFF);
+    setup[5] = static_cast<unsigned char>(wIndex >> 8);
+    setup[6] = static_cast<unsigned char>(wLength & 0xFF);
+    setup[7] = static_cast<unsigned char>(wLength >> 8);
+
+    size_t size = transfer.size_;
+    transfer.size_ = control_setup_size + wLength;
+    error_code_t ec = submit(transfer, USBDEVFS_URB_TYPE_CONTROL, 0, 0);
+    transfer.size_ = size;
+
+    // usbfs has no URB timeout: wait() cancels the transfer once it is due
+    if (!ec && timeout != 0) {
+      transfer.deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+      transfer.has_deadline_ = true;
+    }
+
+    return ec;
+  }
+
+  error_code_t submit_iso(unsigned char endpoint, iso_transfer& transfer) noexcept
+  {
+    assert(is_open());
+    assert(transfer.is_completed());
+    assert(transfer.urb_storage_);
+
+    if (transfer.buffer_ == nullptr) {
+      transfer.buffer_size_ = transfer.packets_ * transfer.packet_size_;
+      transfer.buffer_ = allocate_buffer(transfer.buffer_size_, transfer.mapped_);
+      if (transfer.buffer_ == nullptr)
+        return std::make_error_code(std::errc::not_enough_memory);
+    }
+
+    auto* urb = transfer.urb();
+    ::memset(urb, 0, sizeof(*urb) + transfer.packets_ * sizeof(usbdevfs_iso_packet_desc));
+    urb->type = USBDEVFS_URB_TYPE_ISO;
+    urb->endpoint = endpoint;
+    urb->flags = USBDEVFS_URB_ISO_ASAP;
+    urb->buffer = transfer.buffer_;
+    urb->buffer_length = static_cast<int>(transfer.buffer_size_);
+    urb->number_of_packets = static_cast<int>(transfer.packets_);
+    urb->usercontext = &transfer;
+    for (size_t i = 0; i < transfer.packets_; ++ i)
+      urb->iso_frame_desc[i].length = static_cast<unsigned int>(transfer.packet_size_);
+
+    transfer.owner_ = this;
+    transfer.completed_.store(0, std::memory_order_release);
+
+    if (::ioctl(fd_, USBDEVFS_SUBMITURB, urb) != 0) {
+      int err = errno;
+      transfer.completed_.store(1, std::memory_order_release);
+      return make_errno_error(err);
+    }
+
+    return {};
+  }
+
+  /**
+   * @brief Reaps a set of in-flight transfers (transfer or iso_transfer) in batches.
+   * Waits up to ms for the first completion; every reaping pass completes all URBs that
+   * finished meanwhile. The indices of all completed transfers of the set go to completed[], at
+   * most max_completed of them. Null entries are skipped.
+   */
+  template<typename T>
+  error_code_t wait_some(T* const* transfers, size_t n, size_t* completed, size_t max_completed, size_t& count, unsigned int ms) noexcept
+  {
+    assert(is_open());
+
+    auto collect = [&]() noexcept {
+      count = 0;
+      for (size_t i = 0; i < n && count < max_completed; ++ i) {
+        if (transfers[i] != nullptr && transfers[i]->is_completed())
+          completed[count ++] = i;
+      }
+      return count != 0;
+    };
+
+    if (collect())
+      return {};
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    for (;;) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+      if (remaining.count() <= 0)
+        return std::make_error_code(std::errc::timed_out);
+
+      error_code_t ec = handle_events(static_cast<unsigned int>(remaining.count()), nullptr);
+      if (ec)
+        return ec;
+
+      if (collect())
+        return {};
+    }
+  }
+
+  error_code_t control_transfer(
+      unsigned char bmRequestType, unsigned char bRequest, unsigned short wValue, unsigned short wIndex, unsigned short wLength,
+      unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept
+  {
+    (void)size;
+    transferred = 0;
+
+    usbdevfs_ctrltransfer ctrl{};
+    ctrl.bRequestType = bmRequestType;
+    ctrl.bRequest = bRequest;
+    ctrl.wValue = wValue;
+    ctrl.wIndex = wIndex;
+    ctrl.wLength = wLength;
+    ctrl.timeout = timeout;
+    ctrl.data = data;
+
+    int result = ::ioctl(fd_, USBDEVFS_CONTROL, &ctrl);
+    if (result < 0)
+      return make_errno_error(errno);
+
+    transferred = static_cast<size_t>(result);
+    return {};
+  }
+
+  error_code_t bulk_transfer(unsigned char endpoint,
+    unsigned char* data, size_t length, size_t& transferred, unsigned int timeout) noexcept
+  {
+    return sync_transfer(USBDEVFS_URB_TYPE_BULK, endpoint, data, length, transferred, timeout);
+  }
+
+  error_code_t interrupt_transfer(unsigned char endpoint,
+    unsigned char* data, size_t length, size_t& transferred, unsigned int timeout) noexcept
+  {
+    return sync_transfer(USBDEVFS_URB_TYPE_INTERRUPT, endpoint, data, length, transferred, timeout);
+  }
+};
+
+inline
+error_code_t transfer::wait(unsigned int ms) noexcept
+{
+  if (is_completed())
+    return status();
+
+  assert(owner_ != nullptr);
+
+  if (has_deadline_ && !timed_out_) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline_ - std::chrono::steady_clock::now());
+    if (remaining.count() <= 0) {
+      timed_out_ = true;
+      (void)cancel();
+    } else {
+      ms = std::min(ms, static_cast<unsigned int>(remaining.count()));
+    }
+  }
+
+  error_code_t ec = owner_->handle_events(ms, &completed_);
+  if (ec)
+    return ec;
+
+  if (!is_completed())
+    return std::make_error_code(std::errc::timed_out);
+
+  return status();
+}
+
+inline
+error_code_t transfer::cancel() noexcept
+{
+  if (is_completed())
+    return {};
+
+  assert(owner_ != nullptr);
+
+  // the URB still completes (-ENOENT) and has to be reaped
+  if (::ioctl(owner_->fd_, USBDEVFS_DISCARDURB, urb()) != 0 && errno != EINVAL)
+    return make_errno_error(errno);
+
+  return {};
+}
+
+inline
+void iso_transfer::release() noexcept
+{
+  assert(is_completed());
+
+  if (buffer_ != nullptr) {
+    assert(owner_ != nullptr);
+    owner_->free_buffer(buffer_, buffer_size_, mapped_);
+    buffer_ = nullptr;
+  }
+
+  urb_storage_.reset();
+}
+
+inline
+error_code_t iso_transfer::wait(unsigned int ms) noexcept
+{
+  if (is_completed())
+    return status();
+
+  assert(owner_ != nullptr);
+
+  error_code_t ec = owner_->handle_events(ms, &completed_);
+  if (ec)
+    return ec;
+
+  if (!is_completed())
+    return std::make_error_code(std::errc::timed_out);
+
+  return status();
+}
+
+inline
+error_code_t iso_transfer::cancel() noexcept
+{
+  if (is_completed())
+    return {};
+
+  assert(owner_ != nullptr);
+
+  if (::ioctl(owner_->fd_, USBDEVFS_DISCARDURB, urb()) != 0 && errno != EINVAL)
+    return make_errno_error(errno);
+
+  return {};
+}
+
+} // namespace usbfs
+} // namespace usb
+} // namespace transport
+} // namespace pilink
+
+#endif // #ifndef PILINK_TRANSPORT_USB_USBFS_HPP
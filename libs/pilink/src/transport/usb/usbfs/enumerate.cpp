@@ -0,0 +1,182 @@
+#include "transport/usb/usbfs/enumerate.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <dirent.h>
+
+namespace pilink {
+namespace transport {
+namespace usb {
+namespace usbfs {
+
+static const char *sysfs_usb_devices = "/sys/bus/usb/devices";
+
+// one line sysfs attribute as a number, -1 when absent
+static
+int read_attribute(const std::string& dir, const char *name, int base) noexcept
+{
+  std::string path = dir + "/" + name;
+  FILE *f = std::fopen(path.c_str(), "r");
+  if (f == nullptr)
+    return -1;
+
+  char line[32] = {};
+  bool ok = (std::fgets(line, sizeof(line), f) != nullptr);
+  std::fclose(f);
+  if (!ok)
+    return -1;
+
+  char *end = nullptr;
+  long v = std::strtol(line, &end, base);
+  if (end == line)
+    return -1;
+
+  return static_cast<int>(v);
+}
+
+// one line sysfs attribute as is, empty when absent
+static
+std::string read_string_attribute(const std::string& dir, const char *name)
+{
+  std::string path = dir + "/" + name;
+  FILE *f = std::fopen(path.c_str(), "r");
+  if (f == nullptr)
+    return {};
+
+  char line[256] = {};
+  bool ok = (std::fgets(line, sizeof(line), f) != nullptr);
+  std::fclose(f);
+  if (!ok)
+    return {};
+
+  return std::string(line, ::strcspn(line, "\n"));
+}
+
+static
+bool read_device(const std::string& name, bool with_serial, sysfs_device& d)
+{
+  // interfaces are named 1-2:1.0, root hubs usb1
+  if (name.empty() || name[0] == '.' || name.find(':') != std::string::npos || name.compare(0, 3, "usb") == 0)
+    return false;
+
+  std::string dir = std::string(sysfs_usb_devices) + "/" + name;
+  d.vid = read_attribute(dir, "idVendor", 16);
+  d.pid = read_attribute(dir, "idProduct", 16);
+  d.bus = read_attribute(dir, "busnum", 10);
+  d.addr = read_attribute(dir, "devnum", 10);
+  d.configuration = read_attribute(dir, "bConfigurationValue", 10);
+  if (d.vid < 0 || d.pid < 0 || d.bus < 0 || d.addr < 0)
+    return false;
+
+  // 1-2.4: bus 1, ports 2 then 4
+  size_t dash = name.find('-');
+  if (dash == std::string::npos || !parse_port_chain(name.substr(dash + 1), d.port))
+    return false;
+  d.port_path = name;
+
+  char node[64];
+  std::snprintf(node, sizeof(node), "/dev/bus/usb/%03d/%03d", d.bus, d.addr);
+  d.node = node;
+
+  // the kernel keeps the string descriptor, no need to ask the device
+  if (with_serial)
+    d.serial = read_string_attribute(dir, "serial");
+
+  return true;
+}
+
+static
+bool match(const device_filter& filter, const sysfs_device& d) noexcept
+{
+  if (filter.vid >= 0 && filter.vid != d.vid)
+    return false;
+  if (filter.pid >= 0 && filter.pid != d.pid)
+    return false;
+  if (filter.bus >= 0 && filter.bus != d.bus)
+    return false;
+  if (!filter.port.empty() && filter.port != d.port)
+    return false;
+  if (filter.addr >= 0 && filter.addr != d.addr)
+    return false;
+  if (!filter.serial.empty() && filter.serial != d.serial)
+    return false;
+
+  return true;
+}
+
+// the matching devices by bus then device number: readdir order is whatever the directory holds
+static
+std::error_code list_devices(const device_filter& filter, std::vector<sysfs_device>& matched) noexcept
+{
+  DIR *dir = ::opendir(sysfs_usb_devices);
+  if (dir == nullptr)
+    return std::error_code(errno, std::generic_category());
+
+  std::error_code ec;
+
+  try {
+    while (struct dirent *entry = ::readdir(dir)) {
+      sysfs_device d;
+      if (read_device(entry->d_name, !filter.serial.empty(), d) && match(filter, d))
+        matched.push_back(std::move(d));
+    }
+
+    std::sort(matched.begin(), matched.end(), [](const sysfs_device& a, const sysfs_device& b) {
+      return a.bus != b.bus ? a.bus < b.bus : a.addr < b.addr;
+    });
+  } catch (...) {
+    ec = std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  ::closedir(dir);
+  return ec;
+}
+
+std::error_code find_device(const device_filter& filter, int index, sysfs_device& found) noexcept
+{
+  std::vector<sysfs_device> matched;
+  std::error_code ec = list_devices(filter, matched);
+  if (ec)
+    return ec;
+
+  if (index < 0 || static_cast<size_t>(index) >= matched.size())
+    return std::make_error_code(std::errc::no_such_device);
+
+  found = std::move(matched[static_cast<size_t>(index)]);
+  return {};
+}
+
+std::error_code enumerate_usbfs(const char *filter_uri, std::vector<std::string>& uris) noexcept
+{
+  device_filter filter;
+  std::error_code ec = parse_device_filter(filter_uri, "USBFS", filter, true);
+  if (ec)
+    return ec;
+
+  std::vector<sysfs_device> matched;
+  ec = list_devices(filter, matched);
+  if (ec)
+    return ec;
+
+  try {
+    for (const auto& d : matched) {
+      char ids[32];
+      std::snprintf(ids, sizeof(ids), "VID=%x&PID=%x", static_cast<unsigned int>(d.vid), static_cast<unsigned int>(d.pid));
+      uris.push_back(std::string("USBFS://?") + ids +
+        "&BUS=" + std::to_string(d.bus) + "&PORT=" + format_port_chain(d.port.data(), d.port.size()) +
+        "&ADDR=" + std::to_string(d.addr));
+    }
+  } catch (...) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  return {};
+}
+
+} // namespace usbfs
+} // namespace usb
+} // namespace transport
+} // namespace pilink
@@ -0,0 +1,43 @@
+#ifndef PILINK_TRANSPORT_USB_USBFS_ENUMERATE_HPP
+#define PILINK_TRANSPORT_USB_USBFS_ENUMERATE_HPP
+
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "transport/usb/device_filter.hpp"
+
+namespace pilink {
+namespace transport {
+namespace usb {
+namespace usbfs {
+
+// A device as sysfs describes it, enough to open its usbfs node
+struct sysfs_device
+{
+  std::string node;         // /dev/bus/usb/BBB/DDD
+  std::string port_path;    // sysfs name, e.g. 1-2.4
+  int vid = -1;
+  int pid = -1;
+  int bus = -1;
+  std::vector<uint8_t> port;  // the port path below the bus, as libusb_get_port_numbers
+  int addr = -1;
+  int configuration = -1;   // active bConfigurationValue, -1 unknown
+  std::string serial;       // read only when the filter selects by it
+};
+
+// index: which of the matching devices, by bus then device number
+[[nodiscard]]
+std::error_code find_device(const device_filter& filter, int index, sysfs_device& found) noexcept;
+
+// USBFS://?VID=..&PID=.. (any keys of device_filter): a connect uri per matching device, in the
+// same order
+[[nodiscard]]
+std::error_code enumerate_usbfs(const char *filter_uri, std::vector<std::string>& uris) noexcept;
+
+} // namespace usbfs
+} // namespace usb
+} // namespace transport
+} // namespace pilink
+
+#endif // PILINK_TRANSPORT_USB_USBFS_ENUMERATE_HPP
@@ -0,0 +1,293 @@
+#include <pilink/coalescing.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * coalescing_writer against a link that records its transfers: the stream comes out whole and
+ * in order, whole packet transfers are ended by a zero length packet, a tail waits for its
+ * deadline, and a short or failed transfer is sent again rather than lost.
+ */
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr size_t packet_size = 64;
+
+class recording_link : public pilink::pilink
+{
+private:
+  mutable std::mutex mutex_;
+  std::vector<std::vector<unsigned char>> transfers_;
+  std::vector<clock_type::time_point> times_;
+  size_t short_writes_ = 0;       // the next ones send half and time out
+  std::error_code fail_;          // the next one sends nothing and fails with this
+
+public:
+  virtual std::error_code connect(const char *uri) noexcept override
+  {
+    (void)uri;
+    return {};
+  }
+
+  virtual std::error_code disconnect() noexcept override
+  {
+    return {};
+  }
+
+  virtual bool is_connected() const noexcept override
+  {
+    return true;
+  }
+
+  virtual std::error_code get_link_info(struct info_s& link_info) noexcept override
+  {
+    link_info = info_s{};
+    link_info.in.packet_size = packet_size;
+    link_info.out.packet_size = packet_size;
+    return {};
+  }
+
+  virtual std::error_code reset() noexcept override
+  {
+    return {};
+  }
+
+  virtual std::error_code write_some(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override
+  {
+    (void)timeout;
+    std::lock_guard<std::mutex> lock(mutex_);
+    transferred = 0;
+
+    if (fail_ && size != 0) {
+      std::error_code ec;
+      std::swap(ec, fail_);
+      return ec;
+    }
+
+    std::error_code ec;
+    size_t n = size;
+    if (short_writes_ != 0 && size > 1) {
+      -- short_writes_;
+      n = size / 2;
+      ec = std::make_error_code(std::errc::timed_out);
+    }
+
+    transfers_.emplace_back(data, data + n);
+    times_.push_back(clock_type::now());
+    transferred = n;
+    return ec;
+  }
+
+  virtual std::error_code read_some(unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override
+  {
+    (void)data;
+    (void)size;
+    (void)timeout;
+    transferred = 0;
+    return std::make_error_code(std::errc::operation_not_supported);
+  }
+
+  void short_writes(size_t count)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    short_writes_ = count;
+  }
+
+  void fail_next(std::error_code ec)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fail_ = ec;
+  }
+
+  std::vector<std::vector<unsigned char>> transfers() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return transfers_;
+  }
+
+  std::vector<clock_type::time_point> times() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return times_;
+  }
+
+  void clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    transfers_.clear();
+    times_.clear();
+  }
+};
+
+int failures = 0;
+
+void check(bool ok, const char *what)
+{
+  if (!ok) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    ++ failures;
+  }
+}
+
+std::vector<unsigned char> pattern(size_t size, size_t seed)
+{
+  std::vector<unsigned char> data(size);
+  for (size_t i = 0; i < size; ++ i)
+    data[i] = static_cast<unsigned char>((seed + i) * 31 + (seed + i) / 251);
+  return data;
+}
+
+std::vector<unsigned char> joined(const std::vector<std::vector<unsigned char>>& transfers)
+{
+  std::vector<unsigned char> data;
+  for (const auto& t : transfers)
+    data.insert(data.end(), t.begin(), t.end());
+  return data;
+}
+
+// every transfer of whole packets is followed by a zero length one, and only those are
+bool packets_ended(const std::vector<std::vector<unsigned char>>& transfers)
+{
+  for (size_t i = 0; i < transfers.size(); ++ i) {
+    const auto& t = transfers[i];
+    if (t.empty())
+      continue;
+
+    bool whole = t.size() % packet_size == 0;
+    bool ended = i + 1 < transfers.size() && transfers[i + 1].empty();
+    if (whole != ended)
+      return false;
+  }
+
+  return true;
+}
+
+bool write_all(pilink::coalescing_writer& writer, const std::vector<unsigned char>& data, size_t piece)
+{
+  for (size_t offset = 0; offset < data.size(); offset += piece) {
+    size_t n = std::min(piece, data.size() - offset);
+    size_t transferred = 0;
+    if (writer.write_some(data.data() + offset, n, transferred, 1000) || transferred != n)
+      return false;
+  }
+
+  return true;
+}
+
+void order() noexcept
+{
+  recording_link link;
+  pilink::coalescing_options options;
+  options.threshold = 1000;             // 1024 once rounded to packets
+  options.max_delay_us = 2000;
+  options.capacity = 4096;
+
+  pilink::coalescing_writer writer(link, options);
+
+  // small writes, a direct one in between that has to wait for what is buffered
+  auto data = pattern(100000, 1);
+  check(write_all(writer, std::vector<unsigned char>(data.begin(), data.begin() + 30000), 37), "small writes");
+  check(write_all(writer, std::vector<unsigned char>(data.begin() + 30000, data.begin() + 40000), 10000), "direct write");
+  check(write_all(writer, std::vector<unsigned char>(data.begin() + 40000, data.end()), 13), "small writes after it");
+  check(!writer.flush(1000), "flush");
+
+  auto transfers = link.transfers();
+  check(joined(transfers) == data, "stream whole and in order");
+  check(packets_ended(transfers), "zero length packets after whole packet transfers");
+}
+
+void timing() noexcept
+{
+  recording_link link;
+  pilink::coalescing_options options;
+  options.threshold = 256;
+  options.max_delay_us = 100000;
+
+  pilink::coalescing_writer writer(link, options);
+
+  // under the threshold: held until the deadline
+  auto data = pattern(10, 2);
+  auto written = clock_type::now();
+  check(write_all(writer, data, data.size()), "write under the threshold");
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  check(link.transfers().empty(), "held before the deadline");
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+  auto transfers = link.transfers();
+  auto times = link.times();
+  check(transfers.size() == 1 && transfers[0] == data, "sent at the deadline");
+  check(!times.empty() && times[0] - written >= std::chrono::milliseconds(90), "not before the deadline");
+
+  // over the threshold: whole packets right away, the tail waits a deadline of its own
+  link.clear();
+  data = pattern(300, 3);
+  check(write_all(writer, data, 100), "write over the threshold");
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  transfers = link.transfers();
+  check(transfers.size() == 2 && transfers[0].size() == 256 && transfers[1].empty(), "whole packets right away");
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  transfers = link.transfers();
+  times = link.times();
+  check(transfers.size() == 3 && transfers[2].size() == 44, "tail sent later");
+  check(times.size() == 3 && times[2] - times[0] >= std::chrono::milliseconds(90), "tail waited its deadline");
+  check(joined(transfers) == data, "stream whole");
+
+  // flush does not wait for the deadline
+  link.clear();
+  data = pattern(5, 4);
+  check(write_all(writer, data, data.size()), "write before flush");
+  written = clock_type::now();
+  check(!writer.flush(1000), "flush");
+  check(clock_type::now() - written < std::chrono::milliseconds(50) && link.transfers().size() == 1, "flush sends now");
+}
+
+void retries() noexcept
+{
+  recording_link link;
+  pilink::coalescing_options options;
+  options.threshold = 256;
+  options.max_delay_us = 1000;
+
+  pilink::coalescing_writer writer(link, options);
+
+  // short transfers: the rest goes again, nothing is reported
+  link.short_writes(3);
+  auto data = pattern(5000, 5);
+  check(write_all(writer, data, 100), "writes with short transfers");
+  check(!writer.flush(1000), "flush after short transfers");
+  check(joined(link.transfers()) == data, "nothing lost to short transfers");
+
+  // a failed transfer: reported once, then its data goes out with the rest
+  link.clear();
+  data = pattern(1000, 6);
+  check(write_all(writer, std::vector<unsigned char>(data.begin(), data.begin() + 100), 100), "write before the failure");
+  link.fail_next(std::make_error_code(std::errc::io_error));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  size_t transferred = 0;
+  check(writer.write_some(data.data() + 100, 100, transferred, 1000) == std::errc::io_error && transferred == 0, "failure reported");
+  check(write_all(writer, std::vector<unsigned char>(data.begin() + 100, data.end()), 100), "writes after the failure");
+  check(!writer.flush(1000), "flush after the failure");
+  check(joined(link.transfers()) == data, "nothing lost to the failure");
+}
+
+} // namespace
+
+int main()
+{
+  order();
+  timing();
+  retries();
+
+  if (failures == 0)
+    std::printf("coalescing: ok\n");
+
+  return failures == 0 ? 0 : 1;
+}
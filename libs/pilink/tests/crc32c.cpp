@@ -0,0 +1,112 @@
+#include <pilink/crc32c.hpp>
+#include "integrity/crc32c.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <vector>
+
+/*
+ * CRC-32C: the standard check value, the SSE4.2 and table driven code against each other on
+ * random lengths and alignments, and a checksum continued across pieces.
+ */
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char *what)
+{
+  if (!ok) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    ++ failures;
+  }
+}
+
+// one bit at a time, straight from the definition
+uint32_t reference(uint32_t crc, const unsigned char *data, size_t size) noexcept
+{
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++ i) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; ++ bit)
+      crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+  }
+
+  return ~crc;
+}
+
+} // namespace
+
+int main()
+{
+  using pilink::integrity::crc32c_sw;
+
+  const unsigned char check_input[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+  check(pilink::crc32c(0, check_input, sizeof(check_input)) == 0xE3069283u, "check value");
+  check(crc32c_sw(0, check_input, sizeof(check_input)) == 0xE3069283u, "check value (table)");
+  check(pilink::crc32c(0, nullptr, 0) == 0, "empty");
+
+  auto hw = pilink::integrity::crc32c_hw_if_supported();
+  if (hw != nullptr)
+    check(hw(0, check_input, sizeof(check_input)) == 0xE3069283u, "check value (SSE4.2)");
+  else
+    std::printf("crc32c: no SSE4.2, table driven code only\n");
+
+  std::mt19937_64 random(12345);
+  std::vector<unsigned char> buffer(64 * 1024 + 64);
+  for (auto& b : buffer)
+    b = static_cast<unsigned char>(random());
+
+  // lengths around the unrolled strides and the long-block boundaries, then random ones
+  std::vector<size_t> lengths;
+  for (size_t n = 0; n <= 80; ++ n)
+    lengths.push_back(n);
+  const size_t edges[] = { 255, 256, 257, 1023, 1024, 1025, 3 * 1024 - 1, 3 * 1024, 3 * 1024 + 1, 4096, 8191, 8192, 24 * 1024 + 5 };
+  lengths.insert(lengths.end(), std::begin(edges), std::end(edges));
+  for (int i = 0; i < 500; ++ i)
+    lengths.push_back(static_cast<size_t>(random() % (64 * 1024)));
+
+  for (size_t length : lengths) {
+    size_t offset = static_cast<size_t>(random() % 64);
+    const unsigned char *data = buffer.data() + offset;
+    uint32_t seed = (length % 3 == 0) ? 0 : static_cast<uint32_t>(random());
+
+    uint32_t expected = reference(seed, data, length);
+    if (crc32c_sw(seed, data, length) != expected) {
+      std::fprintf(stderr, "  length %zu offset %zu\n", length, offset);
+      check(false, "table driven matches the reference");
+    }
+    if (hw != nullptr && hw(seed, data, length) != expected) {
+      std::fprintf(stderr, "  length %zu offset %zu\n", length, offset);
+      check(false, "SSE4.2 matches the reference");
+    }
+    if (pilink::crc32c(seed, data, length) != expected) {
+      std::fprintf(stderr, "  length %zu offset %zu\n", length, offset);
+      check(false, "crc32c matches the reference");
+    }
+  }
+
+  // continued across pieces, cut at random places
+  for (int i = 0; i < 100; ++ i) {
+    size_t length = static_cast<size_t>(random() % buffer.size());
+    uint32_t whole = pilink::crc32c(0, buffer.data(), length);
+
+    uint32_t crc = 0;
+    uint32_t crc_sw = 0;
+    for (size_t offset = 0; offset < length;) {
+      size_t piece = std::min<size_t>(length - offset, static_cast<size_t>(random() % 5000) + 1);
+      crc = pilink::crc32c(crc, buffer.data() + offset, piece);
+      crc_sw = crc32c_sw(crc_sw, buffer.data() + offset, piece);
+      offset += piece;
+    }
+
+    check(crc == whole, "chained");
+    check(crc_sw == whole, "chained (table)");
+  }
+
+  if (failures == 0)
+    std::printf("crc32c: ok\n");
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,275 @@
+#include <pilink/framing.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+/*
+ * frame_writer and frame_reader over a link that behaves like a USB bulk pipe: writes go out as
+ * packets, and a read ends on a short (or zero length) packet or once its buffer is full. A
+ * transfer that is a whole number of packets without a zero length packet after it leaves the
+ * reader waiting, which is what the test looks for.
+ */
+
+namespace {
+
+constexpr size_t packet_size = 512;
+
+class packet_link : public pilink::pilink
+{
+private:
+  std::deque<std::vector<unsigned char>> packets_;
+
+public:
+  uint64_t zero_length_packets = 0;
+
+  virtual std::error_code connect(const char *uri) noexcept override
+  {
+    (void)uri;
+    return {};
+  }
+
+  virtual std::error_code disconnect() noexcept override
+  {
+    return {};
+  }
+
+  virtual bool is_connected() const noexcept override
+  {
+    return true;
+  }
+
+  virtual std::error_code get_link_info(struct info_s& link_info) noexcept override
+  {
+    link_info = info_s{};
+    link_info.in.packet_size = packet_size;
+    link_info.out.packet_size = packet_size;
+    return {};
+  }
+
+  virtual std::error_code reset() noexcept override
+  {
+    packets_.clear();
+    return {};
+  }
+
+  virtual std::error_code write_some(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override
+  {
+    (void)timeout;
+    transferred = size;
+
+    if (size == 0) {
+      ++ zero_length_packets;
+      packets_.emplace_back();
+      return {};
+    }
+
+    for (size_t offset = 0; offset < size; offset += packet_size)
+      packets_.emplace_back(data + offset, data + std::min(size, offset + packet_size));
+
+    return {};
+  }
+
+  // size is a whole number of packets, as frame_reader asks
+  virtual std::error_code read_some(unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override
+  {
+    (void)timeout;
+    transferred = 0;
+
+    while (transferred < size && !packets_.empty()) {
+      std::vector<unsigned char> packet = std::move(packets_.front());
+      packets_.pop_front();
+
+      ::memcpy(data + transferred, packet.data(), packet.size());
+      transferred += packet.size();
+
+      if (packet.size() < packet_size)
+        return std::make_error_code(std::errc::argument_out_of_domain);
+    }
+
+    // the transfer did not end: a real pipe would still be waiting on it
+    if (transferred < size)
+      return std::make_error_code(std::errc::timed_out);
+
+    return {};
+  }
+
+  bool empty() const noexcept
+  {
+    return packets_.empty();
+  }
+};
+
+int failures = 0;
+
+void check(bool ok, const char *what)
+{
+  if (!ok) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    ++ failures;
+  }
+}
+
+std::vector<unsigned char> pattern(size_t size, size_t seed)
+{
+  std::vector<unsigned char> data(size);
+  for (size_t i = 0; i < size; ++ i)
+    data[i] = static_cast<unsigned char>((seed + i) * 13 + seed);
+  return data;
+}
+
+// reads until the link is drained, every read has to end its transfer
+bool read_all(pilink::frame_reader& reader, packet_link& link, std::vector<std::vector<unsigned char>>& messages)
+{
+  bool ended = true;
+  while (!link.empty()) {
+    if (reader.read(100))
+      ended = false;
+
+    pilink::message_view message{};
+    while (reader.next(message))
+      messages.emplace_back(message.data, message.data + message.size);
+  }
+
+  return ended;
+}
+
+void round_trips() noexcept
+{
+  // header and payload together at, under and over packet multiples, and around the limit
+  const size_t h = pilink::frame_writer::header_size;
+  const size_t sizes[] = {
+    0, 1, packet_size - h - 1, packet_size - h, packet_size - h + 1,
+    2 * packet_size - h, 3 * packet_size - h + 7, 64 * 1024 - h, 64 * 1024,
+    pilink::max_message_size - 1, pilink::max_message_size
+  };
+
+  // one message per flush: each transfer is a message
+  for (size_t size : sizes) {
+    packet_link link;
+    pilink::frame_writer writer(link);
+    pilink::frame_reader reader(link);
+
+    auto data = pattern(size, size);
+    check(!writer.write(data.data(), data.size(), 100) && !writer.flush(100), "write one");
+
+    std::vector<std::vector<unsigned char>> messages;
+    check(read_all(reader, link, messages), "transfer ended (one message)");
+    check(messages.size() == 1 && messages[0] == data, "one message back");
+  }
+
+  // all of them batched, and a batch that ends on a packet boundary
+  {
+    packet_link link;
+    pilink::frame_writer writer(link, 4 * packet_size);
+    pilink::frame_reader reader(link);
+
+    std::vector<std::vector<unsigned char>> sent;
+    for (size_t size : sizes)
+      sent.push_back(pattern(size, size + 1));
+    sent.push_back(pattern(packet_size - 2 * h - 3, 5));
+    sent.push_back(pattern(3, 6));
+
+    for (const auto& data : sent)
+      check(!writer.write(data.data(), data.size(), 100), "write batched");
+    check(!writer.flush(100), "flush batched");
+
+    std::vector<std::vector<unsigned char>> messages;
+    check(read_all(reader, link, messages), "transfers ended (batched)");
+    check(messages == sent, "batched messages back in order");
+  }
+
+  // in place
+  {
+    packet_link link;
+    pilink::frame_writer writer(link);
+    pilink::frame_reader reader(link);
+
+    unsigned char *p = nullptr;
+    check(writer.commit(1) == std::errc::invalid_argument, "commit without prepare");
+    check(!writer.prepare(packet_size, p, 100) && p != nullptr, "prepare");
+    std::fill(p, p + packet_size - h, static_cast<unsigned char>(0x5a));
+    check(!writer.commit(packet_size - h) && !writer.flush(100), "commit");
+
+    std::vector<std::vector<unsigned char>> messages;
+    check(read_all(reader, link, messages), "transfer ended (in place)");
+    check(messages.size() == 1 && messages[0] == std::vector<unsigned char>(packet_size - h, 0x5a), "in place message back");
+  }
+}
+
+void zero_length_packets() noexcept
+{
+  packet_link link;
+  pilink::frame_writer writer(link);
+
+  // header and payload make exactly one packet: a ZLP follows
+  auto data = pattern(packet_size - pilink::frame_writer::header_size, 1);
+  check(!writer.write(data.data(), data.size(), 100) && !writer.flush(100), "write a whole packet");
+  check(link.zero_length_packets == 1, "zero length packet after a whole packet");
+
+  // one byte more: the short packet ends it
+  data.push_back(0);
+  check(!writer.write(data.data(), data.size(), 100) && !writer.flush(100), "write a packet and a byte");
+  check(link.zero_length_packets == 1, "no zero length packet after a short one");
+}
+
+void oversize() noexcept
+{
+  packet_link link;
+  pilink::frame_writer writer(link);
+  pilink::frame_reader reader(link);
+
+  auto big = pattern(pilink::max_message_size + 1, 1);
+  check(writer.write(big.data(), big.size(), 100) == std::errc::message_size, "writer refuses oversize");
+
+  unsigned char *p = nullptr;
+  check(writer.prepare(pilink::max_message_size + 1, p, 100) == std::errc::message_size, "prepare refuses oversize");
+
+  // a sender that does not know the limit: header and payload as they are, then a good message
+  unsigned char header[pilink::frame_writer::header_size];
+  uint32_t size = static_cast<uint32_t>(big.size());
+  for (size_t i = 0; i < sizeof(header); ++ i)
+    header[i] = static_cast<unsigned char>(size >> (8 * i));
+
+  std::vector<unsigned char> stream(header, header + sizeof(header));
+  stream.insert(stream.end(), big.begin(), big.end());
+  size_t transferred = 0;
+  (void)link.write_some(stream.data(), stream.size(), transferred, 100);
+
+  auto after = pattern(100, 2);
+  check(!writer.write(after.data(), after.size(), 100) && !writer.flush(100), "write after oversize");
+
+  std::vector<std::vector<unsigned char>> messages;
+  (void)read_all(reader, link, messages);
+  check(reader.dropped() == 1, "oversize dropped");
+  check(messages.size() == 1 && messages[0] == after, "next message parses");
+
+  // the same with a reader whose buffer cannot hold a message the limit allows
+  packet_link small_link;
+  pilink::frame_writer small_writer(small_link);
+  pilink::frame_reader small_reader(small_link, 8 * packet_size);
+
+  auto large = pattern(16 * packet_size, 3);
+  check(!small_writer.write(large.data(), large.size(), 100), "write large");
+  check(!small_writer.write(after.data(), after.size(), 100) && !small_writer.flush(100), "write after large");
+
+  messages.clear();
+  (void)read_all(small_reader, small_link, messages);
+  check(small_reader.dropped() == 1, "too large for the buffer dropped");
+  check(messages.size() == 1 && messages[0] == after, "next message parses after a skip");
+}
+
+} // namespace
+
+int main()
+{
+  round_trips();
+  zero_length_packets();
+  oversize();
+
+  if (failures == 0)
+    std::printf("framing: ok\n");
+
+  return failures == 0 ? 0 : 1;
+}
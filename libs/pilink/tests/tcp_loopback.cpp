@@ -0,0 +1,224 @@
+#include <pilink/tcp.hpp>
+#include "transport/tcp/tcp.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * A bridge and a TCP:// client over loopback, serving a link that reads back what was written
+ * to it: transfers go both ways intact, a second client is refused, and a connection that never
+ * says hello does not hold up the next one.
+ */
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+class echo_link : public pilink::pilink
+{
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<unsigned char> data_;
+  bool cancelled_ = false;
+
+public:
+  virtual std::error_code connect(const char *uri) noexcept override
+  {
+    (void)uri;
+    return {};
+  }
+
+  virtual std::error_code disconnect() noexcept override
+  {
+    return {};
+  }
+
+  virtual bool is_connected() const noexcept override
+  {
+    return true;
+  }
+
+  virtual std::error_code get_link_info(struct info_s& link_info) noexcept override
+  {
+    link_info = info_s{};
+    link_info.in.packet_size = 512;
+    link_info.out.packet_size = 512;
+    return {};
+  }
+
+  virtual std::error_code reset() noexcept override
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    data_.clear();
+    cancelled_ = false;
+    return {};
+  }
+
+  virtual std::error_code write_some(const unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override
+  {
+    (void)timeout;
+    std::lock_guard<std::mutex> lock(mutex_);
+    data_.insert(data_.end(), data, data + size);
+    transferred = size;
+    cv_.notify_all();
+    return {};
+  }
+
+  virtual std::error_code read_some(unsigned char *data, size_t size, size_t& transferred, unsigned int timeout) noexcept override
+  {
+    transferred = 0;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto ready = [this] { return !data_.empty() || cancelled_; };
+    if (timeout == 0)
+      cv_.wait(lock, ready);
+    else if (!cv_.wait_for(lock, std::chrono::milliseconds(timeout), ready))
+      return std::make_error_code(std::errc::timed_out);
+
+    if (cancelled_) {
+      cancelled_ = false;
+      return make_error_code(::pilink::error::cancelled);
+    }
+
+    transferred = std::min(size, data_.size());
+    std::copy(data_.begin(), data_.begin() + static_cast<std::ptrdiff_t>(transferred), data);
+    data_.erase(data_.begin(), data_.begin() + static_cast<std::ptrdiff_t>(transferred));
+    return transferred < size ? std::make_error_code(std::errc::argument_out_of_domain) : std::error_code{};
+  }
+
+  virtual void cancel() noexcept override
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled_ = true;
+    cv_.notify_all();
+  }
+};
+
+int failures = 0;
+
+void check(bool ok, const char *what)
+{
+  if (!ok) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    ++ failures;
+  }
+}
+
+// connected, and then silent
+int open_silent(uint16_t port)
+{
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd >= 0 && ::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+bool read_exactly(pilink::pilink& link, unsigned char *data, size_t size)
+{
+  auto deadline = clock_type::now() + std::chrono::seconds(5);
+  while (size != 0 && clock_type::now() < deadline) {
+    size_t transferred = 0;
+    std::error_code ec = link.read_some(data, size, transferred, 100);
+    if (ec && ec != std::errc::timed_out && ec != std::errc::argument_out_of_domain)
+      return false;
+
+    data += transferred;
+    size -= transferred;
+  }
+
+  return size == 0;
+}
+
+} // namespace
+
+int main()
+{
+  echo_link echo;
+  pilink::tcp::server server;
+
+  if (server.add("echo", echo) || server.listen("127.0.0.1", 0)) {
+    std::fprintf(stderr, "FAILED: server setup\n");
+    return 1;
+  }
+
+  std::error_code run_ec;
+  std::thread runner([&] { run_ec = server.run(); });
+
+  char uri[64];
+  std::snprintf(uri, sizeof(uri), "TCP://127.0.0.1:%u?NAME=echo", static_cast<unsigned int>(server.port()));
+
+  // a client that says nothing is waited on for a second, without the others waiting for it
+  int silent = open_silent(server.port());
+  check(silent >= 0, "silent connection");
+
+  pilink::transport::tcp::pilink_tcp client;
+  auto started = clock_type::now();
+  std::error_code ec = client.connect(uri);
+  auto took = clock_type::now() - started;
+  check(!ec, "connect");
+  check(took < std::chrono::milliseconds(500), "connect behind a silent connection");
+
+  pilink::pilink::info_s info{};
+  check(!client.get_link_info(info) && info.in.packet_size == 512, "link info");
+
+  pilink::transport::tcp::pilink_tcp second;
+  check(second.connect(uri) == std::errc::device_or_resource_busy, "second client refused");
+
+  // transfers of a few sizes, packet multiples among them, read back as written
+  const size_t sizes[] = { 1, 511, 512, 4096, 100000, 1 << 20 };
+  for (size_t size : sizes) {
+    std::vector<unsigned char> out(size);
+    std::vector<unsigned char> in(size);
+    for (size_t i = 0; i < size; ++ i)
+      out[i] = static_cast<unsigned char>(i * 7 + size);
+
+    size_t transferred = 0;
+    ec = client.write_some(out.data(), size, transferred, 1000);
+    check(!ec && transferred == size, "write");
+    check(read_exactly(client, in.data(), size) && in == out, "read back");
+  }
+
+  check(!client.disconnect(), "disconnect");
+  if (silent >= 0)
+    ::close(silent);
+
+  // the link is free again once the session is reaped
+  bool reconnected = false;
+  for (int attempt = 0; attempt < 30 && !reconnected; ++ attempt) {
+    pilink::transport::tcp::pilink_tcp again;
+    reconnected = !again.connect(uri);
+    if (reconnected)
+      check(!again.disconnect(), "disconnect again");
+    else
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  check(reconnected, "reconnect after disconnect");
+
+  server.stop();
+  runner.join();
+  check(!run_ec, "run");
+
+  if (failures == 0)
+    std::printf("tcp loopback: ok\n");
+
+  return failures == 0 ? 0 : 1;
+}